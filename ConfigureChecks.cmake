@@ -67,6 +67,7 @@ check_include_file(sys/mman.h HAVE_SYS_MMAN_H)
 check_include_file(sys/ndir.h HAVE_SYS_NDIR_H)
 check_include_file(sys/param.h HAVE_SYS_PARAM_H)
 check_include_file(sys/resource.h HAVE_SYS_RESOURCE_H)
+check_include_file(sys/sendfile.h HAVE_SYS_SENDFILE_H)
 check_include_file(sys/stat.h HAVE_SYS_STAT_H)
 check_include_file(sys/time.h HAVE_SYS_TIME_H)
 check_include_file(sys/types.h HAVE_SYS_TYPES_H)
@@ -89,6 +90,12 @@ ELSE (HAVE_LIBDL)
     SET(LIBDL "")
 ENDIF (HAVE_LIBDL)
 
+IF (HAVE_LIBPTHREAD)
+    SET(LIBPTHREAD "pthread")
+ELSE (HAVE_LIBPTHREAD)
+    SET(LIBPTHREAD "")
+ENDIF (HAVE_LIBPTHREAD)
+
 # function checks
 INCLUDE(CheckSymbolExists)
 INCLUDE(CheckFunctionExists)
@@ -120,8 +127,14 @@ check_symbol_exists(mkstemp "stdlib.h;unistd.h" HAVE_MKSTEMP)
 check_symbol_exists(mktemp "stdlib.h;unistd.h" HAVE_MKTEMP)
 if( NOT LLVM_ON_WIN32 )
   check_symbol_exists(pthread_mutex_lock pthread.h HAVE_PTHREAD_MUTEX_LOCK)
+  check_symbol_exists(pthread_getspecific pthread.h HAVE_PTHREAD_GETSPECIFIC)
+  check_symbol_exists(pthread_rwlock_init pthread.h HAVE_PTHREAD_RWLOCK_INIT)
 endif()
 check_symbol_exists(sbrk unistd.h HAVE_SBRK)
+check_symbol_exists(sendfile sys/sendfile.h HAVE_SENDFILE)
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(copy_file_range unistd.h HAVE_COPY_FILE_RANGE)
+set(CMAKE_REQUIRED_DEFINITIONS)
 check_symbol_exists(strdup string.h HAVE_STRDUP)
 check_symbol_exists(strerror string.h HAVE_STRERROR)
 check_symbol_exists(strerror_r string.h HAVE_STRERROR_R)
@@ -215,18 +228,35 @@ endif( MSVC )
 # FIXME: Signal handler return type, currently hardcoded to 'void'
 set(RETSIGTYPE void)
 
-#if( LLVM_ENABLE_THREADS )
-#  if( HAVE_PTHREAD_H OR WIN32 )
-#    set(ENABLE_THREADS 1)
-#  endif( HAVE_PTHREAD_H OR WIN32 )
-#endif( LLVM_ENABLE_THREADS )
-#
-#if( ENABLE_THREADS )
-#  message(STATUS "Threads enabled.")
-#else( ENABLE_THREADS )
-#  message(STATUS "Threads disabled.")
-#endif( ENABLE_THREADS )
-set(LLVM_HAS_ATOMICS 0)
+OPTION(ENABLE_THREADS "Enable multithreaded assembly (e.g. yasm --batch)" ON)
+set(LLVM_ENABLE_THREADS 0)
+if( ENABLE_THREADS )
+  if( HAVE_PTHREAD_H OR WIN32 )
+    set(LLVM_ENABLE_THREADS 1)
+  endif( HAVE_PTHREAD_H OR WIN32 )
+endif( ENABLE_THREADS )
+
+if( LLVM_ENABLE_THREADS )
+  message(STATUS "Threads enabled.")
+else( LLVM_ENABLE_THREADS )
+  message(STATUS "Threads disabled.")
+  set(LIBPTHREAD "")
+endif( LLVM_ENABLE_THREADS )
+
+# Statistics counters and the thread pool rely on atomic operations.
+CHECK_CXX_SOURCE_COMPILES("
+int main() {
+    volatile unsigned int x = 0;
+    __sync_synchronize();
+    __sync_add_and_fetch(&x, 1);
+    return __sync_val_compare_and_swap(&x, 1, 0) != 1;
+}
+" HAVE_GCC_ATOMICS)
+if( HAVE_GCC_ATOMICS OR MSVC )
+  set(LLVM_HAS_ATOMICS 1)
+else( HAVE_GCC_ATOMICS OR MSVC )
+  set(LLVM_HAS_ATOMICS 0)
+endif( HAVE_GCC_ATOMICS OR MSVC )
 
 if(WIN32)
   if(CYGWIN)
@@ -200,7 +200,8 @@ macro (YASM_ADD_EXECUTABLE _target_NAME)
    if (NOT BUILD_STATIC)
        yasm_handle_rpath_for_executable(${_target_NAME} ${_type})
    endif (NOT BUILD_STATIC)
-   TARGET_LINK_LIBRARIES(${_target_NAME} yasmstdx libyasmx ${LIBPSAPI} ${LIBIMAGEHLP})
+   TARGET_LINK_LIBRARIES(${_target_NAME} yasmstdx libyasmx ${LIBPTHREAD}
+                         ${LIBPSAPI} ${LIBIMAGEHLP})
    set_target_properties(${_target_NAME} PROPERTIES
        LINK_FLAGS "${YASM_EXE_LINKER_FLAGS}"
        )
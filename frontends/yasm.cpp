@@ -26,7 +26,10 @@
 //
 #include "config.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <memory>
+#include <vector>
 
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/STLExtras.h"
@@ -34,11 +37,16 @@
 #include "llvm/Support/Format.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/Mutex.h"
 #include "llvm/Support/system_error.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/TimeValue.h"
 #include "yasmx/Basic/Diagnostic.h"
 #include "yasmx/Basic/FileManager.h"
 #include "yasmx/Basic/SourceManager.h"
+#include "yasmx/Frontend/AssemblyCache.h"
 #include "yasmx/Frontend/DiagnosticOptions.h"
 #include "yasmx/Frontend/TextDiagnosticPrinter.h"
 #include "yasmx/Parse/DirectoryLookup.h"
@@ -46,6 +54,7 @@
 #include "yasmx/Parse/Parser.h"
 #include "yasmx/Parse/Preprocessor.h"
 #include "yasmx/Support/registry.h"
+#include "yasmx/Support/ThreadPool.h"
 #include "yasmx/System/plugin.h"
 #include "yasmx/Arch.h"
 #include "yasmx/Assembler.h"
@@ -54,6 +63,7 @@
 #include "yasmx/Module.h"
 #include "yasmx/Object.h"
 #include "yasmx/ObjectFormat.h"
+#include "yasmx/Profile.h"
 
 #ifdef HAVE_LIBGEN_H
 #include <libgen.h>
@@ -70,6 +80,12 @@ namespace cl = llvm::cl;
 
 static std::auto_ptr<raw_ostream> errfile;
 
+// Serializes batch job diagnostic and profile output to the error file.
+static llvm::sys::Mutex errfile_lock;
+
+// settings of this run, for object cache keys
+static std::string cache_settings;
+
 // version message
 static const char* full_version =
     PACKAGE_NAME " " PACKAGE_VERSION;
@@ -97,6 +113,11 @@ static cl::extrahelp help_tail(
 static cl::opt<std::string> in_filename(cl::Positional,
     cl::desc("file"));
 
+// --batch
+static cl::opt<std::string> batch_filename("batch",
+    cl::desc("Assemble each \"input [output]\" line of file ('-' for stdin)"),
+    cl::value_desc("file"));
+
 // -a, --arch
 static cl::opt<std::string> arch_keyword("a",
     cl::desc("Select architecture (list with -a help)"),
@@ -108,6 +129,17 @@ static cl::alias arch_keyword_long("arch",
     cl::value_desc("arch"),
     cl::aliasopt(arch_keyword));
 
+// --cache-dir, --cache-size, --cache-stats
+static cl::opt<std::string> cache_dir("cache-dir",
+    cl::desc("Cache assembled objects in directory"),
+    cl::value_desc("dir"));
+static cl::opt<unsigned int> cache_size("cache-size",
+    cl::desc("Maximum object cache size in megabytes (0=unlimited)"),
+    cl::value_desc("megabytes"),
+    cl::init(1024));
+static cl::opt<bool> cache_stats("cache-stats",
+    cl::desc("Show object cache statistics"));
+
 // -D, -d
 static cl::list<std::string> predefine_macros("D",
     cl::desc("Pre-define a macro, optionally to value"),
@@ -199,6 +231,17 @@ static cl::alias include_paths_alias("i",
     cl::aliasopt(include_paths),
     cl::Prefix);
 
+// -j, --jobs
+static cl::opt<unsigned int> num_jobs("j",
+    cl::desc("Number of parallel jobs (files in batch mode, else sections)"),
+    cl::value_desc("jobs"),
+    cl::Prefix,
+    cl::init(1));
+static cl::alias num_jobs_long("jobs",
+    cl::desc("Alias for -j"),
+    cl::value_desc("jobs"),
+    cl::aliasopt(num_jobs));
+
 // -L, --lformat
 static cl::opt<std::string> listfmt_keyword("L",
     cl::desc("Select list format (list with -L help)"),
@@ -228,6 +271,16 @@ static cl::alias list_filename_long("list",
 static cl::opt<bool> generate_make_dependencies("M",
     cl::desc("generate Makefile dependencies on stdout"));
 
+// -MD
+static cl::opt<bool> generate_make_dependencies_too("MD",
+    cl::desc("generate Makefile dependencies while assembling"));
+
+// -MF
+static cl::opt<std::string> make_dependencies_filename("MF",
+    cl::desc("Name of Makefile dependencies output"),
+    cl::value_desc("filename"),
+    cl::Prefix);
+
 // -m, --machine
 static cl::opt<std::string> machine_name("m",
     cl::desc("Select machine (list with -m help)"),
@@ -239,9 +292,10 @@ static cl::alias machine_name_long("machine",
     cl::value_desc("machine"),
     cl::aliasopt(machine_name));
 
-// -O, -Onnn
-static cl::opt<int> optimize_level("O",
-    cl::desc("Set optimization level (ignored)"),
+// -O, -Onnn, -Orelax
+static cl::opt<std::string> optimize_level("O",
+    cl::desc("Set optimization level (ignored), or -Orelax to optimize "
+             "using relaxation"),
     cl::value_desc("level"),
     cl::ValueOptional,
     cl::ZeroOrMore,
@@ -276,6 +330,12 @@ static cl::list<std::string> preinclude_files("P",
     cl::value_desc("filename"),
     cl::Prefix);
 
+// --macro-snapshot
+static cl::opt<std::string> macro_snapshot("macro-snapshot",
+    cl::desc("Save macros defined by pre-includes and pre-defines to file, "
+             "and reuse them while unchanged"),
+    cl::value_desc("filename"));
+
 // -p, --parser
 static cl::opt<std::string> parser_keyword("p",
     cl::desc("Select parser (list with -p help)"),
@@ -287,6 +347,20 @@ static cl::alias parser_keyword_long("parser",
     cl::value_desc("parser"),
     cl::aliasopt(parser_keyword));
 
+// --profile, --time-report
+static cl::opt<bool> show_profile("profile",
+    cl::desc("Show time and memory used by each phase of assembly, and the "
+             "source lines with the most optimizer work"));
+static cl::alias show_profile_alias("time-report",
+    cl::desc("Alias for --profile"),
+    cl::aliasopt(show_profile));
+
+// --profile-json
+static cl::opt<std::string> profile_json("profile-json",
+    cl::desc("Append a JSON record of assembly performance counters to "
+             "file"),
+    cl::value_desc("file"));
+
 // -s
 static cl::opt<bool> error_stdout("s",
     cl::desc("redirect error messages to stdout"),
@@ -582,118 +656,86 @@ ApplyPreprocessorSavedOptions(Preprocessor& preproc)
     }
 }
 
-#if 0
-static int
-do_preproc_only(void)
+/// Write a Makefile rule making the object file depend on the input file,
+/// the files it includes, and any other files it reads.
+static bool
+WriteMakeDependencies(StringRef filename,
+                      StringRef obj_file,
+                      StringRef in_file,
+                      const HeaderSearch& headers,
+                      const std::vector<std::string>& data_files,
+                      DiagnosticsEngine& diags)
 {
-    yasm_linemap *linemap;
-    char *preproc_buf = yasm_xmalloc(PREPROC_BUF_SIZE);
-    size_t got;
-    const char *base_filename;
-    FILE *out = NULL;
-    yasm_errwarns *errwarns = yasm_errwarns_create();
-
-    /* Initialize line map */
-    linemap = yasm_linemap_create();
-    yasm_linemap_set(linemap, in_filename, 1, 1);
-
-    /* Default output to stdout if not specified or generating dependency
-       makefiles */
-    if (!obj_filename || generate_make_dependencies)
-    {
-        out = stdout;
-
-        /* determine the object filename if not specified, but we need a
-            file name for the makefile rule */
-        if (generate_make_dependencies && !obj_filename)
-        {
-            if (in_filename == NULL)
-                /* Default to yasm.out if no obj filename specified */
-                obj_filename = yasm__xstrdup("yasm.out");
-            else
-            {
-                /* replace (or add) extension to base filename */
-                yasm__splitpath(in_filename, &base_filename);
-                if (base_filename[0] == '\0')
-                    obj_filename = yasm__xstrdup("yasm.out");
-                else
-                    obj_filename = replace_extension(base_filename,
-                        cur_objfmt_module->extension, "yasm.out");
-            }
-        }
-    }
-    else
+    std::string err;
+    raw_fd_ostream os(filename.str().c_str(), err);
+    if (!err.empty())
     {
-        /* Open output (object) file */
-        out = open_file(obj_filename, "wt");
-        if (!out)
-        {
-            PrintError(String::Compose(_("could not open file `%1'"), filename));
-            yasm_xfree(preproc_buf);
-            return EXIT_FAILURE;
-        }
+        diags.Report(SourceLocation(), diag::err_cannot_open_file)
+            << filename << err;
+        return false;
     }
 
-    /* Pre-process until done */
-    cur_preproc = yasm_preproc_create(cur_preproc_module, in_filename,
-                                      linemap, errwarns);
-
-    apply_preproc_builtins();
-    apply_preproc_saved_options();
-
-    if (generate_make_dependencies)
+    std::vector<StringRef> deps;
+    for (HeaderSearch::found_file_iterator i=headers.found_file_begin(),
+         end=headers.found_file_end(); i != end; ++i)
+        deps.push_back((*i)->getName());
+    for (std::vector<std::string>::const_iterator i=data_files.begin(),
+         end=data_files.end(); i != end; ++i)
     {
-        size_t totlen;
-
-        fprintf(stdout, "%s: %s", obj_filename, in_filename);
-        totlen = strlen(obj_filename)+2+strlen(in_filename);
+        // A file may be incbin'ed more than once.
+        if (std::find(deps.begin(), deps.end(), StringRef(*i)) == deps.end())
+            deps.push_back(*i);
+    }
 
-        while ((got = yasm_preproc_get_included_file(cur_preproc, preproc_buf,
-                                                     PREPROC_BUF_SIZE)) != 0)
+    os << obj_file << ": " << in_file;
+    std::size_t totlen = obj_file.size()+2+in_file.size();
+    for (std::vector<StringRef>::const_iterator i=deps.begin(),
+         end=deps.end(); i != end; ++i)
+    {
+        totlen += i->size();
+        if (totlen > 72)
         {
-            totlen += got;
-            if (totlen > 72)
-            {
-                fputs(" \\\n  ", stdout);
-                totlen = 2;
-            }
-            fputc(' ', stdout);
-            fwrite(preproc_buf, got, 1, stdout);
+            os << " \\\n  ";
+            totlen = 2;
         }
-        fputc('\n', stdout);
-    }
-    else
-    {
-        while ((got = yasm_preproc_input(cur_preproc, preproc_buf,
-                                         PREPROC_BUF_SIZE)) != 0)
-            fwrite(preproc_buf, got, 1, out);
+        os << ' ' << *i;
     }
+    os << '\n';
+    return true;
+}
 
-    if (out != stdout)
-        fclose(out);
+/// Append the JSON profile record for an input to the --profile-json file.
+/// The record is written with a single write so that records from
+/// concurrent assemblies are not interleaved.
+static bool
+WriteProfileJSON(const Profile& profile,
+                 StringRef in_file,
+                 DiagnosticsEngine& diags)
+{
+    std::string record;
+    llvm::raw_string_ostream record_os(record);
+    profile.PrintJSON(record_os, in_file);
+    record_os.flush();
 
-    if (yasm_errwarns_num_errors(errwarns, warning_error) > 0)
+    std::string err;
+    raw_fd_ostream os(profile_json.c_str(), err, raw_fd_ostream::F_Append);
+    if (!err.empty())
     {
-        yasm_errwarns_output_all(errwarns, linemap, warning_error,
-                                 print_yasm_error, print_yasm_warning);
-        if (out != stdout)
-            remove(obj_filename);
-        yasm_xfree(preproc_buf);
-        yasm_linemap_destroy(linemap);
-        yasm_errwarns_destroy(errwarns);
-        return EXIT_FAILURE;
+        diags.Report(SourceLocation(), diag::err_cannot_open_file)
+            << profile_json << err;
+        return false;
     }
-
-    yasm_errwarns_output_all(errwarns, linemap, warning_error,
-                             print_yasm_error, print_yasm_warning);
-    yasm_xfree(preproc_buf);
-    yasm_linemap_destroy(linemap);
-    yasm_errwarns_destroy(errwarns);
-    return EXIT_SUCCESS;
+    os.SetUnbuffered();
+    os << record;
+    return true;
 }
-#endif
+
 static int
-do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
+do_assemble(StringRef in_file,
+            StringRef obj_file,
+            SourceManager& source_mgr,
+            DiagnosticsEngine& diags,
+            ThreadPool* pool = 0)
 {
     // Apply warning settings
     ApplyWarningSettings(diags);
@@ -706,8 +748,18 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
         return EXIT_FAILURE;
 
     // Set object filename if specified.
-    if (!obj_filename.empty())
-        assembler.setObjectFilename(obj_filename);
+    if (!obj_file.empty())
+        assembler.setObjectFilename(obj_file);
+
+    assembler.setThreadPool(pool);
+    assembler.setRelaxOptimizer(optimize_level == "relax");
+
+    OwningPtr<Profile> profile;
+    if (show_profile || !profile_json.empty())
+    {
+        profile.reset(new Profile);
+        assembler.setProfile(profile.get());
+    }
 
     // Set parser.
     assembler.setParser(parser_keyword, diags);
@@ -738,24 +790,24 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
     assembler.getArch()->setVar("force_strict", force_strict);
 
     // open the input file or STDIN (for filename of "-")
-    if (in_filename == "-")
+    if (in_file == "-")
     {
         OwningPtr<MemoryBuffer> my_stdin;
         if (llvm::error_code err = MemoryBuffer::getSTDIN(my_stdin))
         {
             diags.Report(SourceLocation(), diag::fatal_file_open)
-                << in_filename << err.message();
+                << in_file << err.message();
             return EXIT_FAILURE;
         }
         source_mgr.createMainFileIDForMemBuffer(my_stdin.take());
     }
     else
     {
-        const FileEntry* in = file_mgr.getFile(in_filename);
+        const FileEntry* in = file_mgr.getFile(in_file);
         if (!in)
         {
             diags.Report(SourceLocation(), diag::fatal_file_open)
-                << in_filename;
+                << in_file;
             return EXIT_FAILURE;
         }
         source_mgr.createMainFileID(in);
@@ -765,6 +817,19 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
     if (!assembler.InitObject(source_mgr, diags))
         return EXIT_FAILURE;
 
+    // Use a previously assembled object if there is one.  A cache hit
+    // wouldn't tell us the dependencies of the input, or profile it.
+    OwningPtr<AssemblyCache> cache;
+    if (!cache_dir.empty() && in_file != "-" && !preproc_only &&
+        !generate_make_dependencies_too &&
+        dump_object == Assembler::DUMP_NEVER &&
+        !show_profile && profile_json.empty())
+    {
+        cache.reset(new AssemblyCache(cache_dir, cache_size, cache_settings));
+        if (cache->Lookup(in_file, assembler.getObjectFilename()))
+            return EXIT_SUCCESS;
+    }
+
     // Configure object per command line parameters.
     ConfigureObject(*assembler.getObject());
 
@@ -772,9 +837,53 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
     Parser& parser = assembler.InitParser(source_mgr, diags, headers);
     ApplyPreprocessorBuiltins(parser.getPreprocessor());
     ApplyPreprocessorSavedOptions(parser.getPreprocessor());
+    if (!macro_snapshot.empty())
+        parser.getPreprocessor().setMacroSnapshot(macro_snapshot);
     if (diags.hasErrorOccurred())
         return EXIT_FAILURE;
 
+    // Generate Makefile dependencies (on stdout by default) instead of
+    // assembling.
+    if (generate_make_dependencies)
+    {
+        if (!assembler.FindIncludes(diags))
+            return EXIT_FAILURE;
+        std::string dep_file = make_dependencies_filename;
+        if (dep_file.empty())
+            dep_file = "-";
+        if (!WriteMakeDependencies(dep_file, assembler.getObjectFilename(),
+                                   in_file, headers,
+                                   assembler.getObject()->getDataFiles(),
+                                   diags))
+            return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+    // Preprocess only, writing to the output file if one was specified
+    // (otherwise to stdout).
+    if (preproc_only)
+    {
+        std::string out_file = obj_file.empty() ? "-" : obj_file.str();
+        std::string err;
+        raw_fd_ostream out(out_file.c_str(), err);
+        if (!err.empty())
+        {
+            diags.Report(SourceLocation(), diag::err_cannot_open_file)
+                << out_file << err;
+            return EXIT_FAILURE;
+        }
+        if (!assembler.Preprocess(out, diags))
+        {
+            if (out_file != "-")
+            {
+                out.close();
+                remove(out_file.c_str());
+            }
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
     // assemble the input.
     if (!assembler.Assemble(source_mgr, diags))
     {
@@ -789,7 +898,7 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
     if (!err.empty())
     {
         diags.Report(SourceLocation(), diag::err_cannot_open_file)
-            << obj_filename << err;
+            << assembler.getObjectFilename() << err;
         return EXIT_FAILURE;
     }
 
@@ -805,6 +914,28 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
 
     // close object file
     out.close();
+
+    // Write Makefile dependencies alongside the object file.
+    if (generate_make_dependencies_too)
+    {
+        SmallString<128> dep_file;
+        if (make_dependencies_filename.empty())
+        {
+            dep_file = assembler.getObjectFilename();
+            llvm::sys::path::replace_extension(dep_file, "d");
+        }
+        else
+            dep_file = make_dependencies_filename;
+        if (!WriteMakeDependencies(dep_file, assembler.getObjectFilename(),
+                                   in_file, headers,
+                                   assembler.getObject()->getDataFiles(),
+                                   diags))
+            return EXIT_FAILURE;
+    }
+
+    // Cache the object.
+    if (cache && !out.has_error())
+        cache->Store(assembler, parser.getPreprocessor(), source_mgr, diags);
 #if 0
     // Open and write the list file
     if (list_filename)
@@ -822,9 +953,151 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
         fclose(list);
     }
 #endif
+
+    if (show_profile)
+    {
+        llvm::sys::ScopedLock lock(errfile_lock);
+        *errfile << "Profile of " << in_file << ":\n";
+        profile->Print(*errfile, source_mgr);
+        errfile->flush();
+    }
+    if (!profile_json.empty() && !WriteProfileJSON(*profile, in_file, diags))
+        return EXIT_FAILURE;
     return EXIT_SUCCESS;
 }
 
+static int
+PrintCacheStats(DiagnosticsEngine& diags)
+{
+    if (!AssemblyCache::PrintStats(cache_dir, diags))
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+namespace {
+/// A single input of a batch assembly.
+struct BatchJob
+{
+    std::string in_filename;
+    std::string obj_filename;
+    std::string diag_output;    ///< buffered diagnostic messages
+    uint64_t in_size;           ///< size of main input file in bytes
+    int result;
+
+    BatchJob() : in_size(0), result(EXIT_FAILURE) {}
+};
+} // anonymous namespace
+
+static void
+RunBatchJob(BatchJob* job)
+{
+    // Each job gets its own diagnostics and source manager; diagnostic
+    // messages are buffered so that messages for an input are contiguous.
+    DiagnosticOptions diag_opts;
+    diag_opts.Format = ewmsg_style;
+    diag_opts.ShowOptionNames = 1;
+    diag_opts.ShowSourceRanges = 1;
+    llvm::raw_string_ostream diag_os(job->diag_output);
+    TextDiagnosticPrinter diag_printer(diag_os, diag_opts);
+    IntrusiveRefCntPtr<DiagnosticIDs> diagids(new DiagnosticIDs);
+    DiagnosticsEngine diags(diagids, &diag_printer, false);
+    FileSystemOptions opts;
+    FileManager file_mgr(opts);
+    SourceManager source_mgr(diags, file_mgr);
+    diags.setSourceManager(&source_mgr);
+    diag_printer.setPrefix("pathas");
+
+    job->result =
+        do_assemble(job->in_filename, job->obj_filename, source_mgr, diags);
+    if (!source_mgr.getMainFileID().isInvalid())
+        job->in_size =
+            source_mgr.getBuffer(source_mgr.getMainFileID())->getBufferSize();
+
+    diags.setSourceManager(0);
+    diag_os.flush();
+    if (!job->diag_output.empty())
+    {
+        llvm::sys::ScopedLock lock(errfile_lock);
+        *errfile << job->diag_output;
+        errfile->flush();
+    }
+}
+
+static int
+do_batch(DiagnosticsEngine& diags)
+{
+    // Read the batch list; each non-blank line is an input filename,
+    // optionally followed by an output filename, separated by any run of
+    // whitespace.  Lines starting with '#' are comments.
+    OwningPtr<MemoryBuffer> list;
+    if (llvm::error_code err =
+        MemoryBuffer::getFileOrSTDIN(batch_filename, list))
+    {
+        diags.Report(SourceLocation(), diag::fatal_file_open)
+            << batch_filename << err.message();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<BatchJob> jobs;
+    StringRef remainder = list->getBuffer();
+    while (!remainder.empty())
+    {
+        StringRef line;
+        llvm::tie(line, remainder) = remainder.split('\n');
+        line = line.trim();
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        static const char ws[] = " \t\v\f\r";
+        StringRef in = line.substr(0, line.find_first_of(ws));
+        StringRef out = line.substr(in.size()).ltrim(ws);
+        out = out.substr(0, out.find_first_of(ws));
+        jobs.push_back(BatchJob());
+        jobs.back().in_filename = in;
+        jobs.back().obj_filename = out;
+    }
+
+    unsigned int nthreads = num_jobs;
+    if (nthreads == 0)
+        nthreads = ThreadPool::getHardwareConcurrency();
+    if (nthreads > jobs.size())
+        nthreads = jobs.size();
+    if (nthreads > 1)
+        llvm::llvm_start_multithreaded();
+
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+    {
+        ThreadPool pool(nthreads > 1 ? nthreads : 0);
+        for (std::vector<BatchJob>::iterator i=jobs.begin(), end=jobs.end();
+             i != end; ++i)
+            pool.Async(TR1::bind(&RunBatchJob, &*i));
+        pool.Wait();
+    }
+    llvm::sys::TimeValue elapsed = llvm::sys::TimeValue::now() - start;
+
+    unsigned int nfailed = 0;
+    uint64_t total_size = 0;
+    for (std::vector<BatchJob>::const_iterator i=jobs.begin(), end=jobs.end();
+         i != end; ++i)
+    {
+        if (i->result != EXIT_SUCCESS)
+            ++nfailed;
+        total_size += i->in_size;
+    }
+
+    // Report aggregate throughput.
+    double secs = elapsed.seconds() + elapsed.microseconds() / 1e6;
+    if (secs <= 0.0)
+        secs = 1e-6;
+    *errfile << "pathas: assembled " << jobs.size() << " files ("
+             << nfailed << " failed), " << total_size << " bytes in "
+             << llvm::format("%.3f", secs) << " s ("
+             << llvm::format("%.1f", jobs.size() / secs) << " files/s, "
+             << llvm::format("%.0f", total_size / secs) << " bytes/s)\n";
+
+    return nfailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 // main function
 int
 main(int argc, char* argv[])
@@ -834,6 +1107,17 @@ main(int argc, char* argv[])
     cl::SetVersionPrinter(&PrintVersion);
     cl::ParseCommandLineOptions(argc, argv);
 
+    // Everything on the command line that may affect the output goes into
+    // object cache keys.
+    if (!cache_dir.empty())
+    {
+        void* main_addr =
+            reinterpret_cast<void*>(reinterpret_cast<intptr_t>(&PrintVersion));
+        cache_settings = AssemblyCache::getRunSettings(full_version, argc,
+                                                       argv, obj_filename,
+                                                       main_addr);
+    }
+
     // Handle special exiting options
     if (show_help)
         cl::PrintHelpMessage();
@@ -943,14 +1227,6 @@ main(int argc, char* argv[])
         return EXIT_SUCCESS;
     }
 
-    // Require an input filename.  We don't use llvm::cl facilities for this
-    // as we want to allow e.g. "yasm --license".
-    if (in_filename.empty())
-    {
-        diags.Report(diag::fatal_no_input_files);
-        return EXIT_FAILURE;
-    }
-
     // If not already specified, default to bin as the object format.
     if (objfmt_keyword.empty())
         objfmt_keyword = "bin";
@@ -959,11 +1235,25 @@ main(int argc, char* argv[])
     if (parser_keyword.empty())
         parser_keyword = "nasm";
 
-#if 0
-    // handle preproc-only case here
-    if (preproc_only)
-        return do_preproc_only();
-#endif
+    // Assemble a list of files.
+    if (!batch_filename.empty())
+    {
+        int result = do_batch(diags);
+        if (cache_stats && PrintCacheStats(diags) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        return result;
+    }
+
+    // Require an input filename.  We don't use llvm::cl facilities for this
+    // as we want to allow e.g. "yasm --license".
+    if (in_filename.empty())
+    {
+        if (cache_stats)
+            return PrintCacheStats(diags);
+        diags.Report(diag::fatal_no_input_files);
+        return EXIT_FAILURE;
+    }
+
     // If list file enabled, make sure we have a list format loaded.
     if (!list_filename.empty())
     {
@@ -972,6 +1262,18 @@ main(int argc, char* argv[])
             listfmt_keyword = "nasm";
     }
 
-    return do_assemble(source_mgr, diags);
+    // Optimize sections in parallel if requested.
+    unsigned int nthreads = num_jobs;
+    if (nthreads == 0)
+        nthreads = ThreadPool::getHardwareConcurrency();
+    if (nthreads > 1)
+        llvm::llvm_start_multithreaded();
+    ThreadPool pool(nthreads > 1 ? nthreads : 0);
+
+    int result = do_assemble(in_filename, obj_filename, source_mgr, diags,
+                             nthreads > 1 ? &pool : 0);
+    if (cache_stats && PrintCacheStats(diags) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    return result;
 }
 
@@ -26,7 +26,9 @@
 //
 #include "config.h"
 
+#include <cstdlib>
 #include <memory>
+#include <vector>
 
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/STLExtras.h"
@@ -39,6 +41,7 @@
 #include "yasmx/Basic/Diagnostic.h"
 #include "yasmx/Basic/FileManager.h"
 #include "yasmx/Basic/SourceManager.h"
+#include "yasmx/Frontend/AssemblyCache.h"
 #include "yasmx/Frontend/DiagnosticOptions.h"
 #include "yasmx/Frontend/TextDiagnosticPrinter.h"
 #include "yasmx/Parse/HeaderSearch.h"
@@ -54,6 +57,7 @@
 #include "yasmx/Module.h"
 #include "yasmx/Object.h"
 #include "yasmx/ObjectFormat.h"
+#include "yasmx/Profile.h"
 #include "yasmx/Symbol.h"
 
 #ifdef HAVE_LIBGEN_H
@@ -71,6 +75,9 @@ namespace cl = llvm::cl;
 
 static std::auto_ptr<raw_ostream> errfile;
 
+// settings of this run, for object cache keys
+static std::string cache_settings;
+
 // version message
 static const char* full_version =
     PACKAGE_NAME " " PACKAGE_VERSION;
@@ -110,6 +117,17 @@ static cl::list<bool> bits_64("64",
 static cl::list<std::string> defsym("defsym",
     cl::desc("define symbol"));
 
+// --cache-dir, --cache-size, --cache-stats
+static cl::opt<std::string> cache_dir("cache-dir",
+    cl::desc("Cache assembled objects in directory"),
+    cl::value_desc("dir"));
+static cl::opt<unsigned int> cache_size("cache-size",
+    cl::desc("Maximum object cache size in megabytes (0=unlimited)"),
+    cl::value_desc("megabytes"),
+    cl::init(1024));
+static cl::opt<bool> cache_stats("cache-stats",
+    cl::desc("Show object cache statistics"));
+
 // -D (ignored)
 static cl::list<std::string> ignored_D("D",
     cl::desc("Ignored"),
@@ -176,6 +194,20 @@ static cl::opt<bool> ignored_x("x",
     cl::ZeroOrMore,
     cl::Hidden);
 
+// --profile, --time-report
+static cl::opt<bool> show_profile("profile",
+    cl::desc("Show time and memory used by each phase of assembly, and the "
+             "source lines with the most optimizer work"));
+static cl::alias show_profile_alias("time-report",
+    cl::desc("Alias for --profile"),
+    cl::aliasopt(show_profile));
+
+// --profile-json
+static cl::opt<std::string> profile_json("profile-json",
+    cl::desc("Append a JSON record of assembly performance counters to "
+             "file"),
+    cl::value_desc("file"));
+
 // -Qy
 static cl::opt<bool> ignored_qy("Qy",
     cl::desc("Ignored"),
@@ -362,6 +394,31 @@ ConfigureObject(Object& object)
     }
 }
 
+/// Append the JSON profile record to the --profile-json file, as a single
+/// write.
+static bool
+WriteProfileJSON(const Profile& profile,
+                 StringRef in_file,
+                 DiagnosticsEngine& diags)
+{
+    std::string record;
+    llvm::raw_string_ostream record_os(record);
+    profile.PrintJSON(record_os, in_file);
+    record_os.flush();
+
+    std::string err;
+    raw_fd_ostream os(profile_json.c_str(), err, raw_fd_ostream::F_Append);
+    if (!err.empty())
+    {
+        diags.Report(SourceLocation(), diag::err_cannot_open_file)
+            << profile_json << err;
+        return false;
+    }
+    os.SetUnbuffered();
+    os << record;
+    return true;
+}
+
 static int
 do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
 {
@@ -383,6 +440,13 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
     if (!obj_filename.empty())
         assembler.setObjectFilename(obj_filename);
 
+    OwningPtr<Profile> profile;
+    if (show_profile || !profile_json.empty())
+    {
+        profile.reset(new Profile);
+        assembler.setProfile(profile.get());
+    }
+
     // Set parser.
     assembler.setParser("gas", diags);
 
@@ -425,6 +489,18 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
     if (!assembler.InitObject(source_mgr, diags))
         return EXIT_FAILURE;
 
+    // Use a previously assembled object if there is one.  A cache hit
+    // wouldn't profile the input.
+    OwningPtr<AssemblyCache> cache;
+    if (!cache_dir.empty() && in_filename != "-" &&
+        dump_object == Assembler::DUMP_NEVER &&
+        !show_profile && profile_json.empty())
+    {
+        cache.reset(new AssemblyCache(cache_dir, cache_size, cache_settings));
+        if (cache->Lookup(in_filename, assembler.getObjectFilename()))
+            return EXIT_SUCCESS;
+    }
+
     // Configure object per command line parameters.
     ConfigureObject(*assembler.getObject());
 
@@ -495,7 +571,7 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
         return EXIT_FAILURE;
 
     // Initialize the parser.
-    assembler.InitParser(source_mgr, diags, headers);
+    Parser& parser = assembler.InitParser(source_mgr, diags, headers);
 
     // Assemble the input.
     if (!assembler.Assemble(source_mgr, diags))
@@ -527,6 +603,28 @@ do_assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
 
     // close object file
     out.close();
+
+    // Cache the object.
+    if (cache && !out.has_error())
+        cache->Store(assembler, parser.getPreprocessor(), source_mgr, diags);
+
+    if (show_profile)
+    {
+        raw_ostream& os = llvm::errs();
+        os << "Profile of " << in_filename << ":\n";
+        profile->Print(os, source_mgr);
+        os.flush();
+    }
+    if (!profile_json.empty() && !WriteProfileJSON(*profile, in_filename, diags))
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+static int
+PrintCacheStats(DiagnosticsEngine& diags)
+{
+    if (!AssemblyCache::PrintStats(cache_dir, diags))
+        return EXIT_FAILURE;
     return EXIT_SUCCESS;
 }
 
@@ -539,6 +637,17 @@ main(int argc, char* argv[])
     cl::SetVersionPrinter(&PrintVersion);
     cl::ParseCommandLineOptions(argc, argv, "", true);
 
+    // Everything on the command line that may affect the output goes into
+    // object cache keys.
+    if (!cache_dir.empty())
+    {
+        void* main_addr =
+            reinterpret_cast<void*>(reinterpret_cast<intptr_t>(&PrintVersion));
+        cache_settings = AssemblyCache::getRunSettings(full_version, argc,
+                                                       argv, obj_filename,
+                                                       main_addr);
+    }
+
     // Handle special exiting options
     if (show_license)
     {
@@ -584,8 +693,15 @@ main(int argc, char* argv[])
 
     // Default to stdin if no filename specified.
     if (in_filename.empty())
+    {
+        if (cache_stats)
+            return PrintCacheStats(diags);
         in_filename = "-";
+    }
 
-    return do_assemble(source_mgr, diags);
+    int result = do_assemble(source_mgr, diags);
+    if (cache_stats && PrintCacheStats(diags) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    return result;
 }
 
@@ -29,6 +29,9 @@
 #include "llvm/Support/Atomic.h"
 #include "llvm/Support/Valgrind.h"
 #include "yasmx/Config/export.h"
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace llvm {
 class raw_ostream;
@@ -39,15 +42,19 @@ public:
   const char *Desc;
   volatile llvm::sys::cas_flag Value;
   bool Initialized;
+  const char *VarName;
 
   llvm::sys::cas_flag getValue() const { return Value; }
   const char *getName() const { return Name; }
   const char *getDesc() const { return Desc; }
+  const char *getVarName() const { return VarName; }
 
   /// construct - This should only be called for non-global statistics.
-  void construct(const char *name, const char *desc) {
+  void construct(const char *name, const char *desc,
+                 const char *varname = "") {
     Name = name; Desc = desc;
     Value = 0; Initialized = 0;
+    VarName = varname;
   }
 
   // Allow use of this class as the value itself.
@@ -121,7 +128,7 @@ protected:
 // STATISTIC - A macro to make definition of statistics really simple.  This
 // automatically passes the DEBUG_TYPE of the file into the statistic.
 #define STATISTIC(VARNAME, DESC) \
-  static llvm::Statistic VARNAME = { DEBUG_TYPE, DESC, 0, 0 }
+  static llvm::Statistic VARNAME = { DEBUG_TYPE, DESC, 0, 0, #VARNAME }
 
 /// \brief Enable the collection and printing of statistics.
 void EnableStatistics();
@@ -129,6 +136,11 @@ void EnableStatistics();
 /// \brief Check if statistics are enabled.
 bool AreStatisticsEnabled();
 
+/// \brief Get the current value of every statistic that has been bumped,
+/// whether or not statistics are enabled.  Each statistic is named
+/// "<debug type>.<variable name>".
+void GetStatistics(std::vector<std::pair<std::string, unsigned> > &Stats);
+
 /// \brief Print statistics to the file returned by CreateInfoOutputFile().
 void PrintStatistics();
 
@@ -48,6 +48,12 @@ namespace sys {
       /// that memory.
       static size_t GetTotalMemoryUsage();
 
+      /// This static function will return the peak resident set size of the
+      /// process so far, in bytes, or 0 if the operating system does not
+      /// report it.
+      /// @brief Return process peak resident memory.
+      static size_t GetPeakResidentSize();
+
       /// This static function will set \p user_time to the amount of CPU time
       /// spent in user (non-kernel) mode and \p sys_time to the amount of CPU
       /// time spent in system (kernel) mode.  If the operating system does not
@@ -394,6 +394,17 @@ public:
   /// position to the offset specified from the beginning of the file.
   uint64_t seek(uint64_t off);
 
+  /// getFD - Return the underlying file descriptor.
+  int getFD() const { return FD; }
+
+  /// write_file_range - Flushes the stream and copies Size bytes starting at
+  /// Offset in the named file to the underlying file descriptor, within the
+  /// kernel (with copy_file_range or sendfile) where possible.  Returns the
+  /// number of bytes copied, which may be less than Size (zero if in-kernel
+  /// copies are not supported); the caller must write any remainder.
+  uint64_t write_file_range(const char *Filename, uint64_t Offset,
+                            uint64_t Size);
+
   /// SetUseAtomicWrite - Set the stream to attempt to use atomic writes for
   /// individual output routines where possible.
   ///
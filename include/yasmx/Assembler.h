@@ -45,6 +45,7 @@ class ArchModule;
 class DebugFormat;
 class DebugFormatModule;
 class DiagnosticsEngine;
+class Directives;
 class FileManager;
 class HeaderSearch;
 class ListFormat;
@@ -54,7 +55,9 @@ class ObjectFormat;
 class ObjectFormatModule;
 class Parser;
 class ParserModule;
+class Profile;
 class SourceManager;
+class ThreadPool;
 
 /// An assembler.
 class YASM_LIB_EXPORT Assembler
@@ -89,6 +92,22 @@ public:
     /// @param obj_filename     object filename (e.g. "file.o")
     void setObjectFilename(StringRef obj_filename);
 
+    /// Set the thread pool used to optimize and output sections in
+    /// parallel.  If not set, optimization and output are performed
+    /// serially.
+    /// @param pool             thread pool (may be NULL)
+    void setThreadPool(ThreadPool* pool) { m_pool = pool; }
+
+    /// Set a profile to record the time and memory used by each phase of
+    /// assembly and output, and the sizes of the input and of the object.
+    /// @param profile          profile (may be NULL)
+    void setProfile(Profile* profile) { m_profile = profile; }
+
+    /// Select the relaxation optimizer instead of the default interval
+    /// tree optimizer.  See Object::Options::RelaxOptimizer.
+    /// @param relax            use relaxation
+    void setRelaxOptimizer(bool relax) { m_relax_optimizer = relax; }
+
     /// Set the machine of architecture; if not set prior to assembly,
     /// determined by object format.
     /// @param machine          machine name
@@ -144,6 +163,22 @@ public:
     /// @return True on success, false on failure.
     bool Assemble(SourceManager& source_mgr, DiagnosticsEngine& diags);
 
+    /// Preprocess the input without assembling it.
+    /// It is assumed the source manager is already loaded with a main file.
+    /// @param os               output stream for the preprocessed source
+    /// @param diags            diagnostic reporting
+    /// @return True on success, false on failure.
+    bool Preprocess(raw_ostream& os, DiagnosticsEngine& diags);
+
+    /// Find the files included by the input without assembling it.  The
+    /// files found are recorded by the parser's header search.  The
+    /// parser scans for includes if it can, otherwise the input is parsed
+    /// (but not optimized or output).
+    /// It is assumed the source manager is already loaded with a main file.
+    /// @param diags            diagnostic reporting
+    /// @return True on success, false on failure.
+    bool FindIncludes(DiagnosticsEngine& diags);
+
     /// Write assembly results to output file.  Fails if assembly not
     /// performed first.
     /// @param os               output stream
@@ -166,6 +201,9 @@ private:
     Assembler(const Assembler&);                    // not implemented
     const Assembler& operator=(const Assembler&);   // not implemented
 
+    /// Add the directives of all modules.
+    void AddDirectives(Directives& dirs);
+
     util::scoped_ptr<ArchModule> m_arch_module;
     util::scoped_ptr<ParserModule> m_parser_module;
     util::scoped_ptr<ObjectFormatModule> m_objfmt_module;
@@ -183,6 +221,15 @@ private:
     std::string m_obj_filename;
     std::string m_machine;
     Assembler::ObjectDumpTime m_dump_time;
+
+    /// Thread pool for parallel optimization and output (may be NULL).
+    ThreadPool* m_pool;
+
+    /// Profile of assembly phases (may be NULL).
+    Profile* m_profile;
+
+    /// Use the relaxation optimizer.
+    bool m_relax_optimizer;
 };
 
 } // namespace yasm
@@ -0,0 +1,96 @@
+#ifndef YASM_DIAGNOSTIC_BUFFER_H
+#define YASM_DIAGNOSTIC_BUFFER_H
+//
+// Buffering Diagnostic Client (for deferred reporting)
+//
+//  Copyright (C) 2012  Peter Johnson
+//
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+#include <string>
+#include <vector>
+
+#include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/Basic/LLVM.h"
+#include "yasmx/Basic/SourceLocation.h"
+#include "yasmx/Config/export.h"
+
+namespace yasm
+{
+
+/// Diagnostic client that records diagnostics so they can be re-issued
+/// later through another DiagnosticsEngine.  This lets work running on
+/// another thread report diagnostics without touching the main engine;
+/// the recorded diagnostics are replayed (in the order reported) once
+/// the work completes, so the main engine's warning and error mappings
+/// still apply.
+class YASM_LIB_EXPORT DiagnosticBuffer : public DiagnosticConsumer
+{
+public:
+    DiagnosticBuffer() {}
+    ~DiagnosticBuffer();
+
+    /// Create a diagnostics engine that reports into this buffer.
+    /// The engine shares the diagnostic IDs and source manager of
+    /// \p diags.  All warnings are enabled, as filtering is done by
+    /// \p diags at replay time.
+    /// @param diags        engine diagnostics will later be replayed to
+    /// @return Newly allocated engine (caller owns).
+    DiagnosticsEngine* CreateEngine(const DiagnosticsEngine& diags);
+
+    /// Re-issue all recorded diagnostics to an engine, and clear the
+    /// buffer.
+    /// @param diags        diagnostic reporting
+    void Replay(DiagnosticsEngine& diags);
+
+    /// Determine if any diagnostics have been recorded.
+    /// @return True if no diagnostics are recorded.
+    bool empty() const { return m_diags.empty(); }
+
+    virtual void HandleDiagnostic(DiagnosticsEngine::Level level,
+                                  const Diagnostic& info);
+    virtual DiagnosticConsumer* clone(DiagnosticsEngine& diags) const;
+
+private:
+    struct Arg
+    {
+        DiagnosticsEngine::ArgumentKind kind;
+        std::string str;
+        intptr_t val;
+    };
+
+    struct Stored
+    {
+        unsigned int id;
+        SourceLocation loc;
+        std::vector<Arg> args;
+        std::vector<CharSourceRange> ranges;
+        std::vector<FixItHint> fixits;
+    };
+
+    std::vector<Stored> m_diags;
+};
+
+} // end namspace yasm
+
+#endif
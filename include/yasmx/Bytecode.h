@@ -37,6 +37,7 @@
 #include "yasmx/Basic/SourceLocation.h"
 #include "yasmx/Config/export.h"
 #include "yasmx/Config/functional.h"
+#include "yasmx/Support/Arena.h"
 #include "yasmx/Support/scoped_ptr.h"
 #include "yasmx/Bytes.h"
 #include "yasmx/DebugDumper.h"
@@ -52,8 +53,9 @@ class BytecodeOutput;
 class DiagnosticsEngine;
 class Expr;
 
-/// A bytecode.
-class YASM_LIB_EXPORT Bytecode
+/// A bytecode.  Bytecodes in a section are allocated from the object's
+/// arena.
+class YASM_LIB_EXPORT Bytecode : public ArenaAllocated
 {
     friend class BytecodeContainer;
 
@@ -84,7 +86,9 @@ public:
     /// Bytecode contents (abstract base class).  Any implementation of a
     /// specific bytecode must implement a class derived from this one.
     /// The bytecode implementation-specific data is stored in #m_contents.
-    class YASM_LIB_EXPORT Contents
+    /// Contents may be allocated from the object's arena (see
+    /// BytecodeContainer::getArena()).
+    class YASM_LIB_EXPORT Contents : public ArenaAllocated
     {
     public:
         typedef std::auto_ptr<Contents> Ptr;
@@ -365,8 +369,6 @@ public:
         unsigned int m_off;
     };
 
-    void AppendFixup(const Fixup& fixup) { m_fixed_fixups.push_back(fixup); }
-
 #ifdef WITH_XML
     /// Write an XML representation.  For debugging purposes.
     /// @param out          XML node
@@ -375,11 +377,18 @@ public:
 #endif // WITH_XML
 
 private:
+    /// Append a fixup to the fixup table, taking over its contents (the
+    /// passed fixup is left empty).
+    /// @param fixup        fixup
+    /// @return Reference to the appended fixup.
+    Fixup& TakeFixup(Fixup& fixup);
+
     /// Fixed data that comes before the possibly dynamic length data generated
     /// by the implementation-specific tail in m_contents.
     Bytes m_fixed;
 
     /// To allow combination of more complex values, fixups can be specified.
+    /// Kept in offset order, as a side table to m_fixed.
     std::vector<Fixup> m_fixed_fixups;
 
     /// Implementation-specific tail.
@@ -43,6 +43,7 @@ namespace yasm
 {
 
 class Arch;
+class Arena;
 class Bytecode;
 class DiagnosticsEngine;
 class Expr;
@@ -65,6 +66,12 @@ public:
     Section* getSection() { return m_sect; }
     const Section* getSection() const { return m_sect; }
 
+    /// Get the arena that bytecodes and bytecode contents for this
+    /// container should be allocated from.
+    /// @return Arena of the object this container is part of, or NULL if
+    ///         not part of an object (in which case the heap is used).
+    /*@null@*/ Arena* getArena();
+
     /// Add bytecode to the end of the container.
     /// @param bc       bytecode (may be NULL)
     void AppendBytecode(/*@null@*/ std::auto_ptr<Bytecode> bc);
@@ -44,6 +44,7 @@ namespace yasm
 {
 
 class Bytecode;
+class OutputImage;
 
 /// Bytecode output interface.
 ///
@@ -52,7 +53,8 @@ class Bytecode;
 /// called to convert values and relocations into byte format first, then
 /// DoOutputBytes() is called.  It is assumed that DoOutputBytes()
 /// actually outputs the bytes to the object file.  The implementation
-/// function DoOutputGap() will be called for gaps in the output.
+/// function DoOutputGap() will be called for gaps in the output, and
+/// DoOutputFileRange() for data taken verbatim from a file.
 class YASM_LIB_EXPORT BytecodeOutput
 {
 public:
@@ -116,6 +118,18 @@ public:
     /// @param source       source location
     inline void OutputBytes(const Bytes& bytes, SourceLocation source);
 
+    /// Output a range of a file (e.g. incbin data).  The contents are
+    /// passed in memory (typically mapped), but implementations writing to
+    /// a file may copy the range from the file directly.
+    /// @param data         file contents of the range
+    /// @param filename     file name
+    /// @param offset       offset of the range in the file
+    /// @param source       source location
+    inline void OutputFileRange(StringRef data,
+                                StringRef filename,
+                                uint64_t offset,
+                                SourceLocation source);
+
     /// Convert a value to bytes.  Called by OutputValue() so that
     /// implementations can keep track of relocations and verify legal
     /// expressions.
@@ -161,6 +175,17 @@ protected:
     virtual void DoOutputBytes(const Bytes& bytes,
                                SourceLocation source) = 0;
 
+    /// Overrideable implementation of OutputFileRange().  The default
+    /// implementation passes the data to DoOutputBytes() in pieces.
+    /// @param data         file contents of the range
+    /// @param filename     file name
+    /// @param offset       offset of the range in the file
+    /// @param source       source location
+    virtual void DoOutputFileRange(StringRef data,
+                                   StringRef filename,
+                                   uint64_t offset,
+                                   SourceLocation source);
+
 private:
     friend class Bytecode;
 
@@ -218,6 +243,16 @@ BytecodeOutput::OutputBytes(const Bytes& bytes, SourceLocation source)
     m_num_output += static_cast<unsigned long>(bytes.size());
 }
 
+inline void
+BytecodeOutput::OutputFileRange(StringRef data,
+                                StringRef filename,
+                                uint64_t offset,
+                                SourceLocation source)
+{
+    DoOutputFileRange(data, filename, offset, source);
+    m_num_output += static_cast<unsigned long>(data.size());
+}
+
 /// No-output specialization of BytecodeOutput.
 /// Warns on all attempts to output non-gaps.
 class YASM_LIB_EXPORT BytecodeNoOutput : public BytecodeOutput
@@ -235,25 +270,41 @@ protected:
                              NumericOutput& num_out);
     void DoOutputGap(unsigned long size, SourceLocation source);
     void DoOutputBytes(const Bytes& bytes, SourceLocation source);
+    void DoOutputFileRange(StringRef data,
+                           StringRef filename,
+                           uint64_t offset,
+                           SourceLocation source);
 };
 
 /// Stream output specialization of BytecodeOutput.
 /// Handles gaps by converting to 0 and generating a warning.
+/// File ranges are passed by reference when writing to an output image,
+/// and copied directly from the file when writing to a file stream.
 /// This does not implement ConvertValueToBytes(), so it's still a virtual
 /// base class.
 class YASM_LIB_EXPORT BytecodeStreamOutput : public BytecodeOutput
 {
 public:
     BytecodeStreamOutput(raw_ostream& os, DiagnosticsEngine& diags)
-        : BytecodeOutput(diags), m_os(os)
+        : BytecodeOutput(diags), m_os(os), m_image(0), m_fd_os(0)
     {}
+    BytecodeStreamOutput(OutputImage& os, DiagnosticsEngine& diags);
+    BytecodeStreamOutput(raw_fd_ostream& os, DiagnosticsEngine& diags);
     ~BytecodeStreamOutput();
 
 protected:
     void DoOutputGap(unsigned long size, SourceLocation source);
     void DoOutputBytes(const Bytes& bytes, SourceLocation source);
+    void DoOutputFileRange(StringRef data,
+                           StringRef filename,
+                           uint64_t offset,
+                           SourceLocation source);
 
     raw_ostream& m_os;
+
+private:
+    /*@null@*/ OutputImage* m_image;    ///< m_os, if an output image
+    /*@null@*/ raw_fd_ostream* m_fd_os; ///< m_os, if a file stream
 };
 
 } // namespace yasm
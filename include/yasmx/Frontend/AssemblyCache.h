@@ -0,0 +1,117 @@
+#ifndef YASM_ASSEMBLYCACHE_H
+#define YASM_ASSEMBLYCACHE_H
+///
+/// @file
+/// @brief Object cache use shared by the assembler frontends.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "yasmx/Basic/LLVM.h"
+#include "yasmx/Config/export.h"
+#include "yasmx/Support/ObjectCache.h"
+
+
+namespace yasm
+{
+
+class Assembler;
+class DiagnosticsEngine;
+class Preprocessor;
+class SourceManager;
+
+/// The object cache as used for one input by an assembler frontend.
+class YASM_LIB_EXPORT AssemblyCache
+{
+public:
+    /// Constructor.
+    /// @param dir          cache directory
+    /// @param max_size     maximum cache size, in megabytes (0=unlimited)
+    /// @param settings     settings of the run, from getRunSettings()
+    AssemblyCache(StringRef dir, unsigned int max_size, StringRef settings);
+
+    /// Destructor.
+    ~AssemblyCache();
+
+    /// Get the settings of an assembler run that go into the cache key.
+    /// These are the assembler version, the size and modification time of
+    /// the running executable (so a rebuilt assembler doesn't reuse
+    /// objects from an older build), the environment variables the
+    /// assembler reads (YASM_TEST_SUITE), and the command line.  Options
+    /// that cannot change the object are left out of the command line: the
+    /// cache options, --batch, and the object filename (wherever it is
+    /// given, with -o or --objfile).
+    /// @param version      assembler version
+    /// @param argc         number of command line arguments
+    /// @param argv         command line arguments
+    /// @param obj_filename object filename given on the command line
+    /// @param main_addr    address of a function in the executable, to
+    ///                     find it
+    /// @return Settings.
+    static std::string getRunSettings(StringRef version,
+                                      int argc,
+                                      char* argv[],
+                                      StringRef obj_filename,
+                                      void* main_addr);
+
+    /// Look up the object for an input file.  On a hit, the cached object
+    /// is copied to the object file.
+    /// @param in_filename  main input filename
+    /// @param obj_filename object filename
+    /// @return True if the object was found.
+    bool Lookup(StringRef in_filename, StringRef obj_filename);
+
+    /// Store the object just written by an assembler, along with the files
+    /// it read.  Nothing is stored if there were any diagnostics, as they
+    /// would not be repeated for a cache hit, or if the preprocessor
+    /// output depended on the environment (which isn't in the key).
+    /// @param assembler    assembler
+    /// @param preproc      preprocessor used for the input
+    /// @param source_mgr   source manager
+    /// @param diags        diagnostic reporting
+    void Store(Assembler& assembler,
+               const Preprocessor& preproc,
+               SourceManager& source_mgr,
+               DiagnosticsEngine& diags);
+
+    /// Print cache statistics to standard output.
+    /// @param dir          cache directory
+    /// @param diags        diagnostic reporting
+    /// @return False if no cache directory was given.
+    static bool PrintStats(StringRef dir, DiagnosticsEngine& diags);
+
+private:
+    AssemblyCache(const AssemblyCache&);                    // not implemented
+    const AssemblyCache& operator=(const AssemblyCache&);   // not implemented
+
+    ObjectCache m_cache;
+};
+
+} // namespace yasm
+
+#endif
@@ -370,7 +370,8 @@ public:
 
     /// If intnum is a BV, returns its bitvector directly.
     /// If not, converts into passed bv and returns that instead.
-    /// @param bv       bitvector to use if intnum is not bitvector.
+    /// @param bv       bitvector to use if intnum is not bitvector; may be
+    ///                 default constructed, as it is only resized if used.
     /// @return Passed bv or intnum internal bitvector.
     const llvm::APInt* getBV(llvm::APInt* bv) const;
     llvm::APInt* getBV(llvm::APInt* bv);
@@ -31,6 +31,7 @@
 ///
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "llvm/ADT/StringRef.h"
 #include "yasmx/Basic/LLVM.h"
@@ -46,9 +47,12 @@ namespace yasm
 {
 
 class Arch;
+class Arena;
 class DiagnosticsEngine;
+class Profile;
 class Section;
 class Symbol;
+class ThreadPool;
 
 /// An object.  This is the internal representation of an object file.
 class YASM_LIB_EXPORT Object
@@ -66,6 +70,10 @@ public:
 
         /// Alignment directives specify power-of-2.  Defaults to false.
         bool PowerOfTwoAlignment;
+
+        /// Optimize using relaxation (Optimizer::RELAX) instead of the
+        /// interval tree.  Defaults to false.
+        bool RelaxOptimizer;
     };
 
     /// Generic object configuration.
@@ -116,8 +124,14 @@ public:
 
     /// Optimize an object.  Takes the unoptimized object and optimizes it.
     /// If successful, the object is ready for output to an object file.
+    /// If a thread pool is provided, groups of sections that do not
+    /// reference each other are optimized in parallel.
     /// @param diags    diagnostic reporting
-    void Optimize(DiagnosticsEngine& diags);
+    /// @param pool     thread pool (may be NULL)
+    /// @param profile  profile to record optimization steps in (may be NULL)
+    void Optimize(DiagnosticsEngine& diags,
+                  ThreadPool* pool = 0,
+                  Profile* profile = 0);
 
     /// Updates all bytecode offsets in object.
     /// @param diags    diagnostic reporting
@@ -241,6 +255,30 @@ public:
     void setCurSection(/*@null@*/ Section* section)
     { m_cur_section = section; }
 
+    /// Get the memory arena for bytecodes and bytecode contents owned by
+    /// this object.  Memory allocated from the arena is released when the
+    /// object is destroyed.
+    /// @return Arena.
+    Arena& getArena() { return *m_arena; }
+
+    /// Record a file that is read as data during assembly (e.g. by
+    /// incbin).  Source files are tracked by the source manager instead.
+    /// @param filename     filename
+    void AddDataFile(StringRef filename) { m_data_files.push_back(filename); }
+
+    /// Get the files recorded by AddDataFile(), in the order recorded.
+    /// @return Data filenames.
+    const std::vector<std::string>& getDataFiles() const
+    { return m_data_files; }
+
+    /// Get a block of code fill for long alignments: the longest pattern
+    /// of a code fill table, repeated.  Each block is built on first use
+    /// and kept for the life of the object.  Thread safe.
+    /// @param code_fill    code fill table (see Arch::getFill())
+    /// @return Code fill block; empty if the table has no patterns.
+    const std::vector<unsigned char>&
+    getCodeFillBlock(const unsigned char** code_fill);
+
     Arch* getArch() { return m_arch; }
     const Arch* getArch() const { return m_arch; }
 
@@ -255,6 +293,14 @@ private:
     Object(const Object&);                  // not implemented
     const Object& operator=(const Object&); // not implemented
 
+    /// Optimize independent groups of sections in parallel.
+    /// @param diags    diagnostic reporting
+    /// @param pool     thread pool
+    /// @param profile  profile (may be NULL)
+    void OptimizeParallel(DiagnosticsEngine& diags,
+                          ThreadPool& pool,
+                          Profile* profile);
+
     std::string m_src_filename;         ///< Source filename
     std::string m_obj_filename;         ///< Object filename
 
@@ -267,6 +313,12 @@ private:
     /// section active.
     /*@null@*/ Section* m_cur_section;
 
+    /// Files read as data during assembly.
+    std::vector<std::string> m_data_files;
+
+    /// Arena for bytecodes and contents; must outlive the sections.
+    util::scoped_ptr<Arena> m_arena;
+
     /// Sections
     Sections m_sections;
     stdx::ptr_vector_owner<Section> m_sections_owner;
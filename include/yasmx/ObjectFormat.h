@@ -51,6 +51,7 @@ class ObjectFormatModule;
 class Section;
 class SourceLocation;
 class SourceManager;
+class ThreadPool;
 
 /// Object format interface.
 class YASM_LIB_EXPORT ObjectFormat
@@ -58,7 +59,7 @@ class YASM_LIB_EXPORT ObjectFormat
 public:
     /// Constructor.
     ObjectFormat(const ObjectFormatModule& module, Object& object)
-        : m_module(module), m_object(object)
+        : m_module(module), m_object(object), m_pool(0)
     {}
 
     /// Destructor.
@@ -67,6 +68,11 @@ public:
     /// Get module.
     const ObjectFormatModule& getModule() const { return m_module; }
 
+    /// Set the thread pool that may be used to generate output in
+    /// parallel.  If not set, output is performed serially.
+    /// @param pool         thread pool (may be NULL)
+    void setThreadPool(ThreadPool* pool) { m_pool = pool; }
+
     /// Add directive handlers.
     virtual void AddDirectives(Directives& dirs, StringRef parser);
 
@@ -124,6 +130,7 @@ private:
 
 protected:
     Object& m_object;
+    ThreadPool* m_pool;     ///< Thread pool for output (may be NULL)
 };
 
 /// Object format module interface.
@@ -29,6 +29,8 @@
 /// POSSIBILITY OF SUCH DAMAGE.
 /// @endlicense
 ///
+#include <vector>
+
 #include "yasmx/Config/export.h"
 #include "yasmx/Support/scoped_ptr.h"
 #include "yasmx/DebugDumper.h"
@@ -39,13 +41,35 @@ namespace yasm
 
 class Bytecode;
 class DiagnosticsEngine;
+class Profile;
+class Section;
 class Value;
 
 /// Optimizer.  Determines jump sizes, offset setters, all offsets.
 class YASM_LIB_EXPORT Optimizer
 {
 public:
-    Optimizer(DiagnosticsEngine& diags);
+    /// Algorithm used to propagate expansions (step 2).
+    enum Algorithm
+    {
+        /// Interval tree of span terms (Robertson).
+        ROBERTSON = 0,
+        /// Offset deltas and a worklist of the spans affected by each
+        /// length change.  Produces the same result as ROBERTSON: where
+        /// the result could depend on the order spans are expanded in
+        /// (e.g. an align inside a span), ROBERTSON is used instead.
+        RELAX
+    };
+
+    /// Constructor.
+    /// @param diags        diagnostic reporting
+    /// @param algorithm    step 2 algorithm
+    /// @param profile      profile; if not NULL, the work done for each
+    ///                     span is added to it when the optimizer is
+    ///                     destroyed
+    Optimizer(DiagnosticsEngine& diags,
+              Algorithm algorithm = ROBERTSON,
+              /*@null@*/ Profile* profile = 0);
     ~Optimizer();
     void AddSpan(Bytecode& bc,
                  int id,
@@ -57,6 +81,25 @@ public:
     // Step1a: Set bytecode indexes, initial offsets, add spans and
     // offset setters using the above functions.
 
+    /// Create span terms.  This is the first part of Step1b(), and is
+    /// performed by it if not already done; it may be called separately
+    /// to make getReferencedSections() available before Step1b().
+    void CreateTerms();
+
+    /// Get the sections referenced by span terms, other than the sections
+    /// of the spans' own bytecodes.  Spans can only be optimized
+    /// independently of other sections' spans if this is empty.
+    /// Only valid after CreateTerms().
+    /// @param sections     referenced sections (output)
+    void getReferencedSections(std::vector<Section*>& sections) const;
+
+    /// Move all spans and offset setters of another optimizer into this
+    /// one, so that they are optimized jointly.  Both optimizers must be
+    /// at the same step, and the other optimizer's bytecodes should follow
+    /// this optimizer's bytecodes in bytecode index order.
+    /// @param oth          other optimizer; empty on return
+    void Merge(Optimizer& oth);
+
     void Step1b();
 
     // Step1c: update offsets
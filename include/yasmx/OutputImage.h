@@ -0,0 +1,196 @@
+#ifndef YASM_OUTPUTIMAGE_H
+#define YASM_OUTPUTIMAGE_H
+///
+/// @file
+/// @brief Output file image interface.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include "yasmx/Basic/LLVM.h"
+#include "yasmx/Config/export.h"
+
+
+namespace yasm
+{
+
+/// An image of an output file, built in place and written out once complete.
+/// Object formats that lay out headers and section data with seeks can
+/// write into the image through the usual raw_ostream interface; seeking
+/// only moves the write position, and output is copied straight into place
+/// with no intermediate stream buffering.  As with a file, seeking past the
+/// end and writing leaves a zero-filled hole.
+///
+/// An image of an output file is built directly in the file, mapped into
+/// memory, where the platform allows; Finish() then just trims the file to
+/// the image size.  Otherwise (e.g. for a pipe), the image is built in a
+/// memory buffer and Finish() writes it to the file.  Separately generated
+/// ranges of the image (e.g. sections generated concurrently) can be
+/// written straight into place through windows onto it.
+///
+/// Large ranges of input files (e.g. incbin data) appended with
+/// WriteFileRange() to a memory image are not copied into the buffer; the
+/// image refers to them and writes them out directly, by an in-kernel file
+/// copy when written to a file descriptor.
+class YASM_LIB_EXPORT OutputImage : public raw_ostream
+{
+public:
+    /// Constructor for an image in memory.
+    /// @param size         expected image size, used to preallocate the
+    ///                     buffer; the image grows as needed
+    explicit OutputImage(size_t size = 0);
+
+    /// Constructor for an image of an output file, to which nothing has
+    /// been written yet.  The image must be completed with Finish().
+    /// @param file         output file stream
+    /// @param filename     output file name, to map the file
+    /// @param size         expected image size; the image grows as needed
+    OutputImage(raw_fd_ostream& file, StringRef filename, size_t size);
+
+    /// Constructor for a window onto a range of another image, so that the
+    /// range can be generated separately (e.g. concurrently with other
+    /// ranges).  Writes go straight into the other image, which is extended
+    /// to cover the range.  The other image must not be written past its
+    /// end while the window is in use, and the window cannot be written
+    /// past the end of the range.
+    /// @param image        image
+    /// @param offset       offset of the range in the image
+    /// @param size         size of the range
+    OutputImage(OutputImage& image, uint64_t offset, size_t size);
+
+    /// Destructor.
+    ~OutputImage();
+
+    /// Preallocate space for an image of at least the given size.
+    /// @param size         expected image size
+    void reserve(size_t size);
+
+    /// Reposition the write position.
+    /// @param off          offset from the beginning of the image
+    /// @return New write position.
+    uint64_t seek(uint64_t off);
+
+    /// Get the image size.
+    /// @return Image size, in bytes.
+    size_t getSize() const
+    { return m_base ? m_size : m_data.size() + m_ranges_size; }
+
+    /// Get the image contents.  The image must not contain file ranges.
+    /// @return Image contents; valid until the image is next written.
+    StringRef getContents() const;
+
+    /// Write a range of an input file at the write position.  When appending
+    /// a large range to a memory image, the image keeps a reference to the
+    /// data instead of a copy.  The written part of the image can't be
+    /// overwritten later.
+    /// @param data         file contents of the range (e.g. mapped); must
+    ///                     remain valid until the image is written out
+    /// @param filename     file name
+    /// @param offset       offset of the range in the file
+    void WriteFileRange(StringRef data, StringRef filename, uint64_t offset);
+
+    /// Complete an image of an output file.  The file is left positioned
+    /// at the end of the image.
+    void Finish();
+
+    /// Write the image to a stream.
+    /// @param os           output stream
+    void WriteTo(raw_ostream& os) const;
+
+    /// Write the image to a file, copying file ranges within the kernel
+    /// where possible.
+    /// @param os           output file stream
+    void WriteTo(raw_fd_ostream& os) const;
+
+    /// Write the image into another image, passing on file ranges by
+    /// reference.  A window is already in place in the image it is onto;
+    /// this only moves the write position of that image past the window.
+    /// @param os           output image
+    void WriteTo(OutputImage& os) const;
+
+private:
+    OutputImage(const OutputImage&);                    // not implemented
+    const OutputImage& operator=(const OutputImage&);   // not implemented
+
+    void write_impl(const char* ptr, size_t size);
+    uint64_t current_pos() const { return m_pos; }
+
+    /// A range of an input file in the image.
+    struct FileRange
+    {
+        size_t pos;             ///< Position in image
+        StringRef data;         ///< File contents of range
+        std::string filename;   ///< File name
+        uint64_t offset;        ///< Offset in file
+    };
+
+    size_t getDataIndex(size_t pos) const;
+    char* Extend(size_t pos, size_t size);
+    bool Map(size_t capacity);
+    void Unmap();
+    template <typename T>
+    void WriteImage(T& os) const;
+    static void WriteRange(raw_ostream& os, const FileRange& range);
+    static void WriteRange(raw_fd_ostream& os, const FileRange& range);
+    static void WriteRange(OutputImage& os, const FileRange& range);
+
+    std::vector<char> m_data;   ///< Memory image contents, less file ranges
+    std::vector<FileRange> m_ranges;    ///< File ranges, in image order
+    size_t m_ranges_size;       ///< Total size of file ranges
+    size_t m_pos;               ///< Write position
+
+    /// Image built in place (in the mapped file, or for a window, in
+    /// another image), or NULL if in memory.
+    char* m_base;
+    size_t m_size;              ///< Image size, if in place
+    size_t m_capacity;          ///< Space available at m_base
+
+    /*@null@*/ raw_fd_ostream* m_file;  ///< Output file
+    int m_fd;                   ///< Output file descriptor for mapping, or -1
+
+    /*@null@*/ OutputImage* m_window_of;    ///< Image this is a window on
+    size_t m_window_offset;     ///< Offset of window in that image
+};
+
+/// Write a range of an input file to a file stream, copying it within the
+/// kernel where possible.
+/// @param os           output file stream
+/// @param data         file contents of the range
+/// @param filename     file name
+/// @param offset       offset of the range in the file
+YASM_LIB_EXPORT
+void WriteFileRange(raw_fd_ostream& os,
+                    StringRef data,
+                    StringRef filename,
+                    uint64_t offset);
+
+} // namespace yasm
+
+#endif
@@ -49,6 +49,9 @@ struct HeaderFileInfo {
   /// isImport - True if this is a #import'd or #pragma once file.
   bool isImport : 1;
 
+  /// isFound - True if this file has been found by LookupFile.
+  bool isFound : 1;
+
   /// NumIncludes - This is the number of times the file has been included
   /// already.
   unsigned short NumIncludes;
@@ -64,7 +67,7 @@ struct HeaderFileInfo {
   const IdentifierInfo *ControllingMacro;
 
   HeaderFileInfo()
-    : isImport(false), NumIncludes(0), ControllingMacro(0) {}
+    : isImport(false), isFound(false), NumIncludes(0), ControllingMacro(0) {}
 
 #if 0
   /// \brief Retrieve the controlling macro for this header file, if
@@ -102,6 +105,10 @@ class YASM_LIB_EXPORT HeaderSearch
   /// query.
   llvm::StringMap<std::pair<unsigned, unsigned> > LookupFileCache;
 
+  /// FoundFiles - The files found by LookupFile, in the order each was first
+  /// found.  These are the include dependencies of the input.
+  std::vector<const FileEntry *> FoundFiles;
+
 #if 0
   /// \brief Entity used to resolve the identifier IDs of controlling
   /// macros into IdentifierInfo pointers, as needed.
@@ -135,6 +142,7 @@ public:
   /// ClearFileInfo - Forget everything we know about headers so far.
   void ClearFileInfo() {
     FileInfo.clear();
+    FoundFiles.clear();
   }
 
 #if 0
@@ -182,6 +190,18 @@ public:
     getFileInfo(File).ControllingMacro = ControllingMacro;
   }
 
+  /// NoteFoundFile - Add a file to FoundFiles if it is not already there, as
+  /// if LookupFile had returned it.  Returns the file.
+  const FileEntry *NoteFoundFile(const FileEntry *FE);
+
+  typedef std::vector<const FileEntry *>::const_iterator found_file_iterator;
+  found_file_iterator found_file_begin() const { return FoundFiles.begin(); }
+  found_file_iterator found_file_end() const { return FoundFiles.end(); }
+
+  typedef std::vector<DirectoryLookup>::const_iterator search_dir_iterator;
+  search_dir_iterator search_dir_begin() const { return SearchDirs.begin(); }
+  search_dir_iterator search_dir_end() const { return SearchDirs.end(); }
+
   typedef std::vector<HeaderFileInfo>::iterator header_file_iterator;
   header_file_iterator header_file_begin() { return FileInfo.begin(); }
   header_file_iterator header_file_end() { return FileInfo.end(); }
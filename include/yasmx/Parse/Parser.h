@@ -81,6 +81,28 @@ public:
                        Directives& dirs,
                        DiagnosticsEngine& diags) = 0;
 
+    /// Preprocess an input stream without parsing it.
+    /// The default implementation reports that preprocess-only output is
+    /// not supported by the parser.
+    /// @param object       object (for preprocessor expression evaluation)
+    /// @param os           output stream for the preprocessed source
+    /// @param diags        diagnostic reporter
+    /// @return False on error.
+    virtual bool Preprocess(Object& object,
+                            raw_ostream& os,
+                            DiagnosticsEngine& diags);
+
+    /// Find the files included by an input stream without parsing it,
+    /// looking each up through the preprocessor's header search (which
+    /// records the files found).  Implementations should avoid macro
+    /// expansion where they can.
+    /// The default implementation does nothing and returns false.
+    /// @param object       object (for preprocessor expression evaluation)
+    /// @param diags        diagnostic reporter
+    /// @return False if the includes could not be determined without a full
+    ///         parse of the input, or on error.
+    virtual bool ScanIncludes(Object& object, DiagnosticsEngine& diags);
+
 private:
     Parser(const Parser&);                  // not implemented
     const Parser& operator=(const Parser&); // not implemented
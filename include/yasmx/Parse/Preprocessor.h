@@ -42,6 +42,7 @@
 #include "yasmx/Basic/SourceLocation.h"
 #include "yasmx/Basic/SourceManager.h"
 #include "yasmx/Config/export.h"
+#include "yasmx/Config/functional.h"
 #include "yasmx/Parse/IdentifierTable.h"
 #include "yasmx/Parse/Lexer.h"
 #include "yasmx/Parse/Token.h"
@@ -68,6 +69,11 @@ public:
     IdentifierTable& getIdentifierTable() { return m_identifiers; }
     llvm::BumpPtrAllocator& getPreprocessorAllocator() { return m_bp; }
 
+    /// Get the total size of the source buffers entered so far, including
+    /// included files and (for preprocessors that produce text) the
+    /// preprocessed main file.
+    uint64_t getNumInputBytes() const { return m_NumInputBytes; }
+
     /// Control whether or not the preprocessor retains comments in output.
     void setCommentRetentionState(bool keep_comments, bool keep_macro_comments)
     {
@@ -112,9 +118,39 @@ public:
     /// @param macronameval "name=value" string
     virtual void DefineBuiltin(StringRef macronameval) = 0;
 
+    /// Set a file used to save the macro state reached after the
+    /// pre-includes and pre-defines, and to restore it on later runs
+    /// with the same ones.  Ignored by preprocessors without such state.
+    /// @param filename snapshot filename
+    virtual void setMacroSnapshot(StringRef filename);
+
+    /// Record that the output depends on the environment of the run
+    /// (e.g. environment variable values), not just on the input files
+    /// and options.
+    void setEnvironmentDependent() { m_environment_dependent = true; }
+
+    /// Determine if the output depends on the environment of the run.
+    /// @return True if setEnvironmentDependent() has been called.
+    bool isEnvironmentDependent() const { return m_environment_dependent; }
+
     /// Enter the specified FileID as the main source file,
     /// which implicitly adds the builtin defines etc.
     void EnterMainSourceFile();
+
+    /// Function that provides the next piece of main file input.
+    /// Returns NULL when there is no more input; otherwise the preprocessor
+    /// takes ownership of the returned buffer.
+    typedef TR1::function<MemoryBuffer* ()> MainInputFunc;
+
+    /// Read the main file in pieces.  When the end of the main file is
+    /// reached, the function is called for more input, which is lexed as a
+    /// continuation of the main file.  Input must be split only at line
+    /// boundaries.  Each piece becomes a separate file ID, kept by the
+    /// source manager like any other input, so memory use is that of the
+    /// whole input.
+    /// @param func     input function; may be empty to stop reading pieces
+    void setMainInputFunc(const MainInputFunc& func)
+    { m_main_input = func; }
   
     /// Add a source file to the top of the include stack and
     /// start lexing tokens from it instead of the current buffer.  Return true
@@ -134,10 +170,14 @@ public:
     /// tokens has a permanent owner somewhere, so they do not need to be copied.
     /// If it is true, it assumes the array of tokens is allocated with new[] and
     /// must be freed.
+    ///
+    /// The stream is returned repeat_count times in succession (e.g. for a
+    /// repeat block) without copying the tokens.
     void EnterTokenStream(const Token* toks,
                           unsigned int num_toks,
                           bool disable_macro_expansion,
-                          bool owns_tokens);
+                          bool owns_tokens,
+                          unsigned long repeat_count = 1);
 
     /// Pop the current lexer/macro exp off the top of the
     /// lexer stack.  This should only be used in situations where the current
@@ -341,6 +381,9 @@ protected:
     /// True if macro expansion is disabled.
     bool m_disable_macro_expansion : 1;
 
+    /// True if the output depends on the environment of the run.
+    bool m_environment_dependent : 1;
+
     /// Mapping/lookup information for all identifiers in
     /// the program, including program keywords.
     mutable IdentifierTable m_identifiers;
@@ -388,10 +431,15 @@ protected:
 #endif
     // Various statistics we track for performance analysis.
     unsigned int m_NumEnteredSourceFiles, m_MaxIncludeStackDepth;
+    uint64_t m_NumInputBytes;
 
     /// This string is the predefined macros that preprocessor
     /// should use from the command line etc.
     std::vector<MemoryBuffer*> m_predefines;
+
+    /// Source of further main file input, if the main file is read in
+    /// pieces.
+    MainInputFunc m_main_input;
   
     /// Cache macro expanders to reduce malloc traffic.
     enum { TokenLexerCacheSize = 8 };
@@ -77,6 +77,10 @@ class YASM_LIB_EXPORT TokenLexer
     /// This is the next token that Lex will return.
     unsigned m_cur_token;
 
+    /// The number of times the Tokens array is still to be returned after
+    /// the current pass through it (for repeated token streams).
+    unsigned long m_repeats_left;
+
     /// The source location range where this macro was expanded.
     SourceLocation m_expand_loc_start, m_expand_loc_end;
 
@@ -118,12 +122,14 @@ public:
 #endif
     /// Create a TokenLexer for the specified token stream.  If 'OwnsTokens' is
     /// specified, this takes ownership of the tokens and delete[]'s them when
-    /// the token lexer is empty.
+    /// the token lexer is empty.  The stream is returned 'RepeatCount' times.
     TokenLexer(const Token* tok_array, unsigned num_toks,
-               bool disable_expansion, bool owns_tokens, Preprocessor& pp)
+               bool disable_expansion, bool owns_tokens, Preprocessor& pp,
+               unsigned long repeat_count = 1)
         : /*m_macro(0), m_actual_args(0),*/ m_pp(pp), m_owns_tokens(false)
     {
-        Init(tok_array, num_toks, disable_expansion, owns_tokens);
+        Init(tok_array, num_toks, disable_expansion, owns_tokens,
+             repeat_count);
     }
 
     /// Initialize this TokenLexer with the specified token stream.
@@ -131,8 +137,12 @@ public:
     ///
     /// DisableExpansion is true when macro expansion of tokens lexed from this
     /// stream should be disabled.
+    ///
+    /// RepeatCount is the number of times the whole stream is returned; the
+    /// tokens are replayed rather than copied.  A count of 0 returns nothing.
     void Init(const Token* tok_array, unsigned num_toks,
-              bool disable_macro_expansion, bool owns_tokens);
+              bool disable_macro_expansion, bool owns_tokens,
+              unsigned long repeat_count = 1);
 
     ~TokenLexer() { destroy(); }
 
@@ -151,7 +161,7 @@ private:
     /// include stack.
     bool isAtEnd() const
     {
-        return m_cur_token == m_num_tokens;
+        return m_cur_token == m_num_tokens && m_repeats_left == 0;
     }
 
 #if 0
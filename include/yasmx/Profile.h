@@ -0,0 +1,176 @@
+#ifndef YASM_PROFILE_H
+#define YASM_PROFILE_H
+///
+/// @file
+/// @brief Assembly profile interface.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include "yasmx/Basic/LLVM.h"
+#include "yasmx/Basic/SourceLocation.h"
+#include "yasmx/Config/export.h"
+
+
+namespace yasm
+{
+
+class SourceManager;
+
+/// A profile of an assembly.  Records the wall time and heap growth of
+/// each phase of assembly, and how much work the optimizer did for the
+/// spans (span-dependent values such as jump targets) of each source
+/// line, so that lines causing excessive optimization work can be found.
+/// Named counters (sizes of the assembled object and the like) may also be
+/// recorded for the machine-readable report.
+///
+/// Phases may nest; a nested phase is reported under the phase that was
+/// running when it was first started.  Phases must be started and stopped
+/// from a single thread.
+class YASM_LIB_EXPORT Profile
+{
+public:
+    Profile();
+    ~Profile();
+
+    /// Start timing a phase.  Time spent in phases of the same name is
+    /// accumulated.
+    /// @param name         phase name
+    void StartPhase(StringRef name);
+
+    /// Stop timing the most recently started phase.
+    void StopPhase();
+
+    /// Add optimizer work for a span.
+    /// @param source       source location of the span's bytecode
+    /// @param recalcs      number of times the span value was recalculated
+    /// @param expansions   number of times the span was expanded
+    void AddSpan(SourceLocation source,
+                 unsigned long recalcs,
+                 unsigned long expansions);
+
+    /// Set a named counter.  Counters are reported in the order first set.
+    /// @param name         counter name
+    /// @param value        value
+    void setCounter(StringRef name, uint64_t value);
+
+    /// Print the report.
+    /// @param os           output stream
+    /// @param source_mgr   source manager, to find span source lines
+    /// @param max_lines    maximum number of source lines to list
+    void Print(raw_ostream& os,
+               const SourceManager& source_mgr,
+               unsigned int max_lines = 10) const;
+
+    /// Print the report as a single-line JSON object: the counters, the
+    /// number of spans, the peak resident set size of the process (in
+    /// bytes, as of the last phase stopped), the phase times, and the
+    /// change in each llvm::Statistic since the profile was created.  Peak
+    /// size, heap usage and statistics are process-wide, so include the
+    /// work of any concurrent assemblies (and the peak size, anything done
+    /// before the profile was created).
+    /// @param os           output stream
+    /// @param filename     input file name to record
+    void PrintJSON(raw_ostream& os, StringRef filename) const;
+
+private:
+    Profile(const Profile&);                    // not implemented
+    const Profile& operator=(const Profile&);   // not implemented
+
+    struct Phase
+    {
+        std::string name;
+        unsigned int depth;         ///< Nesting depth
+        unsigned long count;        ///< Number of times run
+        double wall;                ///< Total wall time, in seconds
+        long long heap;             ///< Total heap growth, in bytes
+    };
+
+    struct Running
+    {
+        size_t phase;               ///< Index into m_phases
+        double wall;                ///< Wall time at start
+        long long heap;             ///< Heap usage at start
+    };
+
+    struct SpanWork
+    {
+        SpanWork() : recalcs(0), expansions(0) {}
+        unsigned long recalcs;
+        unsigned long expansions;
+    };
+
+    std::vector<Phase> m_phases;        ///< Phases, in order first started
+    std::vector<Running> m_running;     ///< Stack of running phases
+    std::map<unsigned int, SpanWork> m_spans;   ///< Span work by location
+    unsigned long m_num_spans;          ///< Number of spans added
+
+    /// Named counters, in order first set.
+    std::vector<std::pair<std::string, uint64_t> > m_counters;
+
+    /// Statistic values when the profile was created.
+    std::vector<std::pair<std::string, unsigned> > m_start_stats;
+
+    uint64_t m_max_rss;                 ///< Peak resident set size
+};
+
+/// Time a phase for the lifetime of the region object.
+class ProfileRegion
+{
+public:
+    /// Constructor.
+    /// @param profile      profile (may be NULL, in which case nothing
+    ///                     is recorded)
+    /// @param name         phase name
+    ProfileRegion(/*@null@*/ Profile* profile, StringRef name)
+        : m_profile(profile)
+    {
+        if (m_profile)
+            m_profile->StartPhase(name);
+    }
+
+    ~ProfileRegion()
+    {
+        if (m_profile)
+            m_profile->StopPhase();
+    }
+
+private:
+    ProfileRegion(const ProfileRegion&);                    // not implemented
+    const ProfileRegion& operator=(const ProfileRegion&);   // not implemented
+
+    Profile* m_profile;
+};
+
+} // namespace yasm
+
+#endif
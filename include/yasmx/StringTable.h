@@ -29,8 +29,10 @@
 /// POSSIBILITY OF SUCH DAMAGE.
 /// @endlicense
 ///
+#include <utility>
 #include <vector>
 
+#include "llvm/ADT/StringMap.h"
 #include "yasmx/Basic/LLVM.h"
 #include "yasmx/Config/export.h"
 
@@ -40,6 +42,11 @@ namespace yasm
 
 /// A string table of 0-terminated strings.  Always begins with a 0-length
 /// string (a single 0 byte) at offset 0.
+///
+/// By default every string is appended as given.  An interning table
+/// instead stores each distinct string once, and on Finalize() lays out
+/// the strings so that a string which is the tail of another (e.g. ".text"
+/// of ".rel.text") shares its storage.
 class YASM_LIB_EXPORT StringTable
 {
 public:
@@ -47,7 +54,9 @@ public:
     /// @param first_index  Indexes will be returned and interpreted
     ///                     as if the first string starts at this offset.
     ///                     Defaults to 0.
-    explicit StringTable(unsigned long first_index=0);
+    /// @param intern       If true, duplicate strings are given the same
+    ///                     index.  Defaults to false.
+    explicit StringTable(unsigned long first_index=0, bool intern=false);
 
     /// Construct from iterator.
     template <typename InputIterator>
@@ -56,6 +65,8 @@ public:
                 unsigned long first_index=0)
         : m_storage(first, last)
         , m_first_index(first_index)
+        , m_intern(false)
+        , m_finalized(false)
     {}
 
     /// Destructor.
@@ -67,6 +78,24 @@ public:
     /// @return String index.
     unsigned long getIndex(StringRef str);
 
+    /// Add a string to an interning table without using its index yet.
+    /// Strings added before Finalize() take part in tail merging.
+    /// @param str      String
+    void Add(StringRef str) { getIndex(str); }
+
+    /// Lay out an interning table, merging strings that are tails of other
+    /// strings.  Indexes returned by getIndex() before this call are
+    /// provisional and must be translated with getFinalIndex(); later calls
+    /// to getIndex() return final indexes.  Does nothing on a table that
+    /// is not interning or is already finalized.
+    void Finalize();
+
+    /// Translate an index returned by getIndex() before Finalize() into
+    /// its index in the laid out table.
+    /// @param index    Provisional string index
+    /// @return String index.
+    unsigned long getFinalIndex(unsigned long index) const;
+
     /// Get the string corresponding to a particular index.  Due to legal use
     /// of substrings, no error checking is performed except for trying to read
     /// past the end of the string table.
@@ -91,6 +120,14 @@ public:
 private:
     std::vector<char> m_storage;
     unsigned long m_first_index;
+    bool m_intern;
+    bool m_finalized;
+
+    /// Index of each distinct string (interning tables only).
+    llvm::StringMap<unsigned long> m_index;
+
+    /// Provisional to final index, sorted by provisional index.
+    std::vector<std::pair<unsigned long, unsigned long> > m_remap;
 };
 
 } // namespace yasm
@@ -0,0 +1,92 @@
+#ifndef YASM_ARENA_H
+#define YASM_ARENA_H
+///
+/// @file
+/// @brief Memory arena and arena-allocatable base class.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include <cstddef>
+#include <vector>
+
+#include "llvm/Support/Allocator.h"
+#include "yasmx/Config/export.h"
+
+
+namespace yasm
+{
+
+/// A memory arena.  Memory is handed out sequentially from large slabs,
+/// and is only returned to the system, all at once, when the arena is
+/// destroyed.  Small blocks given back with Deallocate() are kept on
+/// per-size free lists and reused by later allocations of the same size.
+/// Not thread-safe: an object's arena must only be used from the thread
+/// that parses into the object.
+class YASM_LIB_EXPORT Arena
+{
+public:
+    Arena();
+    ~Arena();
+
+    /// Allocate memory from the arena.
+    /// @param size         size in bytes
+    /// @return Allocated memory, suitably aligned for any object.
+    void* Allocate(std::size_t size);
+
+    /// Give memory back to the arena for reuse.
+    /// @param ptr          memory returned by Allocate()
+    /// @param size         size passed to Allocate()
+    void Deallocate(void* ptr, std::size_t size);
+
+private:
+    Arena(const Arena&);                    // not implemented
+    const Arena& operator=(const Arena&);   // not implemented
+
+    llvm::BumpPtrAllocator m_alloc;
+
+    /// Free list heads, indexed by size in units of the allocation
+    /// alignment.
+    std::vector<void*> m_free;
+};
+
+/// Base class for objects that may be allocated in an Arena, using
+/// placement syntax: "new (arena) T(...)".  A NULL arena allocates on the
+/// heap, as does a plain "new T(...)".  Objects are always destroyed with
+/// delete, regardless of how they were allocated; the memory of
+/// arena-allocated objects is given back to the arena for reuse, so they
+/// must not outlive it.
+class YASM_LIB_EXPORT ArenaAllocated
+{
+public:
+    static void* operator new(std::size_t size);
+    static void* operator new(std::size_t size, Arena* arena);
+    static void operator delete(void* ptr);
+    static void operator delete(void* ptr, Arena* arena);
+};
+
+} // namespace yasm
+
+#endif
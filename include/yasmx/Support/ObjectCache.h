@@ -0,0 +1,118 @@
+#ifndef YASM_OBJECTCACHE_H
+#define YASM_OBJECTCACHE_H
+///
+/// @file
+/// @brief On-disk cache of assembled object files.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+#include "yasmx/Basic/LLVM.h"
+#include "yasmx/Config/export.h"
+
+
+namespace yasm
+{
+
+/// A cache of assembled object files in a local directory, shared by any
+/// number of concurrent assembler processes.
+///
+/// Objects are found in two steps.  The first key is an MD5 hash over the
+/// options given with AddOption() and the contents of the main input file.
+/// It names a manifest listing the other files (includes and data files)
+/// read by the last assembly with that key, along with their hashes.  The
+/// object itself is keyed by the first key plus the current hashes of the
+/// files in the manifest, so a change to any of them is a miss.
+///
+/// Entries are written to temporary files and renamed into place, so
+/// readers never see partial entries.  When the cache grows beyond its
+/// maximum size, the least recently used entries are removed.
+class YASM_LIB_EXPORT ObjectCache
+{
+public:
+    /// Statistics, accumulated over all users of the cache directory.
+    struct Stats
+    {
+        uint64_t hits;          ///< Number of lookups that found an object
+        uint64_t misses;        ///< Number of lookups that did not
+        uint64_t num_objects;   ///< Number of cached objects
+        uint64_t size;          ///< Total size of cache entries, in bytes
+    };
+
+    /// Constructor.
+    /// @param dir          cache directory; created if it doesn't exist
+    /// @param max_size     maximum total size of cache entries, in bytes;
+    ///                     0 for no limit
+    ObjectCache(StringRef dir, uint64_t max_size);
+
+    /// Destructor.
+    ~ObjectCache();
+
+    /// Add to the key a setting that affects the assembled object (e.g. an
+    /// option or the assembler version).  All settings must be added
+    /// before Lookup() is called.
+    /// @param setting      setting
+    void AddOption(StringRef setting);
+
+    /// Look up the object for an input file.  On a hit, the cached object
+    /// is copied to the object file.
+    /// @param in_filename  main input filename
+    /// @param obj_filename object filename
+    /// @return True if the object was found.
+    bool Lookup(StringRef in_filename, StringRef obj_filename);
+
+    /// Store an assembled object.  Must follow a Lookup() miss for the
+    /// same input.
+    /// @param obj_filename object filename
+    /// @param inputs       other files read to assemble the object
+    void Store(StringRef obj_filename, const std::vector<std::string>& inputs);
+
+    /// Get statistics.
+    /// @param stats        statistics (returned)
+    void getStats(/*@out@*/ Stats* stats) const;
+
+private:
+    ObjectCache(const ObjectCache&);                    // not implemented
+    const ObjectCache& operator=(const ObjectCache&);   // not implemented
+
+    std::string getPath(StringRef name) const;
+    bool WriteEntry(StringRef name, StringRef data);
+    void Count(bool hit);
+    void Evict();
+
+    std::string m_dir;          ///< Cache directory
+    uint64_t m_max_size;        ///< Maximum size (0=unlimited)
+    std::string m_options;      ///< Settings added with AddOption()
+    std::string m_main_key;     ///< First key, from the last Lookup()
+};
+
+} // namespace yasm
+
+#endif
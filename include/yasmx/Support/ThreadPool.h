@@ -0,0 +1,81 @@
+#ifndef YASM_THREADPOOL_H
+#define YASM_THREADPOOL_H
+///
+/// @file
+/// @brief Fixed-size worker thread pool.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include "yasmx/Config/export.h"
+#include "yasmx/Config/functional.h"
+#include "yasmx/Support/scoped_ptr.h"
+
+
+namespace yasm
+{
+
+/// A pool of worker threads executing queued tasks in FIFO order.
+/// If the library was built without thread support, or the pool is
+/// created with zero threads, tasks are run synchronously by Async().
+class YASM_LIB_EXPORT ThreadPool
+{
+public:
+    typedef TR1::function<void ()> Task;
+
+    /// Constructor.  Starts the worker threads.
+    /// @param nthreads     number of worker threads
+    explicit ThreadPool(unsigned int nthreads);
+
+    /// Destructor.  Waits for all queued tasks to complete.
+    ~ThreadPool();
+
+    /// Queue a task for execution.
+    /// @param task         task to run
+    void Async(const Task& task);
+
+    /// Wait for all queued tasks to complete.
+    void Wait();
+
+    /// Get the number of worker threads.
+    /// @return Number of threads (0 if tasks are run synchronously).
+    unsigned int getNumThreads() const;
+
+    /// Get the number of hardware threads available to this process.
+    /// @return Number of hardware threads (at least 1).
+    static unsigned int getHardwareConcurrency();
+
+private:
+    ThreadPool(const ThreadPool&);                  // not implemented
+    const ThreadPool& operator=(const ThreadPool&); // not implemented
+
+    /// Pimpl for class internals.
+    class Impl;
+    util::scoped_ptr<Impl> m_impl;
+};
+
+} // namespace yasm
+
+#endif
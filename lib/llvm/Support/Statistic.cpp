@@ -51,6 +51,8 @@ class StatisticInfo {
   std::vector<const Statistic*> Stats;
   friend void llvm::PrintStatistics();
   friend void llvm::PrintStatistics(raw_ostream &OS);
+  friend void llvm::GetStatistics(
+      std::vector<std::pair<std::string, unsigned> > &Stats);
 public:
   ~StatisticInfo();
 
@@ -66,12 +68,12 @@ static ManagedStatic<sys::SmartMutex<true> > StatLock;
 /// RegisterStatistic - The first time a statistic is bumped, this method is
 /// called.
 void Statistic::RegisterStatistic() {
-  // If stats are enabled, inform StatInfo that this statistic should be
-  // printed.
+  // Inform StatInfo of every statistic, so that values are available from
+  // GetStatistics() even when -stats is not given; they are only printed
+  // if stats are enabled.
   sys::SmartScopedLock<true> Writer(*StatLock);
   if (!Initialized) {
-    if (Enabled)
-      StatInfo->addStatistic(this);
+    StatInfo->addStatistic(this);
 
     TsanHappensBefore(this);
     sys::MemoryFence();
@@ -141,11 +143,25 @@ void llvm::PrintStatistics(raw_ostream &OS) {
 
 }
 
+void llvm::GetStatistics(
+    std::vector<std::pair<std::string, unsigned> > &Stats) {
+  sys::SmartScopedLock<true> Reader(*StatLock);
+  const StatisticInfo &Info = *StatInfo;
+  Stats.clear();
+  Stats.reserve(Info.Stats.size());
+  for (size_t i = 0, e = Info.Stats.size(); i != e; ++i) {
+    std::string Name = Info.Stats[i]->getName();
+    Name += '.';
+    Name += Info.Stats[i]->getVarName();
+    Stats.push_back(std::make_pair(Name, Info.Stats[i]->getValue()));
+  }
+}
+
 void llvm::PrintStatistics() {
   StatisticInfo &Stats = *StatInfo;
 
   // Statistics not enabled?
-  if (Stats.Stats.empty()) return;
+  if (!Enabled || Stats.Stats.empty()) return;
 
   // Get the stream to write to.
   raw_ostream &OutStream = *CreateInfoOutputFile();
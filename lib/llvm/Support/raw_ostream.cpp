@@ -36,6 +36,9 @@
 #if defined(HAVE_SYS_UIO_H) && defined(HAVE_WRITEV)
 #  include <sys/uio.h>
 #endif
+#if defined(HAVE_SYS_SENDFILE_H)
+#  include <sys/sendfile.h>
+#endif
 
 #if defined(__CYGWIN__)
 #include <io.h>
@@ -594,6 +597,60 @@ uint64_t raw_fd_ostream::seek(uint64_t off) {
   return pos;
 }
 
+uint64_t raw_fd_ostream::write_file_range(const char *Filename,
+                                          uint64_t Offset, uint64_t Size) {
+  flush();
+  uint64_t Copied = 0;
+#if defined(HAVE_COPY_FILE_RANGE) || \
+    (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H))
+  int InFD = ::open(Filename, O_RDONLY);
+  if (InFD < 0)
+    return 0;
+
+  // Don't copy past the end of the file if it has shrunk.
+  struct stat Status;
+  if (::fstat(InFD, &Status) != 0 || uint64_t(Status.st_size) < Offset + Size) {
+    ::close(InFD);
+    return 0;
+  }
+
+#if defined(HAVE_COPY_FILE_RANGE)
+  bool UseCopyFileRange = true;
+#else
+  bool UseCopyFileRange = false;
+#endif
+  while (Copied < Size) {
+    // Limit each call so the count fits in ssize_t on 32-bit hosts.
+    size_t Chunk = size_t(std::min<uint64_t>(Size - Copied, 1 << 30));
+    off_t InOffset = off_t(Offset + Copied);
+    ssize_t ret = -1;
+#if defined(HAVE_COPY_FILE_RANGE)
+    if (UseCopyFileRange) {
+      ret = ::copy_file_range(InFD, &InOffset, FD, 0, Chunk, 0);
+      if (ret < 0 && errno != EINTR) {
+        // Not supported for this pair of files (e.g. across filesystems
+        // on older kernels); fall back to sendfile.
+        UseCopyFileRange = false;
+        continue;
+      }
+    }
+#endif
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+    if (!UseCopyFileRange)
+      ret = ::sendfile(FD, InFD, &InOffset, Chunk);
+#endif
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    Copied += ret;
+  }
+  ::close(InFD);
+  pos += Copied;
+#endif
+  return Copied;
+}
+
 size_t raw_fd_ostream::preferred_buffer_size() const {
 #if !defined(_MSC_VER) && !defined(__MINGW32__) && !defined(__minix)
   // Windows and Minix have no st_blksize.
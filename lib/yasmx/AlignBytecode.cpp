@@ -26,7 +26,15 @@
 ///
 #include "yasmx/BytecodeContainer.h"
 
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+#define DEBUG_TYPE "AlignBytecode"
+
+#include "llvm/ADT/Statistic.h"
 #include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/Support/bitcount.h"
 #include "yasmx/Support/scoped_ptr.h"
 #include "yasmx/BytecodeOutput.h"
 #include "yasmx/Bytecode.h"
@@ -34,8 +42,13 @@
 #include "yasmx/Expr.h"
 #include "yasmx/Expr_util.h"
 #include "yasmx/IntNum.h"
+#include "yasmx/Object.h"
+#include "yasmx/Section.h"
 
 
+STATISTIC(num_align, "Number of align bytecodes");
+STATISTIC(num_align_folded, "Number of aligns folded at parse time");
+
 using namespace yasm;
 
 namespace {
@@ -83,7 +96,20 @@ public:
     pugi::xml_node Write(pugi::xml_node out) const;
 #endif // WITH_XML
 
+    /// Determine if the end of this bytecode is known to be aligned to
+    /// a boundary, regardless of its offset.
+    /// @param boundary     alignment boundary (power of two)
+    /// @return True if aligned.
+    bool isAlignedTo(unsigned long boundary) const;
+
 private:
+    /// Get the integer values of the boundary and maxskip expressions,
+    /// if they are constant.
+    void CacheValues();
+
+    /// Calculate the fill length for a given tail offset.
+    unsigned long getFillLen(unsigned long tail) const;
+
     Expr m_boundary;    ///< alignment boundary
 
     /// What to fill intervening locations with, empty if using code_fill
@@ -94,7 +120,20 @@ private:
 
     /// Code fill, NULL if using 0 fill
     /*@null@*/ const unsigned char** m_code_fill;
+
+    /// Length of the longest code fill pattern, 0 if none.
+    unsigned long m_code_fill_maxlen;
+
+    /// Longest code fill pattern, repeated (shared by the object), or NULL
+    /// if not in an object.
+    /*@null@*/ const std::vector<unsigned char>* m_code_fill_block;
+
+    /// Integer values of m_boundary and m_maxskip, so the optimizer can
+    /// repeatedly move the bytecode without evaluating them.
+    unsigned long m_boundary_val;
+    unsigned long m_maxskip_val;    ///< ULONG_MAX if no maximum
 };
+
 } // anonymous namespace
 
 AlignBytecode::AlignBytecode(const Expr& boundary,
@@ -104,14 +143,52 @@ AlignBytecode::AlignBytecode(const Expr& boundary,
     : m_boundary(boundary),
       m_fill(fill),
       m_maxskip(maxskip),
-      m_code_fill(code_fill)
+      m_code_fill(code_fill),
+      m_code_fill_maxlen(0),
+      m_code_fill_block(0)
 {
+    if (m_code_fill)
+    {
+        m_code_fill_maxlen = 15;
+        while (!m_code_fill[m_code_fill_maxlen] && m_code_fill_maxlen>0)
+            m_code_fill_maxlen--;
+    }
+    CacheValues();
 }
 
 AlignBytecode::~AlignBytecode()
 {
 }
 
+void
+AlignBytecode::CacheValues()
+{
+    m_boundary_val = 0;
+    m_maxskip_val = ULONG_MAX;
+    if (m_boundary.isIntNum())
+        m_boundary_val = m_boundary.getIntNum().getUInt();
+    if (m_maxskip.isIntNum())
+        m_maxskip_val = m_maxskip.getIntNum().getUInt();
+}
+
+bool
+AlignBytecode::isAlignedTo(unsigned long boundary) const
+{
+    return m_boundary.isIntNum() && m_maxskip.isEmpty()
+        && isExp2(m_boundary_val) && m_boundary_val >= boundary;
+}
+
+unsigned long
+AlignBytecode::getFillLen(unsigned long tail) const
+{
+    if (m_boundary_val == 0)
+        return 0;
+    unsigned long end = tail;
+    if (end & (m_boundary_val-1))
+        end = (end & ~(m_boundary_val-1)) + m_boundary_val;
+    return end - tail;
+}
+
 bool
 AlignBytecode::Finalize(Bytecode& bc, DiagnosticsEngine& diags)
 {
@@ -156,6 +233,15 @@ AlignBytecode::Finalize(Bytecode& bc, DiagnosticsEngine& diags)
             return false;
         }
     }
+    CacheValues();
+
+    if (m_code_fill && m_code_fill_maxlen != 0)
+    {
+        BytecodeContainer* container = bc.getContainer();
+        Section* sect = container ? container->getSection() : 0;
+        if (Object* object = sect ? sect->getObject() : 0)
+            m_code_fill_block = &object->getCodeFillBlock(m_code_fill);
+    }
     return true;
 }
 
@@ -185,9 +271,7 @@ AlignBytecode::Expand(Bytecode& bc,
                       /*@out@*/ long* pos_thres,
                       DiagnosticsEngine& diags)
 {
-    unsigned long boundary = m_boundary.getIntNum().getUInt();
-
-    if (boundary == 0)
+    if (m_boundary_val == 0)
     {
         *len = 0;
         *pos_thres = new_val;
@@ -195,21 +279,14 @@ AlignBytecode::Expand(Bytecode& bc,
         return true;
     }
 
-    unsigned long end = static_cast<unsigned long>(new_val);
-    if (end & (boundary-1))
-        end = (end & ~(boundary-1)) + boundary;
-
+    *len = getFillLen(static_cast<unsigned long>(new_val));
+    unsigned long end = static_cast<unsigned long>(new_val) + *len;
     *pos_thres = static_cast<long>(end);
-    *len = end - static_cast<unsigned long>(new_val);
 
-    if (!m_maxskip.isEmpty())
+    if (*len > m_maxskip_val)
     {
-        unsigned long maxskip = m_maxskip.getIntNum().getUInt();
-        if (*len > maxskip)
-        {
-            *pos_thres = static_cast<long>(end-maxskip)-1;
-            *len = 0;
-        }
+        *pos_thres = static_cast<long>(end-m_maxskip_val)-1;
+        *len = 0;
     }
     *keep = true;
     return true;
@@ -218,28 +295,9 @@ AlignBytecode::Expand(Bytecode& bc,
 bool
 AlignBytecode::Output(Bytecode& bc, BytecodeOutput& bc_out)
 {
-    unsigned long len;
-    unsigned long boundary = m_boundary.getIntNum().getUInt();
-    Bytes& bytes = bc_out.getScratch();
-
-    if (boundary == 0)
+    unsigned long len = getFillLen(bc.getTailOffset());
+    if (len == 0 || len > m_maxskip_val)
         return true;
-    else
-    {
-        unsigned long tail = bc.getTailOffset();
-        unsigned long end = tail;
-        if (tail & (boundary-1))
-            end = (tail & ~(boundary-1)) + boundary;
-        len = end - tail;
-        if (len == 0)
-            return true;
-        if (!m_maxskip.isEmpty())
-        {
-            unsigned long maxskip = m_maxskip.getIntNum().getUInt();
-            if (len > maxskip)
-                return true;
-        }
-    }
 
     if (!bc_out.isBits())
     {
@@ -247,6 +305,8 @@ AlignBytecode::Output(Bytecode& bc, BytecodeOutput& bc_out)
         bc_out.OutputGap(len, bc.getSource());
         return true;
     }
+
+    Bytes& bytes = bc_out.getScratch();
     if (!m_fill.isEmpty())
     {
         unsigned long v = m_fill.getIntNum().getUInt();
@@ -254,34 +314,45 @@ AlignBytecode::Output(Bytecode& bc, BytecodeOutput& bc_out)
     }
     else if (m_code_fill)
     {
-        unsigned long maxlen = 15;
-        while (!m_code_fill[maxlen] && maxlen>0)
-            maxlen--;
+        unsigned long maxlen = m_code_fill_maxlen;
         if (maxlen == 0)
         {
             bc_out.Diag(bc.getSource(), diag::err_align_code_not_found);
             return false;
         }
 
-        // Fill with maximum code fill as much as possible
-        while (len > maxlen)
-        {
-            bytes.insert(bytes.end(),
-                         &m_code_fill[maxlen][0],
-                         &m_code_fill[maxlen][maxlen]);
-            len -= maxlen;
-        }
-
-        if (!m_code_fill[len])
+        // Fill with maximum code fill as much as possible, then finish
+        // with the pattern for the remaining length.
+        unsigned long rest = len - ((len-1) / maxlen) * maxlen;
+        if (!m_code_fill[rest])
         {
             bc_out.Diag(bc.getSource(), diag::err_align_invalid_code_size)
-                << static_cast<unsigned int>(len);
+                << static_cast<unsigned int>(rest);
             return false;
         }
-        // Handle rest of code fill
+        bytes.reserve(len);
+        len -= rest;
+        if (m_code_fill_block)
+        {
+            // The block is a whole number of patterns, so can be cut
+            // anywhere a pattern ends.
+            const std::vector<unsigned char>& block = *m_code_fill_block;
+            for (; len > 0; )
+            {
+                unsigned long n = std::min<unsigned long>(len, block.size());
+                bytes.insert(bytes.end(), block.begin(), block.begin() + n);
+                len -= n;
+            }
+        }
+        else
+        {
+            const unsigned char* pattern = m_code_fill[maxlen];
+            for (; len > 0; len -= maxlen)
+                bytes.insert(bytes.end(), pattern, pattern + maxlen);
+        }
         bytes.insert(bytes.end(),
-                     &m_code_fill[len][0],
-                     &m_code_fill[len][len]);
+                     &m_code_fill[rest][0],
+                     &m_code_fill[rest][rest]);
     }
     else
     {
@@ -307,7 +378,7 @@ AlignBytecode::getSpecial() const
 AlignBytecode*
 AlignBytecode::clone() const
 {
-    return new AlignBytecode(m_boundary, m_fill, m_maxskip, m_code_fill);
+    return new AlignBytecode(*this);
 }
 
 #ifdef WITH_XML
@@ -324,6 +395,37 @@ AlignBytecode::Write(pugi::xml_node out) const
 }
 #endif // WITH_XML
 
+/// Determine if the end of a container is known to be aligned at parse
+/// time: either everything since the section start or since an at least as
+/// strict alignment has a fixed length, and that length is a multiple of
+/// the boundary.
+static bool
+isEndAligned(BytecodeContainer& container, unsigned long boundary)
+{
+    unsigned long len = 0;
+    for (BytecodeContainer::bc_iterator bc=container.bytecodes_end(),
+         begin=container.bytecodes_begin(); bc != begin; )
+    {
+        --bc;
+        if (bc->hasContents())
+        {
+            Bytecode::Contents& contents = bc->getContents();
+            if (contents.getType() != "yasm::AlignBytecode" ||
+                !static_cast<AlignBytecode&>(contents).isAlignedTo(boundary))
+                return false;
+            return (len & (boundary-1)) == 0;
+        }
+        len += bc->getFixedLen();
+    }
+
+    // Only the start of a section is at a known offset; other containers
+    // (e.g. multiple contents) may be placed anywhere.
+    Section* sect = container.getSection();
+    if (!sect || static_cast<BytecodeContainer*>(sect) != &container)
+        return false;
+    return (len & (boundary-1)) == 0;
+}
+
 void
 yasm::AppendAlign(BytecodeContainer& container,
                   const Expr& boundary,
@@ -332,8 +434,25 @@ yasm::AppendAlign(BytecodeContainer& container,
                   /*@null@*/ const unsigned char** code_fill,
                   SourceLocation source)
 {
+    // Don't create a bytecode for an alignment that is already satisfied.
+    // Fill and maxskip need to be checked for errors at finalization, so
+    // only fold if they're constant as well.
+    if (boundary.isIntNum() && (fill.isEmpty() || fill.isIntNum()) &&
+        (maxskip.isEmpty() || maxskip.isIntNum()))
+    {
+        unsigned long boundint = boundary.getIntNum().getUInt();
+        if (boundint != 0 && isExp2(boundint) &&
+            isEndAligned(container, boundint))
+        {
+            ++num_align_folded;
+            return;
+        }
+    }
+
+    ++num_align;
     Bytecode& bc = container.FreshBytecode();
     bc.Transform(Bytecode::Contents::Ptr(
-        new AlignBytecode(boundary, fill, maxskip, code_fill)));
+        new (container.getArena())
+            AlignBytecode(boundary, fill, maxskip, code_fill)));
     bc.setSource(source);
 }
@@ -28,10 +28,12 @@
 
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
 #include "yasmx/Basic/Diagnostic.h"
 #include "yasmx/Basic/SourceManager.h"
 #include "yasmx/Parse/Directive.h"
 #include "yasmx/Parse/Parser.h"
+#include "yasmx/Parse/Preprocessor.h"
 #include "yasmx/Support/registry.h"
 #include "yasmx/Support/scoped_ptr.h"
 #include "yasmx/Arch.h"
@@ -39,6 +41,8 @@
 #include "yasmx/ListFormat.h"
 #include "yasmx/Object.h"
 #include "yasmx/ObjectFormat.h"
+#include "yasmx/Profile.h"
+#include "yasmx/Section.h"
 
 
 using namespace yasm;
@@ -71,7 +75,10 @@ Assembler::Assembler(StringRef arch_keyword,
       m_dbgfmt(0),
       m_listfmt(0),
       m_object(0),
-      m_dump_time(dump_time)
+      m_dump_time(dump_time),
+      m_pool(0),
+      m_profile(0),
+      m_relax_optimizer(false)
 {
     if (m_arch_module.get() == 0)
     {
@@ -239,6 +246,7 @@ Assembler::InitObject(SourceManager& source_mgr, DiagnosticsEngine& diags)
 
     // Create object
     m_object.reset(new Object(in_filename, m_obj_filename, m_arch.get()));
+    m_object->getOptions().RelaxOptimizer = m_relax_optimizer;
 
     // See if the object format supports such an object
     if (!m_objfmt_module->isOkObject(*m_object))
@@ -291,13 +299,11 @@ Assembler::InitParser(SourceManager& source_mgr,
     return *m_parser;
 }
 
-bool
-Assembler::Assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
+void
+Assembler::AddDirectives(Directives& dirs)
 {
     StringRef parser_keyword = m_parser_module->getKeyword();
 
-    // Set up directive handlers
-    Directives dirs;
     m_arch->AddDirectives(dirs, parser_keyword);
     m_parser->AddDirectives(dirs, parser_keyword);
     m_objfmt->AddDirectives(dirs, parser_keyword);
@@ -307,12 +313,55 @@ Assembler::Assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
         m_listfmt.reset(m_listfmt_module->Create().release());
         m_listfmt->AddDirectives(dirs, parser_keyword);
     }
+}
+
+bool
+Assembler::Preprocess(raw_ostream& os, DiagnosticsEngine& diags)
+{
+    diags.getClient()->BeginSourceFile();
+    bool ok = m_parser->Preprocess(*m_object, os, diags);
+    diags.getClient()->EndSourceFile();
+    return ok && !diags.hasErrorOccurred();
+}
+
+bool
+Assembler::FindIncludes(DiagnosticsEngine& diags)
+{
+    diags.getClient()->BeginSourceFile();
+    if (!m_parser->ScanIncludes(*m_object, diags) &&
+        !diags.hasErrorOccurred())
+    {
+        // The parser can't tell without parsing.
+        Directives dirs;
+        AddDirectives(dirs);
+        m_parser->Parse(*m_object, dirs, diags);
+    }
+    diags.getClient()->EndSourceFile();
+    return !diags.hasErrorOccurred();
+}
+
+bool
+Assembler::Assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
+{
+    // Set up directive handlers
+    Directives dirs;
+    AddDirectives(dirs);
 
     // Inform the diagnostic consumer we are processing a source file
     diags.getClient()->BeginSourceFile();
 
-    // Parse!
-    m_parser->Parse(*m_object, dirs, diags);
+    // Parse!  The main file may be replaced while parsing (e.g. by
+    // preprocessed source), so get its size first.
+    if (m_profile)
+        m_profile->setCounter("input_size",
+            source_mgr.getBuffer(source_mgr.getMainFileID())->getBufferSize());
+    {
+        ProfileRegion region(m_profile, "Parse");
+        m_parser->Parse(*m_object, dirs, diags);
+    }
+    if (m_profile)
+        m_profile->setCounter("preprocessed_size",
+                              m_parser->getPreprocessor().getNumInputBytes());
 
     if (m_dump_time == Assembler::DUMP_AFTER_PARSE)
         DumpXml(*m_object);
@@ -320,14 +369,20 @@ Assembler::Assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
         return false;
 
     // Finalize parse
-    m_object->Finalize(diags);
+    {
+        ProfileRegion region(m_profile, "Finalize");
+        m_object->Finalize(diags);
+    }
     if (m_dump_time == Assembler::DUMP_AFTER_FINALIZE)
         DumpXml(*m_object);
     if (diags.hasErrorOccurred())
         return false;
 
     // Optimize
-    m_object->Optimize(diags);
+    {
+        ProfileRegion region(m_profile, "Optimize");
+        m_object->Optimize(diags, m_pool, m_profile);
+    }
 
     if (m_dump_time == Assembler::DUMP_AFTER_OPTIMIZE)
         DumpXml(*m_object);
@@ -336,11 +391,25 @@ Assembler::Assemble(SourceManager& source_mgr, DiagnosticsEngine& diags)
         return false;
 
     // generate any debugging information
-    m_dbgfmt->Generate(*m_objfmt, source_mgr, diags);
+    {
+        ProfileRegion region(m_profile, "Generate debug info");
+        m_dbgfmt->Generate(*m_objfmt, source_mgr, diags);
+    }
 
     // Inform the diagnostic consumer we are done processing source.
     diags.getClient()->EndSourceFile();
 
+    if (m_profile)
+    {
+        unsigned long num_bytecodes = 0;
+        for (Object::section_iterator i=m_object->sections_begin(),
+             end=m_object->sections_end(); i != end; ++i)
+            num_bytecodes += i->size();
+        m_profile->setCounter("sections", m_object->getNumSections());
+        m_profile->setCounter("bytecodes", num_bytecodes);
+        m_profile->setCounter("symbols",
+            m_object->symbols_end() - m_object->symbols_begin());
+    }
     return true;
 }
 
@@ -351,10 +420,14 @@ Assembler::Output(raw_fd_ostream& os, DiagnosticsEngine& diags)
     diags.getClient()->BeginSourceFile();
 
     // Write the object file
-    m_objfmt->Output(os,
-                     !m_dbgfmt_module->getKeyword().equals_lower("null"),
-                     *m_dbgfmt,
-                     diags);
+    {
+        ProfileRegion region(m_profile, "Output");
+        m_objfmt->setThreadPool(m_pool);
+        m_objfmt->Output(os,
+                         !m_dbgfmt_module->getKeyword().equals_lower("null"),
+                         *m_dbgfmt,
+                         diags);
+    }
 
     // Inform the diagnostic consumer we are done processing source.
     diags.getClient()->EndSourceFile();
@@ -362,6 +435,16 @@ Assembler::Output(raw_fd_ostream& os, DiagnosticsEngine& diags)
     if (m_dump_time == DUMP_AFTER_OUTPUT)
         DumpXml(*m_object);
 
+    if (m_profile)
+    {
+        unsigned long num_relocs = 0;
+        for (Object::section_iterator i=m_object->sections_begin(),
+             end=m_object->sections_end(); i != end; ++i)
+            num_relocs += i->getRelocs().size();
+        m_profile->setCounter("relocations", num_relocs);
+        m_profile->setCounter("output_size", os.tell());
+    }
+
     if (diags.hasErrorOccurred())
         return false;
 
@@ -0,0 +1,118 @@
+//
+// Buffering Diagnostic Client (for deferred reporting)
+//
+//  Copyright (C) 2012  Peter Johnson
+//
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+#include "yasmx/Basic/DiagnosticBuffer.h"
+
+
+using namespace yasm;
+
+DiagnosticBuffer::~DiagnosticBuffer()
+{
+}
+
+DiagnosticsEngine*
+DiagnosticBuffer::CreateEngine(const DiagnosticsEngine& diags)
+{
+    DiagnosticsEngine* engine =
+        new DiagnosticsEngine(diags.getDiagnosticIDs(), this, false);
+    if (diags.hasSourceManager())
+        engine->setSourceManager(&diags.getSourceManager());
+    engine->setEnableAllWarnings(true);
+    return engine;
+}
+
+void
+DiagnosticBuffer::HandleDiagnostic(DiagnosticsEngine::Level level,
+                                   const Diagnostic& info)
+{
+    DiagnosticConsumer::HandleDiagnostic(level, info);
+
+    m_diags.push_back(Stored());
+    Stored& stored = m_diags.back();
+    stored.id = info.getID();
+    stored.loc = info.getLocation();
+
+    for (unsigned int i=0, num=info.getNumArgs(); i<num; ++i)
+    {
+        Arg arg;
+        arg.kind = info.getArgKind(i);
+        arg.val = 0;
+        switch (arg.kind)
+        {
+            case DiagnosticsEngine::ak_std_string:
+                arg.str = info.getArgStdStr(i);
+                break;
+            case DiagnosticsEngine::ak_c_string:
+                // The string may not outlive the diagnostic; keep a copy.
+                arg.kind = DiagnosticsEngine::ak_std_string;
+                arg.str = info.getArgCStr(i);
+                break;
+            default:
+                arg.val = info.getRawArg(i);
+                break;
+        }
+        stored.args.push_back(arg);
+    }
+
+    ArrayRef<CharSourceRange> ranges = info.getRanges();
+    stored.ranges.assign(ranges.begin(), ranges.end());
+
+    for (unsigned int i=0, num=info.getNumFixItHints(); i<num; ++i)
+        stored.fixits.push_back(info.getFixItHint(i));
+}
+
+void
+DiagnosticBuffer::Replay(DiagnosticsEngine& diags)
+{
+    for (std::vector<Stored>::const_iterator i=m_diags.begin(),
+         end=m_diags.end(); i != end; ++i)
+    {
+        DiagnosticBuilder db = diags.Report(i->loc, i->id);
+        for (std::vector<Arg>::const_iterator arg=i->args.begin(),
+             argend=i->args.end(); arg != argend; ++arg)
+        {
+            if (arg->kind == DiagnosticsEngine::ak_std_string)
+                db << arg->str;
+            else
+                db.AddTaggedVal(arg->val, arg->kind);
+        }
+        for (std::vector<CharSourceRange>::const_iterator
+             range=i->ranges.begin(), rangeend=i->ranges.end();
+             range != rangeend; ++range)
+            db << *range;
+        for (std::vector<FixItHint>::const_iterator fixit=i->fixits.begin(),
+             fixitend=i->fixits.end(); fixit != fixitend; ++fixit)
+            db << *fixit;
+    }
+    m_diags.clear();
+}
+
+DiagnosticConsumer*
+DiagnosticBuffer::clone(DiagnosticsEngine& diags) const
+{
+    return new DiagnosticBuffer;
+}
@@ -28,6 +28,8 @@
 
 #include "yasmx/Bytecode.h"
 
+#include <algorithm>
+
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/Twine.h"
 #include "yasmx/Basic/Diagnostic.h"
@@ -281,11 +283,37 @@ Bytecode::UpdateOffset(unsigned long offset, DiagnosticsEngine& diags)
     return getNextOffset();
 }
 
+Bytecode::Fixup&
+Bytecode::TakeFixup(Fixup& fixup)
+{
+    // Copying a fixup clones its expression, so fixups are swapped into
+    // place rather than copied, both when appending and when the table
+    // grows.  For data tables with many relocations this avoids holding
+    // two copies of every expression while the table is reallocated.
+    if (m_fixed_fixups.size() == m_fixed_fixups.capacity())
+    {
+        std::vector<Fixup> fixups;
+        fixups.reserve(std::max<std::vector<Fixup>::size_type>
+                       (1, 2*m_fixed_fixups.size()));
+        for (std::vector<Fixup>::iterator i=m_fixed_fixups.begin(),
+             end=m_fixed_fixups.end(); i != end; ++i)
+        {
+            fixups.push_back(Fixup(0, Value(0)));
+            fixups.back().swap(*i);
+        }
+        m_fixed_fixups.swap(fixups);
+    }
+    m_fixed_fixups.push_back(Fixup(0, Value(0)));
+    m_fixed_fixups.back().swap(fixup);
+    return m_fixed_fixups.back();
+}
+
 void
 Bytecode::AppendFixed(const Value& val)
 {
     unsigned int valsize = val.getSize()/8;
-    m_fixed_fixups.push_back(Fixup(m_fixed.size(), val));
+    Fixup fixup(m_fixed.size(), val);
+    TakeFixup(fixup);
     m_fixed.Write(valsize, 0);
     ++num_fixed_value;
 }
@@ -294,7 +322,8 @@ void
 Bytecode::AppendFixed(std::auto_ptr<Value> val)
 {
     unsigned int valsize = val->getSize()/8;
-    m_fixed_fixups.push_back(Fixup(m_fixed.size(), val));
+    Fixup fixup(m_fixed.size(), val);
+    TakeFixup(fixup);
     m_fixed.Write(valsize, 0);
     ++num_fixed_value;
 }
@@ -304,10 +333,11 @@ Bytecode::AppendFixed(unsigned int size,
                       std::auto_ptr<Expr> e,
                       SourceLocation source)
 {
-    m_fixed_fixups.push_back(Fixup(m_fixed.size(), size*8, e, source));
+    Fixup fixup(m_fixed.size(), size*8, e, source);
+    Value& val = TakeFixup(fixup);
     m_fixed.Write(size, 0);
     ++num_fixed_value;
-    return m_fixed_fixups.back();
+    return val;
 }
 
 #ifdef WITH_XML
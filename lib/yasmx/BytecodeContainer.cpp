@@ -30,7 +30,9 @@
 #include "yasmx/BytecodeOutput.h"
 #include "yasmx/Bytecode.h"
 #include "yasmx/Expr.h"
+#include "yasmx/Object.h"
 #include "yasmx/Optimizer.h"
+#include "yasmx/Section.h"
 
 
 using namespace yasm;
@@ -137,8 +139,11 @@ BytecodeContainer::BytecodeContainer(Section* sect)
       m_bcs_owner(m_bcs),
       m_last_gap(false)
 {
-    // A container always has at least one bytecode.
-    StartBytecode();
+    // A container always has at least one bytecode.  The section (and
+    // thus the arena) is not available while it is being constructed.
+    Bytecode* bc = new Bytecode;
+    bc->m_container = this; // record parent
+    m_bcs.push_back(bc);
 }
 
 BytecodeContainer::~BytecodeContainer()
@@ -165,16 +170,27 @@ BytecodeContainer::AppendGap(unsigned long size, SourceLocation source)
         return m_bcs.back();
     }
     Bytecode& bc = FreshBytecode();
-    bc.Transform(Bytecode::Contents::Ptr(new GapBytecode(size)));
+    bc.Transform(Bytecode::Contents::Ptr(new (getArena()) GapBytecode(size)));
     bc.setSource(source);
     m_last_gap = true;
     return bc;
 }
 
+Arena*
+BytecodeContainer::getArena()
+{
+    if (!m_sect)
+        return 0;
+    Object* object = m_sect->getObject();
+    if (!object)
+        return 0;
+    return &object->getArena();
+}
+
 Bytecode&
 BytecodeContainer::StartBytecode()
 {
-    Bytecode* bc = new Bytecode;
+    Bytecode* bc = new (getArena()) Bytecode;
     bc->m_container = this; // record parent
     m_bcs.push_back(bc);
     m_last_gap = false;
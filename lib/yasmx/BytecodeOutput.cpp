@@ -28,6 +28,7 @@
 
 #include "llvm/Support/raw_ostream.h"
 #include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/OutputImage.h"
 
 
 using namespace yasm;
@@ -47,6 +48,25 @@ BytecodeOutput::isBits() const
     return true;
 }
 
+void
+BytecodeOutput::DoOutputFileRange(StringRef data,
+                                  StringRef filename,
+                                  uint64_t offset,
+                                  SourceLocation source)
+{
+    static const size_t BLOCK_SIZE = 64*1024;
+
+    Bytes bytes;
+    while (!data.empty())
+    {
+        StringRef block = data.substr(0, BLOCK_SIZE);
+        bytes.resize(0);
+        bytes.WriteString(block);
+        DoOutputBytes(bytes, source);
+        data = data.substr(block.size());
+    }
+}
+
 bool
 BytecodeOutput::ConvertSymbolToBytes(SymbolRef sym,
                                      Location loc,
@@ -88,6 +108,29 @@ BytecodeNoOutput::DoOutputBytes(const Bytes& bytes, SourceLocation source)
     Diag(source, diag::warn_nobits_data);
 }
 
+void
+BytecodeNoOutput::DoOutputFileRange(StringRef data,
+                                    StringRef filename,
+                                    uint64_t offset,
+                                    SourceLocation source)
+{
+    if (data.empty())
+        return;
+    Diag(source, diag::warn_nobits_data);
+}
+
+BytecodeStreamOutput::BytecodeStreamOutput(OutputImage& os,
+                                           DiagnosticsEngine& diags)
+    : BytecodeOutput(diags), m_os(os), m_image(&os), m_fd_os(0)
+{
+}
+
+BytecodeStreamOutput::BytecodeStreamOutput(raw_fd_ostream& os,
+                                           DiagnosticsEngine& diags)
+    : BytecodeOutput(diags), m_os(os), m_image(0), m_fd_os(&os)
+{
+}
+
 BytecodeStreamOutput::~BytecodeStreamOutput()
 {
 }
@@ -121,3 +164,17 @@ BytecodeStreamOutput::DoOutputBytes(const Bytes& bytes, SourceLocation source)
     // Output bytes to file
     m_os << bytes;
 }
+
+void
+BytecodeStreamOutput::DoOutputFileRange(StringRef data,
+                                        StringRef filename,
+                                        uint64_t offset,
+                                        SourceLocation source)
+{
+    if (m_image)
+        m_image->WriteFileRange(data, filename, offset);
+    else if (m_fd_os)
+        WriteFileRange(*m_fd_os, data, filename, offset);
+    else
+        m_os.write(data.data(), data.size());
+}
@@ -35,8 +35,6 @@
 using namespace yasm;
 using llvm::APInt;
 
-static APInt staticbv(IntNum::BITVECT_NATIVE_SIZE, 0);
-
 static inline uint64_t
 Extract(const APInt& bv, unsigned int width, unsigned int lsb)
 {
@@ -45,6 +43,24 @@ Extract(const APInt& bv, unsigned int width, unsigned int lsb)
     return v;
 }
 
+/// Get the number of bits needed to represent a long value as LEB128.
+/// Matches APInt::getMinSignedBits() (signed) or getActiveBits() (unsigned).
+/// Unsigned representation of negative values is not handled.
+static inline int
+SizeLong(long v, bool sign)
+{
+    unsigned long uv = static_cast<unsigned long>(v);
+    if (sign && v < 0)
+        uv = ~uv;
+    int bits = 0;
+    while (uv != 0)
+    {
+        uv >>= 1;
+        ++bits;
+    }
+    return sign ? bits+1 : bits;
+}
+
 unsigned long
 yasm::WriteLEB128(Bytes& bytes, const IntNum& intn, bool sign)
 {
@@ -55,14 +71,29 @@ yasm::WriteLEB128(Bytes& bytes, const IntNum& intn, bool sign)
         return 1;
     }
 
-    const APInt* bv = intn.getBV(&staticbv);
+    Bytes::size_type orig_size = bytes.size();
+
+    // Shortcut values that fit in a long.
+    if (intn.isInt() && (sign || intn.getSign() > 0))
+    {
+        long v = intn.getInt();
+        int size = SizeLong(v, sign);
+        int i = 0;
+        for (; i<size-7; i += 7)
+            bytes.push_back(static_cast<unsigned char>((v>>i) & 0x7F) | 0x80);
+        // last byte does not have MSB set
+        bytes.push_back(static_cast<unsigned char>((v>>i) & 0x7F));
+        return static_cast<unsigned long>(bytes.size()-orig_size);
+    }
+
+    APInt bvbuf;
+    const APInt* bv = intn.getBV(&bvbuf);
     int size;
     if (sign)
         size = bv->getMinSignedBits();
     else
         size = bv->getActiveBits();
 
-    Bytes::size_type orig_size = bytes.size();
     int i = 0;
     for (; i<size-7; i += 7)
         bytes.push_back(static_cast<unsigned char>(Extract(*bv, 7, i)) | 0x80);
@@ -78,7 +109,12 @@ yasm::SizeLEB128(const IntNum& intn, bool sign)
     if (intn.isZero())
         return 1;
 
-    const APInt* bv = intn.getBV(&staticbv);
+    // Shortcut values that fit in a long.
+    if (intn.isInt() && (sign || intn.getSign() > 0))
+        return (SizeLong(intn.getInt(), sign)+6)/7;
+
+    APInt bvbuf;
+    const APInt* bv = intn.getBV(&bvbuf);
     if (sign)
         return (bv->getMinSignedBits()+6)/7;
     else
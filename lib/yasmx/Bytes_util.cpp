@@ -38,8 +38,6 @@
 using namespace yasm;
 using llvm::APInt;
 
-static APInt staticbv(IntNum::BITVECT_NATIVE_SIZE, 0);
-
 void
 yasm::Write8(Bytes& bytes, const IntNum& intn)
 {
@@ -108,7 +106,8 @@ yasm::WriteN(Bytes& bytes, const IntNum& intn, int n)
     }
 
     // harder cases
-    const APInt* bv = intn.getBV(&staticbv);
+    APInt bvbuf;
+    const APInt* bv = intn.getBV(&bvbuf);
     const uint64_t* words = bv->getRawData();
     unsigned int nwords = bv->getNumWords();
     APInt tmp;    // must be here so it stays in scope
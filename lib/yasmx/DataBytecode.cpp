@@ -30,7 +30,6 @@
 #include "yasmx/Bytecode.h"
 #include "yasmx/Bytes_util.h"
 #include "yasmx/Expr.h"
-#include "yasmx/NumericOutput.h"
 
 
 using namespace yasm;
@@ -64,14 +63,12 @@ yasm::AppendData(BytecodeContainer& container,
                  unsigned int size,
                  const Arch& arch)
 {
-    Bytecode& bc = container.FreshBytecode();
-    Bytes zero;
-    zero.resize(size);
-    arch.setEndian(zero);
-    NumericOutput numout(zero);
-    numout.setSize(size*8);
-    numout.OutputInteger(val);
-    bc.getFixed().insert(bc.getFixed().end(), zero.begin(), zero.end());
+    // Written straight into the fixed buffer, with no temporary to copy.
+    Bytes& fixed = container.FreshBytecode().getFixed();
+    EndianState saved = fixed;
+    arch.setEndian(fixed);
+    WriteN(fixed, val, size*8);
+    fixed.setEndian(saved);
 }
 
 void
@@ -80,14 +77,11 @@ yasm::AppendData(BytecodeContainer& container,
                  unsigned int size,
                  EndianState endian)
 {
-    Bytecode& bc = container.FreshBytecode();
-    Bytes zero;
-    zero.resize(size);
-    zero.setEndian(endian);
-    NumericOutput numout(zero);
-    numout.setSize(size*8);
-    numout.OutputInteger(val);
-    bc.getFixed().insert(bc.getFixed().end(), zero.begin(), zero.end());
+    Bytes& fixed = container.FreshBytecode().getFixed();
+    EndianState saved = fixed;
+    fixed.setEndian(endian);
+    WriteN(fixed, val, size*8);
+    fixed.setEndian(saved);
 }
 
 void
@@ -218,7 +218,7 @@ ExprTerm::PromoteToFloat(const llvm::fltSemantics& semantics)
 
     std::auto_ptr<APFloat>
         upconvf(new APFloat(semantics, APFloat::fcZero, false));
-    llvm::APInt upconvi(IntNum::BITVECT_NATIVE_SIZE, 0);
+    llvm::APInt upconvi;
     upconvf->convertFromAPInt(*getIntNum()->getBV(&upconvi), true,
                               APFloat::rmNearestTiesToEven);
 
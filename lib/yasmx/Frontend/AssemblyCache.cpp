@@ -0,0 +1,178 @@
+///
+/// @file
+/// @brief Object cache use shared by the assembler frontends.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include "yasmx/Frontend/AssemblyCache.h"
+
+#include <cstdlib>
+#include <vector>
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/Basic/FileManager.h"
+#include "yasmx/Basic/SourceManager.h"
+#include "yasmx/Parse/Preprocessor.h"
+#include "yasmx/Assembler.h"
+#include "yasmx/Object.h"
+
+
+using namespace yasm;
+
+/// Options, without leading dashes, that cannot change the object.
+/// Those in value_opts take a value, either after '=' or as the next
+/// argument.
+static const char* const value_opts[] =
+{
+    "batch", "cache-dir", "cache-size", "o", "objfile", 0
+};
+static const char* const flag_opts[] = { "cache-stats", 0 };
+
+/// Environment variables read by the assembler itself.  Those named by
+/// the source (e.g. NASM %!VAR) are handled by not storing the object.
+static const char* const env_vars[] = { "YASM_TEST_SUITE", 0 };
+
+static bool
+isOneOf(StringRef name, const char* const* names)
+{
+    for (; *names; ++names)
+    {
+        if (name == *names)
+            return true;
+    }
+    return false;
+}
+
+AssemblyCache::AssemblyCache(StringRef dir,
+                             unsigned int max_size,
+                             StringRef settings)
+    : m_cache(dir, static_cast<uint64_t>(max_size) << 20)
+{
+    m_cache.AddOption(settings);
+}
+
+AssemblyCache::~AssemblyCache()
+{
+}
+
+std::string
+AssemblyCache::getRunSettings(StringRef version,
+                              int argc,
+                              char* argv[],
+                              StringRef obj_filename,
+                              void* main_addr)
+{
+    std::string settings;
+    llvm::raw_string_ostream os(settings);
+    os << version << '\0';
+
+    llvm::sys::PathWithStatus exe(
+        llvm::sys::Path::GetMainExecutable(argv[0], main_addr));
+    if (const llvm::sys::FileStatus* status = exe.getFileStatus())
+    {
+        os << exe.str() << ' ' << status->getSize() << ' '
+           << status->getTimestamp().seconds() << '.'
+           << status->getTimestamp().nanoseconds() << '\0';
+    }
+
+    for (const char* const* name = env_vars; *name; ++name)
+    {
+        if (const char* value = std::getenv(*name))
+            os << *name << '=' << value << '\0';
+    }
+
+    std::string prefixed_obj = "-o" + obj_filename.str();
+    for (int i=1; i<argc; ++i)
+    {
+        StringRef arg(argv[i]);
+        if (arg.size() > 1 && arg[0] == '-')
+        {
+            StringRef name = arg.substr(arg.startswith("--") ? 2 : 1);
+            std::pair<StringRef, StringRef> name_value = name.split('=');
+            if (isOneOf(name_value.first, flag_opts))
+                continue;
+            if (isOneOf(name_value.first, value_opts))
+            {
+                if (name_value.first.size() == name.size())
+                    ++i;    // value is the next argument
+                continue;
+            }
+            // -o takes its value in the same argument too.
+            if (!obj_filename.empty() && arg == prefixed_obj)
+                continue;
+        }
+        os << arg << '\0';
+    }
+    return os.str();
+}
+
+bool
+AssemblyCache::Lookup(StringRef in_filename, StringRef obj_filename)
+{
+    m_cache.AddOption(in_filename);
+    return m_cache.Lookup(in_filename, obj_filename);
+}
+
+void
+AssemblyCache::Store(Assembler& assembler,
+                     const Preprocessor& preproc,
+                     SourceManager& source_mgr,
+                     DiagnosticsEngine& diags)
+{
+    if (diags.hasErrorOccurred() || diags.getNumWarnings() != 0 ||
+        preproc.isEnvironmentDependent())
+        return;
+
+    std::vector<std::string> inputs = assembler.getObject()->getDataFiles();
+    for (SourceManager::fileinfo_iterator i=source_mgr.fileinfo_begin(),
+         end=source_mgr.fileinfo_end(); i != end; ++i)
+        inputs.push_back(i->first->getName());
+    m_cache.Store(assembler.getObjectFilename(), inputs);
+}
+
+bool
+AssemblyCache::PrintStats(StringRef dir, DiagnosticsEngine& diags)
+{
+    if (dir.empty())
+    {
+        diags.Report(diag::fatal_no_cache_dir);
+        return false;
+    }
+    ObjectCache cache(dir, 0);
+    ObjectCache::Stats stats;
+    cache.getStats(&stats);
+    llvm::outs() << "cache directory: " << dir << '\n'
+                 << "cache hits:      " << stats.hits << '\n'
+                 << "cache misses:    " << stats.misses << '\n'
+                 << "cached objects:  " << stats.num_objects << '\n'
+                 << "cache size:      "
+                 << llvm::format("%.1f", stats.size / (1024.0*1024.0))
+                 << " MB\n";
+    return true;
+}
@@ -35,6 +35,8 @@
 #include "yasmx/Bytes.h"
 #include "yasmx/Expr.h"
 #include "yasmx/IntNum.h"
+#include "yasmx/Object.h"
+#include "yasmx/Section.h"
 #include "yasmx/Value.h"
 
 
@@ -99,7 +101,9 @@ IncbinBytecode::~IncbinBytecode()
 bool
 IncbinBytecode::Finalize(Bytecode& bc, DiagnosticsEngine& diags)
 {
-    if (llvm::error_code err = MemoryBuffer::getFile(m_filename, m_buf))
+    // No terminator is needed, so the file can always be mapped.
+    if (llvm::error_code err =
+        MemoryBuffer::getFile(m_filename, m_buf, -1, false))
     {
         diags.Report(bc.getSource(), diag::err_file_read) << m_filename
             << err.message();
@@ -198,10 +202,9 @@ IncbinBytecode::Output(Bytecode& bc, BytecodeOutput& bc_out)
         start = m_start->getIntNum().getUInt();
     }
 
-    // Copy len bytes
-    Bytes& bytes = bc_out.getScratch();
-    bytes.WriteString(m_buf->getBuffer().substr(start, bc.getTailLen()));
-    bc_out.OutputBytes(bytes, bc.getSource());
+    // Output len bytes straight from the file buffer.
+    bc_out.OutputFileRange(m_buf->getBuffer().substr(start, bc.getTailLen()),
+                           m_filename, start, bc.getSource());
     return true;
 }
 
@@ -242,6 +245,12 @@ yasm::AppendIncbin(BytecodeContainer& container,
 {
     Bytecode& bc = container.FreshBytecode();
     bc.Transform(Bytecode::Contents::Ptr(
-        new IncbinBytecode(filename, start, maxlen)));
+        new (container.getArena()) IncbinBytecode(filename, start, maxlen)));
     bc.setSource(source);
+
+    if (Section* sect = container.getSection())
+    {
+        if (Object* object = sect->getObject())
+            object->AddDataFile(filename);
+    }
 }
@@ -41,17 +41,11 @@
 using namespace yasm;
 using llvm::APInt;
 
-/// Static bitvect used for conversions.
-static APInt conv_bv(IntNum::BITVECT_NATIVE_SIZE, 0);
-
-/// Static bitvects used for computation.
-static APInt result(IntNum::BITVECT_NATIVE_SIZE, 0);
-static APInt spare(IntNum::BITVECT_NATIVE_SIZE, 0);
-static APInt op1static(IntNum::BITVECT_NATIVE_SIZE, 0);
-static APInt op2static(IntNum::BITVECT_NATIVE_SIZE, 0);
-
-/// Static bitvect used for sign extension.
-static APInt signext_bv(IntNum::BITVECT_NATIVE_SIZE, 0);
+// Note: there are deliberately no static scratch bitvects in this file, as
+// IntNum arithmetic must be re-entrant.  Small values are computed without
+// touching APInt at all; bitvect scratch space for the (rare) big value
+// paths is owned by the caller, and is only sized (heap allocated) when a
+// small value actually has to be widened.
 
 enum
 {
@@ -91,24 +85,28 @@ yasm::isOkSize(const APInt& intn,
 void
 IntNum::setBV(const APInt& bv)
 {
+    // bv may be our own bitvector (see CalcImpl), so read it before freeing.
     if (bv.getMinSignedBits() <= SV_BITS)
     {
+        SmallValue sv = static_cast<SmallValue>(bv.getSExtValue());
         if (m_type == INTNUM_BV)
             delete m_val.bv;
         m_type = INTNUM_SV;
-        m_val.sv = static_cast<SmallValue>(bv.getSExtValue());
+        m_val.sv = sv;
         return;
     }
     else if (m_type == INTNUM_BV)
     {
-        *m_val.bv = bv;
+        if (&bv != m_val.bv)
+            *m_val.bv = bv;
     }
     else
     {
         m_type = INTNUM_BV;
         m_val.bv = new APInt(bv);
     }
-    *m_val.bv = m_val.bv->sextOrTrunc(BITVECT_NATIVE_SIZE);
+    if (m_val.bv->getBitWidth() != BITVECT_NATIVE_SIZE)
+        *m_val.bv = m_val.bv->sextOrTrunc(BITVECT_NATIVE_SIZE);
 }
 
 const APInt*
@@ -117,6 +115,8 @@ IntNum::getBV(APInt* bv) const
     if (m_type == INTNUM_BV)
         return m_val.bv;
 
+    if (bv->getBitWidth() != BITVECT_NATIVE_SIZE)
+        *bv = APInt(BITVECT_NATIVE_SIZE, 0);
     if (m_val.sv >= 0)
         *bv = static_cast<USmallValue>(m_val.sv);
     else
@@ -133,6 +133,8 @@ IntNum::getBV(APInt* bv)
     if (m_type == INTNUM_BV)
         return m_val.bv;
 
+    if (bv->getBitWidth() != BITVECT_NATIVE_SIZE)
+        *bv = APInt(BITVECT_NATIVE_SIZE, 0);
     if (m_val.sv >= 0)
         *bv = static_cast<USmallValue>(m_val.sv);
     else
@@ -203,18 +205,15 @@ IntNum::setStr(StringRef str, unsigned int radix)
     }
 
     // long case
-    conv_bv = 0;
+    APInt conv_bv(BITVECT_NATIVE_SIZE, 0);
 
     // Figure out if we can shift instead of multiply
     unsigned int shift =
         (radix == 16 ? 4 : radix == 8 ? 3 : radix == 2 ? 1 : 0);
 
-    APInt& radixval = op1static;
-    APInt& charval = op2static;
-    APInt& oldval = spare;
-
-    radixval = radix;
-    oldval = 0;
+    APInt radixval(BITVECT_NATIVE_SIZE, radix);
+    APInt charval(BITVECT_NATIVE_SIZE, 0);
+    APInt oldval(BITVECT_NATIVE_SIZE, 0);
 
     bool overflowed = false;
     for (StringRef::iterator i=begin, end=str.end(); i != end; ++i)
@@ -283,14 +282,16 @@ CalcSmallValue(bool* handled,
     switch (op)
     {
         case Op::ADD:
-            if (*lhs >= SV_MAX/2 || *lhs <= SV_MIN/2 ||
-                rhs >= SV_MAX/2 || rhs <= SV_MIN/2)
+            // exact overflow check
+            if ((rhs > 0 && *lhs > SV_MAX-rhs) ||
+                (rhs < 0 && *lhs < SV_MIN-rhs))
                 return true;
             *lhs += rhs;
             break;
         case Op::SUB:
-            if (*lhs >= SV_MAX/2 || *lhs <= SV_MIN/2 ||
-                rhs >= SV_MAX/2 || rhs <= SV_MIN/2)
+            // exact overflow check
+            if ((rhs < 0 && *lhs > SV_MAX+rhs) ||
+                (rhs > 0 && *lhs < SV_MIN+rhs))
                 return true;
             *lhs -= rhs;
             break;
@@ -299,15 +300,26 @@ CalcSmallValue(bool* handled,
             // half range
             IntNumData::SmallValue minmax = 1;
             minmax <<= SV_BITS/2;
-            if (*lhs > -minmax && *lhs < minmax)
+            if (*lhs > -minmax && *lhs < minmax &&
+                rhs > -minmax && rhs < minmax)
             {
-                if (rhs <= -minmax || rhs >= minmax)
-                    return true;
                 *lhs *= rhs;
                 break;
             }
-            // maybe someday?
-            return true;
+            // exact check for the general case
+            if (*lhs == 0 || rhs == 0)
+            {
+                *lhs = 0;
+                break;
+            }
+            if (*lhs == SV_MIN || rhs == SV_MIN)
+                return true;
+            IntNumData::SmallValue alhs = *lhs < 0 ? -*lhs : *lhs;
+            IntNumData::SmallValue arhs = rhs < 0 ? -rhs : rhs;
+            if (alhs > SV_MAX/arhs)
+                return true;
+            *lhs *= rhs;
+            break;
         }
         case Op::DIV:
             // TODO: make sure lhs and rhs are unsigned
@@ -318,6 +330,8 @@ CalcSmallValue(bool* handled,
                 diags->Report(source, diag::err_divide_by_zero);
                 return false;
             }
+            if (*lhs == SV_MIN && rhs == -1)
+                return true;    // overflows
             *lhs /= rhs;
             break;
         case Op::MOD:
@@ -329,6 +343,8 @@ CalcSmallValue(bool* handled,
                 diags->Report(source, diag::err_divide_by_zero);
                 return false;
             }
+            if (*lhs == SV_MIN && rhs == -1)
+                return true;    // overflows
             *lhs %= rhs;
             break;
         case Op::NEG:
@@ -353,10 +369,24 @@ CalcSmallValue(bool* handled,
             *lhs = ~(*lhs | rhs);
             break;
         case Op::SHL:
-            // maybe someday?
-            return true;
+        {
+            // only handle shifts that can't lose bits
+            if (rhs < 0 || rhs >= SV_BITS)
+                return true;
+            IntNumData::SmallValue limit = SV_MAX >> rhs;
+            if (*lhs > limit || *lhs < -limit-1)
+                return true;
+            *lhs = static_cast<IntNumData::SmallValue>(
+                static_cast<IntNumData::USmallValue>(*lhs) << rhs);
+            break;
+        }
         case Op::SHR:
-            *lhs >>= rhs;
+            if (rhs < 0)
+                return true;
+            if (rhs >= SV_BITS)
+                *lhs = (*lhs < 0) ? -1 : 0;
+            else
+                *lhs >>= rhs;
             break;
         case Op::LOR:
             *lhs = (*lhs || rhs);
@@ -423,31 +453,25 @@ IntNum::CalcImpl(Op::Op op,
             return true;
     }
 
-    // Always do computations with in full bit vector.
-    // Bit vector results must be calculated through intermediate storage.
-    const APInt* op1 = getBV(&op1static);
+    // Always do computations with in full bit vector.  The result is
+    // computed in place in op1, which is our own bitvector if we have one;
+    // the scratch bitvects are only sized (allocated) for small values.
+    APInt op1buf, op2buf;
+    APInt* op1 = getBV(&op1buf);
     const APInt* op2 = 0;
-    if (operand)
-        op2 = operand->getBV(&op2static);
+    if (operand && op != Op::SHL && op != Op::SHR)
+        op2 = operand->getBV(&op2buf);
 
-    // A operation does a bitvector computation if result is allocated.
     switch (op)
     {
         case Op::ADD:
-        {
-            result = *op1;
-            result += *op2;
+            *op1 += *op2;
             break;
-        }
         case Op::SUB:
-        {
-            result = *op1;
-            result -= *op2;
+            *op1 -= *op2;
             break;
-        }
         case Op::MUL:
-            result = *op1;
-            result *= *op2;
+            *op1 *= *op2;
             break;
         case Op::DIV:
             // TODO: make sure op1 and op2 are unsigned
@@ -457,7 +481,7 @@ IntNum::CalcImpl(Op::Op op,
                 diags->Report(source, diag::err_divide_by_zero);
                 return false;
             }
-            result = op1->udiv(*op2);
+            *op1 = op1->udiv(*op2);
             break;
         case Op::SIGNDIV:
             if (!*op2)
@@ -466,7 +490,7 @@ IntNum::CalcImpl(Op::Op op,
                 diags->Report(source, diag::err_divide_by_zero);
                 return false;
             }
-            result = op1->sdiv(*op2);
+            *op1 = op1->sdiv(*op2);
             break;
         case Op::MOD:
             // TODO: make sure op1 and op2 are unsigned
@@ -476,7 +500,7 @@ IntNum::CalcImpl(Op::Op op,
                 diags->Report(source, diag::err_divide_by_zero);
                 return false;
             }
-            result = op1->urem(*op2);
+            *op1 = op1->urem(*op2);
             break;
         case Op::SIGNMOD:
             if (!*op2)
@@ -485,58 +509,53 @@ IntNum::CalcImpl(Op::Op op,
                 diags->Report(source, diag::err_divide_by_zero);
                 return false;
             }
-            result = op1->srem(*op2);
+            *op1 = op1->srem(*op2);
             break;
         case Op::NEG:
-            result = -*op1;
+            op1->flipAllBits();
+            ++*op1;
             break;
         case Op::NOT:
-            result = *op1;
-            result.flipAllBits();
+            op1->flipAllBits();
             break;
         case Op::OR:
-            result = *op1;
-            result |= *op2;
+            *op1 |= *op2;
             break;
         case Op::AND:
-            result = *op1;
-            result &= *op2;
+            *op1 &= *op2;
             break;
         case Op::XOR:
-            result = *op1;
-            result ^= *op2;
+            *op1 ^= *op2;
             break;
         case Op::XNOR:
-            result = *op1;
-            result ^= *op2;
-            result.flipAllBits();
+            *op1 ^= *op2;
+            op1->flipAllBits();
             break;
         case Op::NOR:
-            result = *op1;
-            result |= *op2;
-            result.flipAllBits();
+            *op1 |= *op2;
+            op1->flipAllBits();
             break;
         case Op::SHL:
             if (operand->m_type == INTNUM_SV)
             {
                 if (operand->m_val.sv >= 0)
-                    result = op1->shl(operand->m_val.sv);
+                    *op1 = op1->shl(operand->m_val.sv);
                 else
-                    result = op1->ashr(-operand->m_val.sv);
+                    *op1 = op1->ashr(-operand->m_val.sv);
             }
             else    // don't even bother, just zero result
-                result.clearAllBits();
+                op1->clearAllBits();
             break;
         case Op::SHR:
             if (operand->m_type == INTNUM_SV)
             {
                 if (operand->m_val.sv >= 0)
-                    result = op1->ashr(operand->m_val.sv);
+                    *op1 = op1->ashr(operand->m_val.sv);
                 else
-                    result = op1->shl(-operand->m_val.sv);
+                    *op1 = op1->shl(-operand->m_val.sv);
             }
             else    // don't even bother, just zero result
-                result.clearAllBits();
+                op1->clearAllBits();
             break;
         case Op::LOR:
             set(static_cast<SmallValue>((!!*op1) || (!!*op2)));
@@ -587,7 +606,6 @@ IntNum::CalcImpl(Op::Op op,
             diags->Report(source, diag::err_invalid_op_use) << ":";
             return false;
         case Op::IDENT:
-            result = *op1;
             break;
         default:
             assert(diags && "invalid integer operation");
@@ -596,7 +614,7 @@ IntNum::CalcImpl(Op::Op op,
     }
 
     // Try to fit the result into long if possible
-    setBV(result);
+    setBV(*op1);
     return true;
 }
 /*@=nullderef =nullpass =branchstate@*/
@@ -604,10 +622,20 @@ IntNum::CalcImpl(Op::Op op,
 void
 IntNum::SignExtend(unsigned int size)
 {
-    // For now, always implement with full bit vector.
-    APInt* bv = getBV(&signext_bv);
-    *bv = bv->trunc(size).sext(BITVECT_NATIVE_SIZE);
-    setBV(*bv);
+    if (m_type == INTNUM_SV)
+    {
+        // Small values are already sign extended from SV_BITS+1 bits.
+        if (size > SV_BITS)
+            return;
+        unsigned int shift = SV_BITS+1-size;
+        m_val.sv = static_cast<SmallValue>(
+            static_cast<USmallValue>(m_val.sv) << shift) >> shift;
+        return;
+    }
+
+    // Work on a copy, as setBV() may free the current value.
+    APInt bv = m_val.bv->trunc(size).sext(BITVECT_NATIVE_SIZE);
+    setBV(bv);
 }
 
 void
@@ -748,7 +776,7 @@ IntNum::isOkSize(unsigned int size, unsigned int rshift, int rangetype) const
                 return false;
         }
     }
-    return yasm::isOkSize(*getBV(&conv_bv), size, rshift, rangetype);
+    return yasm::isOkSize(*m_val.bv, size, rshift, rangetype);
 }
 
 bool
@@ -808,11 +836,29 @@ yasm::Compare(const IntNum& lhs, const IntNum& rhs)
         return 0;
     }
 
-    const APInt* op1 = lhs.getBV(&op1static);
-    const APInt* op2 = rhs.getBV(&op2static);
-    if (op1->slt(*op2))
+    // Compare a small value against a bitvector without widening it.
+    if (lhs.m_type == IntNum::INTNUM_SV || rhs.m_type == IntNum::INTNUM_SV)
+    {
+        bool lhs_sv = (lhs.m_type == IntNum::INTNUM_SV);
+        IntNumData::SmallValue sv = lhs_sv ? lhs.m_val.sv : rhs.m_val.sv;
+        const APInt& bv = lhs_sv ? *rhs.m_val.bv : *lhs.m_val.bv;
+        int bvcmp;      // sign of (bv - sv)
+        if (bv.getMinSignedBits() >
+            static_cast<unsigned int>(
+                std::numeric_limits<IntNumData::SmallValue>::digits+1))
+            bvcmp = bv.isNegative() ? -1 : 1;
+        else
+        {
+            IntNumData::SmallValue bvval =
+                static_cast<IntNumData::SmallValue>(bv.getSExtValue());
+            bvcmp = (bvval < sv) ? -1 : (bvval > sv) ? 1 : 0;
+        }
+        return lhs_sv ? -bvcmp : bvcmp;
+    }
+
+    if (lhs.m_val.bv->slt(*rhs.m_val.bv))
         return -1;
-    if (op1->sgt(*op2))
+    if (lhs.m_val.bv->sgt(*rhs.m_val.bv))
         return 1;
     return 0;
 }
@@ -823,9 +869,9 @@ yasm::operator==(const IntNum& lhs, const IntNum& rhs)
     if (lhs.m_type == IntNum::INTNUM_SV && rhs.m_type == IntNum::INTNUM_SV)
         return lhs.m_val.sv == rhs.m_val.sv;
 
-    const APInt* op1 = lhs.getBV(&op1static);
-    const APInt* op2 = rhs.getBV(&op2static);
-    return op1->eq(*op2);
+    if (lhs.m_type == IntNum::INTNUM_BV && rhs.m_type == IntNum::INTNUM_BV)
+        return lhs.m_val.bv->eq(*rhs.m_val.bv);
+    return Compare(lhs, rhs) == 0;
 }
 
 bool
@@ -834,9 +880,7 @@ yasm::operator<(const IntNum& lhs, const IntNum& rhs)
     if (lhs.m_type == IntNum::INTNUM_SV && rhs.m_type == IntNum::INTNUM_SV)
         return lhs.m_val.sv < rhs.m_val.sv;
 
-    const APInt* op1 = lhs.getBV(&op1static);
-    const APInt* op2 = rhs.getBV(&op2static);
-    return op1->slt(*op2);
+    return Compare(lhs, rhs) < 0;
 }
 
 bool
@@ -845,9 +889,7 @@ yasm::operator>(const IntNum& lhs, const IntNum& rhs)
     if (lhs.m_type == IntNum::INTNUM_SV && rhs.m_type == IntNum::INTNUM_SV)
         return lhs.m_val.sv > rhs.m_val.sv;
 
-    const APInt* op1 = lhs.getBV(&op1static);
-    const APInt* op2 = rhs.getBV(&op2static);
-    return op1->sgt(*op2);
+    return Compare(lhs, rhs) > 0;
 }
 
 void
@@ -879,14 +921,19 @@ IntNum::getStr(SmallVectorImpl<char>& str, int base, bool lowercase) const
                 fmt = "%lX";
             break;
         default:
-            // fall back to bigval
-            getBV(&conv_bv)->toString(str, static_cast<unsigned>(base), true,
-                                      false, lowercase);
+        {
+            // fall back to APInt, sized to stay in a single word
+            // (the sign is already out, so print the magnitude)
+            APInt(std::numeric_limits<USmallValue>::digits,
+                  static_cast<USmallValue>(v))
+                .toString(str, static_cast<unsigned>(base), false, false,
+                          lowercase);
             return;
+        }
     }
 
     char s[40];
-    std::sprintf(s, fmt, m_val.sv);
+    std::sprintf(s, fmt, v);
     str.append(s, s+std::strlen(s));
 }
 
@@ -936,20 +983,29 @@ IntNum::Print(raw_ostream& os,
               bool showbase,
               int bits) const
 {
-    const APInt* bv = getBV(&conv_bv);
-
-    if (bv->isNegative())
+    SmallString<40> s;
+    if (m_type == INTNUM_SV)
     {
-        // negate in place
-        conv_bv = *bv;
-        conv_bv.flipAllBits();
-        ++conv_bv;
-        bv = &conv_bv;
+        // The magnitude fits in a single word, which APInt keeps inline.
+        USmallValue mag = static_cast<USmallValue>(m_val.sv);
+        if (m_val.sv < 0)
+        {
+            mag = ~mag + 1;
+            os << '-';
+        }
+        APInt(std::numeric_limits<USmallValue>::digits, mag)
+            .toString(s, base, false, false, lowercase);
+    }
+    else if (m_val.bv->isNegative())
+    {
+        APInt mag(*m_val.bv);
+        mag.flipAllBits();
+        ++mag;
         os << '-';
+        mag.toString(s, base, false, false, lowercase);
     }
-
-    SmallString<40> s;
-    bv->toString(s, base, true, false, lowercase);
+    else
+        m_val.bv->toString(s, base, true, false, lowercase);
 
     // prefix and 0 padding, if required
     int padding = 0;
@@ -255,6 +255,7 @@ yasm::AppendLEB128(BytecodeContainer& container,
 
     // More complex; append LEB128 bytecode.
     Bytecode& bc = container.FreshBytecode();
-    bc.Transform(Bytecode::Contents::Ptr(new LEB128Bytecode(expr, sign)));
+    bc.Transform(Bytecode::Contents::Ptr(
+        new (container.getArena()) LEB128Bytecode(expr, sign)));
     bc.setSource(source);
 }
@@ -26,6 +26,9 @@
 ///
 #include "yasmx/BytecodeContainer.h"
 
+#include <algorithm>
+#include <vector>
+
 #define DEBUG_TYPE "MultipleBytecode"
 
 #include "llvm/ADT/Statistic.h"
@@ -40,6 +43,8 @@
 STATISTIC(num_multiple, "Number of multiple bytecodes");
 STATISTIC(num_skip, "Number of skip bytecodes");
 STATISTIC(num_fill, "Number of fill bytecodes");
+STATISTIC(num_replicated, "Number of multiple bytecodes output by replication");
+STATISTIC(num_iterated, "Number of multiple bytecodes output per iteration");
 
 using namespace yasm;
 
@@ -419,25 +424,202 @@ MultipleBytecode::Expand(Bytecode& bc,
     return true;
 }
 
+/// Size of the block built up by OutputReplicated() to output copies of
+/// short contents with fewer, larger writes.
+static const Bytes::size_type REPLICATE_BLOCK_SIZE = 64*1024;
+
+/// Output count copies of bytes.  Bytes is used as a work area and its
+/// contents are clobbered.
+static void
+OutputReplicated(BytecodeOutput& bc_out,
+                 Bytes& bytes,
+                 unsigned long count,
+                 SourceLocation source)
+{
+    Bytes::size_type unit = bytes.size();
+    if (unit == 0 || count == 0)
+        return;
+
+    // Double up the contents until the block is large enough.
+    unsigned long per_block = 1;
+    while (per_block*2 <= count && bytes.size()*2 <= REPLICATE_BLOCK_SIZE)
+    {
+        Bytes::size_type size = bytes.size();
+        bytes.resize(size*2);
+        std::copy(bytes.begin(), bytes.begin() + size, bytes.begin() + size);
+        per_block *= 2;
+    }
+
+    for (; count >= per_block; count -= per_block)
+        bc_out.OutputBytes(bytes, source);
+    if (count > 0)
+    {
+        bytes.resize(count*unit);
+        bc_out.OutputBytes(bytes, source);
+    }
+}
+
+namespace {
+/// Renders one iteration of multiple contents into a buffer.  Values that
+/// do not depend on position (no relocation, WRT, segment or section
+/// relative part) are converted by the real output; anything else stops
+/// the render, as the contents must then be output one iteration at a
+/// time to get a relocation for each copy.
+class RenderOutput : public BytecodeOutput
+{
+public:
+    RenderOutput(BytecodeOutput& real)
+        : BytecodeOutput(real.getDiagnostics())
+        , m_real(real)
+        , m_pos_dependent(false)
+        , m_gap(false)
+    {}
+    ~RenderOutput();
+
+    bool isBits() const;
+
+    bool ConvertValueToBytes(Value& value,
+                             Location loc,
+                             NumericOutput& num_out);
+    bool ConvertSymbolToBytes(SymbolRef sym,
+                              Location loc,
+                              NumericOutput& num_out);
+
+    /// Get the bytes rendered.
+    Bytes& getBytes() { return m_bytes; }
+
+    /// Did rendering stop due to a position-dependent value?
+    bool isPositionDependent() const { return m_pos_dependent; }
+
+    /// Was any gap output?
+    bool hasGap() const { return m_gap; }
+
+    /// Were any bytes output?
+    bool hasData() const { return !m_bytes.empty(); }
+
+protected:
+    void DoOutputGap(unsigned long size, SourceLocation source);
+    void DoOutputBytes(const Bytes& bytes, SourceLocation source);
+
+private:
+    BytecodeOutput& m_real;
+    Bytes m_bytes;
+    bool m_pos_dependent;
+    bool m_gap;
+};
+} // anonymous namespace
+
+RenderOutput::~RenderOutput()
+{
+}
+
+bool
+RenderOutput::isBits() const
+{
+    return m_real.isBits();
+}
+
+bool
+RenderOutput::ConvertValueToBytes(Value& value,
+                                  Location loc,
+                                  NumericOutput& num_out)
+{
+    if (value.isRelative() || value.hasSubRelative() || value.isWRT() ||
+        value.isSegOf() || value.isSectionRelative())
+    {
+        m_pos_dependent = true;
+        return false;
+    }
+    return m_real.ConvertValueToBytes(value, loc, num_out);
+}
+
+bool
+RenderOutput::ConvertSymbolToBytes(SymbolRef sym,
+                                   Location loc,
+                                   NumericOutput& num_out)
+{
+    m_pos_dependent = true;
+    return false;
+}
+
+void
+RenderOutput::DoOutputGap(unsigned long size, SourceLocation source)
+{
+    m_gap = true;
+}
+
+void
+RenderOutput::DoOutputBytes(const Bytes& bytes, SourceLocation source)
+{
+    m_bytes.insert(m_bytes.end(), bytes.begin(), bytes.end());
+}
+
 bool
 MultipleBytecode::Output(Bytecode& bc, BytecodeOutput& bc_out)
 {
     if (!m_multiple.CalcForOutput(bc.getSource(), bc_out.getDiagnostics()))
         return false;
 
-    unsigned long total_len = 0;
-    unsigned long pos = 0;
-    for (long mult=0, multend=m_multiple.getInt(); mult<multend;
-         mult++, pos += total_len)
+    unsigned long count = static_cast<unsigned long>(m_multiple.getInt());
+    if (count == 0)
+        return true;
+
+    // Every iteration outputs the same inner bytecodes, so unless a value
+    // needs a relocation, each produces the same bytes; render those once.
+    RenderOutput render(bc_out);
+    bool rendered = true;
+    for (BytecodeContainer::bc_iterator i = m_contents->bytecodes_begin(),
+         end = m_contents->bytecodes_end(); i != end && rendered; ++i)
+        rendered = i->Output(render);
+
+    if (rendered)
+    {
+        if (!render.hasData() && !bc_out.isBits())
+        {
+            // All gap in a section without bits (e.g. bss).
+            ++num_replicated;
+            bc_out.OutputGap(render.getNumOutput() * count, bc.getSource());
+            return true;
+        }
+        if (!render.hasGap())
+        {
+            ++num_replicated;
+            OutputReplicated(bc_out, render.getBytes(), count,
+                             bc.getSource());
+            return true;
+        }
+    }
+    else if (!render.isPositionDependent())
+        return false;
+
+    // Output each iteration in full, so each copy gets its own relocations
+    // and gap diagnostics.  The inner bytecodes are moved to each copy's
+    // position first so relocations and PC-relative values are correct,
+    // and moved back afterwards.
+    ++num_iterated;
+    std::vector<unsigned long> orig_offsets;
+    for (BytecodeContainer::bc_iterator i = m_contents->bytecodes_begin(),
+         end = m_contents->bytecodes_end(); i != end; ++i)
+        orig_offsets.push_back(i->getOffset());
+
+    bool ok = true;
+    unsigned long offset = bc.getTailOffset();
+    for (unsigned long mult=0; mult<count && ok; ++mult)
     {
         for (BytecodeContainer::bc_iterator i = m_contents->bytecodes_begin(),
-             end = m_contents->bytecodes_end(); i != end; ++i)
+             end = m_contents->bytecodes_end(); i != end && ok; ++i)
         {
-            if (!i->Output(bc_out))
-                return false;
+            i->setOffset(offset);
+            ok = i->Output(bc_out);
+            offset += i->getTotalLen();
         }
     }
-    return true;
+
+    std::vector<unsigned long>::const_iterator orig = orig_offsets.begin();
+    for (BytecodeContainer::bc_iterator i = m_contents->bytecodes_begin(),
+         end = m_contents->bytecodes_end(); i != end; ++i, ++orig)
+        i->setOffset(*orig);
+    return ok;
 }
 
 StringRef
@@ -546,8 +728,10 @@ FillBytecode::Output(Bytecode& bc, BytecodeOutput& bc_out)
         return true;
     }
 
+    unsigned long size = m_value.getSize()/8;
+    unsigned long count = static_cast<unsigned long>(m_multiple.getInt());
     Bytes& bytes = bc_out.getScratch();
-    bytes.resize(m_value.getSize()/8);
+    bytes.resize(size);
 
     NumericOutput num_out(bytes);
     m_value.ConfigureOutput(&num_out);
@@ -558,9 +742,22 @@ FillBytecode::Output(Bytecode& bc, BytecodeOutput& bc_out)
     num_out.EmitWarnings(bc_out.getDiagnostics());
     num_out.ClearWarnings();
 
-    for (long mult=0, multend=m_multiple.getInt(); mult<multend; mult++)
-        bc_out.OutputBytes(bytes, source);
+    if (!m_value.isRelative() && !m_value.hasSubRelative())
+    {
+        OutputReplicated(bc_out, bytes, count, source);
+        return true;
+    }
 
+    // Each copy of a relocated value needs its own relocation.
+    bc_out.OutputBytes(bytes, source);
+    for (unsigned long mult=1; mult<count; ++mult)
+    {
+        loc.off = mult*size;
+        if (!bc_out.ConvertValueToBytes(m_value, loc, num_out))
+            return false;
+        num_out.ClearWarnings();
+        bc_out.OutputBytes(bytes, source);
+    }
     return true;
 }
 
@@ -597,7 +794,8 @@ yasm::AppendMultiple(BytecodeContainer& container,
 {
     ++num_multiple;
     Bytecode& bc = container.FreshBytecode();
-    MultipleBytecode* multbc(new MultipleBytecode(contents, multiple));
+    MultipleBytecode* multbc(
+        new (container.getArena()) MultipleBytecode(contents, multiple));
     bc.Transform(Bytecode::Contents::Ptr(multbc));
     bc.setSource(source);
 }
@@ -610,7 +808,8 @@ yasm::AppendSkip(BytecodeContainer& container,
 {
     ++num_skip;
     Bytecode& bc = container.FreshBytecode();
-    FillBytecode* fillbc(new FillBytecode(multiple, size));
+    FillBytecode* fillbc(
+        new (container.getArena()) FillBytecode(multiple, size));
     bc.Transform(Bytecode::Contents::Ptr(fillbc));
     bc.setSource(source);
 }
@@ -656,7 +855,8 @@ yasm::AppendFill(BytecodeContainer& container,
     // general case
     ++num_fill;
     Bytecode& bc = container.FreshBytecode();
-    FillBytecode* fillbc(new FillBytecode(multiple, size, value, source));
+    FillBytecode* fillbc(new (container.getArena())
+        FillBytecode(multiple, size, value, source));
     bc.Transform(Bytecode::Contents::Ptr(fillbc));
     bc.setSource(source);
 }
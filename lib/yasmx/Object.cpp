@@ -28,22 +28,31 @@
 
 #include "yasmx/Object.h"
 
+#include <map>
 #include <memory>
+#include <vector>
 
 #include <boost/pool/object_pool.hpp>
 
 #include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/Twine.h"
+#include "llvm/Support/Mutex.h"
 #include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/Basic/DiagnosticBuffer.h"
 #include "yasmx/Config/functional.h"
+#include "yasmx/Support/Arena.h"
+#include "yasmx/Support/ptr_vector.h"
+#include "yasmx/Support/scoped_ptr.h"
+#include "yasmx/Support/ThreadPool.h"
 #include "yasmx/Arch.h"
 #include "yasmx/Bytecode.h"
 #include "yasmx/Optimizer.h"
+#include "yasmx/Profile.h"
 #include "yasmx/Section.h"
 #include "yasmx/Symbol.h"
 
-#include "hamt.h"
+#include "ohash.h"
 
 
 STATISTIC(num_exist_symbol, "Number of existing symbols found by name");
@@ -52,7 +61,7 @@ STATISTIC(num_new_symbol, "Number of symbols created by name");
 using namespace yasm;
 
 namespace {
-/// Get name helper for symbol table HAMT.
+/// Get name helper for symbol table.
 class SymGetName
 {
 public:
@@ -81,7 +90,7 @@ public:
         m_sym_pool.destroy(sym);
     }
 
-    typedef hamt<StringRef, Symbol, SymGetName> SymbolTable;
+    typedef ohash<StringRef, Symbol, SymGetName> SymbolTable;
 
     /// Symbol table symbols, indexed by name.
     SymbolTable sym_map;
@@ -92,6 +101,11 @@ public:
     /// Sections, indexed by name.
     llvm::StringMap<Section*> section_map;
 
+    /// Code fill blocks, indexed by code fill table.
+    std::map<const unsigned char**, std::vector<unsigned char> >
+        code_fill_blocks;
+    llvm::sys::Mutex code_fill_lock;    ///< Lock for code_fill_blocks
+
 private:
     /// Pool for symbols not in the symbol table.
     boost::object_pool<Symbol> m_sym_pool;
@@ -100,14 +114,17 @@ private:
 
 Object::Object(StringRef src_filename, StringRef obj_filename, Arch* arch)
     : m_src_filename(src_filename),
+      m_obj_filename(obj_filename),
       m_arch(arch),
       m_cur_section(0),
+      m_arena(new Arena),
       m_sections_owner(m_sections),
       m_symbols_owner(m_symbols),
       m_impl(new Impl(false))
 {
     m_options.DisableGlobalSubRelative = false;
     m_options.PowerOfTwoAlignment = false;
+    m_options.RelaxOptimizer = false;
     m_config.ExecStack = false;
     m_config.NoExecStack = false;
 }
@@ -128,6 +145,27 @@ Object::~Object()
 {
 }
 
+const std::vector<unsigned char>&
+Object::getCodeFillBlock(const unsigned char** code_fill)
+{
+    llvm::sys::ScopedLock lock(m_impl->code_fill_lock);
+    std::vector<unsigned char>& block = m_impl->code_fill_blocks[code_fill];
+    if (!block.empty())
+        return block;
+
+    unsigned long maxlen = 15;
+    while (!code_fill[maxlen] && maxlen>0)
+        maxlen--;
+    if (maxlen != 0)
+    {
+        const unsigned char* pattern = code_fill[maxlen];
+        block.reserve(4096);
+        for (unsigned long n=4096/maxlen; n>0; --n)
+            block.insert(block.end(), pattern, pattern + maxlen);
+    }
+    return block;
+}
+
 void
 Object::Finalize(DiagnosticsEngine& diags)
 {
@@ -174,23 +212,24 @@ Object::FindSymbol(StringRef name)
 SymbolRef
 Object::getSymbol(StringRef name)
 {
+    // Most lookups are of existing symbols; only create a symbol if the
+    // lookup fails.
+    if (Symbol* sym = m_impl->sym_map.Find(name))
+    {
+        ++num_exist_symbol;
+        return SymbolRef(sym);
+    }
+
     // Don't use pool allocator for symbols in the symbol table.
     // We have to maintain an ordered link list of all symbols in the symbol
     // table, so it's easy enough to reuse that for deleting the symbols.
     // The memory impact of keeping a second linked list (internal to the pool)
     // seems to outweigh the moderate time savings of pool deletion.
-    std::auto_ptr<Symbol> sym(new Symbol(name));
-    Symbol* sym2 = m_impl->sym_map.Insert(sym.get());
-    if (sym2)
-    {
-        ++num_exist_symbol;
-        return SymbolRef(sym2);
-    }
-
     ++num_new_symbol;
-    sym2 = sym.get();
-    m_symbols.push_back(sym.release());
-    return SymbolRef(sym2);
+    Symbol* sym = new Symbol(name);
+    m_symbols.push_back(sym);
+    m_impl->sym_map.Insert(sym);
+    return SymbolRef(sym);
 }
 
 SymbolRef
@@ -308,13 +347,217 @@ Object::UpdateBytecodeOffsets(DiagnosticsEngine& diags)
         sect->UpdateOffsets(diags);
 }
 
+namespace {
+/// A group of sections optimized independently of all other sections.
+/// Diagnostics are buffered so that partitions may be optimized
+/// concurrently; they are replayed in section order after each step.
+class OptimizePartition
+{
+public:
+    OptimizePartition(DiagnosticsEngine& diags,
+                      Optimizer::Algorithm algorithm,
+                      Profile* profile)
+        : m_diags(m_diag_buffer.CreateEngine(diags))
+        , m_opt(new Optimizer(*m_diags, algorithm, profile))
+        , m_active(true)
+    {}
+
+    void CreateTerms() { m_opt->CreateTerms(); }
+    void Step1b() { m_opt->Step1b(); }
+    void Step1d() { m_active = !m_opt->Step1d(); }
+    void Step1e() { m_opt->Step1e(); }
+    void Step2() { m_opt->Step2(); }
+    void UpdateOffsets()
+    {
+        for (std::vector<Section*>::iterator sect=m_sections.begin(),
+             end=m_sections.end(); sect != end; ++sect)
+            (*sect)->UpdateOffsets(*m_diags);
+    }
+
+    DiagnosticBuffer m_diag_buffer;
+    util::scoped_ptr<DiagnosticsEngine> m_diags;
+    util::scoped_ptr<Optimizer> m_opt;
+    std::vector<Section*> m_sections;
+
+    /// False once merged into another partition, or once no further
+    /// optimization steps are needed.
+    bool m_active;
+};
+} // anonymous namespace
+
+/// Run an optimization step on all active partitions in parallel.
+/// @return False if an error occurred.
+static bool
+RunOptimizeStep(ThreadPool& pool,
+                stdx::ptr_vector<OptimizePartition>& parts,
+                void (OptimizePartition::*step)(),
+                DiagnosticsEngine& diags,
+                Profile* profile,
+                const char* name)
+{
+    ProfileRegion region(profile, name);
+    for (stdx::ptr_vector<OptimizePartition>::iterator part=parts.begin(),
+         end=parts.end(); part != end; ++part)
+    {
+        if (part->m_active)
+            pool.Async(TR1::bind(step, &*part));
+    }
+    pool.Wait();
+
+    for (stdx::ptr_vector<OptimizePartition>::iterator part=parts.begin(),
+         end=parts.end(); part != end; ++part)
+        part->m_diag_buffer.Replay(diags);
+    return !diags.hasErrorOccurred();
+}
+
+/// Find the representative (lowest numbered) section of a partition.
+static size_t
+FindPartition(std::vector<size_t>& parent, size_t i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void
+Object::OptimizeParallel(DiagnosticsEngine& diags,
+                         ThreadPool& pool,
+                         Profile* profile)
+{
+    stdx::ptr_vector<OptimizePartition> parts;
+    stdx::ptr_vector_owner<OptimizePartition> parts_owner(parts);
+    std::map<Section*, size_t> sect_num;
+    unsigned long bc_index = 0;
+    Optimizer::Algorithm algorithm =
+        m_options.RelaxOptimizer ? Optimizer::RELAX : Optimizer::ROBERTSON;
+
+    // Step 1a; each section starts out as its own partition.  Indexes are
+    // numbered across all sections, as in the serial case.
+    if (profile)
+        profile->StartPhase("Step 1a");
+    for (section_iterator sect=m_sections.begin(), sectend=m_sections.end();
+         sect != sectend; ++sect)
+    {
+        sect_num[&*sect] = parts.size();
+        parts.push_back(new OptimizePartition(diags, algorithm, profile));
+        parts.back().m_sections.push_back(&*sect);
+        Optimizer& opt = *parts.back().m_opt;
+        unsigned long offset = 0;
+
+        // Set the offset of the first (empty) bytecode.
+        sect->bytecodes_front().setIndex(bc_index++);
+        sect->bytecodes_front().setOffset(0);
+
+        // Iterate through the remainder, if any.
+        for (Section::bc_iterator bc=sect->bytecodes_begin(),
+             bcend=sect->bytecodes_end(); bc != bcend; ++bc)
+        {
+            bc->setIndex(bc_index++);
+            bc->setOffset(offset);
+
+            if (bc->CalcLen(TR1::bind(&Optimizer::AddSpan, &opt,
+                                      _1, _2, _3, _4, _5),
+                            diags))
+            {
+                if (bc->getSpecial() == Bytecode::Contents::SPECIAL_OFFSET)
+                    opt.AddOffsetSetter(*bc);
+
+                offset = bc->getNextOffset();
+            }
+        }
+    }
+    if (profile)
+        profile->StopPhase();
+
+    if (diags.hasErrorOccurred())
+        return;
+
+    // Create span terms to determine which sections depend on each other.
+    // Errors are not fatal until the end of Step 1b.
+    RunOptimizeStep(pool, parts, &OptimizePartition::CreateTerms, diags,
+                    profile, "Step 1b");
+
+    // Join sections referenced by spans in other sections into a single
+    // partition.  Partitions are merged in section order so the spans of
+    // each partition stay in the same order as in the serial case.
+    std::vector<size_t> parent(parts.size());
+    for (size_t i=0; i<parts.size(); ++i)
+        parent[i] = i;
+    for (size_t i=0; i<parts.size(); ++i)
+    {
+        std::vector<Section*> refs;
+        parts[i].m_opt->getReferencedSections(refs);
+        for (std::vector<Section*>::iterator ref=refs.begin(),
+             end=refs.end(); ref != end; ++ref)
+        {
+            size_t a = FindPartition(parent, i);
+            size_t b = FindPartition(parent, sect_num[*ref]);
+            if (a < b)
+                parent[b] = a;
+            else
+                parent[a] = b;
+        }
+    }
+    for (size_t i=0; i<parts.size(); ++i)
+    {
+        size_t root = FindPartition(parent, i);
+        if (root == i)
+            continue;
+        parts[root].m_opt->Merge(*parts[i].m_opt);
+        parts[root].m_sections.push_back(parts[i].m_sections.front());
+        parts[i].m_active = false;
+    }
+
+    // Step 1b
+    if (!RunOptimizeStep(pool, parts, &OptimizePartition::Step1b, diags,
+                         profile, "Step 1b"))
+        return;
+
+    // Step 1c
+    if (!RunOptimizeStep(pool, parts, &OptimizePartition::UpdateOffsets,
+                         diags, profile, "UpdateBytecodeOffsets"))
+        return;
+
+    // Step 1d; partitions that don't need step 2 are done.
+    if (!RunOptimizeStep(pool, parts, &OptimizePartition::Step1d, diags,
+                         profile, "Step 1d"))
+        return;
+
+    // Step 1e
+    if (!RunOptimizeStep(pool, parts, &OptimizePartition::Step1e, diags,
+                         profile, "Step 1e"))
+        return;
+
+    // Step 2
+    if (!RunOptimizeStep(pool, parts, &OptimizePartition::Step2, diags,
+                         profile, "Step 2"))
+        return;
+
+    // Step 3
+    RunOptimizeStep(pool, parts, &OptimizePartition::UpdateOffsets, diags,
+                    profile, "UpdateBytecodeOffsets");
+}
+
 void
-Object::Optimize(DiagnosticsEngine& diags)
+Object::Optimize(DiagnosticsEngine& diags, ThreadPool* pool, Profile* profile)
 {
-    Optimizer opt(diags);
+    if (pool && pool->getNumThreads() > 0 && m_sections.size() > 1)
+    {
+        OptimizeParallel(diags, *pool, profile);
+        return;
+    }
+
+    Optimizer opt(diags, m_options.RelaxOptimizer ? Optimizer::RELAX
+                                                  : Optimizer::ROBERTSON,
+                  profile);
     unsigned long bc_index = 0;
 
     // Step 1a
+    if (profile)
+        profile->StartPhase("Step 1a");
     for (section_iterator sect=m_sections.begin(), sectend=m_sections.end();
          sect != sectend; ++sect)
     {
@@ -342,34 +585,52 @@ Object::Optimize(DiagnosticsEngine& diags)
             }
         }
     }
+    if (profile)
+        profile->StopPhase();
 
     if (diags.hasErrorOccurred())
         return;
 
     // Step 1b
-    opt.Step1b();
+    {
+        ProfileRegion region(profile, "Step 1b");
+        opt.Step1b();
+    }
     if (diags.hasErrorOccurred())
         return;
 
     // Step 1c
-    UpdateBytecodeOffsets(diags);
+    {
+        ProfileRegion region(profile, "UpdateBytecodeOffsets");
+        UpdateBytecodeOffsets(diags);
+    }
     if (diags.hasErrorOccurred())
         return;
 
     // Step 1d
-    if (opt.Step1d())
-        return;
+    {
+        ProfileRegion region(profile, "Step 1d");
+        if (opt.Step1d())
+            return;
+    }
 
     // Step 1e
-    opt.Step1e();
+    {
+        ProfileRegion region(profile, "Step 1e");
+        opt.Step1e();
+    }
     if (diags.hasErrorOccurred())
         return;
 
     // Step 2
-    opt.Step2();
+    {
+        ProfileRegion region(profile, "Step 2");
+        opt.Step2();
+    }
     if (diags.hasErrorOccurred())
         return;
 
     // Step 3
+    ProfileRegion region(profile, "UpdateBytecodeOffsets");
     UpdateBytecodeOffsets(diags);
 }
@@ -45,10 +45,12 @@
 #include "yasmx/Config/functional.h"
 #include "yasmx/Support/IntervalTree.h"
 #include "yasmx/Bytecode.h"
+#include "yasmx/BytecodeContainer.h"
 #include "yasmx/DebugDumper.h"
 #include "yasmx/Expr.h"
 #include "yasmx/IntNum.h"
 #include "yasmx/Location_util.h"
+#include "yasmx/Profile.h"
 #include "yasmx/Section.h"
 #include "yasmx/Value.h"
 
@@ -61,6 +63,10 @@ STATISTIC(num_offset_setters, "Number of offset setters");
 STATISTIC(num_recalc, "Number of span recalculations performed");
 STATISTIC(num_expansions, "Number of expansions performed");
 STATISTIC(num_initial_qb, "Number of spans on initial QB");
+STATISTIC(num_relax_rechecks, "Number of spans rechecked by relaxation");
+STATISTIC(num_len_deltas, "Number of length changes added to offset deltas");
+STATISTIC(num_relax_fallbacks,
+          "Number of partitions not optimized by relaxation");
 
 using namespace yasm;
 
@@ -162,6 +168,34 @@ using namespace yasm;
 //       change), add it to tail of Q.
 // 3. Final pass over bytecodes to generate final offsets.
 //
+// Relaxation variant (Optimizer::RELAX):
+//
+// With many spans, maintaining the interval tree and updating every term
+// crossing each expanded bytecode dominates step 2.  The relaxation
+// variant instead:
+//  - keeps the length changes of step 2 (including those of offset
+//    setters) as per-bytecode deltas in a Fenwick (binary indexed) tree,
+//    so the current value of any span term is its step 1d value plus a
+//    range sum;
+//  - indexes the span terms by the bytecode range they cover in a static
+//    array-based segment tree built once in step 1e;
+//  - on a length change, only marks the spans with a term covering the
+//    changed bytecode for recheck (a worklist), and after each expansion
+//    re-evaluates just those spans, adding the ones that exceed their
+//    thresholds to Q.
+// Each expansion thus costs time proportional to the spans it can affect,
+// and a span is evaluated at most once per expansion however many of its
+// terms changed.
+//
+// If no bytecode inside a span term can shrink, and each span value moves
+// in one direction as its terms grow, both variants reach the same
+// (minimal) solution regardless of the order in which spans are expanded.
+// Otherwise (e.g. an offset setter or TIMES inside a span term, which may
+// absorb an expansion), the result may depend on the order in which spans
+// are queued, which differs between the variants; such partitions are
+// optimized with the interval tree even when relaxation is selected, so
+// the output is always the same.
+//
 namespace {
 class OffsetSetter
 {
@@ -221,11 +255,20 @@ public:
         pugi::xml_node Write(pugi::xml_node out) const;
 #endif // WITH_XML
 
+        /// Get the range of bytecode indexes whose length changes affect
+        /// the term value.
+        /// @param low      lowest bytecode index (output)
+        /// @param high     highest bytecode index (output)
+        /// @return 1 if length changes increase the term value, -1 if
+        ///         they decrease it, 0 if the term is always 0.
+        int getRange(long* low, long* high) const;
+
         Location m_loc;
         Location m_loc2;
         Span* m_span;       // span this term is a member of
         long m_cur_val;
         long m_new_val;
+        long m_base_val;    // value at step 1d (relaxation only)
         unsigned int m_subst;
     };
 
@@ -271,6 +314,9 @@ private:
 
     enum { INACTIVE = 0, ACTIVE, ON_Q } m_active;
 
+    // On the relaxation recheck list.
+    bool m_recheck;
+
     // Spans that led to this span.  Used only for
     // checking for circular references (cycles) with id=0 spans.
     typedef llvm::SmallPtrSet<Span*, 4> BacktraceSpans;
@@ -278,6 +324,10 @@ private:
 
     // Index of first offset setter following this span's bytecode
     size_t m_os_index;
+
+    // Work done for this span, for profiling.
+    unsigned long m_num_recalc;
+    unsigned long m_num_expand;
 };
 } // anonymous namespace
 
@@ -285,9 +335,14 @@ namespace yasm {
 class Optimizer::Impl
 {
 public:
-    Impl(DiagnosticsEngine& diags);
+    Impl(DiagnosticsEngine& diags,
+         Optimizer::Algorithm algorithm,
+         Profile* profile);
     ~Impl();
 
+    void CreateTerms();
+    void getReferencedSections(std::vector<Section*>& sections) const;
+    void Merge(Impl& src);
     void Step1b();
     bool Step1d();
     void Step1e();
@@ -300,9 +355,21 @@ public:
     void ITreeAdd(Span& span, Span::Term& term);
     void CheckCycle(IntervalTreeNode<Span::Term*> * node,
                     Span& span);
+    void CheckTermCycle(Span::Term* term, Span& span);
     void ExpandTerm(IntervalTreeNode<Span::Term*> * node, long len_diff);
+    void ExpandQueued();
+    void LengthChanged(const Bytecode& bc, long len_diff);
+
+    bool isOrderIndependent() const;
+    void BuildTermIndex();
+    void AddDelta(long index, long delta);
+    long SumDeltas(long index) const;
+    bool UpdateTerms(Span& span);
+    void Recheck();
 
     DiagnosticsEngine& m_diags;
+    Optimizer::Algorithm m_algorithm;
+    Profile* m_profile;
 
     typedef std::list<Span*> Spans;
     Spans m_spans;      // ownership list
@@ -312,6 +379,28 @@ public:
 
     IntervalTree<Span::Term*> m_itree;
     std::vector<OffsetSetter> m_offset_setters;
+
+    bool m_terms_created;
+
+    // Use relaxation rather than the interval tree in step 2.
+    bool m_relax;
+
+    // Lowest bytecode index covered by a span term (relaxation only);
+    // the deltas and term index are relative to this.
+    long m_index_base;
+
+    // Fenwick tree of bytecode length changes, indexed by bytecode index.
+    std::vector<long> m_deltas;
+
+    // Segment tree of span terms by covered bytecode range, with
+    // m_term_leaves leaves.  The terms stored at node n are
+    // m_term_list[m_term_start[n]] to m_term_list[m_term_start[n+1]-1].
+    unsigned long m_term_leaves;
+    std::vector<unsigned long> m_term_start;
+    std::vector<Span::Term*> m_term_list;
+
+    // Spans to recheck after the current expansion.
+    std::vector<Span*> m_recheck;
 };
 } // namespace yasm
 
@@ -319,6 +408,7 @@ Span::Term::Term()
     : m_span(0),
       m_cur_val(0),
       m_new_val(0),
+      m_base_val(0),
       m_subst(0)
 {
 }
@@ -333,11 +423,42 @@ Span::Term::Term(unsigned int subst,
       m_span(span),
       m_cur_val(0),
       m_new_val(new_val),
+      m_base_val(0),
       m_subst(subst)
 {
     ++num_span_terms;
 }
 
+int
+Span::Term::getRange(long* low, long* high) const
+{
+    long precbc_index, precbc2_index;
+
+    if (m_loc.bc)
+        precbc_index = m_loc.bc->getIndex();
+    else
+        precbc_index = m_span->m_bc.getIndex()-1;
+
+    if (m_loc2.bc)
+        precbc2_index = m_loc2.bc->getIndex();
+    else
+        precbc2_index = m_span->m_bc.getIndex()-1;
+
+    if (precbc_index < precbc2_index)
+    {
+        *low = precbc_index;
+        *high = precbc2_index-1;
+        return 1;
+    }
+    else if (precbc_index > precbc2_index)
+    {
+        *low = precbc2_index;
+        *high = precbc_index-1;
+        return -1;
+    }
+    return 0;
+}
+
 #ifdef WITH_XML
 pugi::xml_node
 Span::Term::Write(pugi::xml_node out) const
@@ -366,7 +487,10 @@ Span::Span(Bytecode& bc,
       m_pos_thres(pos_thres),
       m_id(id),
       m_active(ACTIVE),
-      m_os_index(os_index)
+      m_recheck(false),
+      m_os_index(os_index),
+      m_num_recalc(0),
+      m_num_expand(0)
 {
     ++num_spans;
 }
@@ -434,6 +558,7 @@ bool
 Span::RecalcNormal(DiagnosticsEngine& diags)
 {
     ++num_recalc;
+    ++m_num_recalc;
     m_new_val = 0;
 
     if (m_depval.isRelative())
@@ -534,8 +659,16 @@ Span::WriteRef(pugi::xml_node out) const
 }
 #endif // WITH_XML
 
-Optimizer::Impl::Impl(DiagnosticsEngine& diags)
+Optimizer::Impl::Impl(DiagnosticsEngine& diags,
+                      Optimizer::Algorithm algorithm,
+                      Profile* profile)
     : m_diags(diags)
+    , m_algorithm(algorithm)
+    , m_profile(profile)
+    , m_terms_created(false)
+    , m_relax(false)
+    , m_index_base(0)
+    , m_term_leaves(0)
 {
     // Create an placeholder offset setter for spans to point to; this will
     // get updated if/when we actually run into one.
@@ -546,7 +679,11 @@ Optimizer::Impl::~Impl()
 {
     while (!m_spans.empty())
     {
-        delete m_spans.back();
+        Span* span = m_spans.back();
+        if (m_profile)
+            m_profile->AddSpan(span->m_bc.getSource(), span->m_num_recalc,
+                               span->m_num_expand);
+        delete span;
         m_spans.pop_back();
     }
 }
@@ -600,41 +737,23 @@ Optimizer::AddOffsetSetter(Bytecode& bc)
 void
 Optimizer::Impl::ITreeAdd(Span& span, Span::Term& term)
 {
-    long precbc_index, precbc2_index;
-    unsigned long low, high;
-
-    // Update term length
-    if (term.m_loc.bc)
-        precbc_index = term.m_loc.bc->getIndex();
-    else
-        precbc_index = span.m_bc.getIndex()-1;
-
-    if (term.m_loc2.bc)
-        precbc2_index = term.m_loc2.bc->getIndex();
-    else
-        precbc2_index = span.m_bc.getIndex()-1;
-
-    if (precbc_index < precbc2_index)
-    {
-        low = precbc_index;
-        high = precbc2_index-1;
-    }
-    else if (precbc_index > precbc2_index)
-    {
-        low = precbc2_index;
-        high = precbc_index-1;
-    }
-    else
+    long low, high;
+    if (term.getRange(&low, &high) == 0)
         return;     // difference is same bc - always 0!
 
-    m_itree.Insert(static_cast<long>(low), static_cast<long>(high), &term);
+    m_itree.Insert(low, high, &term);
     ++num_itree;
 }
 
 void
 Optimizer::Impl::CheckCycle(IntervalTreeNode<Span::Term*> * node, Span& span)
 {
-    Span::Term* term = node->getData();
+    CheckTermCycle(node->getData(), span);
+}
+
+void
+Optimizer::Impl::CheckTermCycle(Span::Term* term, Span& span)
+{
     Span* depspan = term->m_span;
 
     // Only check for cycles in id=0 spans
@@ -662,7 +781,6 @@ Optimizer::Impl::ExpandTerm(IntervalTreeNode<Span::Term*> * node, long len_diff)
 {
     Span::Term* term = node->getData();
     Span* span = term->m_span;
-    long precbc_index, precbc2_index;
 
     // Don't expand inactive spans
     if (span->m_active == Span::INACTIVE)
@@ -672,20 +790,8 @@ Optimizer::Impl::ExpandTerm(IntervalTreeNode<Span::Term*> * node, long len_diff)
           << '\n');
 
     // Update term length
-    if (term->m_loc.bc)
-        precbc_index = term->m_loc.bc->getIndex();
-    else
-        precbc_index = span->m_bc.getIndex()-1;
-
-    if (term->m_loc2.bc)
-        precbc2_index = term->m_loc2.bc->getIndex();
-    else
-        precbc2_index = span->m_bc.getIndex()-1;
-
-    if (precbc_index < precbc2_index)
-        term->m_new_val += len_diff;
-    else
-        term->m_new_val -= len_diff;
+    long low, high;
+    term->m_new_val += term->getRange(&low, &high) * len_diff;
     DEBUG(llvm::errs() << "updated " << span->getName() << " term "
           << (term-&span->m_span_terms.front())
           << " newval to " << term->m_new_val << '\n');
@@ -714,14 +820,339 @@ Optimizer::Impl::ExpandTerm(IntervalTreeNode<Span::Term*> * node, long len_diff)
     span->m_active = Span::ON_Q;    // Mark as being in Q
 }
 
+void
+Optimizer::Impl::LengthChanged(const Bytecode& bc, long len_diff)
+{
+    if (m_relax)
+    {
+        long index = static_cast<long>(bc.getIndex()) - m_index_base;
+        if (index < 0 || static_cast<unsigned long>(index) >= m_term_leaves)
+            return;     // no span covers this bytecode
+        AddDelta(index, len_diff);
+
+        // Queue the spans with a term covering the bytecode for recheck.
+        for (unsigned long node=index+m_term_leaves; node != 0; node >>= 1)
+        {
+            for (unsigned long i=m_term_start[node], end=m_term_start[node+1];
+                 i != end; ++i)
+            {
+                Span* span = m_term_list[i]->m_span;
+                if (span->m_active != Span::ACTIVE || span->m_recheck)
+                    continue;
+                span->m_recheck = true;
+                m_recheck.push_back(span);
+            }
+        }
+        return;
+    }
+
+    // Iterate over all spans dependent across the bc just changed
+    m_itree.Enumerate(static_cast<long>(bc.getIndex()),
+                      static_cast<long>(bc.getIndex()),
+                      TR1::bind(&Optimizer::Impl::ExpandTerm, this, _1,
+                                len_diff));
+}
+
+// Determine if an expression is a sum of integers and substitution terms,
+// so its value grows with each term.
+static bool
+isSumOfTerms(const Expr& e)
+{
+    const ExprTerms& terms = e.getTerms();
+    if (terms.size() == 1)
+        return terms.front().isType(ExprTerm::INT | ExprTerm::SUBST);
+    if (!e.isOp(Op::ADD))
+        return false;
+    int depth = terms.back().m_depth + 1;
+    for (ExprTerms::const_iterator i=terms.begin(), end=terms.end()-1;
+         i != end; ++i)
+    {
+        if (i->m_depth != depth ||
+            !i->isType(ExprTerm::INT | ExprTerm::SUBST))
+            return false;
+    }
+    return true;
+}
+
+// Determine if step 2 reaches the same result whatever order the spans are
+// expanded in: no span term covers a bytecode that can shrink (an offset
+// setter or a TIMES), and each span value moves in a single direction.
+bool
+Optimizer::Impl::isOrderIndependent() const
+{
+    std::vector<long> shrinkable;
+    for (std::vector<OffsetSetter>::const_iterator
+         os=m_offset_setters.begin(), osend=m_offset_setters.end();
+         os != osend; ++os)
+    {
+        if (os->m_bc)
+            shrinkable.push_back(static_cast<long>(os->m_bc->getIndex()));
+    }
+    for (Spans::const_iterator spani=m_spans.begin(), endspan=m_spans.end();
+         spani != endspan; ++spani)
+    {
+        if ((*spani)->m_id <= 0)
+            shrinkable.push_back(static_cast<long>((*spani)->m_bc.getIndex()));
+    }
+    std::sort(shrinkable.begin(), shrinkable.end());
+
+    for (Spans::const_iterator spani=m_spans.begin(), endspan=m_spans.end();
+         spani != endspan; ++spani)
+    {
+        const Span* span = *spani;
+        int span_dir = 0;
+        for (Span::Terms::const_iterator term=span->m_span_terms.begin(),
+             endterm=span->m_span_terms.end(); term != endterm; ++term)
+        {
+            long low, high;
+            int dir = term->getRange(&low, &high);
+            if (dir == 0)
+                continue;
+            if (span->m_id > 0 && span_dir != 0 && dir != span_dir)
+                return false;
+            span_dir = dir;
+            std::vector<long>::const_iterator i =
+                std::lower_bound(shrinkable.begin(), shrinkable.end(),
+                                 std::max(low, 0L));
+            if (i != shrinkable.end() && *i <= high)
+                return false;
+        }
+        // TIMES values may move either way; they are simply recalculated
+        // on any change.
+        if (span_dir != 0 && span->m_id > 0 &&
+            !isSumOfTerms(*span->m_depval.getAbs()))
+            return false;
+    }
+    return true;
+}
+
+// Build the term index and offset deltas for relaxation.
+void
+Optimizer::Impl::BuildTermIndex()
+{
+    long min_index = LONG_MAX, max_index = -1;
+    for (Spans::iterator spani=m_spans.begin(), endspan=m_spans.end();
+         spani != endspan; ++spani)
+    {
+        Span* span = *spani;
+        for (Span::Terms::iterator term=span->m_span_terms.begin(),
+             endterm=span->m_span_terms.end(); term != endterm; ++term)
+        {
+            term->m_base_val = term->m_new_val;
+            long low, high;
+            if (term->getRange(&low, &high) == 0)
+                continue;
+            min_index = std::min(min_index, std::max(low, 0L));
+            max_index = std::max(max_index, high);
+        }
+    }
+    if (max_index < 0)
+        return;     // no terms; nothing can change
+    m_index_base = min_index;
+
+    unsigned long size = max_index - min_index + 1;
+    m_deltas.assign(size+1, 0);
+    m_term_leaves = 1;
+    while (m_term_leaves < size)
+        m_term_leaves <<= 1;
+
+    // Store each term at the nodes covering its range: count them, then
+    // fill them in.
+    m_term_start.assign(2*m_term_leaves+1, 0);
+    std::vector<unsigned long> fill;
+    for (int pass=0; pass<2; ++pass)
+    {
+        for (Spans::iterator spani=m_spans.begin(), endspan=m_spans.end();
+             spani != endspan; ++spani)
+        {
+            Span* span = *spani;
+            for (Span::Terms::iterator term=span->m_span_terms.begin(),
+                 endterm=span->m_span_terms.end(); term != endterm; ++term)
+            {
+                long low, high;
+                if (term->getRange(&low, &high) == 0)
+                    continue;
+                low = std::max(low, 0L);
+                if (low > high)
+                    continue;
+                unsigned long l = low - m_index_base + m_term_leaves;
+                unsigned long r = high - m_index_base + m_term_leaves + 1;
+                for (; l < r; l >>= 1, r >>= 1)
+                {
+                    if (l & 1)
+                    {
+                        if (pass == 0)
+                            ++m_term_start[l+1];
+                        else
+                            m_term_list[fill[l]++] = &(*term);
+                        ++l;
+                    }
+                    if (r & 1)
+                    {
+                        --r;
+                        if (pass == 0)
+                            ++m_term_start[r+1];
+                        else
+                            m_term_list[fill[r]++] = &(*term);
+                    }
+                }
+            }
+        }
+        if (pass == 0)
+        {
+            for (unsigned long i=1; i<m_term_start.size(); ++i)
+                m_term_start[i] += m_term_start[i-1];
+            m_term_list.resize(m_term_start.back());
+            fill = m_term_start;
+        }
+    }
+}
+
+void
+Optimizer::Impl::AddDelta(long index, long delta)
+{
+    ++num_len_deltas;
+    for (long i=index+1, size=static_cast<long>(m_deltas.size()); i < size;
+         i += i & -i)
+        m_deltas[i] += delta;
+}
+
+long
+Optimizer::Impl::SumDeltas(long index) const
+{
+    // Sum of deltas at indexes [0, index]
+    long sum = 0;
+    for (long i=index+1; i > 0; i -= i & -i)
+        sum += m_deltas[i];
+    return sum;
+}
+
+// Update span terms from the offset deltas.
+// Returns true if any term value changed.
+bool
+Optimizer::Impl::UpdateTerms(Span& span)
+{
+    bool changed = false;
+    for (Span::Terms::iterator term=span.m_span_terms.begin(),
+         endterm=span.m_span_terms.end(); term != endterm; ++term)
+    {
+        long low, high;
+        int dir = term->getRange(&low, &high);
+        if (dir == 0)
+            continue;
+        low = std::max(low, 0L);
+        long new_val = term->m_base_val +
+            dir * (SumDeltas(high-m_index_base) -
+                   SumDeltas(low-1-m_index_base));
+        if (new_val != term->m_new_val)
+        {
+            term->m_new_val = new_val;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Recheck the spans covering bytecodes whose length changed, adding those
+// pushed over their thresholds to Q.
+void
+Optimizer::Impl::Recheck()
+{
+    for (std::vector<Span*>::iterator spani=m_recheck.begin(),
+         endspan=m_recheck.end(); spani != endspan; ++spani)
+    {
+        Span* span = *spani;
+        span->m_recheck = false;
+        if (span->m_active != Span::ACTIVE)
+            continue;
+        ++num_relax_rechecks;
+        if (!UpdateTerms(*span) || !span->RecalcNormal(m_diags))
+            continue;
+        if (span->m_id <= 0)
+            m_QA.push_back(span);
+        else
+            m_QB.push_back(span);
+        span->m_active = Span::ON_Q;
+    }
+    m_recheck.clear();
+}
+
+void
+Optimizer::Impl::CreateTerms()
+{
+    for (Spans::iterator spani=m_spans.begin(), endspan=m_spans.end();
+         spani != endspan; ++spani)
+    {
+        Span* span = *spani;
+        // An error has been reported; don't try to expand this span.
+        if (!span->CreateTerms(this, m_diags))
+            span->m_active = Span::INACTIVE;
+    }
+    m_terms_created = true;
+}
+
+void
+Optimizer::Impl::getReferencedSections(std::vector<Section*>& sections)
+    const
+{
+    for (Spans::const_iterator spani=m_spans.begin(), endspan=m_spans.end();
+         spani != endspan; ++spani)
+    {
+        const Span* span = *spani;
+        Section* own = span->m_bc.getContainer()->getSection();
+        for (Span::Terms::const_iterator term=span->m_span_terms.begin(),
+             endterm=span->m_span_terms.end(); term != endterm; ++term)
+        {
+            // A null bytecode refers to the span's own bytecode.
+            Bytecode* bcs[2] = { term->m_loc.bc, term->m_loc2.bc };
+            for (int i=0; i<2; ++i)
+            {
+                if (!bcs[i])
+                    continue;
+                Section* sect = bcs[i]->getContainer()->getSection();
+                if (sect != own)
+                    sections.push_back(sect);
+            }
+        }
+    }
+    std::sort(sections.begin(), sections.end());
+    sections.erase(std::unique(sections.begin(), sections.end()),
+                   sections.end());
+}
+
+void
+Optimizer::Impl::Merge(Impl& src)
+{
+    // Offset setter indexes of the merged spans move up by the number of
+    // offset setters already present.  This optimizer's trailing
+    // placeholder is kept, and terminates offset setter iteration for
+    // spans following its last offset setter, as does a change of
+    // container in a single optimizer.
+    size_t base = m_offset_setters.size();
+    for (Spans::iterator spani=src.m_spans.begin(),
+         endspan=src.m_spans.end(); spani != endspan; ++spani)
+        (*spani)->m_os_index += base;
+
+    m_spans.splice(m_spans.end(), src.m_spans);
+    m_offset_setters.insert(m_offset_setters.end(),
+                            src.m_offset_setters.begin(),
+                            src.m_offset_setters.end());
+
+    src.m_offset_setters.clear();
+    src.m_offset_setters.push_back(OffsetSetter());
+}
+
 void
 Optimizer::Impl::Step1b()
 {
+    if (!m_terms_created)
+        CreateTerms();
+
     Spans::iterator spani = m_spans.begin();
     while (spani != m_spans.end())
     {
         Span* span = *spani;
-        if (span->CreateTerms(this, m_diags) && span->RecalcNormal(m_diags))
+        if (span->m_active != Span::INACTIVE && span->RecalcNormal(m_diags))
         {
             bool still_depend = false;
             if (!span->m_bc.Expand(span->m_id, span->m_cur_val, span->m_new_val,
@@ -804,6 +1235,41 @@ Optimizer::Impl::Step1e()
         ++num_offset_setters;
     }
 
+    // Relaxation queues spans in a different order than the interval tree,
+    // so use it only where the order cannot change the result.
+    m_relax = (m_algorithm == Optimizer::RELAX);
+    if (m_relax && !isOrderIndependent())
+    {
+        ++num_relax_fallbacks;
+        m_relax = false;
+    }
+    if (m_relax)
+    {
+        BuildTermIndex();
+
+        // Look for cycles in times expansion (span.id==0)
+        for (Spans::iterator spani=m_spans.begin(), endspan=m_spans.end();
+             spani != endspan; ++spani)
+        {
+            Span* span = *spani;
+            if (span->m_id > 0)
+                continue;
+            long index = static_cast<long>(span->m_bc.getIndex()) -
+                m_index_base;
+            if (index < 0 ||
+                static_cast<unsigned long>(index) >= m_term_leaves)
+                continue;
+            for (unsigned long node=index+m_term_leaves; node != 0;
+                 node >>= 1)
+            {
+                for (unsigned long i=m_term_start[node],
+                     end=m_term_start[node+1]; i != end; ++i)
+                    CheckTermCycle(m_term_list[i], *span);
+            }
+        }
+        return;
+    }
+
     // Build up interval tree
     for (Spans::iterator spani=m_spans.begin(), endspan=m_spans.end();
          spani != endspan; ++spani)
@@ -833,6 +1299,12 @@ Optimizer::Impl::Step2()
 {
     DEBUG(DumpXml(*this));
 
+    ExpandQueued();
+}
+
+void
+Optimizer::Impl::ExpandQueued()
+{
     while (!m_QA.empty() || !m_QB.empty())
     {
         Span* span;
@@ -855,6 +1327,9 @@ Optimizer::Impl::Step2()
             continue;
         span->m_active = Span::ACTIVE;  // no longer in Q
 
+        if (m_relax)
+            UpdateTerms(*span);
+
         // Make sure we ended up ultimately exceeding thresholds; due to
         // offset BCs we may have been placed on Q and then reduced in size
         // again.
@@ -862,6 +1337,7 @@ Optimizer::Impl::Step2()
             continue;
 
         ++num_expansions;
+        ++span->m_num_expand;
 
         unsigned long orig_len = span->m_bc.getTotalLen();
 
@@ -894,11 +1370,7 @@ Optimizer::Impl::Step2()
         DEBUG(llvm::errs() << "BC@" << &span->m_bc << " ("
               << span->m_bc.getIndex() << ") expansion by "
               << len_diff << ":\n");
-        // Iterate over all spans dependent across the bc just expanded
-        m_itree.Enumerate(static_cast<long>(span->m_bc.getIndex()),
-                          static_cast<long>(span->m_bc.getIndex()),
-                          TR1::bind(&Optimizer::Impl::ExpandTerm, this, _1,
-                                    len_diff));
+        LengthChanged(span->m_bc, len_diff);
 
         // Iterate over offset-setters that follow the bc just expanded.
         // Stop iteration if:
@@ -937,20 +1409,22 @@ Optimizer::Impl::Step2()
                 DEBUG(llvm::errs() << "BC@" << os->m_bc << " ("
                       << os->m_bc->getIndex() << ") offset setter change by "
                       << len_diff << ":\n");
-                m_itree.Enumerate(static_cast<long>(os->m_bc->getIndex()),
-                                  static_cast<long>(os->m_bc->getIndex()),
-                                  TR1::bind(&Optimizer::Impl::ExpandTerm, this,
-                                            _1, len_diff));
+                LengthChanged(*os->m_bc, len_diff);
             }
 
             os->m_cur_val = os->m_new_val;
             ++os;
         }
+
+        if (m_relax)
+            Recheck();
     }
 }
 
-Optimizer::Optimizer(DiagnosticsEngine& diags)
-    : m_impl(new Impl(diags))
+Optimizer::Optimizer(DiagnosticsEngine& diags,
+                     Algorithm algorithm,
+                     Profile* profile)
+    : m_impl(new Impl(diags, algorithm, profile))
 {
 }
 
@@ -958,6 +1432,24 @@ Optimizer::~Optimizer()
 {
 }
 
+void
+Optimizer::CreateTerms()
+{
+    m_impl->CreateTerms();
+}
+
+void
+Optimizer::getReferencedSections(std::vector<Section*>& sections) const
+{
+    m_impl->getReferencedSections(sections);
+}
+
+void
+Optimizer::Merge(Optimizer& oth)
+{
+    m_impl->Merge(*oth.m_impl);
+}
+
 void
 Optimizer::Step1b()
 {
@@ -234,6 +234,7 @@ yasm::AppendOrg(BytecodeContainer& container,
                 SourceLocation source)
 {
     Bytecode& bc = container.FreshBytecode();
-    bc.Transform(Bytecode::Contents::Ptr(new OrgBytecode(start, fill)));
+    bc.Transform(Bytecode::Contents::Ptr(
+        new (container.getArena()) OrgBytecode(start, fill)));
     bc.setSource(source);
 }
@@ -0,0 +1,416 @@
+///
+/// @file
+/// @brief Output file image implementation.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include "yasmx/OutputImage.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "llvm/Config/config.h"
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H) && \
+    defined(HAVE_FCNTL_H) && defined(HAVE_SYS_STAT_H)
+#define YASM_MAP_OUTPUT
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+using namespace yasm;
+
+/// File ranges smaller than this are simply copied.
+static const size_t MIN_FILE_RANGE = 64*1024;
+
+void
+yasm::WriteFileRange(raw_fd_ostream& os,
+                     StringRef data,
+                     StringRef filename,
+                     uint64_t offset)
+{
+    uint64_t copied = 0;
+    if (data.size() >= MIN_FILE_RANGE)
+        copied = os.write_file_range(filename.str().c_str(), offset,
+                                     data.size());
+    if (copied < data.size())
+        os.write(data.data() + copied, data.size() - copied);
+}
+
+OutputImage::OutputImage(size_t size)
+    : m_ranges_size(0)
+    , m_pos(0)
+    , m_base(0)
+    , m_size(0)
+    , m_capacity(0)
+    , m_file(0)
+    , m_fd(-1)
+    , m_window_of(0)
+    , m_window_offset(0)
+{
+    // Writes go directly into the image.
+    SetUnbuffered();
+    m_data.reserve(size);
+}
+
+OutputImage::OutputImage(raw_fd_ostream& file, StringRef filename, size_t size)
+    : m_ranges_size(0)
+    , m_pos(0)
+    , m_base(0)
+    , m_size(0)
+    , m_capacity(0)
+    , m_file(&file)
+    , m_fd(-1)
+    , m_window_of(0)
+    , m_window_offset(0)
+{
+    SetUnbuffered();
+#ifdef YASM_MAP_OUTPUT
+    // Only a regular file can be mapped (not e.g. standard output or a
+    // pipe).  The stream's descriptor is write-only, so open the file
+    // again, checking it is the same file.
+    struct stat st, file_st;
+    if (filename != "-" && file.tell() == 0 &&
+        ::fstat(file.getFD(), &file_st) == 0 && S_ISREG(file_st.st_mode))
+    {
+        m_fd = ::open(filename.str().c_str(), O_RDWR);
+        if (m_fd >= 0 && (::fstat(m_fd, &st) != 0 ||
+                          st.st_dev != file_st.st_dev ||
+                          st.st_ino != file_st.st_ino))
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+        if (m_fd >= 0 && Map(size))
+            return;
+    }
+#endif
+    m_data.reserve(size);
+}
+
+OutputImage::OutputImage(OutputImage& image, uint64_t offset, size_t size)
+    : m_ranges_size(0)
+    , m_pos(0)
+    , m_base(0)
+    , m_size(0)
+    , m_capacity(size)
+    , m_file(0)
+    , m_fd(-1)
+    , m_window_of(&image)
+    , m_window_offset(static_cast<size_t>(offset))
+{
+    SetUnbuffered();
+    image.flush();
+    m_base = image.Extend(m_window_offset, size);
+}
+
+OutputImage::~OutputImage()
+{
+    if (m_window_of)
+        return;
+#ifdef YASM_MAP_OUTPUT
+    if (m_fd >= 0)
+    {
+        // Not finished; trim off the unused space.
+        size_t size = getSize();
+        Unmap();
+        if (::ftruncate(m_fd, size) != 0)
+            error_detected();
+        ::close(m_fd);
+    }
+#endif
+}
+
+bool
+OutputImage::Map(size_t capacity)
+{
+#ifdef YASM_MAP_OUTPUT
+    // Grow the file, then map it afresh.
+    capacity = std::max(capacity, static_cast<size_t>(4096));
+    if (::ftruncate(m_fd, capacity) == 0)
+    {
+        void* base = ::mmap(0, capacity, PROT_READ|PROT_WRITE, MAP_SHARED,
+                            m_fd, 0);
+        if (base != MAP_FAILED)
+        {
+            Unmap();
+            m_base = static_cast<char*>(base);
+            m_capacity = capacity;
+            return true;
+        }
+    }
+
+    // Build the rest of the image in memory.
+    if (m_base)
+    {
+        m_data.reserve(capacity);
+        m_data.assign(m_base, m_base + m_size);
+        Unmap();
+    }
+#endif
+    return false;
+}
+
+void
+OutputImage::Unmap()
+{
+#ifdef YASM_MAP_OUTPUT
+    if (m_base)
+        ::munmap(m_base, m_capacity);
+#endif
+    m_base = 0;
+    m_capacity = 0;
+}
+
+void
+OutputImage::reserve(size_t size)
+{
+    if (m_window_of)
+        return;
+    if (m_base)
+    {
+        if (size > m_capacity)
+            Map(size);
+        return;
+    }
+    m_data.reserve(size);
+}
+
+uint64_t
+OutputImage::seek(uint64_t off)
+{
+    flush();
+    m_pos = static_cast<size_t>(off);
+    return m_pos;
+}
+
+StringRef
+OutputImage::getContents() const
+{
+    assert(m_ranges.empty() && "image contains file ranges");
+    if (m_base)
+        return StringRef(m_base, m_size);
+    if (m_data.empty())
+        return StringRef();
+    return StringRef(&m_data[0], m_data.size());
+}
+
+size_t
+OutputImage::getDataIndex(size_t pos) const
+{
+    // Usually writing after all file ranges.
+    if (m_ranges.empty() ||
+        pos >= m_ranges.back().pos + m_ranges.back().data.size())
+        return pos - m_ranges_size;
+
+    size_t before = 0;
+    for (std::vector<FileRange>::const_iterator i=m_ranges.begin(),
+         end=m_ranges.end(); i != end && i->pos < pos; ++i)
+    {
+        assert(pos >= i->pos + i->data.size() &&
+               "write into file range of output image");
+        before += i->data.size();
+    }
+    return pos - before;
+}
+
+void
+OutputImage::WriteFileRange(StringRef data,
+                            StringRef filename,
+                            uint64_t offset)
+{
+    flush();
+    if (m_base || data.size() < MIN_FILE_RANGE || m_pos < getSize())
+    {
+        write(data.data(), data.size());
+        return;
+    }
+
+    // Fill any hole left by seeking past the end.
+    m_data.resize(m_pos - m_ranges_size);
+
+    FileRange range;
+    range.pos = m_pos;
+    range.data = data;
+    range.filename = filename;
+    range.offset = offset;
+    m_ranges.push_back(range);
+    m_ranges_size += data.size();
+    m_pos += data.size();
+}
+
+void
+OutputImage::WriteRange(raw_ostream& os, const FileRange& range)
+{
+    os.write(range.data.data(), range.data.size());
+}
+
+void
+OutputImage::WriteRange(raw_fd_ostream& os, const FileRange& range)
+{
+    yasm::WriteFileRange(os, range.data, range.filename, range.offset);
+}
+
+void
+OutputImage::WriteRange(OutputImage& os, const FileRange& range)
+{
+    os.WriteFileRange(range.data, range.filename, range.offset);
+}
+
+template <typename T>
+void
+OutputImage::WriteImage(T& os) const
+{
+    size_t done = 0, before = 0;
+    for (std::vector<FileRange>::const_iterator i=m_ranges.begin(),
+         end=m_ranges.end(); i != end; ++i)
+    {
+        size_t index = i->pos - before;
+        if (index > done)
+            os.write(&m_data[done], index - done);
+        WriteRange(os, *i);
+        done = index;
+        before += i->data.size();
+    }
+    if (m_data.size() > done)
+        os.write(&m_data[done], m_data.size() - done);
+}
+
+void
+OutputImage::WriteTo(raw_ostream& os) const
+{
+    if (m_base)
+        os.write(m_base, m_size);
+    else
+        WriteImage(os);
+}
+
+void
+OutputImage::WriteTo(raw_fd_ostream& os) const
+{
+    if (m_base)
+        os.write(m_base, m_size);
+    else
+        WriteImage(os);
+}
+
+void
+OutputImage::WriteTo(OutputImage& os) const
+{
+    if (&os == m_window_of)
+        os.seek(m_window_offset + m_size);
+    else if (m_base)
+        os.write(m_base, m_size);
+    else
+        WriteImage(os);
+}
+
+void
+OutputImage::Finish()
+{
+    assert(m_file && "not an image of an output file");
+    flush();
+    size_t size = getSize();
+    if (m_base)
+    {
+        // Already in place.
+        Unmap();
+        m_file->seek(size);
+    }
+    else
+    {
+        WriteImage(*m_file);
+        m_file->flush();
+    }
+#ifdef YASM_MAP_OUTPUT
+    if (m_fd >= 0)
+    {
+        // Trim off the unused space.
+        if (::ftruncate(m_fd, size) != 0)
+            error_detected();
+        ::close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    m_file = 0;
+}
+
+char*
+OutputImage::Extend(size_t pos, size_t size)
+{
+    size_t end = pos + size;
+    if (m_window_of)
+    {
+        if (end > m_capacity)
+        {
+            assert(false && "write past end of output image window");
+            return 0;
+        }
+        m_size = std::max(m_size, end);
+        return m_base + pos;
+    }
+
+    // Grow geometrically.
+    if (m_base && end > m_capacity)
+        Map(std::max(end, 2*m_capacity));
+    if (m_base)
+    {
+        m_size = std::max(m_size, end);
+        return m_base + pos;
+    }
+
+    // In memory; resize() zero-fills any hole left by seeking.
+    size_t index = getDataIndex(pos);
+    end = index + size;
+    if (end > m_data.size())
+    {
+        if (end > m_data.capacity())
+            m_data.reserve(std::max(end, 2*m_data.capacity()));
+        m_data.resize(end);
+    }
+    if (m_data.empty())
+        return 0;
+    return &m_data[index];
+}
+
+void
+OutputImage::write_impl(const char* ptr, size_t size)
+{
+    if (size == 0)
+        return;
+    char* dest = Extend(m_pos, size);
+    if (!dest)
+    {
+        error_detected();
+        return;
+    }
+    std::memcpy(dest, ptr, size);
+    m_pos += size;
+}
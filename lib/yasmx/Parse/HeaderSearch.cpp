@@ -140,7 +140,7 @@ HeaderSearch::LookupFile(StringRef Filename,
     if (FromDir) return 0;
 
     // Otherwise, just return the file.
-    return FileMgr.getFile(Filename);
+    return NoteFoundFile(FileMgr.getFile(Filename));
   }
 
   // Step #0, unless disabled, check to see if the file is in the #includer's
@@ -157,7 +157,7 @@ HeaderSearch::LookupFile(StringRef Filename,
     TmpDir.append(Filename.begin(), Filename.end());
     if (const FileEntry *FE = FileMgr.getFile(TmpDir)) {
       // Leave CurDir unset.
-      return FE;
+      return NoteFoundFile(FE);
     }
   }
 
@@ -201,7 +201,7 @@ HeaderSearch::LookupFile(StringRef Filename,
 
     // Remember this location for the next lookup we do.
     CacheLookup.second = i;
-    return FE;
+    return NoteFoundFile(FE);
   }
 
   // Otherwise, didn't find it. Remember we didn't find this.
@@ -222,6 +222,19 @@ HeaderFileInfo &HeaderSearch::getFileInfo(const FileEntry *FE) {
   return FileInfo[FE->getUID()];
 }
 
+/// NoteFoundFile - Add a file to FoundFiles if it is not already there.
+/// Returns the file.
+const FileEntry *HeaderSearch::NoteFoundFile(const FileEntry *FE) {
+  if (!FE)
+    return 0;
+  HeaderFileInfo &Info = getFileInfo(FE);
+  if (!Info.isFound) {
+    Info.isFound = true;
+    FoundFiles.push_back(FE);
+  }
+  return FE;
+}
+
 /// ShouldEnterIncludeFile - Mark the specified file as a target of of a
 /// #include, #include_next, or #import directive.  Return false if #including
 /// the file will have no effect or true if we should include it.
@@ -71,6 +71,7 @@ Preprocessor::EnterSourceFile(FileID FID,
             << std::string(m_source_mgr.getBufferName(FileStart)) << "";
         return;
     }
+    m_NumInputBytes += InputFile->getBufferSize();
 
     EnterSourceFileWithLexer(CreateLexer(FID, InputFile), CurDir);
 }
@@ -101,7 +102,8 @@ void
 Preprocessor::EnterTokenStream(const Token* toks,
                                unsigned int num_toks,
                                bool disable_macro_expansion,
-                               bool owns_tokens)
+                               bool owns_tokens,
+                               unsigned long repeat_count)
 {
     // Save our current state.
     PushIncludeMacroStack();
@@ -112,13 +114,14 @@ Preprocessor::EnterTokenStream(const Token* toks,
     {
         m_cur_token_lexer.reset(new TokenLexer(toks, num_toks,
                                                disable_macro_expansion,
-                                               owns_tokens, *this));
+                                               owns_tokens, *this,
+                                               repeat_count));
     }
     else
     {
         m_cur_token_lexer.reset(m_token_lexer_cache[--m_num_cached_token_lexers]);
         m_cur_token_lexer->Init(toks, num_toks, disable_macro_expansion,
-                                owns_tokens);
+                                owns_tokens, repeat_count);
     }
 }
 
@@ -153,6 +156,18 @@ Preprocessor::HandleEndOfFile(Token* Result, bool isEndOfMacro)
         return false;
     }
 
+    // If the main file is read in pieces, continue with the next piece.
+    if (m_main_input)
+    {
+        if (MemoryBuffer* buf = m_main_input())
+        {
+            FileID fid = m_source_mgr.createFileIDForMemBuffer(buf);
+            m_cur_lexer.reset();
+            EnterSourceFile(fid, 0, SourceLocation());
+            return false;
+        }
+    }
+
     // If the file ends with a newline, form the EOF token on the newline itself,
     // rather than "on the line following it", which doesn't exist.  This makes
     // diagnostics relating to the end of file include the last file that the user
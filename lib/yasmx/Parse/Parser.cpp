@@ -29,6 +29,8 @@
 ///
 #include "yasmx/Parse/Parser.h"
 
+#include "yasmx/Basic/Diagnostic.h"
+
 
 using namespace yasm;
 
@@ -41,6 +43,20 @@ Parser::AddDirectives(Directives& dirs, StringRef parser)
 {
 }
 
+bool
+Parser::Preprocess(Object& object, raw_ostream& os, DiagnosticsEngine& diags)
+{
+    diags.Report(SourceLocation(), diag::fatal_preproc_only_unsupported)
+        << m_module.getKeyword();
+    return false;
+}
+
+bool
+Parser::ScanIncludes(Object& object, DiagnosticsEngine& diags)
+{
+    return false;
+}
+
 ParserModule::~ParserModule()
 {
 }
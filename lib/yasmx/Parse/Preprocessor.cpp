@@ -49,6 +49,7 @@ Preprocessor::Preprocessor(DiagnosticsEngine& diags,
 {
     // Clear stats.
     m_NumEnteredSourceFiles = m_MaxIncludeStackDepth = 0;
+    m_NumInputBytes = 0;
 
     // Default to discarding comments.
     m_keep_comments = false;
@@ -57,6 +58,7 @@ Preprocessor::Preprocessor(DiagnosticsEngine& diags,
     // Macro expansion is enabled.
     m_disable_macro_expansion = false;
     m_in_macro_args = false;
+    m_environment_dependent = false;
     m_num_cached_token_lexers = 0;
 
     m_cached_lex_pos = 0;
@@ -115,6 +117,11 @@ Preprocessor::PreInclude(StringRef filename)
     PredefineText(file.take());
 }
 
+void
+Preprocessor::setMacroSnapshot(StringRef filename)
+{
+}
+
 void
 Preprocessor::RegisterBuiltinMacros()
 {
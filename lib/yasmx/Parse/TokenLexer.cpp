@@ -76,7 +76,8 @@ void TokenLexer::Init(Token &Tok, SourceLocation ILEnd, MacroArgs *Actuals) {
 /// take ownership of the specified token vector.
 void
 TokenLexer::Init(const Token *TokArray, unsigned NumToks,
-                 bool disableMacroExpansion, bool ownsTokens)
+                 bool disableMacroExpansion, bool ownsTokens,
+                 unsigned long RepeatCount)
 {
     // If the client is reusing a TokenLexer, make sure to free any memory
     // associated with it.
@@ -89,8 +90,9 @@ TokenLexer::Init(const Token *TokArray, unsigned NumToks,
     m_tokens = TokArray;
     m_owns_tokens = ownsTokens;
     m_disable_macro_expansion = disableMacroExpansion;
-    m_num_tokens = NumToks;
+    m_num_tokens = RepeatCount == 0 ? 0 : NumToks;
     m_cur_token = 0;
+    m_repeats_left = NumToks == 0 || RepeatCount == 0 ? 0 : RepeatCount-1;
     m_expand_loc_start = m_expand_loc_end = SourceLocation();
     m_at_start_of_line = false;
     m_has_leading_space = false;
@@ -324,6 +326,12 @@ void TokenLexer::ExpandFunctionArguments() {
 /// Lex - Lex and return a token from this macro stream.
 ///
 void TokenLexer::Lex(Token* Tok) {
+  // At the end of one pass through a repeated stream, start the next one.
+  if (m_cur_token == m_num_tokens && m_repeats_left != 0) {
+    --m_repeats_left;
+    m_cur_token = 0;
+  }
+
   // Lexing off the end of the macro, pop this macro off the expansion stack.
   if (isAtEnd()) {
 #if 0
@@ -519,6 +527,8 @@ unsigned TokenLexer::isNextTokenLParen() const {
   // Out of tokens?
   if (isAtEnd())
     return 2;
+  if (m_cur_token == m_num_tokens)
+    return m_tokens[0].is(Token::l_paren);   // start of the next repeat
   return m_tokens[m_cur_token].is(Token::l_paren);
 }
 
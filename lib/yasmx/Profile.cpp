@@ -0,0 +1,326 @@
+///
+/// @file
+/// @brief Assembly profile implementation.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include "yasmx/Profile.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/TimeValue.h"
+#include "yasmx/Basic/SourceManager.h"
+
+
+using namespace yasm;
+
+static double
+getWallTime()
+{
+    llvm::sys::TimeValue now = llvm::sys::TimeValue::now();
+    return now.seconds() + now.nanoseconds() / 1e9;
+}
+
+static long long
+getHeapUsage()
+{
+    return static_cast<long long>(llvm::sys::Process::GetMallocUsage());
+}
+
+namespace {
+/// Span work for a source line, for sorting.
+struct LineWork
+{
+    LineWork() : recalcs(0), expansions(0) {}
+
+    std::string where;
+    unsigned long recalcs;
+    unsigned long expansions;
+
+    bool operator< (const LineWork& oth) const
+    {
+        unsigned long total = recalcs + expansions;
+        unsigned long oth_total = oth.recalcs + oth.expansions;
+        if (total != oth_total)
+            return total > oth_total;
+        return where < oth.where;
+    }
+};
+} // anonymous namespace
+
+/// Write a JSON string literal.
+static void
+WriteJSONString(raw_ostream& os, StringRef str)
+{
+    os << '"';
+    for (StringRef::iterator i=str.begin(), end=str.end(); i != end; ++i)
+    {
+        unsigned char ch = static_cast<unsigned char>(*i);
+        switch (ch)
+        {
+            case '"':   os << "\\\""; break;
+            case '\\':  os << "\\\\"; break;
+            case '\n':  os << "\\n"; break;
+            case '\r':  os << "\\r"; break;
+            case '\t':  os << "\\t"; break;
+            default:
+                if (ch < 0x20)
+                    os << llvm::format("\\u%04x", ch);
+                else
+                    os << *i;
+        }
+    }
+    os << '"';
+}
+
+Profile::Profile()
+    : m_num_spans(0)
+    , m_max_rss(llvm::sys::Process::GetPeakResidentSize())
+{
+    llvm::GetStatistics(m_start_stats);
+    std::sort(m_start_stats.begin(), m_start_stats.end());
+}
+
+Profile::~Profile()
+{
+}
+
+void
+Profile::StartPhase(StringRef name)
+{
+    unsigned int depth = static_cast<unsigned int>(m_running.size());
+    size_t phase = 0;
+    for (; phase < m_phases.size(); ++phase)
+    {
+        if (m_phases[phase].depth == depth && m_phases[phase].name == name)
+            break;
+    }
+    if (phase == m_phases.size())
+    {
+        Phase newphase;
+        newphase.name = name;
+        newphase.depth = depth;
+        newphase.count = 0;
+        newphase.wall = 0;
+        newphase.heap = 0;
+        m_phases.push_back(newphase);
+    }
+
+    Running running;
+    running.phase = phase;
+    running.heap = getHeapUsage();
+    running.wall = getWallTime();
+    m_running.push_back(running);
+}
+
+void
+Profile::StopPhase()
+{
+    assert(!m_running.empty() && "phase stopped but not started");
+    double wall = getWallTime();
+    const Running& running = m_running.back();
+    Phase& phase = m_phases[running.phase];
+    long long heap = getHeapUsage();
+    ++phase.count;
+    phase.wall += wall - running.wall;
+    phase.heap += heap - running.heap;
+    // A high-water mark, so covers peaks within the phase.
+    m_max_rss = llvm::sys::Process::GetPeakResidentSize();
+    m_running.pop_back();
+}
+
+void
+Profile::AddSpan(SourceLocation source,
+                 unsigned long recalcs,
+                 unsigned long expansions)
+{
+    ++m_num_spans;
+    if (recalcs == 0 && expansions == 0)
+        return;
+    SpanWork& work = m_spans[source.getRawEncoding()];
+    work.recalcs += recalcs;
+    work.expansions += expansions;
+}
+
+void
+Profile::setCounter(StringRef name, uint64_t value)
+{
+    for (std::vector<std::pair<std::string, uint64_t> >::iterator
+         i=m_counters.begin(), end=m_counters.end(); i != end; ++i)
+    {
+        if (i->first == name)
+        {
+            i->second = value;
+            return;
+        }
+    }
+    m_counters.push_back(std::make_pair(name.str(), value));
+}
+
+void
+Profile::Print(raw_ostream& os,
+               const SourceManager& source_mgr,
+               unsigned int max_lines) const
+{
+    double total = 0;
+    for (std::vector<Phase>::const_iterator i=m_phases.begin(),
+         end=m_phases.end(); i != end; ++i)
+    {
+        if (i->depth == 0)
+            total += i->wall;
+    }
+
+    os << "Phase                                Count    Wall time (s)"
+          "    Heap (KB)\n";
+    for (std::vector<Phase>::const_iterator i=m_phases.begin(),
+         end=m_phases.end(); i != end; ++i)
+    {
+        std::string name(2*i->depth, ' ');
+        name += i->name;
+        os << llvm::format("%-34s %7lu %9.4f (%5.1f%%) %+12lld\n",
+                           name.c_str(), i->count, i->wall,
+                           total > 0 ? i->wall * 100 / total : 0.0,
+                           i->heap / 1024);
+    }
+    os << "Total" << llvm::format("%47.4f\n", total);
+
+    if (m_spans.empty())
+        return;
+
+    // Combine spans on the same source line.
+    llvm::StringMap<LineWork> lines;
+    for (std::map<unsigned int, SpanWork>::const_iterator i=m_spans.begin(),
+         end=m_spans.end(); i != end; ++i)
+    {
+        PresumedLoc ploc = source_mgr.getPresumedLoc(
+            SourceLocation::getFromRawEncoding(i->first));
+        std::string where;
+        if (ploc.isValid())
+        {
+            llvm::raw_string_ostream oss(where);
+            oss << ploc.getFilename() << ':' << ploc.getLine();
+        }
+        else
+            where = "<unknown>";
+        LineWork& work = lines[where];
+        work.where = where;
+        work.recalcs += i->second.recalcs;
+        work.expansions += i->second.expansions;
+    }
+
+    std::vector<LineWork> sorted;
+    for (llvm::StringMap<LineWork>::const_iterator i=lines.begin(),
+         end=lines.end(); i != end; ++i)
+        sorted.push_back(i->getValue());
+    std::sort(sorted.begin(), sorted.end());
+    if (sorted.size() > max_lines)
+        sorted.resize(max_lines);
+
+    os << "\nSource lines with the most optimizer work:\n";
+    os << "  Recalcs  Expansions  Location\n";
+    for (std::vector<LineWork>::const_iterator i=sorted.begin(),
+         end=sorted.end(); i != end; ++i)
+        os << llvm::format("%9lu %11lu  ", i->recalcs, i->expansions)
+           << i->where << '\n';
+}
+
+void
+Profile::PrintJSON(raw_ostream& os, StringRef filename) const
+{
+    os << "{\"file\":";
+    WriteJSONString(os, filename);
+    for (std::vector<std::pair<std::string, uint64_t> >::const_iterator
+         i=m_counters.begin(), end=m_counters.end(); i != end; ++i)
+    {
+        os << ',';
+        WriteJSONString(os, i->first);
+        os << ':' << i->second;
+    }
+    os << ",\"spans\":" << m_num_spans;
+    os << ",\"max_rss\":" << m_max_rss;
+
+    // Nested phases are named by their path, e.g. "Optimize/Step 1a".
+    double total = 0;
+    std::vector<std::string> path;
+    os << ",\"phases\":{";
+    for (std::vector<Phase>::const_iterator i=m_phases.begin(),
+         end=m_phases.end(); i != end; ++i)
+    {
+        if (i->depth == 0)
+            total += i->wall;
+        path.resize(i->depth);
+        std::string name;
+        for (std::vector<std::string>::const_iterator j=path.begin(),
+             jend=path.end(); j != jend; ++j)
+        {
+            name += *j;
+            name += '/';
+        }
+        name += i->name;
+        path.push_back(i->name);
+
+        if (i != m_phases.begin())
+            os << ',';
+        WriteJSONString(os, name);
+        os << ":{\"count\":" << i->count
+           << ",\"wall\":" << llvm::format("%.6f", i->wall)
+           << ",\"heap\":" << i->heap << '}';
+    }
+    os << "},\"wall\":" << llvm::format("%.6f", total);
+
+    // Statistics are process-wide totals; report the change since the
+    // profile was created.
+    std::vector<std::pair<std::string, unsigned> > stats;
+    llvm::GetStatistics(stats);
+    std::sort(stats.begin(), stats.end());
+    std::vector<std::pair<std::string, unsigned> >::const_iterator
+        start = m_start_stats.begin(), start_end = m_start_stats.end();
+    bool first = true;
+    os << ",\"statistics\":{";
+    for (std::vector<std::pair<std::string, unsigned> >::const_iterator
+         i=stats.begin(), end=stats.end(); i != end; ++i)
+    {
+        unsigned value = i->second;
+        while (start != start_end && start->first < i->first)
+            ++start;
+        if (start != start_end && start->first == i->first)
+            value -= start->second;
+        if (value == 0)
+            continue;
+        if (!first)
+            os << ',';
+        first = false;
+        WriteJSONString(os, i->first);
+        os << ':' << value;
+    }
+    os << "}}\n";
+}
@@ -26,14 +26,56 @@
 
 #include "yasmx/StringTable.h"
 
+#include <algorithm>
+
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/raw_ostream.h"
 
 
 using namespace yasm;
 
-StringTable::StringTable(unsigned long first_index)
+namespace {
+/// A string waiting to be laid out by StringTable::Finalize().
+struct Pending
+{
+    unsigned long index;    ///< provisional index
+    StringRef str;
+    std::size_t host;       ///< string whose storage this string uses
+};
+
+/// Orders strings by their reversed bytes, so a string that is the tail of
+/// another sorts immediately before the strings it is a tail of.
+struct ReverseLess
+{
+    const std::vector<Pending>& m_pending;
+    explicit ReverseLess(const std::vector<Pending>& pending)
+        : m_pending(pending)
+    {}
+    bool operator() (std::size_t a, std::size_t b) const
+    {
+        StringRef sa = m_pending[a].str, sb = m_pending[b].str;
+        std::size_t ia = sa.size(), ib = sb.size();
+        for (; ia > 0 && ib > 0; --ia, --ib)
+        {
+            unsigned char ca = sa[ia-1], cb = sb[ib-1];
+            if (ca != cb)
+                return ca < cb;
+        }
+        return ia == 0 && ib != 0;
+    }
+};
+
+inline bool
+byIndex(const Pending& a, const Pending& b)
+{
+    return a.index < b.index;
+}
+} // anonymous namespace
+
+StringTable::StringTable(unsigned long first_index, bool intern)
     : m_first_index(first_index)
+    , m_intern(intern)
+    , m_finalized(false)
 {
     m_storage.push_back('\0');
 }
@@ -45,12 +87,97 @@ StringTable::~StringTable()
 unsigned long
 StringTable::getIndex(StringRef str)
 {
+    if (m_intern)
+    {
+        if (str.empty())
+            return m_first_index;
+        llvm::StringMap<unsigned long>::iterator i = m_index.find(str);
+        if (i != m_index.end())
+            return i->getValue();
+    }
+
     unsigned long end = m_storage.size();
     m_storage.insert(m_storage.end(), str.begin(), str.end());
     m_storage.push_back('\0');
+    if (m_intern)
+        m_index[str] = m_first_index+end;
     return m_first_index+end;
 }
 
+void
+StringTable::Finalize()
+{
+    if (!m_intern || m_finalized)
+        return;
+    m_finalized = true;
+
+    // Gather the strings in the order they were first added, which keeps
+    // the layout deterministic.
+    std::vector<Pending> pending;
+    pending.reserve(m_index.size());
+    for (llvm::StringMap<unsigned long>::iterator i=m_index.begin(),
+         end=m_index.end(); i != end; ++i)
+    {
+        Pending p = {i->getValue(), i->getKey(), 0};
+        pending.push_back(p);
+    }
+    std::sort(pending.begin(), pending.end(), byIndex);
+
+    // In reversed order, a string is a tail of another exactly when it is
+    // a tail of its successor; walk backwards so each string finds the
+    // longest string containing it.
+    std::vector<std::size_t> order(pending.size());
+    for (std::size_t i=0; i<order.size(); ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), ReverseLess(pending));
+    for (std::size_t n=order.size(); n > 0; --n)
+    {
+        Pending& p = pending[order[n-1]];
+        p.host = order[n-1];
+        if (n == order.size())
+            continue;
+        Pending& next = pending[order[n]];
+        if (next.str.endswith(p.str))
+            p.host = next.host;
+    }
+
+    // Lay out the hosts, then point the tails into them.
+    std::vector<char> storage;
+    storage.push_back('\0');
+    std::vector<unsigned long> offset(pending.size());
+    for (std::size_t i=0; i<pending.size(); ++i)
+    {
+        if (pending[i].host != i)
+            continue;
+        offset[i] = storage.size();
+        storage.insert(storage.end(), pending[i].str.begin(),
+                       pending[i].str.end());
+        storage.push_back('\0');
+    }
+
+    m_remap.reserve(pending.size());
+    for (std::size_t i=0; i<pending.size(); ++i)
+    {
+        const Pending& p = pending[i];
+        unsigned long index = m_first_index + offset[p.host] +
+            pending[p.host].str.size() - p.str.size();
+        m_remap.push_back(std::make_pair(p.index, index));
+        m_index[p.str] = index;
+    }
+    m_storage.swap(storage);
+}
+
+unsigned long
+StringTable::getFinalIndex(unsigned long index) const
+{
+    std::vector<std::pair<unsigned long, unsigned long> >::const_iterator i =
+        std::lower_bound(m_remap.begin(), m_remap.end(),
+                         std::make_pair(index, 0UL));
+    if (i == m_remap.end() || i->first != index)
+        return index;
+    return i->second;
+}
+
 StringRef
 StringTable::getString(unsigned long index) const
 {
@@ -68,4 +195,7 @@ StringTable::Read(StringRef buf)
 {
     m_storage.clear();
     m_storage.insert(m_storage.end(), buf.begin(), buf.end());
+    m_index.clear();
+    m_remap.clear();
+    m_finalized = false;
 }
@@ -0,0 +1,147 @@
+///
+/// @file libyasmx/Support/Arena.cpp
+/// @brief Memory arena implementation.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include "yasmx/Support/Arena.h"
+
+#include <new>
+
+#include "llvm/Support/AlignOf.h"
+
+
+using namespace yasm;
+
+namespace {
+/// Header preceding each ArenaAllocated object, recording the arena the
+/// object was allocated from (NULL if allocated on the heap) and the
+/// size of the allocation.  The union keeps the object that follows
+/// aligned for any fundamental type.
+struct HeaderData
+{
+    Arena* arena;
+    std::size_t size;
+};
+
+union Header
+{
+    HeaderData data;
+    long double align_ld;
+    double align_d;
+    long align_l;
+    void* align_p;
+    void (*align_fp)();
+};
+
+// Allocation granularity and alignment.  Header is padded to a multiple
+// of its alignment, so arena blocks are rounded up to the same unit.
+enum { ALIGN = llvm::AlignOf<Header>::Alignment };
+
+// Blocks larger than this are not kept for reuse.
+enum { MAX_FREE_SIZE = 1024 };
+
+inline std::size_t
+RoundUp(std::size_t size)
+{
+    return (size + ALIGN - 1) & ~static_cast<std::size_t>(ALIGN - 1);
+}
+} // anonymous namespace
+
+// Large slabs keep the number of underlying allocations small.
+Arena::Arena()
+    : m_alloc(64*1024, 64*1024)
+{
+}
+
+Arena::~Arena()
+{
+}
+
+void*
+Arena::Allocate(std::size_t size)
+{
+    size = RoundUp(size);
+    std::size_t index = size / ALIGN;
+    if (index < m_free.size() && m_free[index])
+    {
+        void* ptr = m_free[index];
+        m_free[index] = *static_cast<void**>(ptr);
+        return ptr;
+    }
+    return m_alloc.Allocate(size, ALIGN);
+}
+
+void
+Arena::Deallocate(void* ptr, std::size_t size)
+{
+    size = RoundUp(size);
+    if (size > MAX_FREE_SIZE)
+        return;
+    std::size_t index = size / ALIGN;
+    if (index >= m_free.size())
+        m_free.resize(index+1, 0);
+    *static_cast<void**>(ptr) = m_free[index];
+    m_free[index] = ptr;
+}
+
+void*
+ArenaAllocated::operator new(std::size_t size)
+{
+    return operator new(size, 0);
+}
+
+void*
+ArenaAllocated::operator new(std::size_t size, Arena* arena)
+{
+    Header* header;
+    if (arena)
+        header = static_cast<Header*>(arena->Allocate(sizeof(Header)+size));
+    else
+        header = static_cast<Header*>(::operator new(sizeof(Header)+size));
+    header->data.arena = arena;
+    header->data.size = size;
+    return header+1;
+}
+
+void
+ArenaAllocated::operator delete(void* ptr)
+{
+    if (!ptr)
+        return;
+    Header* header = static_cast<Header*>(ptr)-1;
+    if (header->data.arena)
+        header->data.arena->Deallocate(header,
+                                       sizeof(Header)+header->data.size);
+    else
+        ::operator delete(header);
+}
+
+void
+ArenaAllocated::operator delete(void* ptr, Arena* arena)
+{
+    operator delete(ptr);
+}
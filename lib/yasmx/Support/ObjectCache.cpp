@@ -0,0 +1,458 @@
+///
+/// @file
+/// @brief On-disk cache of assembled object files.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include "yasmx/Support/ObjectCache.h"
+
+#include <algorithm>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Config/config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include "yasmx/Support/MD5.h"
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+
+using namespace yasm;
+
+namespace {
+/// A cache entry, for eviction.
+struct Entry
+{
+    std::string path;
+    uint64_t size;
+    llvm::sys::TimeValue time;
+
+    Entry() : size(0), time(0, 0) {}
+    bool operator< (const Entry& oth) const { return time < oth.time; }
+};
+} // anonymous namespace
+
+/// Statistics file, holding the hit and miss counters as "hits misses".
+/// It is updated while holding the lock directory, which is created and
+/// removed atomically.
+static const char stats_name[] = "stats";
+static const char stats_lock_name[] = "stats.lock";
+
+/// Unfinished entries older than this (in seconds) are assumed to have
+/// been left by a writer that died, and are removed on eviction.
+static const unsigned long stale_tmp_age = 60*60;
+
+/// A statistics lock older than this (in seconds) is assumed to have been
+/// left by a process that died, and is broken.
+static const unsigned long stale_lock_age = 10;
+
+/// Number of times to try for the statistics lock before giving up on
+/// counting a lookup.
+static const int lock_tries = 100;
+
+static void
+SleepBriefly()
+{
+#if defined(_WIN32)
+    Sleep(1);
+#elif defined(HAVE_UNISTD_H)
+    usleep(1000);
+#endif
+}
+
+static void
+AddString(MD5& md5, StringRef str)
+{
+    md5.Update(reinterpret_cast<const unsigned char*>(str.data()),
+               static_cast<unsigned long>(str.size()));
+    md5.Update(reinterpret_cast<const unsigned char*>(""), 1);
+}
+
+static std::string
+FinalHex(MD5& md5)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    unsigned char digest[16];
+    md5.Final(digest);
+    std::string hex;
+    for (int i=0; i<16; ++i)
+    {
+        hex += hexdigits[digest[i] >> 4];
+        hex += hexdigits[digest[i] & 0xf];
+    }
+    return hex;
+}
+
+static bool
+HashFile(StringRef filename, std::string* hex)
+{
+    OwningPtr<MemoryBuffer> buf;
+    if (MemoryBuffer::getFile(filename, buf))
+        return false;
+    MD5 md5;
+    md5.Update(reinterpret_cast<const unsigned char*>(buf->getBufferStart()),
+               static_cast<unsigned long>(buf->getBufferSize()));
+    *hex = FinalHex(md5);
+    return true;
+}
+
+static bool
+isEntry(StringRef name)
+{
+    return name.endswith(".o") || name.endswith(".m");
+}
+
+ObjectCache::ObjectCache(StringRef dir, uint64_t max_size)
+    : m_dir(dir)
+    , m_max_size(max_size)
+{
+    bool existed;
+    llvm::sys::fs::create_directories(m_dir, existed);
+}
+
+ObjectCache::~ObjectCache()
+{
+}
+
+void
+ObjectCache::AddOption(StringRef setting)
+{
+    m_options += setting;
+    m_options += '\0';
+}
+
+std::string
+ObjectCache::getPath(StringRef name) const
+{
+    SmallString<128> path(m_dir);
+    llvm::sys::path::append(path, name);
+    return path.str();
+}
+
+bool
+ObjectCache::Lookup(StringRef in_filename, StringRef obj_filename)
+{
+    m_main_key.clear();
+
+    OwningPtr<MemoryBuffer> in;
+    if (MemoryBuffer::getFile(in_filename, in))
+        return false;
+    MD5 main_md5;
+    AddString(main_md5, m_options);
+    AddString(main_md5, in->getBuffer());
+    m_main_key = FinalHex(main_md5);
+
+    // The manifest lists the other inputs and their hashes as of the last
+    // time this input was assembled; all must be unchanged.
+    std::string manifest_path = getPath(m_main_key + ".m");
+    OwningPtr<MemoryBuffer> manifest;
+    if (MemoryBuffer::getFile(manifest_path, manifest))
+    {
+        Count(false);
+        return false;
+    }
+
+    MD5 obj_md5;
+    AddString(obj_md5, m_main_key);
+    StringRef remainder = manifest->getBuffer();
+    while (!remainder.empty())
+    {
+        StringRef line, hash, path;
+        llvm::tie(line, remainder) = remainder.split('\n');
+        llvm::tie(hash, path) = line.split(' ');
+        std::string cur_hash;
+        if (!HashFile(path, &cur_hash) || cur_hash != hash)
+        {
+            Count(false);
+            return false;
+        }
+        AddString(obj_md5, path);
+        AddString(obj_md5, hash);
+    }
+
+    llvm::sys::PathWithStatus obj_path(getPath(FinalHex(obj_md5) + ".o"));
+    OwningPtr<MemoryBuffer> obj;
+    if (MemoryBuffer::getFile(obj_path.str(), obj))
+    {
+        Count(false);
+        return false;
+    }
+
+    std::string err;
+    raw_fd_ostream out(obj_filename.str().c_str(), err,
+                       raw_fd_ostream::F_Binary);
+    if (!err.empty())
+    {
+        Count(false);
+        return false;
+    }
+    out << obj->getBuffer();
+    out.close();
+    if (out.has_error())
+    {
+        out.clear_error();
+        bool existed;
+        llvm::sys::fs::remove(obj_filename, existed);
+        Count(false);
+        return false;
+    }
+
+    // Mark the entry as recently used.
+    if (const llvm::sys::FileStatus* status = obj_path.getFileStatus())
+    {
+        llvm::sys::FileStatus used = *status;
+        used.modTime = llvm::sys::TimeValue::now();
+        obj_path.setStatusInfoOnDisk(used);
+        llvm::sys::Path(manifest_path).setStatusInfoOnDisk(used);
+    }
+
+    Count(true);
+    return true;
+}
+
+void
+ObjectCache::Store(StringRef obj_filename,
+                   const std::vector<std::string>& inputs)
+{
+    if (m_main_key.empty())
+        return;
+
+    std::vector<std::string> sorted(inputs);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::string manifest;
+    MD5 obj_md5;
+    AddString(obj_md5, m_main_key);
+    for (std::vector<std::string>::const_iterator i=sorted.begin(),
+         end=sorted.end(); i != end; ++i)
+    {
+        std::string hash;
+        if (!HashFile(*i, &hash) || i->find('\n') != std::string::npos)
+            return;
+        manifest += hash;
+        manifest += ' ';
+        manifest += *i;
+        manifest += '\n';
+        AddString(obj_md5, *i);
+        AddString(obj_md5, hash);
+    }
+
+    OwningPtr<MemoryBuffer> obj;
+    if (MemoryBuffer::getFile(obj_filename, obj))
+        return;
+
+    // Write the object before the manifest that leads to it.
+    if (!WriteEntry(FinalHex(obj_md5) + ".o", obj->getBuffer()))
+        return;
+    if (!WriteEntry(m_main_key + ".m", manifest))
+        return;
+
+    if (m_max_size != 0)
+        Evict();
+}
+
+bool
+ObjectCache::WriteEntry(StringRef name, StringRef data)
+{
+    // Write to a temporary file and rename it into place, so that
+    // concurrent readers only ever see complete entries.
+    SmallString<128> tmp_path;
+    int fd;
+    if (llvm::sys::fs::unique_file(getPath("tmp-%%%%%%%%%%%%"), fd, tmp_path,
+                                   false, 0666))
+        return false;
+
+    bool ok;
+    {
+        raw_fd_ostream os(fd, true);
+        os << data;
+        os.close();
+        ok = !os.has_error();
+        os.clear_error();
+    }
+
+    bool existed;
+    if (!ok || llvm::sys::fs::rename(tmp_path.str(), getPath(name)))
+    {
+        llvm::sys::fs::remove(tmp_path.str(), existed);
+        return false;
+    }
+    return true;
+}
+
+static void
+ReadCounters(StringRef path, uint64_t* hits, uint64_t* misses)
+{
+    *hits = 0;
+    *misses = 0;
+    OwningPtr<MemoryBuffer> buf;
+    if (MemoryBuffer::getFile(path, buf))
+        return;
+    StringRef hits_str, misses_str;
+    llvm::tie(hits_str, misses_str) = buf->getBuffer().split(' ');
+    if (hits_str.getAsInteger(10, *hits) ||
+        misses_str.rtrim("\n").getAsInteger(10, *misses))
+    {
+        *hits = 0;
+        *misses = 0;
+    }
+}
+
+void
+ObjectCache::Count(bool hit)
+{
+    std::string lock_path = getPath(stats_lock_name);
+    bool locked = false;
+    for (int i=0; i<lock_tries; ++i)
+    {
+        bool existed;
+        if (llvm::sys::fs::create_directory(lock_path, existed))
+            return;
+        if (!existed)
+        {
+            locked = true;
+            break;
+        }
+
+        // Break a lock left behind by a process that died.
+        llvm::sys::PathWithStatus lock(lock_path);
+        const llvm::sys::FileStatus* status = lock.getFileStatus();
+        if (status && status->getTimestamp() <
+            llvm::sys::TimeValue::now() - llvm::sys::TimeValue(
+                static_cast<llvm::sys::TimeValue::SecondsType>
+                (stale_lock_age)))
+        {
+            llvm::sys::fs::remove(lock_path, existed);
+            continue;
+        }
+        SleepBriefly();
+    }
+    if (!locked)
+        return;
+
+    uint64_t hits, misses;
+    ReadCounters(getPath(stats_name), &hits, &misses);
+    if (hit)
+        ++hits;
+    else
+        ++misses;
+    SmallString<64> counters;
+    llvm::raw_svector_ostream os(counters);
+    os << hits << ' ' << misses << '\n';
+    WriteEntry(stats_name, os.str());
+
+    bool existed;
+    llvm::sys::fs::remove(lock_path, existed);
+}
+
+void
+ObjectCache::Evict()
+{
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    llvm::sys::TimeValue stale_time = llvm::sys::TimeValue::now() -
+        llvm::sys::TimeValue(static_cast<llvm::sys::TimeValue::SecondsType>
+                             (stale_tmp_age));
+
+    llvm::error_code ec;
+    for (llvm::sys::fs::directory_iterator i(m_dir, ec), end;
+         i != end && !ec; i.increment(ec))
+    {
+        StringRef name = llvm::sys::path::filename(i->path());
+        bool is_tmp = name.startswith("tmp-");
+        if (!is_tmp && !isEntry(name))
+            continue;
+        llvm::sys::PathWithStatus path(i->path());
+        const llvm::sys::FileStatus* status = path.getFileStatus();
+        if (!status)
+            continue;
+        if (is_tmp)
+        {
+            if (status->getTimestamp() < stale_time)
+            {
+                bool existed;
+                llvm::sys::fs::remove(i->path(), existed);
+            }
+            continue;
+        }
+        Entry entry;
+        entry.path = i->path();
+        entry.size = status->getSize();
+        entry.time = status->getTimestamp();
+        entries.push_back(entry);
+        total += entry.size;
+    }
+
+    if (total <= m_max_size)
+        return;
+
+    // Remove the least recently used entries, going somewhat below the
+    // limit so that eviction isn't needed again on every store.
+    uint64_t target = m_max_size - m_max_size/10;
+    std::sort(entries.begin(), entries.end());
+    for (std::vector<Entry>::const_iterator i=entries.begin(),
+         end=entries.end(); i != end && total > target; ++i)
+    {
+        bool existed;
+        if (!llvm::sys::fs::remove(i->path, existed))
+            total -= i->size;
+    }
+}
+
+void
+ObjectCache::getStats(Stats* stats) const
+{
+    stats->num_objects = 0;
+    stats->size = 0;
+
+    ReadCounters(getPath(stats_name), &stats->hits, &stats->misses);
+
+    llvm::error_code ec;
+    for (llvm::sys::fs::directory_iterator i(m_dir, ec), end;
+         i != end && !ec; i.increment(ec))
+    {
+        StringRef name = llvm::sys::path::filename(i->path());
+        if (!isEntry(name))
+            continue;
+        uint64_t size;
+        if (llvm::sys::fs::file_size(i->path(), size))
+            continue;
+        if (name.endswith(".o"))
+            ++stats->num_objects;
+        stats->size += size;
+    }
+}
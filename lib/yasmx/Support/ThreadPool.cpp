@@ -0,0 +1,231 @@
+///
+/// @file libyasmx/Support/ThreadPool.cpp
+/// @brief Fixed-size worker thread pool implementation.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+///  - Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+///  - Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include "yasmx/Support/ThreadPool.h"
+
+#include <deque>
+#include <vector>
+
+#include "llvm/Config/config.h"
+
+#if LLVM_ENABLE_THREADS && defined(HAVE_PTHREAD_H)
+#define YASM_POOL_THREADS 1
+#include <pthread.h>
+#else
+#define YASM_POOL_THREADS 0
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+
+using namespace yasm;
+
+namespace yasm {
+class ThreadPool::Impl
+{
+public:
+    Impl(unsigned int nthreads);
+    ~Impl();
+
+    void Async(const Task& task);
+    void Wait();
+
+    unsigned int m_nthreads;
+
+#if YASM_POOL_THREADS
+    static void* Worker(void* arg);
+
+    std::vector<pthread_t> m_threads;
+    std::deque<Task> m_queue;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_work_cond;     ///< signalled when work is queued
+    pthread_cond_t m_done_cond;     ///< signalled when a task completes
+    unsigned int m_active;          ///< number of tasks being executed
+    bool m_shutdown;
+#endif
+};
+} // namespace yasm
+
+#if YASM_POOL_THREADS
+ThreadPool::Impl::Impl(unsigned int nthreads)
+    : m_nthreads(0)
+    , m_active(0)
+    , m_shutdown(false)
+{
+    pthread_mutex_init(&m_lock, 0);
+    pthread_cond_init(&m_work_cond, 0);
+    pthread_cond_init(&m_done_cond, 0);
+
+    m_threads.reserve(nthreads);
+    for (unsigned int i=0; i<nthreads; ++i)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, 0, &Worker, this) != 0)
+            break;
+        m_threads.push_back(thread);
+    }
+    m_nthreads = m_threads.size();
+}
+
+ThreadPool::Impl::~Impl()
+{
+    Wait();
+
+    pthread_mutex_lock(&m_lock);
+    m_shutdown = true;
+    pthread_cond_broadcast(&m_work_cond);
+    pthread_mutex_unlock(&m_lock);
+
+    for (std::vector<pthread_t>::iterator i=m_threads.begin(),
+         end=m_threads.end(); i != end; ++i)
+        pthread_join(*i, 0);
+
+    pthread_cond_destroy(&m_done_cond);
+    pthread_cond_destroy(&m_work_cond);
+    pthread_mutex_destroy(&m_lock);
+}
+
+void*
+ThreadPool::Impl::Worker(void* arg)
+{
+    Impl* pool = static_cast<Impl*>(arg);
+    pthread_mutex_lock(&pool->m_lock);
+    for (;;)
+    {
+        while (pool->m_queue.empty() && !pool->m_shutdown)
+            pthread_cond_wait(&pool->m_work_cond, &pool->m_lock);
+        if (pool->m_queue.empty())
+            break;  // shutting down
+
+        Task task = pool->m_queue.front();
+        pool->m_queue.pop_front();
+        ++pool->m_active;
+        pthread_mutex_unlock(&pool->m_lock);
+
+        task();
+
+        pthread_mutex_lock(&pool->m_lock);
+        --pool->m_active;
+        pthread_cond_broadcast(&pool->m_done_cond);
+    }
+    pthread_mutex_unlock(&pool->m_lock);
+    return 0;
+}
+
+void
+ThreadPool::Impl::Async(const Task& task)
+{
+    if (m_nthreads == 0)
+    {
+        task();
+        return;
+    }
+    pthread_mutex_lock(&m_lock);
+    m_queue.push_back(task);
+    pthread_cond_signal(&m_work_cond);
+    pthread_mutex_unlock(&m_lock);
+}
+
+void
+ThreadPool::Impl::Wait()
+{
+    pthread_mutex_lock(&m_lock);
+    while (!m_queue.empty() || m_active != 0)
+        pthread_cond_wait(&m_done_cond, &m_lock);
+    pthread_mutex_unlock(&m_lock);
+}
+#else
+ThreadPool::Impl::Impl(unsigned int nthreads)
+    : m_nthreads(0)
+{
+}
+
+ThreadPool::Impl::~Impl()
+{
+}
+
+void
+ThreadPool::Impl::Async(const Task& task)
+{
+    task();
+}
+
+void
+ThreadPool::Impl::Wait()
+{
+}
+#endif
+
+ThreadPool::ThreadPool(unsigned int nthreads)
+    : m_impl(new Impl(nthreads))
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+}
+
+void
+ThreadPool::Async(const Task& task)
+{
+    m_impl->Async(task);
+}
+
+void
+ThreadPool::Wait()
+{
+    m_impl->Wait();
+}
+
+unsigned int
+ThreadPool::getNumThreads() const
+{
+    return m_impl->m_nthreads;
+}
+
+unsigned int
+ThreadPool::getHardwareConcurrency()
+{
+    long n = 1;
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1)
+        n = 1;
+    return static_cast<unsigned int>(n);
+}
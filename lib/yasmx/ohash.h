@@ -0,0 +1,281 @@
+#ifndef YASM_OHASH_H
+#define YASM_OHASH_H
+///
+/// @file
+/// @brief Open addressing hash table implementation.
+///
+/// @license
+///  Copyright (C) 2012  Peter Johnson
+///
+/// Redistribution and use in source and binary forms, with or without
+/// modification, are permitted provided that the following conditions
+/// are met:
+/// 1. Redistributions of source code must retain the above copyright
+///    notice, this list of conditions and the following disclaimer.
+/// 2. Redistributions in binary form must reproduce the above copyright
+///    notice, this list of conditions and the following disclaimer in the
+///    documentation and/or other materials provided with the distribution.
+///
+/// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+/// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+/// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+/// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+/// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+/// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+/// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+/// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+/// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+/// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+/// POSSIBILITY OF SUCH DAMAGE.
+/// @endlicense
+///
+#include <cctype>
+#include <cstddef>
+
+
+namespace yasm
+{
+
+/// Open addressing hash table of data pointers, with the same interface
+/// as hamt.  The table is a single flat array of (hash, pointer) slots,
+/// probed linearly, so a lookup usually touches one or two cache lines of
+/// the table and only dereferences data whose full hash matches.
+/// Template parameters:
+/// - Key: class that keys the data (e.g. std::string)
+/// - T: class that contains the data
+/// - GetKey: functor that gets a key from the data;
+///   definition should be: "Key GetKey(const T*)" or similar.
+template <typename Key, typename T, typename GetKey>
+class ohash
+{
+public:
+    /// Constructor.
+    /// @param  nocase      True if table should be case-insensitive
+    explicit ohash(bool nocase);
+
+    /// Destructor.
+    ~ohash();
+
+    /// Search for the data associated with a key in the table.
+    /// @param key          Key
+    /// @return NULL if key/data not present, otherwise data.
+    T* Find(const Key& key) const;
+
+    /// Insert keyed data into table, without replacement.
+    /// @param data         Data to insert
+    /// @return If key was already present, data from table with that key.
+    ///         If key was not present, NULL.
+    T* Insert(T* data) { return InsRep(data, false); }
+
+    /// Insert keyed data into table, with replacement.
+    /// @param data         Data to insert
+    /// @return If key was already present, old data from table with that
+    ///         key.  If key was not present, NULL.
+    T* Replace(T* data) { return InsRep(data, true); }
+
+    /// Remove the data associated with a key from the table.
+    /// @param key          Key
+    /// @return NULL if key not present, otherwise old associated data.
+    T* Remove(const Key& key);
+
+    /// Get the number of entries in the table.
+    /// @return Number of entries.
+    std::size_t size() const { return m_size; }
+
+private:
+    ohash(const ohash&);                    // not implemented
+    const ohash& operator=(const ohash&);   // not implemented
+
+    /// A slot.  Empty slots have a NULL value.
+    struct Slot
+    {
+        unsigned int hash;      ///< full hash of the value's key
+        T* value;
+    };
+
+    Slot* m_slots;
+    std::size_t m_mask;         ///< number of slots - 1; 0 if none
+    std::size_t m_size;         ///< number of used slots
+    bool m_nocase;
+
+    GetKey get_key; // functor instance
+
+    /// Insert or replace keyed data into table.
+    /// @param data     Data to insert/replace
+    /// @param replace  True if should replace
+    /// @return Old data from table; if no old data, NULL.
+    T* InsRep(T* data, bool replace);
+
+    /// Find the slot for a key.
+    /// @param key      Key
+    /// @param hash     Hash of key
+    /// @return The slot holding the key, or the empty slot where it
+    ///         would be inserted.
+    Slot* FindSlot(const Key& key, unsigned int hash) const;
+
+    /// Double the number of slots (or allocate the initial slots).
+    void Grow();
+
+    unsigned int Hash(const Key& key) const;
+    bool Equals(const Key& k1, const Key& k2) const;
+};
+
+template <typename Key, typename T, typename GetKey>
+unsigned int
+ohash<Key,T,GetKey>::Hash(const Key& key) const
+{
+    unsigned int h = 2166136261u;
+    if (m_nocase)
+    {
+        for (typename Key::const_iterator i=key.begin(), end=key.end();
+             i != end; ++i)
+            h = (h ^ std::tolower(static_cast<unsigned char>(*i))) * 16777619u;
+    }
+    else
+    {
+        for (typename Key::const_iterator i=key.begin(), end=key.end();
+             i != end; ++i)
+            h = (h ^ static_cast<unsigned char>(*i)) * 16777619u;
+    }
+    // Mix the high bits into the low bits used to index the table.
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+template <typename Key, typename T, typename GetKey>
+bool
+ohash<Key,T,GetKey>::Equals(const Key& k1, const Key& k2) const
+{
+    if (k1.size() != k2.size())
+        return false;
+    for (typename Key::const_iterator i=k1.begin(), i2=k2.begin(), end=k1.end();
+         i != end; ++i, ++i2)
+    {
+        if (*i != *i2 &&
+            (!m_nocase ||
+             std::tolower(static_cast<unsigned char>(*i)) !=
+             std::tolower(static_cast<unsigned char>(*i2))))
+            return false;
+    }
+    return true;
+}
+
+template <typename Key, typename T, typename GetKey>
+ohash<Key,T,GetKey>::ohash(bool nocase)
+    : m_slots(0)
+    , m_mask(0)
+    , m_size(0)
+    , m_nocase(nocase)
+{
+}
+
+template <typename Key, typename T, typename GetKey>
+ohash<Key,T,GetKey>::~ohash()
+{
+    delete[] m_slots;
+}
+
+template <typename Key, typename T, typename GetKey>
+typename ohash<Key,T,GetKey>::Slot*
+ohash<Key,T,GetKey>::FindSlot(const Key& key, unsigned int hash) const
+{
+    for (std::size_t i = hash & m_mask; ; i = (i+1) & m_mask)
+    {
+        Slot* slot = &m_slots[i];
+        if (slot->value == 0 ||
+            (slot->hash == hash && Equals(key, get_key(slot->value))))
+            return slot;
+    }
+}
+
+template <typename Key, typename T, typename GetKey>
+void
+ohash<Key,T,GetKey>::Grow()
+{
+    std::size_t oldnum = m_slots ? m_mask+1 : 0;
+    std::size_t num = oldnum ? oldnum*2 : 64;
+    Slot* oldslots = m_slots;
+
+    m_slots = new Slot[num];
+    m_mask = num-1;
+    for (std::size_t i=0; i<num; ++i)
+        m_slots[i].value = 0;
+
+    for (std::size_t i=0; i<oldnum; ++i)
+    {
+        if (oldslots[i].value == 0)
+            continue;
+        std::size_t j = oldslots[i].hash & m_mask;
+        while (m_slots[j].value != 0)
+            j = (j+1) & m_mask;
+        m_slots[j] = oldslots[i];
+    }
+    delete[] oldslots;
+}
+
+template <typename Key, typename T, typename GetKey>
+T*
+ohash<Key,T,GetKey>::Find(const Key& key) const
+{
+    if (m_size == 0)
+        return 0;
+    return FindSlot(key, Hash(key))->value;
+}
+
+template <typename Key, typename T, typename GetKey>
+T*
+ohash<Key,T,GetKey>::InsRep(T* data, bool replace)
+{
+    // Keep the table at most 3/4 full.
+    if (!m_slots || (m_size+1)*4 > (m_mask+1)*3)
+        Grow();
+
+    unsigned int hash = Hash(get_key(data));
+    Slot* slot = FindSlot(get_key(data), hash);
+    T* oldvalue = slot->value;
+    if (oldvalue == 0)
+    {
+        slot->hash = hash;
+        slot->value = data;
+        ++m_size;
+    }
+    else if (replace)
+        slot->value = data;
+    return oldvalue;
+}
+
+template <typename Key, typename T, typename GetKey>
+T*
+ohash<Key,T,GetKey>::Remove(const Key& key)
+{
+    if (m_size == 0)
+        return 0;
+    Slot* slot = FindSlot(key, Hash(key));
+    T* oldvalue = slot->value;
+    if (oldvalue == 0)
+        return 0;
+
+    // Shift later entries of the probe sequence back into the hole, so
+    // that lookups never need to skip deleted slots.
+    std::size_t hole = slot - m_slots;
+    for (std::size_t i = (hole+1) & m_mask; m_slots[i].value != 0;
+         i = (i+1) & m_mask)
+    {
+        std::size_t home = m_slots[i].hash & m_mask;
+        // Leave the entry if its home slot is cyclically in (hole, i].
+        if (hole <= i ? (hole < home && home <= i)
+                      : (hole < home || home <= i))
+            continue;
+        m_slots[hole] = m_slots[i];
+        hole = i;
+    }
+    m_slots[hole].value = 0;
+    --m_size;
+    return oldvalue;
+}
+
+} // namespace yasm
+
+#endif
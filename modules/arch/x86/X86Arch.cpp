@@ -57,6 +57,9 @@ X86Arch::X86Arch(const ArchModule& module)
 {
     // default to all instructions/features enabled
     m_active_cpu.set();
+
+    for (int i=0; i<MATCH_CACHE_SIZE; ++i)
+        m_match_cache[i].index = 0;
 }
 
 bool
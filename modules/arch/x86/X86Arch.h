@@ -46,6 +46,8 @@ namespace arch
 {
 
 class X86RegisterGroup;
+struct X86InsnIndex;
+struct X86InsnMatch;
 
 class YASM_STD_EXPORT X86RegTmod
 {
@@ -197,6 +199,14 @@ public:
 
     unsigned int getModeBits() const { return m_mode_bits; }
 
+    /// Look up the match index entry for an instruction group.
+    /// Results are cached, so repeated lookups are inexpensive.
+    /// @param index        instruction group match index
+    /// @param key          operand match key
+    /// @return Match index entry, or NULL if no forms can match.
+    const X86InsnMatch* FindInsnMatch(const X86InsnIndex& index,
+                                      unsigned int key) const;
+
     static const char* getName()
     { return "x86 (IA-32 and derivatives), AMD64"; }
     static const char* getKeyword() { return "x86"; }
@@ -225,6 +235,16 @@ private:
     bool m_force_strict;
     bool m_default_rel;
     NopFormat m_nop;
+
+    // Recently used instruction match index lookups
+    struct MatchCacheEntry
+    {
+        const X86InsnIndex* index;
+        unsigned int key;
+        const X86InsnMatch* match;
+    };
+    enum { MATCH_CACHE_SIZE = 256 };
+    mutable MatchCacheEntry m_match_cache[MATCH_CACHE_SIZE];
 };
 
 }} // namespace yasm::arch
@@ -585,8 +585,9 @@ arch::AppendGeneral(BytecodeContainer& container,
     }
 
     // TODO: optimize EA case
-    bc.Transform(Bytecode::Contents::Ptr(new X86General(
-        common, opcode, ea, imm, special_prefix, rex, postop, default_rel)));
+    bc.Transform(Bytecode::Contents::Ptr(new (container.getArena())
+        X86General(common, opcode, ea, imm, special_prefix, rex, postop,
+                   default_rel)));
     bc.setSource(source);
     ++num_generic_bc;
 }
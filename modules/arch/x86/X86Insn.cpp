@@ -59,6 +59,7 @@
 #endif
 
 STATISTIC(num_groups_scanned, "Total number of instruction groups scanned");
+STATISTIC(num_match_cache_hits, "Number of instruction match cache hits");
 STATISTIC(num_jmp_groups_scanned, "Total number of jump groups scanned");
 STATISTIC(num_empty_insn, "Number of empty instructions created");
 
@@ -226,6 +227,22 @@ enum X86OperandPostAction
     OPAP_SImm32Avail = 4
 };
 
+// Operand kinds used as the key for the instruction match index.
+// Must match the OPK_* values in gen_x86_insn.py.
+enum X86OperandKind
+{
+    OPK_None = 0,
+    OPK_Imm = 1,        // immediate
+    OPK_Mem = 2,        // memory
+    OPK_SegReg = 3,     // segment register
+    OPK_GPR = 4,        // general purpose or FPU register
+    OPK_SIMD = 5,       // MMX, XMM, or YMM register
+    OPK_CR = 6,         // CR register
+    OPK_DR = 7,         // DR register
+    OPK_TR = 8,         // TR register
+    OPK_Other = 9       // any other register
+};
+
 class IsRegType
 {
 public:
@@ -376,6 +393,30 @@ struct X86InsnInfo
     // operand, see above
     unsigned int operands_index:12;
 };
+
+struct X86InsnMatch
+{
+    // Match key: the kind of each operand in source order (4 bits each,
+    // see X86OperandKind), the number of operands (bits 20-22), and whether
+    // the GAS parser is active (bit 23).
+    unsigned int key;
+
+    // The index into the insn_candidates array of the group forms that can
+    // match operands with this key.  Forms are listed in group order.
+    unsigned short candidates_index;
+
+    // The number of candidate forms
+    unsigned char num_candidates;
+};
+
+struct X86InsnIndex
+{
+    // Match entries for the instruction group, sorted by key
+    const X86InsnMatch* matches;
+
+    // The number of match entries
+    unsigned int num_matches;
+};
 }} // namespace yasm::arch
 
 inline
@@ -1025,18 +1066,109 @@ X86Insn::MatchInfo(const X86InsnInfo& info, const unsigned int* size_lookup,
 #endif
 }
 
+static unsigned int
+OperandKind(const Operand& op)
+{
+    switch (op.getType())
+    {
+        case Operand::IMM:
+            return OPK_Imm;
+        case Operand::MEMORY:
+            return OPK_Mem;
+        case Operand::SEGREG:
+            return OPK_SegReg;
+        case Operand::REG:
+            switch (static_cast<const X86Register*>(op.getReg())->getType())
+            {
+                case X86Register::REG8:
+                case X86Register::REG8X:
+                case X86Register::REG16:
+                case X86Register::REG32:
+                case X86Register::REG64:
+                case X86Register::FPUREG:
+                    return OPK_GPR;
+                case X86Register::MMXREG:
+                case X86Register::XMMREG:
+                case X86Register::YMMREG:
+                    return OPK_SIMD;
+                case X86Register::CRREG:
+                    return OPK_CR;
+                case X86Register::DRREG:
+                    return OPK_DR;
+                case X86Register::TRREG:
+                    return OPK_TR;
+                default:
+                    return OPK_Other;
+            }
+        default:
+            return OPK_Other;
+    }
+}
+
+unsigned int
+X86Insn::getMatchKey() const
+{
+    unsigned int key = m_operands.size() << 20;
+    if (m_parser == X86Arch::PARSER_GAS)
+        key |= 1<<23;
+    unsigned int shift = 0;
+    for (Operands::const_iterator i = m_operands.begin(),
+         end = m_operands.end(); i != end; ++i, shift += 4)
+        key |= OperandKind(*i) << shift;
+    return key;
+}
+
+namespace {
+struct MatchKeyLess
+{
+    bool operator() (const X86InsnMatch& match, unsigned int key) const
+    { return match.key < key; }
+};
+} // anonymous namespace
+
+const X86InsnMatch*
+X86Arch::FindInsnMatch(const X86InsnIndex& index, unsigned int key) const
+{
+    // Instructions tend to be used repeatedly with the same operand kinds,
+    // so check the cache before searching the index.
+    size_t hash = reinterpret_cast<size_t>(&index);
+    hash = (hash ^ (hash >> 7) ^ key ^ (key >> 8)) % MATCH_CACHE_SIZE;
+    MatchCacheEntry& entry = m_match_cache[hash];
+    if (entry.index == &index && entry.key == key)
+    {
+        ++num_match_cache_hits;
+        return entry.match;
+    }
+
+    const X86InsnMatch* end = index.matches + index.num_matches;
+    const X86InsnMatch* match =
+        std::lower_bound(index.matches, end, key, MatchKeyLess());
+    if (match == end || match->key != key)
+        match = 0;
+
+    entry.index = &index;
+    entry.key = key;
+    entry.match = match;
+    return match;
+}
+
 const X86InsnInfo*
 X86Insn::FindMatch(const unsigned int* size_lookup, int bypass) const
 {
-    // Just do a simple linear search through the info array for a match.
-    // First match wins.
-    const X86InsnInfo* info =
-        std::find_if(&m_group[0], &m_group[m_num_info],
-                     TR1::bind(&X86Insn::MatchInfo, this, _1, size_lookup,
-                               bypass));
-    if (info == &m_group[m_num_info])
+    // Look up the forms that can match the kinds of operands present, then
+    // do a linear search through just those for a match.  The candidates
+    // are in group order, so the first match wins.
+    const X86InsnMatch* match = m_arch.FindInsnMatch(*m_index, getMatchKey());
+    if (!match)
         return 0;
-    return info;
+    const unsigned char* candidate = &insn_candidates[match->candidates_index];
+    for (unsigned int i=0; i<match->num_candidates; ++i, ++candidate)
+    {
+        const X86InsnInfo& info = m_group[*candidate];
+        if (MatchInfo(info, size_lookup, bypass))
+            return &info;
+    }
+    return 0;
 }
 
 void
@@ -1840,6 +1972,10 @@ struct InsnPrefixParseData
     // If num_info == 0, prefix
     const void* struc;
 
+    // For instruction, match index for the parse group.
+    // 0 if prefix
+    const X86InsnIndex* index;
+
     // For instruction, number of elements in group.
     // 0 if prefix
     unsigned int num_info:8;
@@ -1955,7 +2091,7 @@ X86Arch::ParseCheckInsnPrefix(StringRef id,
     if (id_len > 16)
         return InsnPrefix();
 
-    static char lcaseid[17];
+    char lcaseid[17];
     for (size_t i=0; i<id_len; i++)
         lcaseid[i] = tolower(id[i]);
     lcaseid[id_len] = '\0';
@@ -2017,6 +2153,7 @@ X86Arch::ParseCheckInsnPrefix(StringRef id,
 inline
 X86Insn::X86Insn(const X86Arch& arch,
                  const X86InsnInfo* group,
+                 const X86InsnIndex* index,
                  const X86Arch::CpuMask& active_cpu,
                  unsigned char mod_data0,
                  unsigned char mod_data1,
@@ -2030,6 +2167,7 @@ X86Insn::X86Insn(const X86Arch& arch,
                  bool default_rel)
     : m_arch(arch),
       m_group(group),
+      m_index(index),
       m_active_cpu(active_cpu),
       m_num_info(num_info),
       m_mode_bits(mode_bits),
@@ -2089,6 +2227,7 @@ X86Arch::CreateEmptyInsn() const
     return std::auto_ptr<Insn>(new X86Insn(
         *this,
         empty_insn,
+        &empty_index,
         m_active_cpu,
         0,
         0,
@@ -2111,6 +2250,7 @@ X86Arch::CreateInsn(const Arch::InsnInfo* info) const
     return std::auto_ptr<Insn>(new X86Insn(
         *this,
         static_cast<const X86InsnInfo*>(pdata->struc),
+        pdata->index,
         m_active_cpu,
         pdata->mod_data0,
         pdata->mod_data1,
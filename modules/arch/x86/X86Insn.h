@@ -40,6 +40,7 @@ namespace arch
 {
 
 struct X86InfoOperand;
+struct X86InsnIndex;
 struct X86InsnInfo;
 class X86Opcode;
 
@@ -48,6 +49,7 @@ class YASM_STD_EXPORT X86Insn : public Insn
 public:
     X86Insn(const X86Arch& arch,
             const X86InsnInfo* group,
+            const X86InsnIndex* index,
             const X86Arch::CpuMask& active_cpu,
             unsigned char mod_data0,
             unsigned char mod_data1,
@@ -92,6 +94,7 @@ private:
                          SourceLocation source,
                          DiagnosticsEngine& diags);
 
+    unsigned int getMatchKey() const;
     const X86InsnInfo* FindMatch(const unsigned int* size_lookup, int bypass)
         const;
     bool MatchInfo(const X86InsnInfo& info,
@@ -112,6 +115,9 @@ private:
     // instruction parse group - NULL if empty instruction (just prefixes)
     /*@null@*/ const X86InsnInfo* m_group;
 
+    // match index for the instruction parse group
+    const X86InsnIndex* m_index;
+
     // CPU feature flags enabled at the time of parsing the instruction
     X86Arch::CpuMask m_active_cpu;
 
@@ -312,8 +312,8 @@ arch::AppendJmp(BytecodeContainer& container,
     // same bytecode (as the distance is known)
     if (op_sel == X86_JMP_NONE)
     {
-        bc.Transform(Bytecode::Contents::Ptr(new X86Jmp(
-            common, op_sel, shortop, nearop, target, target_source)));
+        bc.Transform(Bytecode::Contents::Ptr(new (container.getArena())
+            X86Jmp(common, op_sel, shortop, nearop, target, target_source)));
         bc.setSource(source);
         ++num_jmp_bc;
         return;
@@ -326,13 +326,14 @@ arch::AppendJmp(BytecodeContainer& container,
     unsigned long orig_size = bytes.size();
     common.ToBytes(bytes, 0);
 
-    Value targetv(0, target);
-    targetv.setSource(source);
-    targetv.setJumpTarget();
-    targetv.setIPRelative();
-    targetv.setSigned();
-    targetv.setNextInsn(0);     // always 0.
-    targetv.setSource(target_source);
+    // Heap-allocated so AppendFixed() takes it over without a copy.
+    std::auto_ptr<Value> targetv(new Value(0, target));
+    targetv->setSource(source);
+    targetv->setJumpTarget();
+    targetv->setIPRelative();
+    targetv->setSigned();
+    targetv->setNextInsn(0);    // always 0.
+    targetv->setSource(target_source);
 
     if (op_sel == X86_JMP_SHORT)
     {
@@ -340,8 +341,8 @@ arch::AppendJmp(BytecodeContainer& container,
         shortop.ToBytes(bytes);
 
         // Adjust relative displacement to end of bytecode
-        targetv.AddAbs(-1);
-        targetv.setSize(8);
+        targetv->AddAbs(-1);
+        targetv->setSize(8);
     }
     else
     {
@@ -351,9 +352,9 @@ arch::AppendJmp(BytecodeContainer& container,
         unsigned int i = (common.m_opersize == 16) ? 2 : 4;
 
         // Adjust relative displacement to end of bytecode
-        targetv.AddAbs(-static_cast<long>(i));
-        targetv.setSize(i*8);
+        targetv->AddAbs(-static_cast<long>(i));
+        targetv->setSize(i*8);
     }
-    targetv.setInsnStart(bytes.size()-orig_size);
+    targetv->setInsnStart(bytes.size()-orig_size);
     bc.AppendFixed(targetv);
 }
@@ -27,6 +27,7 @@
 #
 # NOTE: operands are arranged in NASM / Intel order (e.g. dest, src)
 
+import itertools
 import sys
 
 scriptname = "gen_x86_insn.py"
@@ -488,6 +489,7 @@ class Insn(object):
         mods_str.extend(["0", "0", "0"])
 
         return ",\t".join(["%s_insn" % self.groupname,
+                           "&%s_index" % self.groupname,
                            "%d" % len(groups[self.groupname]),
                            suffix_str,
                            mods_str[0],
@@ -521,6 +523,7 @@ class Prefix(object):
                            "0",
                            "0",
                            "0",
+                           "0",
                            self.only64 and "ONLY_64" or "0",
                            "0",
                            "0",
@@ -611,6 +614,85 @@ def output_gas_insns(f):
 def output_nasm_insns(f):
     output_insns(f, "Nasm", nasm_insns)
 
+# Operand kinds, as computed for each parsed operand by X86Insn::FindMatch().
+# Must match the X86OperandKind enum in X86Insn.cpp.
+OPK_Imm = 1
+OPK_Mem = 2
+OPK_SegReg = 3
+OPK_GPR = 4         # general purpose or FPU register
+OPK_SIMD = 5        # MMX, XMM, or YMM register
+OPK_CR = 6
+OPK_DR = 7
+OPK_TR = 8
+OPK_Other = 9       # any other register
+
+# Operand kinds each operand type can possibly match.  This may be a
+# superset of what X86Insn::MatchOperand() accepts, but never a subset.
+operand_kinds = {
+    "Imm": [OPK_Imm],
+    "Imm1": [OPK_Imm],
+    "ImmNotSegOff": [OPK_Imm],
+    "Reg": [OPK_GPR],
+    "RM": [OPK_GPR, OPK_Mem],
+    "Mem": [OPK_Mem],
+    "MemOffs": [OPK_Mem],
+    "MemrAX": [OPK_Mem],
+    "MemEAX": [OPK_Mem],
+    "MemDX": [OPK_Mem],
+    "MemXMMIndex": [OPK_Mem],
+    "MemYMMIndex": [OPK_Mem],
+    "SIMDReg": [OPK_SIMD],
+    "SIMDRM": [OPK_SIMD, OPK_Mem],
+    "XMM0": [OPK_SIMD],
+    "SegReg": [OPK_SegReg],
+    "CS": [OPK_SegReg],
+    "DS": [OPK_SegReg],
+    "ES": [OPK_SegReg],
+    "FS": [OPK_SegReg],
+    "GS": [OPK_SegReg],
+    "SS": [OPK_SegReg],
+    "CRReg": [OPK_CR],
+    "CR4": [OPK_CR],
+    "DRReg": [OPK_DR],
+    "TRReg": [OPK_TR],
+    "ST0": [OPK_GPR],
+}
+
+def operand_match_kinds(op):
+    if op.type in ["Areg", "Creg", "Dreg"]:
+        # Only the register number is checked unless a size is given
+        if op.size in [8, 16, 32, 64]:
+            return [OPK_GPR]
+        return [OPK_GPR, OPK_SIMD, OPK_CR, OPK_DR, OPK_TR, OPK_Other]
+    return operand_kinds[op.type]
+
+def build_match_index(forms):
+    """Build the match index for a group of forms.  The index maps a key
+    of (GAS parser, number of operands, operand kinds in source order) to
+    the ordered list of forms that can match operands of those kinds.
+    Returns a list of (key, forms) tuples sorted by key."""
+    if len(forms) > 256:
+        raise ValueError("too many forms in group")
+    index = {}
+    for i, form in enumerate(forms):
+        num_operands = len(form.operands)
+        if num_operands > 5:
+            raise ValueError("too many operands")
+        kinds = [operand_match_kinds(op) for op in form.operands]
+        for parser in sorted(form.parsers):
+            key_base = num_operands << 20
+            form_kinds = kinds
+            if parser == "gas":
+                key_base |= 1 << 23
+                if not form.gas_no_rev:
+                    form_kinds = list(reversed(kinds))
+            for sig in itertools.product(*form_kinds):
+                key = key_base
+                for pos, kind in enumerate(sig):
+                    key |= kind << (4*pos)
+                index.setdefault(key, []).append(i)
+    return sorted((key, tuple(index[key])) for key in index)
+
 def output_groups(f):
     # Merge all operand lists into single list
     # Sort by number of operands to shorten output
@@ -637,6 +719,27 @@ def output_groups(f):
     lprint(",\n    ".join(str(x) for x in all_operands), file=f)
     lprint("};\n", file=f)
 
+    # Build match indexes, merging identical candidate lists
+    all_candidates = []
+    candidate_lists = {}
+    indexes = {}
+    for name in sorted(groups):
+        index = build_match_index(groups[name])
+        for key, forms in index:
+            if forms not in candidate_lists:
+                candidate_lists[forms] = len(all_candidates)
+                all_candidates.extend(forms)
+        indexes[name] = index
+    if len(all_candidates) > 65535:
+        raise ValueError("too many match candidates")
+
+    # Output candidate list
+    lprint("static const unsigned char insn_candidates[] = {", file=f)
+    for i in range(0, len(all_candidates), 16):
+        lprint("    %s," % ", ".join("%d" % x
+                                     for x in all_candidates[i:i+16]), file=f)
+    lprint("};\n", file=f)
+
     # Output groups
     seen = set()
     for name in groupnames_ordered:
@@ -648,6 +751,20 @@ def output_groups(f):
         lprint(",\n    ".join(str(x) for x in groups[name]), file=f)
         lprint("};\n", file=f)
 
+        index = indexes[name]
+        if not index:
+            lprint("static const X86InsnIndex %s_index = { 0, 0 };\n" % name,
+                   file=f)
+            continue
+        lprint("static const X86InsnMatch %s_match[] = {" % name, file=f)
+        lprint("   ", end='', file=f)
+        lprint(",\n    ".join("{ 0x%06X, %d, %d }" %
+                              (key, candidate_lists[forms], len(forms))
+                              for key, forms in index), file=f)
+        lprint("};\n", file=f)
+        lprint("static const X86InsnIndex %s_index = { %s_match, %d };\n" %
+               (name, name, len(index)), file=f)
+
     # Output prefixes
     for name in sorted(prefixes):
         lprint(prefixes[name].code_str(), file=f)
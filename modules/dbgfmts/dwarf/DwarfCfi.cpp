@@ -26,6 +26,7 @@
 //
 #include "DwarfCfi.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "yasmx/Basic/Diagnostic.h"
 #include "yasmx/Parse/Directive.h"
 #include "yasmx/Parse/DirHelpers.h"
@@ -102,7 +103,7 @@ IsFdeMatch::operator() (const DwarfCfiCie& cie)
     }
 
     // check for commonality in instructions
-    stdx::ptr_vector<DwarfCfiInsn>::const_iterator
+    std::vector<DwarfCfiInsn>::const_iterator
          lhs = cie.m_fde->m_insns.begin(),
          lhsend = cie.m_fde->m_insns.begin() + cie.m_num_insns,
          rhs = m_fde.m_insns.begin(),
@@ -166,7 +167,7 @@ DwarfCfiInsn::operator== (const DwarfCfiInsn& oth) const
         case DW_CFA_advance_loc1:
         case DW_CFA_advance_loc2:
         case DW_CFA_advance_loc4:
-            return m_from == oth.m_from && m_to == oth.m_to;
+            return m_to == oth.m_to;
         case DW_CFA_offset:
         case DW_CFA_offset_extended:
         case DW_CFA_offset_extended_sf:
@@ -204,90 +205,124 @@ DwarfCfiInsn::operator== (const DwarfCfiInsn& oth) const
     }
 }
 
-DwarfCfiInsn*
+unsigned long
+DwarfCfiInsn::getHash() const
+{
+    unsigned long hash = m_op;
+    switch (m_op)
+    {
+        case DW_CFA_offset:
+        case DW_CFA_offset_extended:
+        case DW_CFA_offset_extended_sf:
+        case DW_CFA_def_cfa:
+        case DW_CFA_def_cfa_sf:
+            hash = hash*31 + m_regs[0];
+            // fall through
+        case DW_CFA_def_cfa_offset:
+        case DW_CFA_def_cfa_offset_sf:
+        case DW_CFA_GNU_args_size:
+            if (m_off.isInt())
+                hash = hash*31 + static_cast<unsigned long>(m_off.getInt());
+            break;
+        case DW_CFA_restore:
+        case DW_CFA_restore_extended:
+        case DW_CFA_undefined:
+        case DW_CFA_same_value:
+        case DW_CFA_def_cfa_register:
+            hash = hash*31 + m_regs[0];
+            break;
+        case DW_CFA_register:
+            hash = (hash*31 + m_regs[0])*31 + m_regs[1];
+            break;
+        default:
+            break;
+    }
+    return hash;
+}
+
+DwarfCfiInsn
 DwarfCfiInsn::MakeOffset(unsigned int reg, const IntNum& off)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_offset, off);
-    insn->m_regs[0] = reg;
+    DwarfCfiInsn insn(DW_CFA_offset, off);
+    insn.m_regs[0] = reg;
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeRestore(unsigned int reg)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_restore);
-    insn->m_regs[0] = reg;
+    DwarfCfiInsn insn(DW_CFA_restore);
+    insn.m_regs[0] = reg;
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeUndefined(unsigned int reg)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_undefined);
-    insn->m_regs[0] = reg;
+    DwarfCfiInsn insn(DW_CFA_undefined);
+    insn.m_regs[0] = reg;
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeSameValue(unsigned int reg)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_same_value);
-    insn->m_regs[0] = reg;
+    DwarfCfiInsn insn(DW_CFA_same_value);
+    insn.m_regs[0] = reg;
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeRegister(unsigned int reg1, unsigned int reg2)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_register);
-    insn->m_regs[0] = reg1;
-    insn->m_regs[1] = reg2;
+    DwarfCfiInsn insn(DW_CFA_register);
+    insn.m_regs[0] = reg1;
+    insn.m_regs[1] = reg2;
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeDefCfa(unsigned int reg, const IntNum& off)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_def_cfa, off);
-    insn->m_regs[0] = reg;
+    DwarfCfiInsn insn(DW_CFA_def_cfa, off);
+    insn.m_regs[0] = reg;
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeDefCfaRegister(unsigned int reg)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_def_cfa_register);
-    insn->m_regs[0] = reg;
+    DwarfCfiInsn insn(DW_CFA_def_cfa_register);
+    insn.m_regs[0] = reg;
     return insn;
 }
 
-DwarfCfiInsn*
-DwarfCfiInsn::MakeAdvanceLoc(Location from, Location to)
+DwarfCfiInsn
+DwarfCfiInsn::MakeAdvanceLoc(Location to)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(DW_CFA_advance_loc);
-    insn->m_from = from;
-    insn->m_to = to;
+    DwarfCfiInsn insn(DW_CFA_advance_loc);
+    insn.m_to = to;
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeEscape(std::vector<Expr>* esc)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(CFI_escape);
-    esc->swap(insn->m_esc);
+    DwarfCfiInsn insn(CFI_escape);
+    esc->swap(insn.m_esc);
     return insn;
 }
 
-DwarfCfiInsn*
+DwarfCfiInsn
 DwarfCfiInsn::MakeValEncodedAddr(unsigned int reg,
                                  unsigned int encoding,
                                  Expr e)
 {
-    DwarfCfiInsn* insn = new DwarfCfiInsn(CFI_val_encoded_addr);
+    DwarfCfiInsn insn(CFI_val_encoded_addr);
     // somewhat of a hack to store it this way
-    insn->m_regs[0] = reg;
-    insn->m_regs[1] = encoding;
-    insn->m_esc.push_back(e);
+    insn.m_regs[0] = reg;
+    insn.m_regs[1] = encoding;
+    insn.m_esc.push_back(e);
     return insn;
 }
 
@@ -306,7 +341,7 @@ DwarfCfiInsn::~DwarfCfiInsn()
 }
 
 void
-DwarfCfiInsn::Output(DwarfCfiOutput& out)
+DwarfCfiInsn::Output(DwarfCfiOutput& out, Location* loc)
 {
     BytecodeContainer& container = out.container;
     Arch& arch = *out.debug.m_object.getArch();
@@ -320,7 +355,9 @@ DwarfCfiInsn::Output(DwarfCfiOutput& out)
             // It's safe to use CalcDist because this is run after
             // optimization.
             IntNum dist;
-            if (CalcDist(m_from, m_to, &dist))
+            Location from = *loc;
+            *loc = m_to;
+            if (CalcDist(from, m_to, &dist))
             {
                 dist /= out.debug.m_min_insn_len;
                 if (dist.isInRange(0, 0x3F))
@@ -345,7 +382,7 @@ DwarfCfiInsn::Output(DwarfCfiOutput& out)
             {
                 AppendByte(container, DW_CFA_advance_loc4);
                 Expr::Ptr e(new Expr(m_to));
-                *e -= m_from;
+                *e -= from;
                 AppendData(container, e, 4, arch, m_source, diags);
             }
             break;
@@ -481,10 +518,18 @@ DwarfCfiInsn::Output(DwarfCfiOutput& out)
 }
 
 DwarfCfiCie::DwarfCfiCie(DwarfCfiFde* fde)
-    : m_fde(fde), m_num_insns(0)
+    : m_fde(fde)
+    , m_num_insns(getNumInsns(*fde))
+    , m_next_same_hash(static_cast<size_t>(-1))
+{
+}
+
+size_t
+DwarfCfiCie::getNumInsns(const DwarfCfiFde& fde)
 {
-    for (stdx::ptr_vector<DwarfCfiInsn>::const_iterator
-         i = fde->m_insns.begin(), end = fde->m_insns.end(); i != end; ++i)
+    size_t num_insns = 0;
+    for (std::vector<DwarfCfiInsn>::const_iterator
+         i = fde.m_insns.begin(), end = fde.m_insns.end(); i != end; ++i)
     {
         switch (i->getOp())
         {
@@ -492,12 +537,26 @@ DwarfCfiCie::DwarfCfiCie(DwarfCfiFde* fde)
             case DwarfCfiInsn::DW_CFA_remember_state:
             case DwarfCfiInsn::CFI_escape:
             case DwarfCfiInsn::CFI_val_encoded_addr:
-                return;
+                return num_insns;
             default:
                 break;
         }
-        ++m_num_insns;
+        ++num_insns;
     }
+    return num_insns;
+}
+
+unsigned long
+DwarfCfiCie::getHash(const DwarfCfiFde& fde, size_t num_insns)
+{
+    unsigned long hash = fde.m_personality_encoding;
+    hash = hash*31 + fde.m_lsda_encoding;
+    hash = hash*31 + fde.m_return_column;
+    hash = hash*31 + (fde.m_signal_frame ? 1 : 0);
+    hash = hash*31 + num_insns;
+    for (size_t i=0; i<num_insns; ++i)
+        hash = hash*31 + fde.m_insns[i].getHash();
+    return hash;
 }
 
 void
@@ -600,8 +659,9 @@ DwarfCfiCie::Output(DwarfCfiOutput& out, unsigned int align)
     }
 
     // Instructions
+    Location loc = m_fde->m_start;
     for (size_t i=0; i<m_num_insns; ++i)
-        m_fde->m_insns[i].Output(out);
+        m_fde->m_insns[i].Output(out, &loc);
 
     // Align
     AppendAlign(container, Expr(align), Expr(DwarfCfiInsn::DW_CFA_nop),
@@ -615,7 +675,6 @@ DwarfCfiFde::DwarfCfiFde(const DwarfDebug& debug,
                          SourceLocation source)
     : m_source(source)
     , m_start(start)
-    , m_insns_owner(m_insns)
     , m_personality_encoding(DW_EH_PE_omit)
     , m_lsda_encoding(DW_EH_PE_omit)
     , m_return_column(debug.m_default_return_column)
@@ -627,6 +686,16 @@ DwarfCfiFde::~DwarfCfiFde()
 {
 }
 
+void
+DwarfCfiFde::Close(Location end)
+{
+    m_end = end;
+
+    // Release unused instruction capacity.
+    if (m_insns.capacity() > m_insns.size())
+        std::vector<DwarfCfiInsn>(m_insns).swap(m_insns);
+}
+
 void
 DwarfCfiFde::Output(DwarfCfiOutput& out, DwarfCfiCie& cie, unsigned int align)
 {
@@ -687,8 +756,9 @@ DwarfCfiFde::Output(DwarfCfiOutput& out, DwarfCfiCie& cie, unsigned int align)
     }
 
     // Instructions
+    Location loc = m_start;
     for (size_t i = cie.m_num_insns, end = m_insns.size(); i < end; ++i)
-        m_insns[i].Output(out);
+        m_insns[i].Output(out, &loc);
 
     // Align
     AppendAlign(container, Expr(align), Expr(DwarfCfiInsn::DW_CFA_nop),
@@ -819,8 +889,8 @@ DwarfDebug::AdvanceCfiAddress(Location loc, SourceLocation source)
 {
     if (loc == m_last_address)
         return;
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeAdvanceLoc(m_last_address, loc);
-    insn->setSource(source);
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeAdvanceLoc(loc);
+    insn.setSource(source);
     m_cur_fde->m_insns.push_back(insn);
     m_last_address = loc;
 }
@@ -926,8 +996,8 @@ DwarfDebug::DirCfiDefCfa(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeDefCfa(reg, off);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeDefCfa(reg, off);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -946,8 +1016,8 @@ DwarfDebug::DirCfiDefCfaRegister(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeDefCfaRegister(reg);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeDefCfaRegister(reg);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -966,8 +1036,8 @@ DwarfDebug::DirCfiDefCfaOffset(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeDefCfaOffset(off);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeDefCfaOffset(off);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -986,8 +1056,8 @@ DwarfDebug::DirCfiAdjustCfaOffset(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeDefCfaOffset(m_cfa_cur_offset+off);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeDefCfaOffset(m_cfa_cur_offset+off);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1008,8 +1078,8 @@ DwarfDebug::DirCfiOffset(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeOffset(reg, off);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeOffset(reg, off);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1030,8 +1100,8 @@ DwarfDebug::DirCfiRelOffset(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeOffset(reg, off-m_cfa_cur_offset);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeOffset(reg, off-m_cfa_cur_offset);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1052,8 +1122,8 @@ DwarfDebug::DirCfiRegister(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeRegister(reg1, reg2);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeRegister(reg1, reg2);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1072,8 +1142,8 @@ DwarfDebug::DirCfiRestore(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeRestore(reg);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeRestore(reg);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1092,8 +1162,8 @@ DwarfDebug::DirCfiUndefined(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeUndefined(reg);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeUndefined(reg);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1112,8 +1182,8 @@ DwarfDebug::DirCfiSameValue(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeSameValue(reg);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeSameValue(reg);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1126,8 +1196,8 @@ DwarfDebug::DirCfiRememberState(DirectiveInfo& info, DiagnosticsEngine& diags)
     m_cfa_stack.push_back(m_cfa_cur_offset);
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeRememberState();
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeRememberState();
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1146,8 +1216,8 @@ DwarfDebug::DirCfiRestoreState(DirectiveInfo& info, DiagnosticsEngine& diags)
     m_cfa_stack.pop_back();
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeRememberState();
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeRememberState();
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1182,8 +1252,8 @@ DwarfDebug::DirCfiWindowSave(DirectiveInfo& info, DiagnosticsEngine& diags)
     if (!DirCheck(info, diags, 0))
         return;
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeGNUWindowSave();
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeGNUWindowSave();
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1212,8 +1282,8 @@ DwarfDebug::DirCfiEscape(DirectiveInfo& info, DiagnosticsEngine& diags)
     }
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeEscape(&esc);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeEscape(&esc);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1240,8 +1310,8 @@ DwarfDebug::DirCfiValEncodedAddr(DirectiveInfo& info, DiagnosticsEngine& diags)
         return;
 
     AdvanceCfiAddress(info.getLocation(), info.getSource());
-    DwarfCfiInsn* insn = DwarfCfiInsn::MakeValEncodedAddr(reg, encoding, func);
-    insn->setSource(info.getSource());
+    DwarfCfiInsn insn = DwarfCfiInsn::MakeValEncodedAddr(reg, encoding, func);
+    insn.setSource(info.getSource());
     m_cur_fde->m_insns.push_back(insn);
 }
 
@@ -1353,6 +1423,10 @@ DwarfDebug::GenerateCfiSection(ObjectFormat& ofmt,
     DwarfCfiOutput out(*sect, diags, *this, m_object, eh_frame);
     std::vector<DwarfCfiCie> cies;
 
+    // CIEs are indexed by hash; CIEs with the same hash are chained.
+    // The index maps a hash to the first CIE in its chain.
+    llvm::DenseMap<unsigned long, size_t> cie_index;
+
     for (FDEs::iterator i=m_fdes.begin(), end=m_fdes.end(); i != end; ++i)
     {
         if (!eh_frame)
@@ -1364,16 +1438,37 @@ DwarfDebug::GenerateCfiSection(ObjectFormat& ofmt,
         }
 
         // Try to find an existing CIE that matches this FDE
+        unsigned long hash =
+            DwarfCfiCie::getHash(*i, DwarfCfiCie::getNumInsns(*i));
+        // Avoid the DenseMap empty and tombstone keys.
+        if (hash >= ~0UL - 1)
+            hash = 0;
         IsFdeMatch matcher(*i);
-        std::vector<DwarfCfiCie>::iterator ciep =
-            std::find_if(cies.begin(), cies.end(), matcher);
-        DwarfCfiCie* cie;
-        if (ciep != cies.end())
-            cie = &(*ciep);
-        else
+        DwarfCfiCie* cie = 0;
+        std::pair<llvm::DenseMap<unsigned long, size_t>::iterator, bool>
+            indexp = cie_index.insert(std::make_pair(hash, cies.size()));
+        if (!indexp.second)
+        {
+            for (size_t n = indexp.first->second; n != static_cast<size_t>(-1);
+                 n = cies[n].m_next_same_hash)
+            {
+                if (matcher(cies[n]))
+                {
+                    cie = &cies[n];
+                    break;
+                }
+            }
+        }
+        if (!cie)
         {
             cies.push_back(DwarfCfiCie(&(*i)));
             cie = &cies.back();
+            if (!indexp.second)
+            {
+                // Add to the front of the chain.
+                cie->m_next_same_hash = indexp.first->second;
+                indexp.first->second = cies.size()-1;
+            }
             cie->Output(out, eh_frame ? 4 : align);
         }
         i->Output(out, *cie, (eh_frame && (i+1) != m_fdes.end()) ? 4 : align);
@@ -26,7 +26,8 @@
 // ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
 // POSSIBILITY OF SUCH DAMAGE.
 //
-#include "yasmx/Support/ptr_vector.h"
+#include <vector>
+
 #include "yasmx/Expr.h"
 #include "yasmx/IntNum.h"
 #include "yasmx/Location.h"
@@ -74,27 +75,35 @@ public:
     ~DwarfCfiInsn();
 
     void setSource(SourceLocation source) { m_source = source; }
-    void Output(DwarfCfiOutput& out);
-
-    static DwarfCfiInsn* MakeAdvanceLoc(Location from, Location to);
-    static DwarfCfiInsn* MakeOffset(unsigned int reg, const IntNum& off);
-    static DwarfCfiInsn* MakeRestore(unsigned int reg);
-    static DwarfCfiInsn* MakeUndefined(unsigned int reg);
-    static DwarfCfiInsn* MakeSameValue(unsigned int reg);
-    static DwarfCfiInsn* MakeRegister(unsigned int reg1, unsigned int reg2);
-    static DwarfCfiInsn* MakeRememberState()
-    { return new DwarfCfiInsn(DW_CFA_remember_state); }
-    static DwarfCfiInsn* MakeRestoreState()
-    { return new DwarfCfiInsn(DW_CFA_restore_state); }
-    static DwarfCfiInsn* MakeDefCfa(unsigned int reg, const IntNum& off);
-    static DwarfCfiInsn* MakeDefCfaRegister(unsigned int reg);
-    static DwarfCfiInsn* MakeDefCfaOffset(const IntNum& off)
-    { return new DwarfCfiInsn(DW_CFA_def_cfa_offset, off); }
-    static DwarfCfiInsn* MakeGNUWindowSave()
-    { return new DwarfCfiInsn(DW_CFA_GNU_window_save); }
-
-    static DwarfCfiInsn* MakeEscape(std::vector<Expr>* esc);
-    static DwarfCfiInsn* MakeValEncodedAddr(unsigned int reg,
+
+    /// Output the instruction.
+    /// @param out      output state
+    /// @param loc      location advanced to by the previous advance
+    ///                 instruction (or the start of the FDE); updated if
+    ///                 this is an advance instruction
+    void Output(DwarfCfiOutput& out, Location* loc);
+
+    /// Make an advance instruction.  The location advanced from is the
+    /// location of the previous advance instruction in the FDE.
+    static DwarfCfiInsn MakeAdvanceLoc(Location to);
+    static DwarfCfiInsn MakeOffset(unsigned int reg, const IntNum& off);
+    static DwarfCfiInsn MakeRestore(unsigned int reg);
+    static DwarfCfiInsn MakeUndefined(unsigned int reg);
+    static DwarfCfiInsn MakeSameValue(unsigned int reg);
+    static DwarfCfiInsn MakeRegister(unsigned int reg1, unsigned int reg2);
+    static DwarfCfiInsn MakeRememberState()
+    { return DwarfCfiInsn(DW_CFA_remember_state); }
+    static DwarfCfiInsn MakeRestoreState()
+    { return DwarfCfiInsn(DW_CFA_restore_state); }
+    static DwarfCfiInsn MakeDefCfa(unsigned int reg, const IntNum& off);
+    static DwarfCfiInsn MakeDefCfaRegister(unsigned int reg);
+    static DwarfCfiInsn MakeDefCfaOffset(const IntNum& off)
+    { return DwarfCfiInsn(DW_CFA_def_cfa_offset, off); }
+    static DwarfCfiInsn MakeGNUWindowSave()
+    { return DwarfCfiInsn(DW_CFA_GNU_window_save); }
+
+    static DwarfCfiInsn MakeEscape(std::vector<Expr>* esc);
+    static DwarfCfiInsn MakeValEncodedAddr(unsigned int reg,
                                           unsigned int encoding,
                                           Expr e);
 
@@ -135,6 +144,9 @@ public:
 
     Op getOp() const { return m_op; }
 
+    /// Get a hash of the instruction, consistent with operator==.
+    unsigned long getHash() const;
+
     bool operator== (const DwarfCfiInsn& oth) const;
     bool operator!= (const DwarfCfiInsn& oth) const { return !(*this == oth); }
 
@@ -143,7 +155,7 @@ private:
     DwarfCfiInsn(Op op, const IntNum& off);
 
     Op m_op;
-    Location m_from, m_to;
+    Location m_to;
     unsigned int m_regs[2];
     std::vector<Expr> m_esc;
     IntNum m_off;
@@ -157,9 +169,18 @@ public:
 
     void Output(DwarfCfiOutput& out, unsigned int align);
 
+    /// Get the number of leading instructions of an FDE that can be
+    /// placed in its CIE.
+    static size_t getNumInsns(const DwarfCfiFde& fde);
+
+    /// Get a hash of the parts of an FDE that must be equal for FDEs to
+    /// share a CIE.
+    static unsigned long getHash(const DwarfCfiFde& fde, size_t num_insns);
+
     DwarfCfiFde* m_fde;
     SymbolRef m_start;
     size_t m_num_insns;
+    size_t m_next_same_hash;    ///< index of next CIE with same hash
 };
 
 class YASM_STD_EXPORT DwarfCfiFde
@@ -171,13 +192,12 @@ public:
     ~DwarfCfiFde();
 
     void Output(DwarfCfiOutput& out, DwarfCfiCie& cie, unsigned int align);
-    void Close(Location end) { m_end = end; }
+    void Close(Location end);
 
     SourceLocation m_source;
     Location m_start;
     Location m_end;
-    stdx::ptr_vector<DwarfCfiInsn> m_insns;
-    stdx::ptr_vector_owner<DwarfCfiInsn> m_insns_owner;
+    std::vector<DwarfCfiInsn> m_insns;
     Expr m_personality;
     Expr m_lsda;
     SourceLocation m_personality_source;
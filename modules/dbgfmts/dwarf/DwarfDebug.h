@@ -28,8 +28,10 @@
 //
 #include <vector>
 
+#include "llvm/ADT/StringMap.h"
 #include "yasmx/Basic/SourceLocation.h"
 #include "yasmx/Config/export.h"
+#include "yasmx/Support/ptr_vector.h"
 #include "yasmx/DebugFormat.h"
 #include "yasmx/Location.h"
 #include "yasmx/SymbolRef.h"
@@ -41,6 +43,7 @@
 
 namespace yasm {
 class BytecodeContainer;
+class Bytes;
 class DirectiveInfo;
 class FileEntry;
 class Section;
@@ -98,9 +101,13 @@ private:
 
     typedef std::vector<std::string> Dirs;
     Dirs m_dirs;
+    llvm::StringMap<unsigned long> m_dir_index;     // dir name -> m_dirs index
 
     typedef std::vector<Filename> Filenames;
     Filenames m_filenames;
+    // dir name + '\0' + file name -> m_filenames index; only maintained for
+    // files added from the source manager (see AddFile(const FileEntry*)).
+    llvm::StringMap<size_t> m_file_index;
 
     enum Format
     {
@@ -186,14 +193,14 @@ private:
                            bool asm_source,
                            /*@out@*/ Section** main_code,
                            /*@out@*/ size_t* num_line_sections);
-    void AppendLineOp(BytecodeContainer& container,
-                      unsigned int opcode);
-    void AppendLineOp(BytecodeContainer& container,
+    // Line opcodes with constant operands are written straight into the
+    // fixed bytes of the .debug_line bytecode being built.
+    void AppendLineOp(Bytes& bytes, unsigned int opcode);
+    void AppendLineOp(Bytes& bytes,
                       unsigned int opcode,
                       const IntNum& operand);
-    void AppendLineExtOp(BytecodeContainer& container,
-                         DwarfLineNumberExtOp ext_opcode);
-    void AppendLineExtOp(BytecodeContainer& container,
+    void AppendLineExtOp(Bytes& bytes, DwarfLineNumberExtOp ext_opcode);
+    void AppendLineExtOp(Bytes& bytes,
                          DwarfLineNumberExtOp ext_opcode,
                          const IntNum& operand);
     void AppendLineExtOp(BytecodeContainer& container,
@@ -206,7 +213,7 @@ private:
                              bool asm_source,
                              Section** last_code,
                              size_t* num_line_sections);
-    void GenerateLineOp(Section& debug_line,
+    void GenerateLineOp(Bytes& bytes,
                         DwarfLineState* state,
                         const DwarfLoc& loc,
                         const DwarfLoc* nextloc);
@@ -29,7 +29,7 @@
 //
 #include "DwarfDebug.h"
 
-#include <algorithm>
+#include <string>
 
 #include "llvm/Support/Path.h"
 #include "yasmx/Basic/Diagnostic.h"
@@ -103,65 +103,41 @@ struct DwarfLineState
 };
 }} // namespace yasm::dbgfmt
 
-namespace {
-class MatchFileDir
-{
-public:
-    MatchFileDir(StringRef name, unsigned long dir)
-        : m_name(name), m_dir(dir)
-    {}
-
-    bool operator() (const DwarfDebug::Filename& file)
-    {
-        if (file.filename.empty())
-            return true;
-        return (m_dir == file.dir && m_name == file.filename);
-    }
-
-private:
-    StringRef m_name;
-    unsigned long m_dir;
-};
-} // anonymous namespace
-
 unsigned long
 DwarfDebug::AddDir(StringRef dirname)
 {
     // Put the directory into the directory table (checking for duplicates)
-    Dirs::iterator d =
-        std::find(m_dirs.begin(), m_dirs.end(), dirname);
-    if (d != m_dirs.end())
-        return d-m_dirs.begin();
-
-    m_dirs.push_back(dirname);
-    return m_dirs.size()-1;
+    llvm::StringMapEntry<unsigned long>& entry =
+        m_dir_index.GetOrCreateValue(dirname, m_dirs.size());
+    if (entry.getValue() == m_dirs.size())
+        m_dirs.push_back(dirname);
+    return entry.getValue();
 }
 
 size_t
 DwarfDebug::AddFile(const FileEntry* file)
 {
-    unsigned long dir = AddDir(file->getDir()->getName());
-
-    // Put the filename into the filename table (checking for duplicates)
-    Filenames::iterator f = std::find_if(m_filenames.begin(), m_filenames.end(),
-                                         MatchFileDir(file->getName(), dir));
+    StringRef dirname = file->getDir()->getName();
+    unsigned long dir = AddDir(dirname);
 
-    size_t filenum;
-    if (f != m_filenames.end())
-    {
-        filenum = f-m_filenames.begin();
-        if (!f->filename.empty())
-            return filenum;
-    }
-    else
-    {
-        filenum = m_filenames.size();
-        m_filenames.push_back(Filename());
-    }
-    m_filenames[filenum].filename = file->getName();
-    m_filenames[filenum].dir = dir;
-    m_filenames[filenum].time = file->getModificationTime();
-    m_filenames[filenum].length = file->getSize();
+    // Put the filename into the filename table (checking for duplicates).
+    // This is only used in the absence of .file directives, so the table
+    // never has unassigned entries to fill in.
+    std::string key = dirname;
+    key += '\0';
+    key += file->getName();
+    llvm::StringMapEntry<size_t>& entry =
+        m_file_index.GetOrCreateValue(key, m_filenames.size());
+    size_t filenum = entry.getValue();
+    if (filenum != m_filenames.size())
+        return filenum;
+
+    m_filenames.push_back(Filename());
+    Filename& f = m_filenames.back();
+    f.filename = file->getName();
+    f.dir = dir;
+    f.time = file->getModificationTime();
+    f.length = file->getSize();
     return filenum;
 }
 
@@ -191,44 +167,40 @@ DwarfDebug::AddFile(unsigned long filenum, StringRef pathname)
     return filenum;
 }
 
-// Create and add a new line opcode to a section.
+// Write a line opcode.
 void
-DwarfDebug::AppendLineOp(BytecodeContainer& container,
-                          unsigned int opcode)
+DwarfDebug::AppendLineOp(Bytes& bytes, unsigned int opcode)
 {
-    AppendByte(container, opcode);
+    Write8(bytes, opcode);
 }
 
 void
-DwarfDebug::AppendLineOp(BytecodeContainer& container,
-                          unsigned int opcode,
-                          const IntNum& operand)
+DwarfDebug::AppendLineOp(Bytes& bytes,
+                         unsigned int opcode,
+                         const IntNum& operand)
 {
-    AppendByte(container, opcode);
-    AppendLEB128(container, operand, opcode == DW_LNS_advance_line,
-                 SourceLocation(), *m_diags);
+    Write8(bytes, opcode);
+    WriteLEB128(bytes, operand, opcode == DW_LNS_advance_line);
 }
 
-// Create and add a new extended line opcode to a section.
+// Write an extended line opcode.
 void
-DwarfDebug::AppendLineExtOp(BytecodeContainer& container,
-                            DwarfLineNumberExtOp ext_opcode)
+DwarfDebug::AppendLineExtOp(Bytes& bytes, DwarfLineNumberExtOp ext_opcode)
 {
-    AppendByte(container, DW_LNS_extended_op);
-    AppendLEB128(container, 1, false, SourceLocation(), *m_diags);
-    AppendByte(container, ext_opcode);
+    Write8(bytes, DW_LNS_extended_op);
+    WriteULEB128(bytes, 1);
+    Write8(bytes, ext_opcode);
 }
 
 void
-DwarfDebug::AppendLineExtOp(BytecodeContainer& container,
+DwarfDebug::AppendLineExtOp(Bytes& bytes,
                             DwarfLineNumberExtOp ext_opcode,
                             const IntNum& operand)
 {
-    AppendByte(container, DW_LNS_extended_op);
-    AppendLEB128(container, 1 + SizeLEB128(operand, false), false,
-                 SourceLocation(), *m_diags);
-    AppendByte(container, ext_opcode);
-    AppendLEB128(container, operand, false, SourceLocation(), *m_diags);
+    Write8(bytes, DW_LNS_extended_op);
+    WriteULEB128(bytes, 1 + SizeLEB128(operand, false));
+    Write8(bytes, ext_opcode);
+    WriteULEB128(bytes, operand);
 }
 
 void
@@ -246,7 +218,7 @@ DwarfDebug::AppendLineExtOp(BytecodeContainer& container,
 }
 
 void
-DwarfDebug::GenerateLineOp(Section& debug_line,
+DwarfDebug::GenerateLineOp(Bytes& bytes,
                            DwarfLineState* state,
                            const DwarfLoc& loc,
                            const DwarfLoc* nextloc)
@@ -254,47 +226,47 @@ DwarfDebug::GenerateLineOp(Section& debug_line,
     if (state->file != loc.file)
     {
         state->file = loc.file;
-        AppendLineOp(debug_line, DW_LNS_set_file, state->file);
+        AppendLineOp(bytes, DW_LNS_set_file, state->file);
     }
     if (state->column != loc.column)
     {
         state->column = loc.column;
-        AppendLineOp(debug_line, DW_LNS_set_column, state->column);
+        AppendLineOp(bytes, DW_LNS_set_column, state->column);
     }
     if (loc.discriminator != 0)
     {
-        AppendLineExtOp(debug_line, DW_LNE_set_discriminator,
+        AppendLineExtOp(bytes, DW_LNE_set_discriminator,
                         loc.discriminator);
     }
 #ifdef WITH_DWARF3
     if (loc.isa_change)
     {
         state->isa = loc.isa;
-        AppendLineOp(debug_line, DW_LNS_set_isa, state->isa);
+        AppendLineOp(bytes, DW_LNS_set_isa, state->isa);
     }
 #endif
     if (!state->is_stmt && loc.is_stmt == DwarfLoc::IS_STMT_SET)
     {
         state->is_stmt = true;
-        AppendLineOp(debug_line, DW_LNS_negate_stmt);
+        AppendLineOp(bytes, DW_LNS_negate_stmt);
     }
     else if (state->is_stmt && loc.is_stmt == DwarfLoc::IS_STMT_CLEAR)
     {
         state->is_stmt = false;
-        AppendLineOp(debug_line, DW_LNS_negate_stmt);
+        AppendLineOp(bytes, DW_LNS_negate_stmt);
     }
     if (loc.basic_block)
     {
-        AppendLineOp(debug_line, DW_LNS_set_basic_block);
+        AppendLineOp(bytes, DW_LNS_set_basic_block);
     }
 #ifdef WITH_DWARF3
     if (loc.prologue_end)
     {
-        AppendLineOp(debug_line, DW_LNS_set_prologue_end);
+        AppendLineOp(bytes, DW_LNS_set_prologue_end);
     }
     if (loc.epilogue_begin)
     {
-        AppendLineOp(debug_line, DW_LNS_set_epilogue_begin);
+        AppendLineOp(bytes, DW_LNS_set_epilogue_begin);
     }
 #endif
 
@@ -320,7 +292,7 @@ DwarfDebug::GenerateLineOp(Section& debug_line,
         || line_delta >= DWARF_LINE_BASE+DWARF_LINE_RANGE)
     {
         // Won't fit in special opcode, use (signed) line advance
-        AppendLineOp(debug_line, DW_LNS_advance_line, line_delta);
+        AppendLineOp(bytes, DW_LNS_advance_line, line_delta);
         line_delta.Zero();
     }
 
@@ -334,32 +306,32 @@ DwarfDebug::GenerateLineOp(Section& debug_line,
     if (line_delta.isZero() && addr_delta.isZero())
     {
         // Both line and addr deltas are 0: do DW_LNS_copy
-        AppendLineOp(debug_line, DW_LNS_copy);
+        AppendLineOp(bytes, DW_LNS_copy);
     }
     else if (addr_delta.getUInt() <= DWARF_MAX_SPECIAL_ADDR_DELTA &&
              opcode1 <= 255)
     {
         // Addr delta in range of special opcode
-        AppendLineOp(debug_line, opcode1);
+        AppendLineOp(bytes, opcode1);
     }
     else if (addr_delta.getUInt() <= 2*DWARF_MAX_SPECIAL_ADDR_DELTA &&
              opcode2 <= 255)
     {
         // Addr delta in range of const_add_pc + special
-        AppendLineOp(debug_line, DW_LNS_const_add_pc);
-        AppendLineOp(debug_line, opcode2);
+        AppendLineOp(bytes, DW_LNS_const_add_pc);
+        AppendLineOp(bytes, opcode2);
     }
     else
     {
         // Need advance_pc
-        AppendLineOp(debug_line, DW_LNS_advance_pc, addr_delta);
+        AppendLineOp(bytes, DW_LNS_advance_pc, addr_delta);
         // Take care of any remaining line_delta and add entry to matrix
         if (line_delta.isZero())
-            AppendLineOp(debug_line, DW_LNS_copy);
+            AppendLineOp(bytes, DW_LNS_copy);
         else
         {
-            AppendLineOp(debug_line, DWARF_LINE_OPCODE_BASE +
-                                     line_delta.getInt() - DWARF_LINE_BASE);
+            AppendLineOp(bytes, DWARF_LINE_OPCODE_BASE +
+                                line_delta.getInt() - DWARF_LINE_BASE);
         }
     }
     state->prevloc = loc.loc;
@@ -439,6 +411,10 @@ DwarfDebug::GenerateLineSection(Section& sect,
     AppendLineExtOp(debug_line, DW_LNE_set_address, m_sizeof_address,
                     sect.getSymbol());
 
+    // Everything else in the sequence has constant operands, so it is
+    // written directly into a single run of fixed bytes.
+    Bytes& bytes = debug_line.FreshBytecode().getFixed();
+
     if (asm_source)
     {
 #if 0
@@ -458,7 +434,7 @@ DwarfDebug::GenerateLineSection(Section& sect,
              end=dwarf2sect->locs.end(); i != end; ++i)
         {
             DwarfSection::Locs::const_iterator next = i+1;
-            GenerateLineOp(debug_line, &state, *i, next != end ? &*next : 0);
+            GenerateLineOp(bytes, &state, *i, next != end ? &*next : 0);
         }
     }
 
@@ -470,10 +446,10 @@ DwarfDebug::GenerateLineSection(Section& sect,
     IntNum addr_delta;
     CalcDist(state.prevloc, sect.getEndLoc(), &addr_delta);
     if (addr_delta == DWARF_MAX_SPECIAL_ADDR_DELTA)
-        AppendLineOp(debug_line, DW_LNS_const_add_pc);
+        AppendLineOp(bytes, DW_LNS_const_add_pc);
     else if (addr_delta > 0)
-        AppendLineOp(debug_line, DW_LNS_advance_pc, addr_delta);
-    AppendLineExtOp(debug_line, DW_LNE_end_sequence);
+        AppendLineOp(bytes, DW_LNS_advance_pc, addr_delta);
+    AppendLineExtOp(bytes, DW_LNE_end_sequence);
 }
 
 Section&
@@ -642,8 +618,7 @@ DwarfDebug::DirLoc(DirectiveInfo& info, DiagnosticsEngine& diags)
     // Defaults for optional settings
     Bytecode& herebc = info.getObject().getCurSection()->FreshBytecode();
     Location here = { &herebc, herebc.getFixedLen() };
-    std::auto_ptr<DwarfLoc> loc(new DwarfLoc(here, info.getSource(),
-                                             file.getUInt(), line.getUInt()));
+    DwarfLoc loc(here, info.getSource(), file.getUInt(), line.getUInt());
 
     // Optional column number
     ++nv;
@@ -656,7 +631,7 @@ DwarfDebug::DirLoc(DirectiveInfo& info, DiagnosticsEngine& diags)
                          diag::err_loc_column_number_not_integer);
             return;
         }
-        loc->column = col_e.getIntNum().getUInt();
+        loc.column = col_e.getIntNum().getUInt();
         ++nv;
     }
 
@@ -687,9 +662,9 @@ restart:
             }
             IntNum is_stmt = is_stmt_e.getIntNum();
             if (is_stmt.isZero())
-                loc->is_stmt = DwarfLoc::IS_STMT_SET;
+                loc.is_stmt = DwarfLoc::IS_STMT_SET;
             else if (is_stmt.isPos1())
-                loc->is_stmt = DwarfLoc::IS_STMT_CLEAR;
+                loc.is_stmt = DwarfLoc::IS_STMT_CLEAR;
             else
             {
                 diags.Report(nv->getValueRange().getBegin(),
@@ -720,8 +695,8 @@ restart:
                              diag::err_loc_isa_less_than_zero);
                 return;
             }
-            loc->isa_change = true;
-            loc->isa = isa.getUInt();
+            loc.isa_change = true;
+            loc.isa = isa.getUInt();
         }
         else if (in_discriminator)
         {
@@ -746,7 +721,7 @@ restart:
                              diag::err_loc_discriminator_less_than_zero);
                 return;
             }
-            loc->discriminator = discriminator;
+            loc.discriminator = discriminator;
         }
         else if (name.empty() && nv->isId())
         {
@@ -758,11 +733,11 @@ restart:
             else if (s.equals_lower("discriminator"))
                 in_discriminator = true;
             else if (s.equals_lower("basic_block"))
-                loc->basic_block = true;
+                loc.basic_block = true;
             else if (s.equals_lower("prologue_end"))
-                loc->prologue_end = true;
+                loc.prologue_end = true;
             else if (s.equals_lower("epilogue_begin"))
-                loc->epilogue_begin = true;
+                loc.epilogue_begin = true;
             else
                 diags.Report(nv->getValueRange().getBegin(),
                              diag::warn_unrecognized_loc_option) << s;
@@ -801,7 +776,7 @@ restart:
     }
 
     // Append new location
-    dwarf2sect->locs.push_back(loc.release());
+    dwarf2sect->locs.push_back(loc);
 }
 
 void
@@ -27,7 +27,8 @@
 // POSSIBILITY OF SUCH DAMAGE.
 //
 #include "yasmx/Basic/SourceLocation.h"
-#include "yasmx/Support/ptr_vector.h"
+#include <vector>
+
 #include "yasmx/AssocData.h"
 #include "yasmx/IntNum.h"
 #include "yasmx/Location.h"
@@ -83,8 +84,8 @@ public:
 #endif // WITH_XML
 
     /// The locations set by the .loc directives in this section, in assembly
-    /// source order.
-    typedef stdx::ptr_vector<DwarfLoc> Locs;
+    /// source order.  Stored by value, as there is one per .loc directive.
+    typedef std::vector<DwarfLoc> Locs;
     Locs locs;
 };
 
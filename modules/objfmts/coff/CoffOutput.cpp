@@ -41,6 +41,7 @@
 #include "yasmx/IntNum.h"
 #include "yasmx/Location_util.h"
 #include "yasmx/Object.h"
+#include "yasmx/OutputImage.h"
 #include "yasmx/Reloc.h"
 #include "yasmx/Section.h"
 #include "yasmx/StringTable.h"
@@ -59,7 +60,7 @@ namespace {
 class CoffOutput : public BytecodeStreamOutput
 {
 public:
-    CoffOutput(raw_ostream& os,
+    CoffOutput(OutputImage& os,
                CoffObject& objfmt,
                Object& object,
                bool all_syms,
@@ -78,6 +79,8 @@ public:
                              NumericOutput& num_out);
 
 private:
+    bool isOutputSymbol(const Symbol& sym) const;
+
     CoffObject& m_objfmt;
     CoffSection* m_coffsect;
     Object& m_object;
@@ -87,7 +90,7 @@ private:
 };
 } // anonymous namespace
 
-CoffOutput::CoffOutput(raw_ostream& os,
+CoffOutput::CoffOutput(OutputImage& os,
                        CoffObject& objfmt,
                        Object& object,
                        bool all_syms,
@@ -96,7 +99,7 @@ CoffOutput::CoffOutput(raw_ostream& os,
     , m_objfmt(objfmt)
     , m_object(object)
     , m_all_syms(all_syms)
-    , m_strtab(4)   // first 4 bytes in string table are length
+    , m_strtab(4, true) // first 4 bytes in string table are length
     , m_no_output(diags)
 {
 }
@@ -438,14 +441,12 @@ CoffOutput::CountSymbols()
     for (Object::symbol_iterator i = m_object.symbols_begin(),
          end = m_object.symbols_end(); i != end; ++i)
     {
+        if (!isOutputSymbol(*i))
+            continue;
+
         int vis = i->getVisibility();
         CoffSymbol* coffsym = i->getAssocData<CoffSymbol>();
 
-        // Don't output local syms unless outputting all syms
-        if (!m_all_syms && vis == Symbol::LOCAL && !i->isAbsoluteSymbol()
-            && !(coffsym && coffsym->m_forcevis))
-            continue;
-
         // Create basic coff symbol data if it doesn't already exist
         if (!coffsym)
         {
@@ -468,19 +469,43 @@ CoffOutput::CountSymbols()
     return indx;
 }
 
+bool
+CoffOutput::isOutputSymbol(const Symbol& sym) const
+{
+    const CoffSymbol* coffsym = sym.getAssocData<CoffSymbol>();
+
+    // Don't output local syms unless outputting all syms
+    return m_all_syms || sym.getVisibility() != Symbol::LOCAL
+        || sym.isAbsoluteSymbol() || (coffsym && coffsym->m_forcevis);
+}
+
 void
 CoffOutput::OutputSymbolTable()
 {
+    // Symbols refer directly into the string table, so lay it out first
+    // and move the long section names to their final offsets.
     for (Object::const_symbol_iterator i = m_object.symbols_begin(),
          end = m_object.symbols_end(); i != end; ++i)
     {
-        const CoffSymbol* coffsym = i->getAssocData<CoffSymbol>();
+        if (isOutputSymbol(*i))
+            i->getAssocData<CoffSymbol>()->AddStrings(m_strtab, *i);
+    }
+    m_strtab.Finalize();
+    for (Object::section_iterator i=m_object.sections_begin(),
+         end=m_object.sections_end(); i != end; ++i)
+    {
+        CoffSection* coffsect = i->getAssocData<CoffSection>();
+        coffsect->m_strtab_name =
+            m_strtab.getFinalIndex(coffsect->m_strtab_name);
+    }
 
-        // Don't output local syms unless outputting all syms
-        if (!m_all_syms && i->getVisibility() == Symbol::LOCAL
-            && !i->isAbsoluteSymbol() && !(coffsym && coffsym->m_forcevis))
+    for (Object::const_symbol_iterator i = m_object.symbols_begin(),
+         end = m_object.symbols_end(); i != end; ++i)
+    {
+        if (!isOutputSymbol(*i))
             continue;
 
+        const CoffSymbol* coffsym = i->getAssocData<CoffSymbol>();
         Bytes& bytes = getScratch();
         assert(coffsym != 0);
         coffsym->Write(bytes, *i, getDiagnostics(), m_strtab);
@@ -508,7 +533,7 @@ CoffOutput::OutputSectionHeader(const Section& sect)
 }
 
 void
-CoffObject::Output(raw_fd_ostream& os,
+CoffObject::Output(raw_fd_ostream& fd_os,
                    bool all_syms,
                    DebugFormat& dbgfmt,
                    DiagnosticsEngine& diags)
@@ -524,6 +549,7 @@ CoffObject::Output(raw_fd_ostream& os,
     // addends in the generated code.
     unsigned int scnum = 1;
     unsigned long addr = 0;
+    size_t image_size = 0;
     for (Object::section_iterator i=m_object.sections_begin(),
          end=m_object.sections_end(); i != end; ++i)
     {
@@ -544,8 +570,16 @@ CoffObject::Output(raw_fd_ostream& os,
                 i->setVMA(0);
             addr += i->bytecodes_back().getNextOffset();
         }
+        if (!i->isBSS())
+            image_size += i->bytecodes_back().getNextOffset();
     }
 
+    // Build the file image in place, preallocating space for the headers
+    // and the section data.  Section data is written directly into place
+    // in the image.
+    image_size += 20+40*(scnum-1);
+    OutputImage os(fd_os, m_object.getObjectFilename(), image_size);
+
     // Allocate space for headers by seeking forward.
     os.seek(20+40*(scnum-1));
     if (os.has_error())
@@ -620,4 +654,6 @@ CoffObject::Output(raw_fd_ostream& os,
     {
         out.OutputSectionHeader(*i);
     }
+
+    os.Finish();
 }
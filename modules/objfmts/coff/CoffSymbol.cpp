@@ -85,6 +85,22 @@ CoffSymbol::Write(pugi::xml_node out) const
 }
 #endif // WITH_XML
 
+void
+CoffSymbol::AddStrings(StringTable& strtab, const Symbol& sym) const
+{
+    if (!sym.isAbsoluteSymbol() && sym.getName().size() > 8)
+        strtab.Add(sym.getName());
+
+    if (m_auxtype != AUX_FILE)
+        return;
+    for (std::vector<AuxEntry>::const_iterator i=m_aux.begin(), end=m_aux.end();
+         i != end; ++i)
+    {
+        if (i->fname.length() > 18)
+            strtab.Add(i->fname);
+    }
+}
+
 void
 CoffSymbol::Write(Bytes& bytes,
                   const Symbol& sym,
@@ -103,6 +103,9 @@ struct YASM_STD_EXPORT CoffSymbol : public AssocData
                DiagnosticsEngine& diags,
                StringTable& strtab) const;
 
+    /// Add the names Write() will place in the string table.
+    void AddStrings(StringTable& strtab, const Symbol& sym) const;
+
     bool m_forcevis;                ///< force visibility in symbol table
     unsigned long m_index;          ///< assigned COFF symbol table index
     StorageClass m_sclass;          ///< storage class
@@ -50,13 +50,18 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 #include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/Basic/DiagnosticBuffer.h"
 #include "yasmx/Basic/SourceManager.h"
+#include "yasmx/Config/functional.h"
 #include "yasmx/Parse/Directive.h"
 #include "yasmx/Parse/DirHelpers.h"
 #include "yasmx/Parse/NameValue.h"
 #include "yasmx/Support/bitcount.h"
+#include "yasmx/Support/ptr_vector.h"
 #include "yasmx/Support/registry.h"
 #include "yasmx/Support/scoped_array.h"
+#include "yasmx/Support/scoped_ptr.h"
+#include "yasmx/Support/ThreadPool.h"
 #include "yasmx/Arch.h"
 #include "yasmx/BytecodeContainer.h"
 #include "yasmx/BytecodeOutput.h"
@@ -67,6 +72,7 @@
 #include "yasmx/Location_util.h"
 #include "yasmx/Object.h"
 #include "yasmx/Object_util.h"
+#include "yasmx/OutputImage.h"
 #include "yasmx/Section.h"
 #include "yasmx/StringTable.h"
 #include "yasmx/Symbol_util.h"
@@ -759,7 +765,7 @@ namespace {
 class ElfOutput : public BytecodeStreamOutput
 {
 public:
-    ElfOutput(raw_fd_ostream& os,
+    ElfOutput(OutputImage& os,
               ElfObject& objfmt,
               Object& object,
               DiagnosticsEngine& diags);
@@ -768,6 +774,14 @@ public:
     void OutputGroup(ElfGroup& group);
     void OutputSection(Section& sect, StringTable& shstrtab);
 
+    /// Output all user sections, generating the contents of each section
+    /// in parallel.  The resulting file contents are identical to calling
+    /// OutputSection() on each section in order.
+    void OutputSections(StringTable& shstrtab, ThreadPool& pool);
+
+    /// Output section contents at the current position.
+    void OutputContents(Section& sect);
+
     // OutputBytecode overrides
     bool ConvertValueToBytes(Value& value,
                              Location loc,
@@ -779,23 +793,26 @@ public:
     bool NeedsGOT() const { return m_needs_GOT; }
 
 private:
+    bool BeginSection(Section& sect, StringTable& shstrtab);
+    void EndSection(Section& sect, StringTable& shstrtab);
+
     ElfObject& m_objfmt;
     Object& m_object;
-    raw_fd_ostream& m_fd_os;
+    OutputImage& m_image;
     BytecodeNoOutput m_no_output;
     SymbolRef m_GOT_sym;
     bool m_needs_GOT;
 };
 } // anonymous namespace
 
-ElfOutput::ElfOutput(raw_fd_ostream& os,
+ElfOutput::ElfOutput(OutputImage& os,
                      ElfObject& objfmt,
                      Object& object,
                      DiagnosticsEngine& diags)
     : BytecodeStreamOutput(os, diags)
     , m_objfmt(objfmt)
     , m_object(object)
-    , m_fd_os(os)
+    , m_image(os)
     , m_no_output(diags)
     , m_GOT_sym(object.FindSymbol("_GLOBAL_OFFSET_TABLE_"))
     , m_needs_GOT(false)
@@ -944,7 +961,7 @@ ElfOutput::OutputGroup(ElfGroup& group)
         return;
     }
 
-    m_fd_os.seek(group.elfsect->setFileOffset(pos));
+    m_image.seek(group.elfsect->setFileOffset(pos));
     if (m_os.has_error())
     {
         Diag(SourceLocation(), diag::err_file_output_seek);
@@ -973,11 +990,9 @@ ElfOutput::OutputGroup(ElfGroup& group)
     OutputBytes(scratch, SourceLocation());
 }
 
-void
-ElfOutput::OutputSection(Section& sect, StringTable& shstrtab)
+bool
+ElfOutput::BeginSection(Section& sect, StringTable& shstrtab)
 {
-    BytecodeOutput* outputter = this;
-
     ElfSection* elfsect = sect.getAssocData<ElfSection>();
     assert(elfsect != 0);
 
@@ -986,29 +1001,35 @@ ElfOutput::OutputSection(Section& sect, StringTable& shstrtab)
 
     elfsect->setName(shstrtab.getIndex(sect.getName()));
 
-    uint64_t pos;
+    // Don't output BSS sections; position = 0 because it's not in the file.
     if (sect.isBSS())
+        return true;
+
+    uint64_t pos = m_os.tell();
+    if (m_os.has_error())
     {
-        // Don't output BSS sections.
-        outputter = &m_no_output;
-        pos = 0;    // position = 0 because it's not in the file
+        Diag(SourceLocation(), diag::err_file_output_position);
+        return false;
     }
-    else
-    {
-        pos = m_os.tell();
-        if (m_os.has_error())
-        {
-            Diag(SourceLocation(), diag::err_file_output_position);
-            return;
-        }
 
-        m_fd_os.seek(elfsect->setFileOffset(pos));
-        if (m_os.has_error())
-        {
-            Diag(SourceLocation(), diag::err_file_output_seek);
-            return;
-        }
+    m_image.seek(elfsect->setFileOffset(pos));
+    if (m_os.has_error())
+    {
+        Diag(SourceLocation(), diag::err_file_output_seek);
+        return false;
     }
+    return true;
+}
+
+void
+ElfOutput::OutputContents(Section& sect)
+{
+    BytecodeOutput* outputter = this;
+    if (sect.isBSS())
+        outputter = &m_no_output;
+
+    ElfSection* elfsect = sect.getAssocData<ElfSection>();
+    assert(elfsect != 0);
 
     // Output bytecodes
     for (Section::bc_iterator i=sect.bytecodes_begin(),
@@ -1017,10 +1038,17 @@ ElfOutput::OutputSection(Section& sect, StringTable& shstrtab)
         if (i->Output(*outputter))
             elfsect->AddSize(i->getTotalLen());
     }
+}
 
+void
+ElfOutput::EndSection(Section& sect, StringTable& shstrtab)
+{
     if (getDiagnostics().hasErrorOccurred())
         return;
 
+    ElfSection* elfsect = sect.getAssocData<ElfSection>();
+    assert(elfsect != 0);
+
     // Sanity check final section size
     assert(elfsect->getSize() == sect.bytecodes_back().getNextOffset());
 
@@ -1037,8 +1065,102 @@ ElfOutput::OutputSection(Section& sect, StringTable& shstrtab)
     elfsect->setRelName(shstrtab.getIndex(relname));
 }
 
+void
+ElfOutput::OutputSection(Section& sect, StringTable& shstrtab)
+{
+    if (!BeginSection(sect, shstrtab))
+        return;
+    OutputContents(sect);
+    EndSection(sect, shstrtab);
+}
+
+namespace {
+/// The contents of a single section, generated through a window onto its
+/// place in the output image so that sections may be generated
+/// concurrently.  Relocations are attached to the section as usual.
+/// Diagnostics are buffered for replay in section order.
+class ElfSectionContents
+{
+public:
+    ElfSectionContents(Section& sect,
+                       OutputImage& image,
+                       uint64_t offset,
+                       ElfObject& objfmt,
+                       Object& object,
+                       const DiagnosticsEngine& diags)
+        : m_sect(sect)
+        , m_diags(m_diag_buffer.CreateEngine(diags))
+        , m_image(image, offset,
+                  sect.isBSS() ? 0 : sect.bytecodes_back().getNextOffset())
+        , m_out(m_image, objfmt, object, *m_diags)
+    {}
+
+    void Generate() { m_out.OutputContents(m_sect); }
+
+    Section& m_sect;
+    DiagnosticBuffer m_diag_buffer;
+    util::scoped_ptr<DiagnosticsEngine> m_diags;
+    OutputImage m_image;
+    ElfOutput m_out;
+};
+} // anonymous namespace
+
+void
+ElfOutput::OutputSections(StringTable& shstrtab, ThreadPool& pool)
+{
+    // Lay out the sections first, as BeginSection() will, and make space
+    // for all of them in the image so the windows onto it stay valid.
+    std::vector<uint64_t> offsets;
+    offsets.reserve(m_object.getNumSections());
+    uint64_t pos = m_os.tell();
+    for (Object::section_iterator i=m_object.sections_begin(),
+         end=m_object.sections_end(); i != end; ++i)
+    {
+        ElfSection* elfsect = i->getAssocData<ElfSection>();
+        assert(elfsect != 0);
+        if (elfsect->getAlign() == 0)
+            elfsect->setAlign(i->getAlign());
+        if (i->isBSS())
+        {
+            offsets.push_back(pos);
+            continue;
+        }
+        offsets.push_back(elfsect->setFileOffset(pos));
+        pos = offsets.back() + i->bytecodes_back().getNextOffset();
+    }
+    m_image.reserve(pos);
+
+    stdx::ptr_vector<ElfSectionContents> parts;
+    stdx::ptr_vector_owner<ElfSectionContents> parts_owner(parts);
+
+    std::vector<uint64_t>::const_iterator offset = offsets.begin();
+    for (Object::section_iterator i=m_object.sections_begin(),
+         end=m_object.sections_end(); i != end; ++i, ++offset)
+    {
+        parts.push_back(new ElfSectionContents(*i, m_image, *offset,
+                                               m_objfmt, m_object,
+                                               getDiagnostics()));
+        pool.Async(TR1::bind(&ElfSectionContents::Generate, &parts.back()));
+    }
+    pool.Wait();
+
+    // Finish the sections in order.
+    for (stdx::ptr_vector<ElfSectionContents>::iterator part=parts.begin(),
+         end=parts.end(); part != end; ++part)
+    {
+        part->m_diag_buffer.Replay(getDiagnostics());
+        if (part->m_out.NeedsGOT())
+            m_needs_GOT = true;
+
+        if (!BeginSection(part->m_sect, shstrtab))
+            continue;
+        part->m_image.WriteTo(m_image);
+        EndSection(part->m_sect, shstrtab);
+    }
+}
+
 static unsigned long
-ElfAlignOutput(raw_fd_ostream& os,
+ElfAlignOutput(OutputImage& os,
                unsigned int align,
                DiagnosticsEngine& diags)
 {
@@ -1065,13 +1187,60 @@ ElfAlignOutput(raw_fd_ostream& os,
     return static_cast<unsigned long>(pos);
 }
 
+/// Write the relocation entries of a section into a separate buffer.
+static void
+ElfWriteRelocEntries(ElfSection* elfsect, Section* sect, OutputImage* os)
+{
+    Bytes scratch;
+    elfsect->WriteRelocEntries(*os, *sect, scratch);
+}
+
+void
+ElfObject::OutputRelocsParallel(OutputImage& os, DiagnosticsEngine& diags)
+{
+    stdx::ptr_vector<OutputImage> relocs;
+    stdx::ptr_vector_owner<OutputImage> relocs_owner(relocs);
+
+    // Generate the entries of each relocation section in parallel.
+    for (Object::section_iterator i=m_object.sections_begin(),
+         end=m_object.sections_end(); i != end; ++i)
+    {
+        if (i->getRelocs().size() == 0)
+            continue;
+
+        ElfSection* elfsect = i->getAssocData<ElfSection>();
+        assert(elfsect != 0);
+
+        relocs.push_back(new OutputImage);
+        m_pool->Async(TR1::bind(&ElfWriteRelocEntries, elfsect, &*i,
+                                &relocs.back()));
+    }
+    m_pool->Wait();
+
+    // Lay out the relocation sections in order, as WriteRelocs() would.
+    stdx::ptr_vector<OutputImage>::iterator reloc = relocs.begin();
+    for (Object::section_iterator i=m_object.sections_begin(),
+         end=m_object.sections_end(); i != end; ++i)
+    {
+        if (i->getRelocs().size() == 0)
+            continue;
+
+        ElfSection* elfsect = i->getAssocData<ElfSection>();
+        elfsect->setRelIndex(m_config.secthead_count++);
+        elfsect->setRelFileOffset(ElfAlignOutput(os, 4, diags));
+        reloc->WriteTo(os);
+        ++reloc;
+    }
+}
+
 void
-ElfObject::Output(raw_fd_ostream& os,
+ElfObject::Output(raw_fd_ostream& fd_os,
                   bool all_syms,
                   DebugFormat& dbgfmt,
                   DiagnosticsEngine& diags)
 {
-    StringTable shstrtab, strtab;
+    // Names are interned and merged by tail when the tables are laid out.
+    StringTable shstrtab(0, true), strtab(0, true);
     unsigned int align = (m_config.cls == ELFCLASS32) ? 4 : 8;
 
     // XXX: ugly workaround to prevent all_syms from kicking in
@@ -1108,6 +1277,18 @@ ElfObject::Output(raw_fd_ostream& os,
         }
     }
 
+    // Build the file image in place, preallocating space for the Ehdr and
+    // the section data (the sizes of which are known at this point).
+    // Section data is written directly into place in the image.
+    size_t image_size = m_config.getProgramHeaderSize();
+    for (Object::section_iterator i=m_object.sections_begin(),
+         end=m_object.sections_end(); i != end; ++i)
+    {
+        if (!i->isBSS())
+            image_size += i->bytecodes_back().getNextOffset();
+    }
+    OutputImage os(fd_os, m_object.getObjectFilename(), image_size);
+
     // Allocate space for Ehdr by seeking forward
     os.seek(m_config.getProgramHeaderSize());
     if (os.has_error())
@@ -1239,10 +1420,17 @@ ElfObject::Output(raw_fd_ostream& os,
 
     // Output user sections.
     // Assign indices and names as we go (including relocation section names).
-    for (Object::section_iterator i=m_object.sections_begin(),
-         end=m_object.sections_end(); i != end; ++i)
+    bool parallel = m_pool && m_pool->getNumThreads() > 0 &&
+        m_object.getNumSections() > 1;
+    if (parallel)
+        out.OutputSections(shstrtab, *m_pool);
+    else
     {
-        out.OutputSection(*i, shstrtab);
+        for (Object::section_iterator i=m_object.sections_begin(),
+             end=m_object.sections_end(); i != end; ++i)
+        {
+            out.OutputSection(*i, shstrtab);
+        }
     }
 
     // Go through relocations and force referenced symbols into symbol table,
@@ -1303,6 +1491,33 @@ ElfObject::Output(raw_fd_ostream& os,
     ElfStringIndex strtab_name = shstrtab.getIndex(".strtab");
     ElfStringIndex symtab_name = shstrtab.getIndex(".symtab");
 
+    // Lay out the string tables and move all names given out so far to
+    // their final indices.
+    shstrtab.Finalize();
+    strtab.Finalize();
+    shstrtab_name = shstrtab.getFinalIndex(shstrtab_name);
+    strtab_name = shstrtab.getFinalIndex(strtab_name);
+    symtab_name = shstrtab.getFinalIndex(symtab_name);
+    for (Groups::iterator i=m_groups.begin(), end=m_groups.end(); i != end; ++i)
+    {
+        ElfSection& elfsect = *i->elfsect;
+        elfsect.setName(shstrtab.getFinalIndex(elfsect.getName()));
+    }
+    for (Object::section_iterator i=m_object.sections_begin(),
+         end=m_object.sections_end(); i != end; ++i)
+    {
+        ElfSection* elfsect = i->getAssocData<ElfSection>();
+        elfsect->setName(shstrtab.getFinalIndex(elfsect->getName()));
+        elfsect->setRelName(shstrtab.getFinalIndex(elfsect->getRelName()));
+    }
+    for (Object::symbol_iterator i=m_object.symbols_begin(),
+         end=m_object.symbols_end(); i != end; ++i)
+    {
+        ElfSymbol* elfsym = i->getAssocData<ElfSymbol>();
+        if (elfsym)
+            elfsym->setName(strtab.getFinalIndex(elfsym->getName()));
+    }
+
     // section header string table (.shstrtab)
     offset = ElfAlignOutput(os, align, diags);
     size = shstrtab.getSize();
@@ -1339,19 +1554,25 @@ ElfObject::Output(raw_fd_ostream& os,
     symtab_sect.setLink(strtab_sect.getIndex());    // link to .strtab
 
     // output relocations
-    for (Object::section_iterator i=m_object.sections_begin(),
-         end=m_object.sections_end(); i != end; ++i)
+    if (parallel)
+        OutputRelocsParallel(os, diags);
+    else
     {
-        // No relocations to output?  Go on to next section
-        if (i->getRelocs().size() == 0)
-            continue;
+        for (Object::section_iterator i=m_object.sections_begin(),
+             end=m_object.sections_end(); i != end; ++i)
+        {
+            // No relocations to output?  Go on to next section
+            if (i->getRelocs().size() == 0)
+                continue;
 
-        ElfSection* elfsect = i->getAssocData<ElfSection>();
-        assert(elfsect != 0);
+            ElfSection* elfsect = i->getAssocData<ElfSection>();
+            assert(elfsect != 0);
 
-        // need relocation section; set it up
-        elfsect->setRelIndex(m_config.secthead_count++);
-        elfsect->WriteRelocs(os, *i, out.getScratch(), *m_machine, diags);
+            // need relocation section; set it up
+            elfsect->setRelIndex(m_config.secthead_count++);
+            elfsect->WriteRelocs(os, *i, out.getScratch(), *m_machine,
+                                 diags);
+        }
     }
 
     // output section header table
@@ -1423,6 +1644,8 @@ ElfObject::Output(raw_fd_ostream& os,
     }
 
     m_config.WriteProgramHeader(os, out.getScratch());
+
+    os.Finish();
 }
 
 Section*
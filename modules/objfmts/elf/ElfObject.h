@@ -54,6 +54,7 @@ namespace yasm
 {
 class DiagnosticsEngine;
 class DirectiveInfo;
+class OutputImage;
 
 namespace objfmt
 {
@@ -128,6 +129,7 @@ public:
                 bool all_syms,
                 DebugFormat& dbgfmt,
                 DiagnosticsEngine& diags);
+    void OutputRelocsParallel(OutputImage& os, DiagnosticsEngine& diags);
 
     Section* AddDefaultSection();
     Section* AppendSection(StringRef name,
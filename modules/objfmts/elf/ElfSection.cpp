@@ -370,6 +370,14 @@ ElfSection::WriteRelocs(raw_ostream& os,
         os << '\0';
     m_rel_offset = static_cast<unsigned long>(pos);
 
+    return WriteRelocEntries(os, sect, scratch);
+}
+
+unsigned long
+ElfSection::WriteRelocEntries(raw_ostream& os,
+                              Section& sect,
+                              Bytes& scratch) const
+{
     unsigned long size = 0;
     for (Section::reloc_iterator i=sect.relocs_begin(), end=sect.relocs_end();
          i != end; ++i)
@@ -107,6 +107,8 @@ public:
 
     void setRelIndex(ElfSectionIndex sectidx) { m_rel_index = sectidx; }
     void setRelName(ElfStringIndex nameidx) { m_rel_name_index = nameidx; }
+    ElfStringIndex getRelName() const { return m_rel_name_index; }
+    void setRelFileOffset(unsigned long pos) { m_rel_offset = pos; }
 
     void setEntSize(ElfSize size) { m_entsize = size; }
     ElfSize getEntSize() const { return m_entsize; }
@@ -124,6 +126,9 @@ public:
                               Bytes& scratch,
                               const ElfMachine& machine,
                               DiagnosticsEngine& diags);
+    unsigned long WriteRelocEntries(raw_ostream& os,
+                                    Section& sect,
+                                    Bytes& scratch) const;
     void ReadRelocs(const MemoryBuffer& in,
                     const ElfSection& reloc_sect,
                     Section& sect,
@@ -37,6 +37,7 @@
 #include "yasmx/IntNum.h"
 #include "yasmx/Location_util.h"
 #include "yasmx/Object.h"
+#include "yasmx/OutputImage.h"
 #include "yasmx/StringTable.h"
 #include "yasmx/Symbol.h"
 
@@ -133,7 +134,7 @@ namespace {
 class MachOutput : public BytecodeStreamOutput
 {
 public:
-    MachOutput(raw_ostream& os,
+    MachOutput(OutputImage& os,
                Object& object,
                DiagnosticsEngine& diags,
                SymbolRef gotpcrel_sym,
@@ -211,7 +212,7 @@ isSectionLabel(const Symbol& sym)
     return true;
 }
 
-MachOutput::MachOutput(raw_ostream& os,
+MachOutput::MachOutput(OutputImage& os,
                        Object& object,
                        DiagnosticsEngine& diags,
                        SymbolRef gotpcrel_sym,
@@ -223,6 +224,7 @@ MachOutput::MachOutput(raw_ostream& os,
     , m_gotpcrel_sym(gotpcrel_sym)
     , m_is64(is64)
     , m_all_syms(all_syms)
+    , m_strtab(0, true)
     , m_symtab_offset(0)
     , m_symtab_count(0)
     , m_strtab_offset(0)
@@ -707,6 +709,16 @@ MachOutput::EnumerateSymbols()
 void
 MachOutput::OutputSymbolTable()
 {
+    // Lay out the string table first, so names can share tails.
+    for (Object::symbol_iterator i = m_object.symbols_begin(),
+         end = m_object.symbols_end(); i != end; ++i)
+    {
+        const MachSymbol* msym = i->getAssocData<MachSymbol>();
+        if (msym && msym->m_required)
+            m_strtab.Add(i->getName());
+    }
+    m_strtab.Finalize();
+
     m_symtab_offset = m_os.tell();
     for (Object::symbol_iterator i = m_object.symbols_begin(),
          end = m_object.symbols_end(); i != end; ++i)
@@ -785,7 +797,7 @@ MachIsNotZeroFill(const Section& sect)
 }
 
 void
-MachObject::Output(raw_fd_ostream& os,
+MachObject::Output(raw_fd_ostream& fd_os,
                    bool all_syms,
                    DebugFormat& dbgfmt,
                    DiagnosticsEngine& diags)
@@ -800,6 +812,9 @@ MachObject::Output(raw_fd_ostream& os,
     stdx::stable_partition(m_object.sections_begin(), m_object.sections_end(),
                            MachIsNotZeroFill);
 
+    // Build the file image in place; section data is written directly into
+    // place in the image.
+    OutputImage os(fd_os, m_object.getObjectFilename(), 0);
     MachOutput out(os, m_object, diags, m_gotpcrel_sym, m_bits == 64, all_syms);
 
     // write raw section data first
@@ -859,6 +874,9 @@ MachObject::Output(raw_fd_ostream& os,
         }
     }
 
+    // preallocate space for the headers and section data
+    os.reserve(offset);
+
     // output sections to file
     for (Object::section_iterator i=m_object.sections_begin(),
          end=m_object.sections_end(); i != end; ++i)
@@ -903,4 +921,6 @@ MachObject::Output(raw_fd_ostream& os,
     out.OutputSegmentCommand(vmsize, filesize);
     out.OutputSymtabCommand();
     out.OutputDysymtabCommand();
+
+    os.Finish();
 }
@@ -136,6 +136,7 @@ objfmt::AppendSxData(BytecodeContainer& container,
                      SourceLocation source)
 {
     Bytecode& bc = container.FreshBytecode();
-    bc.Transform(Bytecode::Contents::Ptr(new SxData(sym)));
+    bc.Transform(Bytecode::Contents::Ptr(
+        new (container.getArena()) SxData(sym)));
     bc.setSource(source);
 }
@@ -93,7 +93,7 @@ namespace {
 class XdfOutput : public BytecodeStreamOutput
 {
 public:
-    XdfOutput(raw_ostream& os, Object& object, DiagnosticsEngine& diags);
+    XdfOutput(raw_fd_ostream& os, Object& object, DiagnosticsEngine& diags);
     ~XdfOutput();
 
     void OutputSection(Section& sect);
@@ -112,7 +112,9 @@ private:
 };
 } // anonymous namespace
 
-XdfOutput::XdfOutput(raw_ostream& os, Object& object, DiagnosticsEngine& diags)
+XdfOutput::XdfOutput(raw_fd_ostream& os,
+                     Object& object,
+                     DiagnosticsEngine& diags)
     : BytecodeStreamOutput(os, diags)
     , m_object(object)
     , m_no_output(diags)
@@ -29,7 +29,12 @@
 //
 #include "GasParser.h"
 
+#include <algorithm>
+
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "yasmx/Parse/Directive.h"
+#include "yasmx/Parse/HeaderSearch.h"
 #include "yasmx/Support/registry.h"
 #include "yasmx/Arch.h"
 #include "yasmx/Object.h"
@@ -216,6 +221,75 @@ GasParser::Parse(Object& object, Directives& dirs, DiagnosticsEngine& diags)
     object.ExternUndefinedSymbols();
 }
 
+/// Follow the .include directives of a file through the header search.
+/// @return False if an include name isn't a plain string or its file
+///         could not be found.
+static bool
+ScanFileIncludes(SourceManager& sm,
+                 HeaderSearch& headers,
+                 llvm::SmallPtrSet<const FileEntry*, 16>& seen,
+                 const MemoryBuffer* buf,
+                 const FileEntry* from_file)
+{
+    const char* p = buf->getBufferStart();
+    const char* end = buf->getBufferEnd();
+    while (p != end)
+    {
+        const char* eol = std::find(p, end, '\n');
+        StringRef line(p, eol-p);
+        p = (eol == end) ? end : eol+1;
+
+        line = line.ltrim(" \t");
+        if (!line.startswith(".include"))
+            continue;
+        StringRef operand = line.substr(8);
+        if (!operand.empty() && operand[0] != ' ' && operand[0] != '\t' &&
+            operand[0] != '"')
+            continue;   // e.g. .includefoo
+        operand = operand.ltrim(" \t");
+
+        // Names with escapes need the string parser.
+        std::size_t close = operand.find('"', 1);
+        if (operand.empty() || operand[0] != '"' || close == StringRef::npos)
+            return false;
+        StringRef name = operand.slice(1, close);
+        if (name.find('\\') != StringRef::npos)
+            return false;
+
+        const DirectoryLookup* cur_dir = 0;
+        const FileEntry* file =
+            headers.LookupFile(name, false, 0, cur_dir, from_file);
+        if (!file)
+            return false;
+        if (!seen.insert(file))
+            continue;
+
+        bool invalid = false;
+        const MemoryBuffer* inc = sm.getMemoryBufferForFile(file, &invalid);
+        if (invalid ||
+            !ScanFileIncludes(sm, headers, seen, inc, file))
+            return false;
+    }
+    return true;
+}
+
+bool
+GasParser::ScanIncludes(Object& object, DiagnosticsEngine& diags)
+{
+    SourceManager& sm = m_preproc.getSourceManager();
+    HeaderSearch& headers = m_preproc.getHeaderSearch();
+    FileID main_id = sm.getMainFileID();
+
+    llvm::SmallPtrSet<const FileEntry*, 16> seen;
+    if (ScanFileIncludes(sm, headers, seen, sm.getBuffer(main_id),
+                         sm.getFileEntryForID(main_id)))
+        return true;
+
+    // Let a full parse find them.
+    headers.ClearFileInfo();
+    return false;
+}
+
 void
 GasParser::AddDirectives(Directives& dirs, StringRef parser)
 {
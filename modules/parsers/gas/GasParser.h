@@ -89,6 +89,7 @@ public:
     static StringRef getKeyword() { return "gas"; }
 
     void Parse(Object& object, Directives& dirs, DiagnosticsEngine& diags);
+    bool ScanIncludes(Object& object, DiagnosticsEngine& diags);
 
 private:
 
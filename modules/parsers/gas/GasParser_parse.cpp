@@ -537,10 +537,11 @@ GasParser::ParseDirRept(unsigned int param, SourceLocation source)
         tokens.push_back(m_token);
         ConsumeToken();
     }
-    Token* alloc_tokens = new Token[count*tokens.size()];
-    for (unsigned long i=0; i<count; ++i)
-        std::copy(tokens.begin(), tokens.end(), &alloc_tokens[i*tokens.size()]);
-    m_preproc.EnterTokenStream(alloc_tokens, count*tokens.size(), false, true);
+    // Replay the body count times from a single copy of the tokens.
+    Token* alloc_tokens = new Token[tokens.size()];
+    std::copy(tokens.begin(), tokens.end(), alloc_tokens);
+    m_preproc.EnterTokenStream(alloc_tokens, tokens.size(), false, true,
+                               count);
     ConsumeToken(); // consume the .endr and get the first repeated token
     return true;
 }
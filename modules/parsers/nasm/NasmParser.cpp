@@ -28,17 +28,31 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <cctype>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
 #include "yasmx/Parse/Directive.h"
+#include "yasmx/Parse/HeaderSearch.h"
 #include "yasmx/Support/registry.h"
 #include "yasmx/Arch.h"
+#include "yasmx/Bytes.h"
+#include "yasmx/Bytes_util.h"
 #include "yasmx/Expr.h"
+#include "yasmx/InputBuffer.h"
+#include "yasmx/IntNum.h"
 #include "yasmx/Object.h"
 #include "yasmx/Section.h"
 #include "yasmx/Symbol_util.h"
@@ -53,7 +67,8 @@
 using namespace yasm;
 using namespace yasm::parser;
 
-static unsigned int nasm_errors;
+static NASM_THREAD_LOCAL unsigned int nasm_errors;
+static NASM_THREAD_LOCAL unsigned int nasm_warnings;
 
 static void
 nasm_efunc(int severity, const char *fmt, ...)
@@ -68,6 +83,7 @@ nasm_efunc(int severity, const char *fmt, ...)
         case ERR_WARNING:
             vfprintf(stderr, fmt, va);
             fputc('\n', stderr);
+            ++nasm_warnings;
             break;
         case ERR_NONFATAL:
             vfprintf(stderr, fmt, va);
@@ -132,10 +148,435 @@ NasmParser::Parse(Object& object, Directives& dirs, DiagnosticsEngine& diags)
     m_abspos.Clear();
 
     // XXX: HACK: run through nasm preproc and replace main file contents
-    nasm::yasm_preproc = &m_preproc;
+    nasm::PreprocScope pp_scope(m_nasm_preproc.getNasmState());
+    SourceManager& sm = m_preproc.getSourceManager();
+    InitPreprocessor(object);
+
+    // Preprocess input.  The preprocessed source is handed to the lexer in
+    // pieces as parsing proceeds, rather than preprocessing the whole file
+    // into a string first and copying it, so only one copy of the
+    // preprocessed source is kept.  That copy is not bounded: each piece
+    // is kept by the source manager to the end, as diagnostics issued
+    // later (e.g. during optimization and output) refer into it.
+    // Diagnostics come out in source order: a preprocessor error
+    // in a later piece is reported after any parser diagnostics for the
+    // pieces before it, and only then is parsing stopped with the fatal
+    // "preprocessor errors".  Errors in the first piece still stop the
+    // parse before it starts.
+    MemoryBuffer* first = ReadPreprocessed();
+    if (nasm_errors == 0)
+    {
+        // override main file with preprocessed source
+        sm.clearIDTables();
+        sm.createMainFileIDForMemBuffer(first);
+        m_nasm_preproc.setMainInputFunc(
+            TR1::bind(&NasmParser::ReadPreprocessed, this));
+
+        // Get first token
+        m_preproc.EnterMainSourceFile();
+        m_preproc.Lex(&m_token);
+        DoParse();
+
+        m_nasm_preproc.setMainInputFunc(Preprocessor::MainInputFunc());
+    }
+    else
+        delete first;
+
+    CleanupPreprocessor();
+    if (nasm_errors > 0)
+    {
+        diags.Report(SourceLocation(), diag::fatal_pp_errors);
+        return;
+    }
+
+    // Check for undefined symbols
+    object.FinalizeSymbols(m_preproc.getDiagnostics());
+}
+
+bool
+NasmParser::Preprocess(Object& object, raw_ostream& os,
+                       DiagnosticsEngine& diags)
+{
+    nasm::PreprocScope pp_scope(m_nasm_preproc.getNasmState());
+    InitPreprocessor(object);
+
+    // The pieces are written out back to back, so only the first needs
+    // to be self-contained (m_pp_first is left set).
+    while (!m_pp_done)
+    {
+        ReadPreprocessedChunk();
+        os << m_pp_chunk;
+    }
+
+    CleanupPreprocessor();
+    if (nasm_errors > 0)
+    {
+        diags.Report(SourceLocation(), diag::fatal_pp_errors);
+        return false;
+    }
+    return true;
+}
+
+/// Find an incbin instruction (possibly labeled) in a source line.
+/// @param line         line, with leading whitespace removed
+/// @param operand      incbin operands (output)
+/// @return True if the line is an incbin.
+static bool
+FindIncbin(StringRef line, /*@out@*/ StringRef& operand)
+{
+    for (int word=0; word<2; ++word)
+    {
+        std::size_t n = 0;
+        while (n < line.size() && isidchar(line[n]))
+            ++n;
+        if (n == 0)
+            return false;
+        if (line.substr(0, n).equals_lower("incbin") &&
+            (n == line.size() || isspace(line[n]) || line[n] == '"' ||
+             line[n] == '\''))
+        {
+            operand = line.substr(n).ltrim(" \t");
+            return true;
+        }
+        // Skip a label.
+        line = line.substr(n);
+        if (!line.empty() && line[0] == ':')
+            line = line.substr(1);
+        line = line.ltrim(" \t");
+    }
+    return false;
+}
+
+/// Get the file name of an incbin.
+/// @param operand      incbin operands
+/// @param name         file name (output)
+/// @return False if the name isn't a plain string.
+static bool
+GetIncbinName(StringRef operand, /*@out@*/ StringRef& name)
+{
+    if (operand.empty() || (operand[0] != '"' && operand[0] != '\''))
+        return false;
+    std::size_t close = operand.find(operand[0], 1);
+    if (close == StringRef::npos)
+        return false;
+    name = operand.slice(1, close);
+    return true;
+}
+
+namespace {
+/// Follows %include directives through the header search without running
+/// the NASM preprocessor, and collects incbin file names.  Macro expansion
+/// is not performed, so the scan notes anything that could make it matter
+/// (see ScanIncludes()).
+class IncludeScanner
+{
+public:
+    IncludeScanner(SourceManager& sm, HeaderSearch& headers)
+        : m_sm(sm), m_headers(headers), m_dynamic(false) {}
+
+    /// Scan a file's lines for %include, incbin and macro definitions,
+    /// following each include found.
+    /// @return False if an include could not be followed, or an incbin
+    ///         file does not exist.
+    bool ScanFile(const MemoryBuffer* buf,
+                  const FileEntry* file,
+                  const DirectoryLookup* dir);
+
+    /// Look up an included file and scan it if not seen before.
+    /// @return False if the file was not found.
+    bool Include(StringRef name,
+                 const FileEntry* from_file,
+                 const DirectoryLookup* from_dir);
+
+    /// Note the name of a macro defined on the command line or in a
+    /// scanned file.
+    void AddDefine(StringRef name);
+
+    /// Determine if macro expansion could change any include or incbin
+    /// name seen.
+    bool NeedsExpansion() const;
+
+    /// Get the incbin file names found, in the order found.
+    const std::vector<std::string>& getIncbins() const { return m_incbins; }
+
+private:
+    SourceManager& m_sm;
+    HeaderSearch& m_headers;
+    llvm::SmallPtrSet<const FileEntry*, 16> m_seen;
+    llvm::StringMap<char> m_defines;    ///< lowercased macro names
+    std::vector<std::string> m_names;   ///< include and incbin names
+    std::vector<std::string> m_incbins; ///< incbin names
+    bool m_dynamic;                     ///< a name isn't literal
+};
+
+/// Collects incbin file names from preprocessed source.
+class IncbinCollector : public raw_ostream
+{
+public:
+    IncbinCollector(Object& object) : m_object(object), m_pos(0) {}
+    ~IncbinCollector() { flush(); }
+
+    /// Process the last line, if unterminated.
+    void Finish();
+
+private:
+    void write_impl(const char* ptr, size_t size);
+    uint64_t current_pos() const { return m_pos; }
+    void ScanLine(StringRef line);
+
+    Object& m_object;
+    std::string m_line;                 ///< incomplete line
+    uint64_t m_pos;
+};
+} // anonymous namespace
+
+bool
+IncludeScanner::ScanFile(const MemoryBuffer* buf,
+                         const FileEntry* file,
+                         const DirectoryLookup* dir)
+{
+    const char* p = buf->getBufferStart();
+    const char* end = buf->getBufferEnd();
+    while (p != end)
+    {
+        const char* eol = std::find(p, end, '\n');
+        StringRef line(p, eol-p);
+        p = (eol == end) ? end : eol+1;
+
+        line = line.ltrim(" \t");
+        StringRef incbin, name;
+        if (FindIncbin(line, incbin))
+        {
+            if (!GetIncbinName(incbin, name))
+            {
+                // e.g. a macro parameter or a %define'd string
+                m_names.push_back(incbin);
+                m_dynamic = true;
+                continue;
+            }
+            // It may be in a macro never used or conditionally excluded;
+            // only the preprocessor can say.
+            if (!llvm::sys::fs::exists(name))
+                return false;
+            m_names.push_back(name);
+            m_incbins.push_back(name);
+            continue;
+        }
+        if (line.empty() || line[0] != '%')
+            continue;
+        std::size_t n = 1;
+        while (n < line.size() && isalpha(line[n]))
+            ++n;
+        StringRef directive = line.slice(1, n);
+        StringRef operand = line.substr(n).ltrim(" \t");
+
+        if (directive.equals_lower("include"))
+        {
+            std::size_t close = StringRef::npos;
+            if (!operand.empty() && (operand[0] == '"' || operand[0] == '\''))
+                close = operand.find(operand[0], 1);
+            if (close == StringRef::npos)
+            {
+                // e.g. a macro parameter or a %define'd string
+                m_names.push_back(operand);
+                m_dynamic = true;
+                continue;
+            }
+            if (!Include(operand.slice(1, close), file, dir))
+                return false;
+        }
+        else if (directive.equals_lower("define") ||
+                 directive.equals_lower("idefine") ||
+                 directive.equals_lower("xdefine") ||
+                 directive.equals_lower("ixdefine") ||
+                 directive.equals_lower("assign") ||
+                 directive.equals_lower("iassign") ||
+                 directive.equals_lower("strlen") ||
+                 directive.equals_lower("substr"))
+        {
+            std::size_t len = 0;
+            while (len < operand.size() && isidchar(operand[len]))
+                ++len;
+            if (len == 0 || !isidstart(operand[0]))
+                m_dynamic = true;   // e.g. %define %1 ...
+            else
+                AddDefine(operand.substr(0, len));
+        }
+    }
+    return true;
+}
+
+bool
+IncludeScanner::Include(StringRef name,
+                        const FileEntry* from_file,
+                        const DirectoryLookup* from_dir)
+{
+    m_names.push_back(name);
+    if (name.find('%') != StringRef::npos)
+    {
+        // %ENVVAR% or a macro reference; only the preprocessor knows.
+        m_dynamic = true;
+        return true;
+    }
+
+    // Same lookup as the preprocessor's %include.
+    const DirectoryLookup* cur_dir = 0;
+    const FileEntry* file =
+        m_headers.LookupFile(name, false, from_dir, cur_dir, from_file);
+    if (!file)
+        return false;
+    if (!m_seen.insert(file))
+        return true;
+
+    bool invalid = false;
+    const MemoryBuffer* buf = m_sm.getMemoryBufferForFile(file, &invalid);
+    if (invalid)
+        return false;
+    return ScanFile(buf, file, cur_dir);
+}
+
+void
+IncludeScanner::AddDefine(StringRef name)
+{
+    m_defines[name.lower()] = 1;
+}
+
+bool
+IncludeScanner::NeedsExpansion() const
+{
+    if (m_names.empty())
+        return false;
+    if (m_dynamic)
+        return true;
+
+    // The preprocessor expands single-line macros in include names, so
+    // check each identifier in each name against every macro defined
+    // anywhere (and the builtin and standard macros, which all start with
+    // "__").
+    for (std::vector<std::string>::const_iterator i = m_names.begin(),
+         end = m_names.end(); i != end; ++i)
+    {
+        StringRef name = *i;
+        std::size_t pos = 0;
+        while (pos < name.size())
+        {
+            if (!isidstart(name[pos]))
+            {
+                ++pos;
+                continue;
+            }
+            std::size_t start = pos;
+            while (pos < name.size() && isidchar(name[pos]))
+                ++pos;
+            StringRef id = name.slice(start, pos);
+            if (id.startswith("__") || m_defines.count(id.lower()) != 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+void
+IncbinCollector::write_impl(const char* ptr, size_t size)
+{
+    m_pos += size;
+    const char* end = ptr + size;
+    while (ptr != end)
+    {
+        const char* eol = std::find(ptr, end, '\n');
+        if (eol == end)
+        {
+            m_line.append(ptr, end);
+            return;
+        }
+        if (m_line.empty())
+            ScanLine(StringRef(ptr, eol-ptr));
+        else
+        {
+            m_line.append(ptr, eol);
+            ScanLine(m_line);
+            m_line.clear();
+        }
+        ptr = eol+1;
+    }
+}
+
+void
+IncbinCollector::Finish()
+{
+    flush();
+    ScanLine(m_line);
+    m_line.clear();
+}
+
+void
+IncbinCollector::ScanLine(StringRef line)
+{
+    StringRef operand, name;
+    if (FindIncbin(line.ltrim(" \t"), operand) &&
+        GetIncbinName(operand, name))
+        m_object.AddDataFile(name);
+}
+
+bool
+NasmParser::ScanIncludes(Object& object, DiagnosticsEngine& diags)
+{
+    SourceManager& sm = m_preproc.getSourceManager();
+    HeaderSearch& headers = m_preproc.getHeaderSearch();
+    FileID main_id = sm.getMainFileID();
+    const FileEntry* main_file = sm.getFileEntryForID(main_id);
+
+    IncludeScanner scanner(sm, headers);
+    bool ok = true;
+
+    // Command line includes are processed first, as if from the main file.
+    for (std::vector<NasmPreproc::Predef>::const_iterator
+         i = m_nasm_preproc.m_predefs.begin(),
+         end = m_nasm_preproc.m_predefs.end();
+         ok && i != end; ++i)
+    {
+        StringRef def = i->m_string;
+        switch (i->m_type)
+        {
+            case NasmPreproc::Predef::PREINC:
+                ok = scanner.Include(def, main_file, 0);
+                break;
+            case NasmPreproc::Predef::PREDEF:
+            case NasmPreproc::Predef::BUILTIN:
+                scanner.AddDefine(def.substr(0, def.find_first_of("=(")));
+                break;
+            case NasmPreproc::Predef::UNDEF:
+                break;
+        }
+    }
+
+    if (ok)
+        ok = scanner.ScanFile(sm.getBuffer(main_id), main_file, 0);
+    if (ok && !scanner.NeedsExpansion())
+    {
+        for (std::vector<std::string>::const_iterator
+             i = scanner.getIncbins().begin(),
+             end = scanner.getIncbins().end(); i != end; ++i)
+            object.AddDataFile(*i);
+        return true;
+    }
+
+    // Fall back to running the preprocessor; it reports any include that
+    // really can't be found, and its output has the incbins actually used.
+    headers.ClearFileInfo();
+    IncbinCollector incbins(object);
+    bool preprocessed = Preprocess(object, incbins, diags);
+    incbins.Finish();
+    return preprocessed;
+}
+
+void
+NasmParser::InitPreprocessor(Object& object)
+{
     nasm::yasm_object = &object;
     SourceManager& sm = m_preproc.getSourceManager();
     nasm_errors = 0;
+    nasm_warnings = 0;
     nasm::nasmpp.reset(sm.getMainFileID(), 2, nasm_efunc, nasm::nasm_evaluate);
 
     // pass down command line options
@@ -170,81 +611,307 @@ NasmParser::Parse(Object& object, Directives& dirs, DiagnosticsEngine& diags)
     if (matched == 3)
         patchlevel = 0;
 
-    char* nasm_version_mac[8];
     for (int i=0; i<7; ++i)
-        nasm_version_mac[i] = new char[100];
-    sprintf(nasm_version_mac[0], "%%define __YASM_MAJOR__ %d", major);
-    sprintf(nasm_version_mac[1], "%%define __YASM_MINOR__ %d", minor);
-    sprintf(nasm_version_mac[2], "%%define __YASM_SUBMINOR__ %d", subminor);
-    sprintf(nasm_version_mac[3], "%%define __YASM_BUILD__ %d", patchlevel);
-    sprintf(nasm_version_mac[4], "%%define __YASM_PATCHLEVEL__ %d", patchlevel);
+        m_pp_version_mac[i] = new char[100];
+    sprintf(m_pp_version_mac[0], "%%define __YASM_MAJOR__ %d", major);
+    sprintf(m_pp_version_mac[1], "%%define __YASM_MINOR__ %d", minor);
+    sprintf(m_pp_version_mac[2], "%%define __YASM_SUBMINOR__ %d", subminor);
+    sprintf(m_pp_version_mac[3], "%%define __YASM_BUILD__ %d", patchlevel);
+    sprintf(m_pp_version_mac[4], "%%define __YASM_PATCHLEVEL__ %d", patchlevel);
 
     /* Version id (hex number) */
-    sprintf(nasm_version_mac[5],
+    sprintf(m_pp_version_mac[5],
             "%%define __YASM_VERSION_ID__ 0%02x%02x%02x%02xh",
             major, minor, subminor, patchlevel);
 
     /* Version string */
-    sprintf(nasm_version_mac[6], "%%define __YASM_VER__ \"%s\"",
+    sprintf(m_pp_version_mac[6], "%%define __YASM_VER__ \"%s\"",
             PACKAGE_VERSION);
-    nasm_version_mac[7] = NULL;
-    nasm::pp_extra_stdmac(const_cast<const char**>(nasm_version_mac));
+    m_pp_version_mac[7] = NULL;
+    nasm::pp_extra_stdmac(const_cast<const char**>(m_pp_version_mac));
 
     // add standard macros
     nasm::pp_extra_stdmac(nasm_standard_mac);
 
-    // preprocess input
-    std::string result;
-    long prior_linnum = 0;
-    char *file_name = 0;
-    int lineinc = 0;
-    while (char* line = nasm::nasmpp.getline())
+    m_pp_bufname = sm.getBuffer(sm.getMainFileID())->getBufferIdentifier();
+    m_pp_prior_linnum = 0;
+    m_pp_file_name = 0;
+    m_pp_lineinc = 0;
+    m_pp_first = true;
+    m_pp_done = false;
+
+    m_pp_prelude.clear();
+    m_pp_snapshot_pending = false;
+    if (!m_nasm_preproc.m_snapshot_file.empty() && !LoadMacroSnapshot())
+    {
+        m_pp_snapshot_pending = true;
+        nasm::pp_set_snapshot_func(&NasmParser::SaveMacroSnapshot, this);
+    }
+}
+
+void
+NasmParser::CleanupPreprocessor()
+{
+    nasm::nasmpp.cleanup(1);
+    for (int i=0; i<7; ++i)
+        delete[] m_pp_version_mac[i];
+}
+
+/// Preprocessed input is read into pieces of about this size.  This bounds
+/// the text held outside the source manager, not the total kept.
+static const std::string::size_type PP_CHUNK_SIZE = 64*1024;
+
+void
+NasmParser::ReadPreprocessedChunk()
+{
+    // Until a macro snapshot is saved, output from before the main file
+    // is kept for it; a loaded snapshot's output starts the first piece.
+    if (m_pp_snapshot_pending)
+        m_pp_prelude += m_pp_chunk;
+    m_pp_chunk.clear();
+    if (!m_pp_snapshot_pending)
+        m_pp_chunk.swap(m_pp_prelude);
+    while (m_pp_chunk.size() < PP_CHUNK_SIZE)
     {
-        long linnum = prior_linnum += lineinc;
-        int altline = nasm::nasm_src_get(&linnum, &file_name);
-        if (altline != 0) {
-            lineinc = (altline != -1 || lineinc != 1);
+        char* line = nasm::nasmpp.getline();
+        if (!line)
+        {
+            m_pp_done = true;
+            break;
+        }
+        long linnum = m_pp_prior_linnum += m_pp_lineinc;
+        int altline = nasm::nasm_src_get(&linnum, &m_pp_file_name);
+        if (altline != 0)
+            m_pp_lineinc = (altline != -1 || m_pp_lineinc != 1);
+        // Each piece after the first is a separate buffer, so needs its
+        // own line marker.
+        if (altline != 0 || (m_pp_chunk.empty() && !m_pp_first))
+        {
             SmallString<64> linestr;
             llvm::raw_svector_ostream los(linestr);
-            los << "%line " << linnum << '+' << lineinc << ' ' << file_name
-                << '\n';
-            result += los.str();
-            prior_linnum = linnum;
+            los << "%line " << linnum << '+' << m_pp_lineinc << ' '
+                << m_pp_file_name << '\n';
+            m_pp_chunk += los.str();
+            m_pp_prior_linnum = linnum;
         }
-        result += line;
-        result += '\n';
+        m_pp_chunk += line;
+        m_pp_chunk += '\n';
+        nasm_free(line);
     }
-    nasm::nasmpp.cleanup(1);
-    for (int i=0; i<7; ++i)
-        delete[] nasm_version_mac[i];
+
+    // Stop at the first piece with preprocessor errors.
     if (nasm_errors > 0)
+        m_pp_done = true;
+}
+
+MemoryBuffer*
+NasmParser::ReadPreprocessed()
+{
+    if (m_pp_done)
+        return 0;
+
+    ReadPreprocessedChunk();
+
+    // The piece with the errors is not parsed; Parse() reports the fatal
+    // error once parsing of the earlier pieces ends.
+    if (nasm_errors > 0 && !m_pp_first)
+        return 0;
+
+    if (m_pp_chunk.empty() && !m_pp_first)
+        return 0;
+    m_pp_first = false;
+    return MemoryBuffer::getMemBufferCopy(m_pp_chunk, m_pp_bufname);
+}
+
+/// Macro snapshot file format version.  Bump when the snapshot layout or
+/// the nasm-pp state it records changes.
+static const unsigned long SNAPSHOT_VERSION = 2;
+
+static void
+WriteSnapshotString(Bytes& bytes, StringRef str)
+{
+    Write32(bytes, str.size());
+    bytes.Write(llvm::makeArrayRef(
+        reinterpret_cast<const unsigned char*>(str.data()), str.size()));
+}
+
+static StringRef
+ReadSnapshotString(InputBuffer& input)
+{
+    return input.ReadString(ReadU32(input));
+}
+
+/// The key identifies everything that decides the macro state reached at
+/// the start of the main file, other than the contents of included files.
+void
+NasmParser::getMacroSnapshotKey(Bytes& key)
+{
+    key.setLittleEndian();
+    key.Write(llvm::makeArrayRef(
+        reinterpret_cast<const unsigned char*>("YASMNMS"), 8));
+    Write32(key, SNAPSHOT_VERSION);
+
+    HeaderSearch& headers = m_preproc.getHeaderSearch();
+    for (HeaderSearch::search_dir_iterator i = headers.search_dir_begin(),
+         end = headers.search_dir_end(); i != end; ++i)
     {
-        diags.Report(SourceLocation(), diag::fatal_pp_errors);
+        Write8(key, 1);
+        WriteSnapshotString(key, i->getName());
+    }
+    Write8(key, 0);
+
+    // Pre-includes are looked up relative to the main file; key on the
+    // files they resolve to, so main files in different directories that
+    // pre-include the same files share a snapshot.
+    SourceManager& sm = m_preproc.getSourceManager();
+    const FileEntry* main_file = sm.getFileEntryForID(sm.getMainFileID());
+    for (std::vector<NasmPreproc::Predef>::iterator
+         i = m_nasm_preproc.m_predefs.begin(),
+         end = m_nasm_preproc.m_predefs.end(); i != end; ++i)
+    {
+        if (i->m_type != NasmPreproc::Predef::PREINC)
+            continue;
+        const DirectoryLookup* cur_dir;
+        const FileEntry* fe =
+            headers.LookupFile(i->m_string, false, 0, cur_dir, main_file);
+        Write8(key, 1);
+        WriteSnapshotString(key, fe ? fe->getName() : "");
+    }
+    Write8(key, 0);
+
+    // Builtin, standard (including version) and command line lines.
+    nasm::pp_save_predefs(key);
+}
+
+/// A macro snapshot records the nasm-pp state reached after processing the
+/// builtin, standard and command line lines (including pre-included
+/// files), so that later runs with the same lines and unchanged
+/// pre-included files start the main file without processing them again.
+/// @return True if the snapshot was loaded.
+bool
+NasmParser::LoadMacroSnapshot()
+{
+    OwningPtr<MemoryBuffer> file;
+    if (MemoryBuffer::getFile(m_nasm_preproc.m_snapshot_file, file))
+        return false;
+
+    Bytes key;
+    getMacroSnapshotKey(key);
+
+    HeaderSearch& headers = m_preproc.getHeaderSearch();
+    FileManager& file_mgr = headers.getFileMgr();
+    std::vector<const FileEntry*> deps;
+
+    InputBuffer input(*file);
+    input.setLittleEndian();
+    try
+    {
+        StringRef file_key = input.ReadString(key.size());
+        if (std::memcmp(file_key.data(), &key[0], key.size()) != 0)
+            return false;
+
+        // Every file read for the snapshot must be unchanged.
+        for (unsigned long n = ReadU32(input); n > 0; --n)
+        {
+            const FileEntry* fe = file_mgr.getFile(ReadSnapshotString(input));
+            IntNum size = ReadU64(input);
+            IntNum mtime = ReadU64(input);
+            if (!fe || size != IntNum(static_cast<long long>(fe->getSize())) ||
+                mtime != IntNum(static_cast<long long>(
+                    fe->getModificationTime())))
+                return false;
+            deps.push_back(fe);
+        }
+
+        std::string prelude = ReadSnapshotString(input);
+
+        try
+        {
+            nasm::pp_load_state(input);
+        }
+        catch (std::out_of_range&)
+        {
+            // Start over without the partly loaded state.
+            nasm::nasmpp.cleanup(2);
+            nasm::nasmpp.reset(m_preproc.getSourceManager().getMainFileID(),
+                               2, nasm_efunc, nasm::nasm_evaluate);
+            return false;
+        }
+        m_pp_prelude.swap(prelude);
+    }
+    catch (std::out_of_range&)
+    {
+        return false;
+    }
+
+    // Report the snapshot's files as included (e.g. for -MD).
+    for (std::vector<const FileEntry*>::iterator i = deps.begin(),
+         end = deps.end(); i != end; ++i)
+        headers.NoteFoundFile(*i);
+    return true;
+}
+
+void
+NasmParser::SaveMacroSnapshot(void* parser)
+{
+    static_cast<NasmParser*>(parser)->SaveMacroSnapshot();
+}
+
+void
+NasmParser::SaveMacroSnapshot()
+{
+    m_pp_snapshot_pending = false;
+    std::string prelude;
+    prelude.swap(m_pp_prelude);
+    prelude += m_pp_chunk;
+
+    // Warnings from the pre-included files would not be repeated by runs
+    // that load the snapshot, so don't save one.  Nor if they expanded
+    // environment variables, which aren't part of the snapshot key.
+    if (nasm_errors > 0 || nasm_warnings > 0 ||
+        m_preproc.isEnvironmentDependent())
         return;
+
+    Bytes bytes;
+    getMacroSnapshotKey(bytes);
+
+    HeaderSearch& headers = m_preproc.getHeaderSearch();
+    Write32(bytes, headers.found_file_end() - headers.found_file_begin());
+    for (HeaderSearch::found_file_iterator i = headers.found_file_begin(),
+         end = headers.found_file_end(); i != end; ++i)
+    {
+        WriteSnapshotString(bytes, (*i)->getName());
+        Write64(bytes, IntNum(static_cast<long long>((*i)->getSize())));
+        Write64(bytes, IntNum(static_cast<long long>(
+            (*i)->getModificationTime())));
     }
 
-#if 0
-    fputs("=================\n", stdout);
-    fputs("=================\n", stdout);
-    fputs(result.c_str(), stdout);    // for debugging
-    fputs("=================\n", stdout);
-    fputs("=================\n", stdout);
-#endif
-
-    // override main file with preprocessed source
-    const char* filename =
-        sm.getBuffer(sm.getMainFileID())->getBufferIdentifier();
-    sm.clearIDTables();
-    sm.createMainFileIDForMemBuffer(
-        MemoryBuffer::getMemBufferCopy(result, filename));
-
-    // Get first token
-    m_preproc.EnterMainSourceFile();
-    m_preproc.Lex(&m_token);
-    DoParse();
+    WriteSnapshotString(bytes, prelude);
 
-    // Check for undefined symbols
-    object.FinalizeSymbols(m_preproc.getDiagnostics());
+    if (!nasm::pp_save_state(bytes))
+        return;
+
+    // Write to a temporary file and rename it into place, so that
+    // concurrent runs only ever see complete snapshots.
+    const std::string& filename = m_nasm_preproc.m_snapshot_file;
+    SmallString<128> tmp_path;
+    int fd;
+    if (llvm::sys::fs::unique_file(filename + "-%%%%%%%%", fd, tmp_path,
+                                   false, 0666))
+        return;
+
+    bool ok;
+    {
+        raw_fd_ostream os(fd, true);
+        os.write(reinterpret_cast<const char*>(&bytes[0]), bytes.size());
+        os.close();
+        ok = !os.has_error();
+        os.clear_error();
+    }
+
+    bool existed;
+    if (!ok || llvm::sys::fs::rename(tmp_path.str(), filename))
+        llvm::sys::fs::remove(tmp_path.str(), existed);
 }
 
 void
@@ -42,6 +42,7 @@ namespace yasm
 
 class Arch;
 class Bytecode;
+class Bytes;
 class DirectiveInfo;
 class Directives;
 class Expr;
@@ -81,6 +82,10 @@ public:
     static StringRef getKeyword() { return "nasm"; }
 
     void Parse(Object& object, Directives& dirs, DiagnosticsEngine& diags);
+    bool Preprocess(Object& object,
+                    raw_ostream& os,
+                    DiagnosticsEngine& diags);
+    bool ScanIncludes(Object& object, DiagnosticsEngine& diags);
 
 private:
     friend class NasmParseDirExprTerm;
@@ -105,6 +110,16 @@ private:
 
     void DefineLabel(SymbolRef sym, SourceLocation source, bool local);
 
+    void InitPreprocessor(Object& object);
+    void CleanupPreprocessor();
+    void ReadPreprocessedChunk();
+    MemoryBuffer* ReadPreprocessed();
+
+    void getMacroSnapshotKey(Bytes& key);
+    bool LoadMacroSnapshot();
+    void SaveMacroSnapshot();
+    static void SaveMacroSnapshot(void* parser);
+
     void DoParse();
     bool ParseLine();
     bool ParseDirective(/*@out@*/ NameValues& nvs);
@@ -141,6 +156,20 @@ private:
 
     NasmPreproc m_nasm_preproc;
 
+    // State of the preprocessed input (see ReadPreprocessed()).
+    std::string m_pp_bufname;
+    std::string m_pp_chunk;
+    long m_pp_prior_linnum;
+    char* m_pp_file_name;
+    int m_pp_lineinc;
+    bool m_pp_first;
+    bool m_pp_done;
+    char* m_pp_version_mac[8];
+
+    // Macro snapshot state (see LoadMacroSnapshot()).
+    bool m_pp_snapshot_pending; // save snapshot when the main file starts
+    std::string m_pp_prelude;   // output from before the main file
+
     PseudoInsn m_data_insns[8], m_reserve_insns[8];
 
     // Indexes into m_data_insns and m_reserve_insns.
@@ -31,6 +31,8 @@
 #include "NasmPreproc.h"
 
 #include "NasmLexer.h"
+#include "nasm.h"
+#include "nasm-pp.h"
 
 
 using namespace yasm;
@@ -40,11 +42,13 @@ NasmPreproc::NasmPreproc(DiagnosticsEngine& diags,
                          SourceManager& sm,
                          HeaderSearch& headers)
     : Preprocessor(diags, sm, headers)
+    , m_nasm_state(nasm::pp_new_state(this))
 {
 }
 
 NasmPreproc::~NasmPreproc()
 {
+    nasm::pp_delete_state(m_nasm_state);
 }
 
 void
@@ -75,6 +79,12 @@ NasmPreproc::DefineBuiltin(StringRef macronameval)
     m_predefs.push_back(p);
 }
 
+void
+NasmPreproc::setMacroSnapshot(StringRef filename)
+{
+    m_snapshot_file = filename;
+}
+
 /// RegisterBuiltinMacro - Register the specified identifier in the identifier
 /// table and mark it as a builtin macro to be expanded.
 static IdentifierInfo*
@@ -35,6 +35,8 @@
 #include "yasmx/Parse/Preprocessor.h"
 
 
+namespace nasm { struct PreprocState; }
+
 namespace yasm
 {
 
@@ -55,6 +57,7 @@ public:
     virtual void PredefineMacro(StringRef macronameval);
     virtual void UndefineMacro(StringRef macroname);
     virtual void DefineBuiltin(StringRef macronameval);
+    virtual void setMacroSnapshot(StringRef filename);
 
     struct Predef
     {
@@ -64,6 +67,12 @@ public:
 
     std::vector<Predef> m_predefs;
 
+    /// Macro snapshot filename; empty if none.
+    std::string m_snapshot_file;
+
+    /// Get the NASM preprocessor state owned by this preprocessor.
+    nasm::PreprocState* getNasmState() const { return m_nasm_state; }
+
 protected:
     virtual void RegisterBuiltinMacros();
     virtual Lexer* CreateLexer(FileID fid, const MemoryBuffer* input_buffer);
@@ -75,6 +84,9 @@ private:
     IdentifierInfo *m_BITS;           // __BITS__
 
     SourceLocation m_DATE_loc, m_TIME_loc;
+
+    /// NASM preprocessor (nasm-pp) state.
+    nasm::PreprocState* m_nasm_state;
 };
 
 }} // namespace yasm::parser
@@ -25,16 +25,17 @@ using yasm::IntNum;
 namespace nasm {
 
 /* The assembler object (for symbol table). */
-yasm::Object *yasm_object;
+NASM_THREAD_LOCAL yasm::Object *yasm_object;
 
-static scanner scan;    /* Address of scanner routine */
-static efunc error;     /* Address of error reporting routine */
-static curl_eval curly_evaluator; /*curly structure processor func*/
+/* Evaluator state is per-thread so preprocessors may run concurrently. */
+static NASM_THREAD_LOCAL scanner scan;    /* Address of scanner routine */
+static NASM_THREAD_LOCAL efunc error;     /* Address of error reporting routine */
+static NASM_THREAD_LOCAL curl_eval curly_evaluator; /*curly structure processor func*/
 
-static struct tokenval *tokval;   /* The current token */
-static int i;                     /* The t_type of tokval */
+static NASM_THREAD_LOCAL struct tokenval *tokval;   /* The current token */
+static NASM_THREAD_LOCAL int i;                     /* The t_type of tokval */
 
-static void *scpriv;
+static NASM_THREAD_LOCAL void *scpriv;
 
 /*
  * Recursive-descent parser. Called with a single boolean operand,
@@ -76,7 +77,7 @@ static bool rexp0(Expr*), rexp1(Expr*), rexp2(Expr*), rexp3(Expr*);
 static bool expr0(Expr*), expr1(Expr*), expr2(Expr*), expr3(Expr*);
 static bool expr4(Expr*), expr5(Expr*), expr6(Expr*);
 
-static bool (*bexpr)(Expr*);
+static NASM_THREAD_LOCAL bool (*bexpr)(Expr*);
 
 
 /*
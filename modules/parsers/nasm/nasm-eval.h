@@ -15,7 +15,7 @@ namespace yasm { class Expr; class Object; }
 
 namespace nasm {
 
-extern yasm::Object* yasm_object;
+extern NASM_THREAD_LOCAL yasm::Object* yasm_object;
 
 /*
  * The evaluator itself.
@@ -41,7 +41,10 @@
 
 #include "llvm/ADT/SmallString.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "yasmx/Bytes.h"
+#include "yasmx/Bytes_util.h"
 #include "yasmx/IntNum.h"
+#include "yasmx/InputBuffer.h"
 #include "yasmx/Expr.h"
 #include "yasmx/Parse/Preprocessor.h"
 #include "yasmx/Parse/HeaderSearch.h"
@@ -50,9 +53,11 @@
 #include "nasmlib.h"
 #include "nasm-pp.h"
 
+using yasm::Bytes;
 using yasm::DirectoryLookup;
 using yasm::Expr;
 using yasm::FileID;
+using yasm::InputBuffer;
 using yasm::IntNum;
 using yasm::MemoryBuffer;
 using yasm::SourceLocation;
@@ -63,25 +68,22 @@ using yasm::StringRef;
 namespace nasm {
 
 int tasm_compatible_mode = 0;
-int tasm_locals;
-const char *tasm_segment;
-
-yasm::Preprocessor* yasm_preproc;
 
 const MemoryBuffer*
-yasm_fopen_include(StringRef filename,
+yasm_fopen_include(yasm::Preprocessor& preproc,
+                   StringRef filename,
                    const DirectoryLookup* from_dir,
                    const DirectoryLookup*& cur_dir,
                    FileID from_file,
                    FileID& cur_file)
 {
-    yasm::SourceManager& srcmgr = yasm_preproc->getSourceManager();
+    yasm::SourceManager& srcmgr = preproc.getSourceManager();
 
     const yasm::FileEntry* from_file_ent = srcmgr.getFileEntryForID(from_file);
 
     const yasm::FileEntry* file =
-        yasm_preproc->getHeaderSearch().LookupFile(filename, false, from_dir,
-                                                   cur_dir, from_file_ent);
+        preproc.getHeaderSearch().LookupFile(filename, false, from_dir,
+                                             cur_dir, from_file_ent);
     if (!file)
         return 0;
 
@@ -148,6 +150,7 @@ struct SMacro
 {
     SMacro *next;
     char *name;
+    unsigned int hashval;       /* hash(name) */
     int level;
     int casesense;
     int nparam;
@@ -176,6 +179,7 @@ struct MMacro
 {
     MMacro *next;
     char *name;
+    unsigned int hashval;       /* hash(name), if in the hash table */
     int casesense;
     long nparam_min, nparam_max;
     int plus;                   /* is the last parameter greedy? */
@@ -423,51 +427,24 @@ static const char *tasm_directives[] = {
     "ifndef", "include", "local"
 };
 
-static int StackSize = 4;
-static const char *StackPointer = "ebp";
-static int ArgOffset = 8;
-static int LocalOffset = 4;
-static int Level = 0;
-
-
-static Context *cstk;
-static Include *istk;
-
-static efunc _error;            /* Pointer to client-provided error reporting function */
-static evalfunc evaluate;
-
-static int pass;                /* HACK: pass 0 = generate dependencies only */
-
-static unsigned long unique;    /* unique identifier numbers */
-
-static Line *builtindef = NULL;
-static Line *stddef = NULL;
-static Line *predef = NULL;
-static int first_line = 1;
-static int curly_opened = 0;
-
-/*
- * The number of hash values we use for the macro lookup tables.
- * FIXME: We should *really* be able to configure this at run time,
- * or even have the hash table automatically expanding when necessary.
- */
-#define NHASH 31
-
-/*
- * The current set of multi-line macros we have defined.
- */
-static MMacro *mmacros[NHASH];
-
 /*
- * The current set of single-line macros we have defined.
+ * The macro lookup tables.  Each macro records its full hash value,
+ * so that chains can be searched without comparing most names and
+ * the number of buckets can be doubled without rehashing any names.
+ * A table starts with MACRO_HASH_INIT buckets and grows whenever it
+ * averages more than MACRO_HASH_LOAD macros per bucket.  The macros
+ * in a chain are kept newest first, as before.
  */
-static SMacro *smacros[NHASH];
+#define MACRO_HASH_INIT 32
+#define MACRO_HASH_LOAD 2
 
-/*
- * The multi-line macro we are currently defining, or the %rep
- * block we are currently reading, if any.
- */
-static MMacro *defining;
+template <typename M>
+struct MacroTable
+{
+    M **buckets;
+    unsigned int nbuckets;      /* zero, or a power of two */
+    unsigned long count;        /* number of macros in the table */
+};
 
 /*
  * The number of macro parameters to allocate space for at a time.
@@ -532,20 +509,15 @@ static const char *tasm_compat_macros[] =
     NULL
 };
 
-static int nested_mac_count, nested_rep_count;
-
 /*
  * Tokens are allocated in blocks to improve speed
  */
 #define TOKEN_BLOCKSIZE 4096
-static Token *freeTokens = NULL;
 struct Blocks {
         Blocks *next;
         void *chunk;
 };
 
-static Blocks blocks = { NULL, NULL };
-
 /*
  * Forward declarations.
  */
@@ -583,10 +555,6 @@ typedef struct TMEndItem {
     struct TMEndItem *next;
 } TMEndItem;
 
-static TMEndItem *EndmStack = NULL, *EndsStack = NULL;
-
-char **TMParameters;
-
 struct TStrucField {
     char *name;
     char *type;
@@ -597,21 +565,203 @@ struct TStruc {
     struct TStrucField *fields, *lastField;
     struct TStruc *next;
 };
-static struct TStruc *TStrucs = NULL;
-static int inTstruc = 0;
 
 struct TSegmentAssume {
     char *segreg;
     char *segment;
 };
-struct TSegmentAssume *TAssumes;
+
+/*
+ * All of the mutable preprocessor state.  Each NasmPreproc owns one of
+ * these; the functions in this file operate on the state made current
+ * for the calling thread by PreprocScope, so independent preprocessors
+ * may run concurrently on different threads.
+ */
+struct PreprocState {
+    explicit PreprocState(yasm::Preprocessor* preproc);
+
+    yasm::Preprocessor* yasm_preproc;
+
+    Context *cstk;
+    Include *istk;
+
+    efunc _error;           /* Pointer to client-provided error reporting function */
+    evalfunc evaluate;
+
+    int pass;               /* HACK: pass 0 = generate dependencies only */
+
+    unsigned long unique;   /* unique identifier numbers */
+
+    Line *builtindef;
+    Line *stddef;
+    Line *predef;
+    int first_line;
+    int curly_opened;
+
+    /*
+     * Called once the predefined lines have been processed, just
+     * before the first line of the main file is read (see
+     * pp_set_snapshot_func).
+     */
+    void (*snapshot_func)(void *);
+    void *snapshot_data;
+
+    /*
+     * The current set of multi-line macros we have defined.
+     */
+    MacroTable<MMacro> mmacros;
+
+    /*
+     * The current set of single-line macros we have defined.
+     */
+    MacroTable<SMacro> smacros;
+
+    /*
+     * The multi-line macro we are currently defining, or the %rep
+     * block we are currently reading, if any.
+     */
+    MMacro *defining;
+
+    int nested_mac_count, nested_rep_count;
+
+    /*
+     * Free list and storage blocks for Token allocation.
+     */
+    Token *freeTokens;
+    Blocks blocks;
+
+    /*
+     * Current source file name and line number (see nasm_src_*).
+     */
+    char *file_name;
+    long line_number;
+
+    /*
+     * TASM compatibility state.
+     */
+    int StackSize;
+    const char *StackPointer;
+    int ArgOffset;
+    int LocalOffset;
+    int Level;
+    int tasm_locals;
+    const char *tasm_segment;
+    TMEndItem *EndmStack, *EndsStack;
+    char **TMParameters;
+    struct TStruc *TStrucs;
+    int inTstruc;
+    struct TSegmentAssume *TAssumes;
+};
+
+PreprocState::PreprocState(yasm::Preprocessor* preproc)
+    : yasm_preproc(preproc)
+    , cstk(NULL)
+    , istk(NULL)
+    , _error(NULL)
+    , evaluate(NULL)
+    , pass(0)
+    , unique(0)
+    , builtindef(NULL)
+    , stddef(NULL)
+    , predef(NULL)
+    , first_line(1)
+    , curly_opened(0)
+    , snapshot_func(NULL)
+    , snapshot_data(NULL)
+    , defining(NULL)
+    , nested_mac_count(0)
+    , nested_rep_count(0)
+    , freeTokens(NULL)
+    , file_name(NULL)
+    , line_number(0)
+    , StackSize(4)
+    , StackPointer("ebp")
+    , ArgOffset(8)
+    , LocalOffset(4)
+    , Level(0)
+    , tasm_locals(0)
+    , tasm_segment(NULL)
+    , EndmStack(NULL)
+    , EndsStack(NULL)
+    , TMParameters(NULL)
+    , TStrucs(NULL)
+    , inTstruc(0)
+    , TAssumes(NULL)
+{
+    mmacros.buckets = NULL;
+    mmacros.nbuckets = 0;
+    mmacros.count = 0;
+    smacros.buckets = NULL;
+    smacros.nbuckets = 0;
+    smacros.count = 0;
+    blocks.next = NULL;
+    blocks.chunk = NULL;
+}
+
+/*
+ * The state of the preprocessor currently running on this thread.
+ */
+static NASM_THREAD_LOCAL PreprocState *pp = NULL;
+
+PreprocScope::PreprocScope(PreprocState* state)
+    : m_prev(pp)
+{
+    pp = state;
+}
+
+PreprocScope::~PreprocScope()
+{
+    pp = m_prev;
+}
+
+char *nasm_src_set_fname(char *newname) 
+{
+    char *oldname = pp->file_name;
+    pp->file_name = newname;
+    return oldname;
+}
+
+char *nasm_src_get_fname(void)
+{
+    return pp->file_name;
+}
+
+long nasm_src_set_linnum(long newline) 
+{
+    long oldline = pp->line_number;
+    pp->line_number = newline;
+    return oldline;
+}
+
+long nasm_src_get_linnum(void) 
+{
+    return pp->line_number;
+}
+
+int nasm_src_get(long *xline, char **xname) 
+{
+    if (!pp->file_name || !*xname || strcmp(*xname, pp->file_name)) 
+    {
+        nasm_free(*xname);
+        *xname = pp->file_name ? nasm_strdup(pp->file_name) : NULL;
+        *xline = pp->line_number;
+        return -2;
+    }
+    if (*xline != pp->line_number) 
+    {
+        long tmp = pp->line_number - *xline;
+        *xline = pp->line_number;
+        return tmp;
+    }
+    return 0;
+}
 
 const char *tasm_get_segment_register(const char *segment)
 {
     struct TSegmentAssume *assume;
-    if (!TAssumes)
+    if (!pp->TAssumes)
         return NULL;
-    for (assume = TAssumes; assume->segreg; assume++) {
+    for (assume = pp->TAssumes; assume->segreg; assume++) {
         if (!strcmp(assume->segment, segment))
             break;
     }
@@ -701,13 +851,13 @@ check_tasm_directive(char *line)
     if (!nasm_stricmp(p, "endm")) {
         /* handle end of endm directive */
         char **parameter;
-        end = EndmStack;
+        end = pp->EndmStack;
         /* undef parameters */
         if (!end) {
             error(ERR_FATAL, "ENDM: not in an endm context");
             return line;
         }
-        EndmStack = EndmStack->next;
+        pp->EndmStack = pp->EndmStack->next;
         nasm_free(line);
         switch (end->type) {
         case TM_MACRO:
@@ -757,13 +907,13 @@ check_tasm_directive(char *line)
         /* handle repeat directive */
         end = (TMEndItem*)nasm_malloc(sizeof(*end));
         end->type = TM_REPT;
-        end->next = EndmStack;
-        EndmStack = end;
+        end->next = pp->EndmStack;
+        pp->EndmStack = end;
         memcpy(p, "%rep", 4);
         p[len] = oldchar;
         return line;
     } else if (!nasm_stricmp(p, "locals")) {
-        tasm_locals = 1;
+        pp->tasm_locals = 1;
         nasm_free(line);
         return nasm_strdup("");
     }
@@ -808,9 +958,9 @@ check_tasm_directive(char *line)
 
         end = (TMEndItem*)nasm_malloc(sizeof(*end));
         end->type = TM_IRP;
-        end->next = EndmStack;
+        end->next = pp->EndmStack;
         end->data = data;
-        EndmStack = end;
+        pp->EndmStack = end;
 
         nasm_free(oldline);
         return line;
@@ -820,7 +970,7 @@ check_tasm_directive(char *line)
         /* count parameters */
         j = 1;
         i = 0;
-        TMParameters = (char**)nasm_malloc(j*sizeof(*TMParameters));
+        pp->TMParameters = (char**)nasm_malloc(j*sizeof(*pp->TMParameters));
         len = 0;
         p = q + len2 + 1;
         /* Skip whitespaces */
@@ -832,15 +982,15 @@ check_tasm_directive(char *line)
             len2 = q-p;
             if (len2 == 0)
                 error(ERR_FATAL, "'%s': expected parameter name", p);
-            TMParameters[i] = (char*)nasm_malloc(len2 + 1);
-            memcpy(TMParameters[i], p, len2);
-            TMParameters[i][len2] = '\0';
+            pp->TMParameters[i] = (char*)nasm_malloc(len2 + 1);
+            memcpy(pp->TMParameters[i], p, len2);
+            pp->TMParameters[i][len2] = '\0';
             len += len2;
             i++;
             if (i + 1 > j) {
                 j *= 2;
-                TMParameters = (char**)nasm_realloc(TMParameters,
-                                               j*sizeof(*TMParameters));
+                pp->TMParameters = (char**)nasm_realloc(pp->TMParameters,
+                                               j*sizeof(*pp->TMParameters));
             }
             if (i == 1000)
                 error(ERR_FATAL, "too many parameters for macro %s", name);
@@ -855,23 +1005,23 @@ check_tasm_directive(char *line)
             while (isspace(*p) && *p)
                 p++;
         }
-        TMParameters[i] = NULL;
-        TMParameters = (char**)nasm_realloc(TMParameters,
-                                        (i+1)*sizeof(*TMParameters));
+        pp->TMParameters[i] = NULL;
+        pp->TMParameters = (char**)nasm_realloc(pp->TMParameters,
+                                        (i+1)*sizeof(*pp->TMParameters));
         len += 1 + 6 + 1 + strlen(name) + 1 + 3; /* macro definition */
         len += i * (1 + 9 + 1 + 1 + 1 + 3 + 2); /* macro parameter definition */
         oldline = line;
         p = line = (char*)nasm_malloc(len + 1);
         p += sprintf(p, "%%imacro %s 0-*", name);
         nasm_free(oldline);
-        for (j = 0; TMParameters[j]; j++) {
-            p += sprintf(p, "\n%%idefine %s %%{%-u}", TMParameters[j], j + 1);
+        for (j = 0; pp->TMParameters[j]; j++) {
+            p += sprintf(p, "\n%%idefine %s %%{%-u}", pp->TMParameters[j], j + 1);
         }
         end = (TMEndItem*)nasm_malloc(sizeof(*end));
         end->type = TM_MACRO;
-        end->next = EndmStack;
-        end->data = TMParameters;
-        EndmStack = end;
+        end->next = pp->EndmStack;
+        end->data = pp->TMParameters;
+        pp->EndmStack = end;
         return line;
     } else if (!nasm_stricmp(q, "proc")) {
         /* handle PROC */
@@ -883,7 +1033,7 @@ check_tasm_directive(char *line)
     } else if (!nasm_stricmp(q, "struc")) {
         /* handle struc */
         struct TStruc *struc;
-        if (inTstruc) {
+        if (pp->inTstruc) {
             error(ERR_FATAL, "STRUC: already in a struc context");
             return line;
         }
@@ -894,48 +1044,48 @@ check_tasm_directive(char *line)
         struc->name = nasm_strdup(p);
         struc->fields = NULL;
         struc->lastField = NULL;
-        struc->next = TStrucs;
-        TStrucs = struc;
-        inTstruc = 1;
+        struc->next = pp->TStrucs;
+        pp->TStrucs = struc;
+        pp->inTstruc = 1;
         nasm_free(oldline);
         end = (TMEndItem*)nasm_malloc(sizeof(*end));
         end->type = TM_STRUC;
-        end->next = EndsStack;
-        EndsStack = end;
+        end->next = pp->EndsStack;
+        pp->EndsStack = end;
         return line;
     } else if (!nasm_stricmp(q, "segment")) {
         /* handle SEGMENT */
         oldline = line;
         line = nasm_strdup(oldchar2?q+len2+1:"");
-        if (tasm_segment) {
+        if (pp->tasm_segment) {
             error(ERR_FATAL, "SEGMENT: already in a segment context");
             return line;
         }
-        tasm_segment = nasm_strdup(p);
+        pp->tasm_segment = nasm_strdup(p);
         nasm_free(oldline);
         end = (TMEndItem*)nasm_malloc(sizeof(*end));
         end->type = TM_SEGMENT;
-        end->next = EndsStack;
-        EndsStack = end;
+        end->next = pp->EndsStack;
+        pp->EndsStack = end;
         return line;
     } else if (!nasm_stricmp(p, "ends") || !nasm_stricmp(q, "ends")) {
         /* handle end of ends directive */
-        end = EndsStack;
+        end = pp->EndsStack;
         /* undef parameters */
         if (!end) {
             error(ERR_FATAL, "ENDS: not in an ends context");
             return line;
         }
-        EndsStack = EndsStack->next;
+        pp->EndsStack = pp->EndsStack->next;
         nasm_free(line);
         switch (end->type) {
         case TM_STRUC:
-            inTstruc = 0;
+            pp->inTstruc = 0;
             return nasm_strdup("endstruc");
         case TM_SEGMENT:
             /* XXX: yes, we leak memory here, but that permits labels
              * to avoid strduping... */
-            tasm_segment = NULL;
+            pp->tasm_segment = NULL;
             return nasm_strdup("");
         default:
             error(ERR_FATAL, "ENDS: bogus ends context type %d",end->type);
@@ -947,9 +1097,9 @@ check_tasm_directive(char *line)
     } else if (!nasm_stricmp(p, "assume")) {
         struct TSegmentAssume *assume;
         /* handle ASSUME */
-        if (!TAssumes) {
-            TAssumes = (TSegmentAssume*)nasm_malloc(sizeof(*TAssumes));
-            TAssumes[0].segreg = NULL;
+        if (!pp->TAssumes) {
+            pp->TAssumes = (TSegmentAssume*)nasm_malloc(sizeof(*pp->TAssumes));
+            pp->TAssumes[0].segreg = NULL;
         }
         i = 0;
         q[len2] = oldchar2;
@@ -962,14 +1112,14 @@ check_tasm_directive(char *line)
             if (!*q || *q == ';')
                 break;
             /* segment register name */
-            for (assume = TAssumes; assume->segreg; assume++)
+            for (assume = pp->TAssumes; assume->segreg; assume++)
                 if (strlen(assume->segreg) == (size_t)(q-p) &&
                     !nasm_strnicmp(assume->segreg, p, q-p))
                     break;
             if (!assume->segreg) {
-                i = assume - TAssumes + 1;
-                TAssumes = (TSegmentAssume*)nasm_realloc(TAssumes, (i+1)*sizeof(*TAssumes));
-                assume = TAssumes + i - 1;
+                i = assume - pp->TAssumes + 1;
+                pp->TAssumes = (TSegmentAssume*)nasm_realloc(pp->TAssumes, (i+1)*sizeof(*pp->TAssumes));
+                assume = pp->TAssumes + i - 1;
                 assume->segreg = nasm_strndup(p, q-p);
                 assume[1].segreg = NULL;
             }
@@ -990,11 +1140,11 @@ check_tasm_directive(char *line)
                 q++;
             for (; *q && isspace(*q); q++);
         }
-        TAssumes[i].segreg = NULL;
-        TAssumes = (TSegmentAssume*)nasm_realloc(TAssumes, (i+1)*sizeof(*TAssumes));
+        pp->TAssumes[i].segreg = NULL;
+        pp->TAssumes = (TSegmentAssume*)nasm_realloc(pp->TAssumes, (i+1)*sizeof(*pp->TAssumes));
         nasm_free(line);
         return nasm_strdup("");
-    } else if (inTstruc) {
+    } else if (pp->inTstruc) {
         struct TStrucField *field;
         /* TODO: handle unnamed data */
         field = (TStrucField*)nasm_malloc(sizeof(*field));
@@ -1002,11 +1152,11 @@ check_tasm_directive(char *line)
         /* TODO: type struc ! */
         field->type = nasm_strdup(q);
         field->next = NULL;
-        if (!TStrucs->fields)
-                TStrucs->fields = field;
-        else if (TStrucs->lastField)
-                TStrucs->lastField->next = field;
-        TStrucs->lastField = field;
+        if (!pp->TStrucs->fields)
+                pp->TStrucs->fields = field;
+        else if (pp->TStrucs->lastField)
+                pp->TStrucs->lastField->next = field;
+        pp->TStrucs->lastField = field;
         if (!oldchar2) {
             error(ERR_FATAL, "Expected struc field initializer after %s %s", p, q);
             return line;
@@ -1019,7 +1169,7 @@ check_tasm_directive(char *line)
     }
     {
         struct TStruc *struc;
-        for (struc = TStrucs; struc; struc = struc->next) {
+        for (struc = pp->TStrucs; struc; struc = struc->next) {
             if (!nasm_stricmp(q, struc->name)) {
                 char *r = q + len2 + 1, *s, *t, tasm_param[6];
                 struct TStrucField *field = struc->fields;
@@ -1042,9 +1192,9 @@ check_tasm_directive(char *line)
                 oldline = line;
                 size = len + len2 + 128;
                 line = (char*)nasm_malloc(size);
-                if (defining)
-                    for (n=0;TMParameters[n];n++)
-                        if (!strcmp(TMParameters[n],p)) {
+                if (pp->defining)
+                    for (n=0;pp->TMParameters[n];n++)
+                        if (!strcmp(pp->TMParameters[n],p)) {
                             sprintf(tasm_param,"%%{%d}",n+1);
                             p = tasm_param;
                             break;
@@ -1160,7 +1310,7 @@ prepreproc(char *line)
     *c = '\0';
     ret = nasm_strdup(line);
 
-    lp = &istk->expansion;
+    lp = &pp->istk->expansion;
     do {
         d = strchr(c+1, '\n');
         if (d)
@@ -1181,33 +1331,115 @@ prepreproc(char *line)
  * The hash function for macro lookups. Note that due to some
  * macros having case-insensitive names, the hash function must be
  * invariant under case changes. We implement this by applying a
- * perfectly normal hash function to the uppercase of the string.
+ * perfectly normal hash function (FNV-1a) to the uppercase of the
+ * string.
  */
-static int
-hash(char *s)
+static unsigned int
+hash(const char *s)
 {
-    unsigned int h = 0;
-    unsigned int i = 0;
-    /*
-     * Powers of three, mod 31.
-     */
-    static const int multipliers[] = {
-        1, 3, 9, 27, 19, 26, 16, 17, 20, 29, 25, 13, 8, 24, 10,
-        30, 28, 22, 4, 12, 5, 15, 14, 11, 2, 6, 18, 23, 7, 21
-    };
-
+    unsigned int h = 2166136261U;
 
     while (*s)
     {
-        h += multipliers[i] * (unsigned char) (toupper(*s));
+        h = (h ^ (unsigned char) toupper(*s)) * 16777619U;
         s++;
-        if (++i >= elements(multipliers))
-            i = 0;
     }
-    h %= NHASH;
+    /* mix the high bits into the low bits used as the bucket index */
+    h ^= h >> 16;
     return h;
 }
 
+/*
+ * Double the number of buckets in a macro table (or allocate the
+ * first ones), keeping the macros of each chain in the same order.
+ */
+template <typename M>
+static void
+table_grow(MacroTable<M> *t)
+{
+    unsigned int n = t->nbuckets ? t->nbuckets * 2 : MACRO_HASH_INIT;
+    M **buckets = (M**)nasm_malloc(n * sizeof(M*));
+    M ***tails = (M***)nasm_malloc(n * sizeof(M**));
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    {
+        buckets[i] = NULL;
+        tails[i] = &buckets[i];
+    }
+    for (i = 0; i < t->nbuckets; i++)
+    {
+        M *m = t->buckets[i];
+        while (m)
+        {
+            M *next = m->next;
+            unsigned int b = m->hashval & (n - 1);
+            m->next = NULL;
+            *tails[b] = m;
+            tails[b] = &m->next;
+            m = next;
+        }
+    }
+    nasm_free(tails);
+    nasm_free(t->buckets);
+    t->buckets = buckets;
+    t->nbuckets = n;
+}
+
+/*
+ * Get the chain of a macro table for the hash value `h'.
+ */
+template <typename M>
+static M **
+table_bucket(MacroTable<M> *t, unsigned int h)
+{
+    if (!t->buckets)
+        table_grow(t);
+    return &t->buckets[h & (t->nbuckets - 1)];
+}
+
+/*
+ * Count a macro just pushed on to a chain of a macro table, growing
+ * the table if needed.  Pointers to chains are invalid afterwards.
+ */
+template <typename M>
+static void
+table_added(MacroTable<M> *t)
+{
+    if (++t->count > (unsigned long)t->nbuckets * MACRO_HASH_LOAD)
+        table_grow(t);
+}
+
+/*
+ * Free a macro table's buckets (but not its macros).
+ */
+template <typename M>
+static void
+table_free(MacroTable<M> *t)
+{
+    nasm_free(t->buckets);
+    t->buckets = NULL;
+    t->nbuckets = 0;
+    t->count = 0;
+}
+
+/*
+ * Allocate a single-line macro to be called `name' and push it on to
+ * `*head', which is either a chain of the global table (if `ctx' is
+ * NULL) or the local macros of `ctx'.
+ */
+static SMacro *
+new_smacro(SMacro **head, Context *ctx, const char *name)
+{
+    SMacro *smac = (SMacro*)nasm_malloc(sizeof(SMacro));
+    smac->next = *head;
+    smac->hashval = hash(name);
+    *head = smac;
+    if (!ctx)
+        table_added(&pp->smacros);
+    return smac;
+}
+
 /*
  * Free a linked list of tokens.
  */
@@ -1249,16 +1481,48 @@ free_mmacro(MMacro * m)
     nasm_free(m);
 }
 
+/*
+ * Free all the macros in the global tables.
+ */
+static void
+free_macros(void)
+{
+    unsigned int h;
+
+    for (h = 0; h < pp->mmacros.nbuckets; h++)
+    {
+        while (pp->mmacros.buckets[h])
+        {
+            MMacro *m = pp->mmacros.buckets[h];
+            pp->mmacros.buckets[h] = m->next;
+            free_mmacro(m);
+        }
+    }
+    pp->mmacros.count = 0;
+    for (h = 0; h < pp->smacros.nbuckets; h++)
+    {
+        while (pp->smacros.buckets[h])
+        {
+            SMacro *s = pp->smacros.buckets[h];
+            pp->smacros.buckets[h] = s->next;
+            nasm_free(s->name);
+            free_tlist(s->expansion);
+            nasm_free(s);
+        }
+    }
+    pp->smacros.count = 0;
+}
+
 /*
  * Pop the context stack.
  */
 static void
 ctx_pop(void)
 {
-    Context *c = cstk;
+    Context *c = pp->cstk;
     SMacro *smac, *s;
 
-    cstk = cstk->next;
+    pp->cstk = pp->cstk->next;
     smac = c->localmac;
     while (smac)
     {
@@ -1291,7 +1555,7 @@ read_line(void)
     continued_count = 0;
     while (1)
     {
-        q = yasm_fgets(p, bufsize - (int)(p - buffer), istk->in, &istk->pos);
+        q = yasm_fgets(p, bufsize - (int)(p - buffer), pp->istk->in, &pp->istk->pos);
         if (!q)
             break;
         p += strlen(p);
@@ -1330,7 +1594,7 @@ read_line(void)
         return NULL;
     }
 
-    nasm_src_set_linnum(nasm_src_get_linnum() + istk->lineinc + (continued_count * istk->lineinc));
+    nasm_src_set_linnum(nasm_src_get_linnum() + pp->istk->lineinc + (continued_count * pp->istk->lineinc));
 
     /*
      * Play safe: remove CRs as well as LFs, if any of either are
@@ -1525,19 +1789,12 @@ tokenise(char *line)
 static void *
 new_Block(size_t size)
 {
-        Blocks *b = &blocks;
-        
-        /* first, get to the end of the linked list      */
-        while (b->next)
-                b = b->next;
-        /* now allocate the requested chunk */
+        Blocks *b = (Blocks*)nasm_malloc(sizeof(Blocks));
+
+        /* link the new block in after the first, static one */
         b->chunk = nasm_malloc(size);
-        
-        /* now allocate a new block for the next request */
-        b->next = (Blocks*)nasm_malloc(sizeof(Blocks));
-        /* and initialize the contents of the new block */
-        b->next->next = NULL;
-        b->next->chunk = NULL;
+        b->next = pp->blocks.next;
+        pp->blocks.next = b;
         return b->chunk;
 }
 
@@ -1547,7 +1804,7 @@ new_Block(size_t size)
 static void
 delete_Blocks(void)
 {
-        Blocks *a,*b = &blocks;
+        Blocks *a,*b = &pp->blocks;
 
         /* 
          * keep in mind that the first block, pointed to by blocks
@@ -1560,7 +1817,7 @@ delete_Blocks(void)
                         nasm_free(b->chunk);
                 a = b;
                 b = b->next;
-                if (a != &blocks)
+                if (a != &pp->blocks)
                         nasm_free(a);
         }
 }       
@@ -1576,15 +1833,15 @@ new_Token(Token * next, int type, const char *text, size_t txtlen)
     Token *t;
     int i;
 
-    if (freeTokens == NULL)
+    if (pp->freeTokens == NULL)
     {
-        freeTokens = (Token *)new_Block(TOKEN_BLOCKSIZE * sizeof(Token));
+        pp->freeTokens = (Token *)new_Block(TOKEN_BLOCKSIZE * sizeof(Token));
         for (i = 0; i < TOKEN_BLOCKSIZE - 1; i++)
-            freeTokens[i].next = &freeTokens[i + 1];
-        freeTokens[i].next = NULL;
+            pp->freeTokens[i].next = &pp->freeTokens[i + 1];
+        pp->freeTokens[i].next = NULL;
     }
-    t = freeTokens;
-    freeTokens = t->next;
+    t = pp->freeTokens;
+    pp->freeTokens = t->next;
     t->next = next;
     t->mac = NULL;
     t->type = type;
@@ -1608,8 +1865,8 @@ delete_Token(Token * t)
 {
     Token *next = t->next;
     nasm_free(t->text);
-    t->next = freeTokens;
-    freeTokens = t;
+    t->next = pp->freeTokens;
+    pp->freeTokens = t;
     return next;
 }
 
@@ -1631,6 +1888,7 @@ detoken(Token * tlist, int expand_locals)
         if (t->type == TOK_PREPROC_ID && t->text[1] == '!')
         {
             char *p2 = getenv(t->text + 2);
+            pp->yasm_preproc->setEnvironmentDependent();
             nasm_free(t->text);
             if (p2)
                 t->text = nasm_strdup(p2);
@@ -1824,17 +2082,18 @@ get_ctx(char *name, int all_contexts)
     Context *ctx;
     SMacro *m;
     size_t i;
+    unsigned int h;
 
     if (!name || name[0] != '%' || name[1] != '$')
         return NULL;
 
-    if (!cstk)
+    if (!pp->cstk)
     {
         error(ERR_NONFATAL, "`%s': context stack is empty", name);
         return NULL;
     }
 
-    for (i = strspn(name + 2, "$"), ctx = cstk; (i > 0) && ctx; i--)
+    for (i = strspn(name + 2, "$"), ctx = pp->cstk; (i > 0) && ctx; i--)
     {
         ctx = ctx->next;
 /*        i--;  Lino - 02/25/02 */
@@ -1848,13 +2107,14 @@ get_ctx(char *name, int all_contexts)
     if (!all_contexts)
         return ctx;
 
+    h = hash(name);
     do
     {
         /* Search for this smacro in found context */
         m = ctx->localmac;
         while (m)
         {
-            if (!mstrcmp(m->name, name, m->casesense))
+            if (m->hashval == h && !mstrcmp(m->name, name, m->casesense))
                 return ctx;
             m = m->next;
         }
@@ -1878,6 +2138,7 @@ inc_fopen(char *file,
           FileID from_file,
           FileID& cur_file)
 {
+    yasm::Preprocessor& preproc = *pp->yasm_preproc;
     const MemoryBuffer *in;
     char *c;
     char *pb, *p1, *p2, *file2 = NULL;
@@ -1903,6 +2164,7 @@ inc_fopen(char *file,
          */
         *p2 = '\0';
         env = getenv(p1+1);
+        preproc.setEnvironmentDependent();
         if (!env) {
             /* warn, restore %, and continue looking */
             error(ERR_WARNING, "environment variable `%s' does not exist",
@@ -1927,7 +2189,7 @@ inc_fopen(char *file,
     if (file2)
         strcat(file2, pb);
 
-    in = yasm_fopen_include(file2 ? file2 : file, from_dir, cur_dir, from_file, cur_file);
+    in = yasm_fopen_include(preproc, file2 ? file2 : file, from_dir, cur_dir, from_file, cur_file);
     if (!in && tasm_compatible_mode)
     {
         char *thefile = file2 ? file2 : file;
@@ -1935,17 +2197,17 @@ inc_fopen(char *file,
         do {
             for (c = thefile; *c; c++)
                 *c = toupper(*c);
-            in = yasm_fopen_include(thefile, from_dir, cur_dir, from_file, cur_file);
+            in = yasm_fopen_include(preproc, thefile, from_dir, cur_dir, from_file, cur_file);
             if (in) break;
             *thefile = tolower(*thefile);
-            in = yasm_fopen_include(thefile, from_dir, cur_dir, from_file, cur_file);
+            in = yasm_fopen_include(preproc, thefile, from_dir, cur_dir, from_file, cur_file);
             if (in) break;
             for (c = thefile; *c; c++)
                 *c = tolower(*c);
-            in = yasm_fopen_include(thefile, from_dir, cur_dir, from_file, cur_file);
+            in = yasm_fopen_include(preproc, thefile, from_dir, cur_dir, from_file, cur_file);
             if (in) break;
             *thefile = toupper(*thefile);
-            in = yasm_fopen_include(thefile, from_dir, cur_dir, from_file, cur_file);
+            in = yasm_fopen_include(preproc, thefile, from_dir, cur_dir, from_file, cur_file);
             if (in) break;
         } while (0);
     }
@@ -1987,23 +2249,25 @@ smacro_defined(Context * ctx, char *name, int nparam, SMacro ** defn,
 {
     SMacro *m;
     int highest_level = -1;
+    unsigned int h = hash(name);
 
     if (ctx)
         m = ctx->localmac;
     else if (name[0] == '%' && name[1] == '$')
     {
-        if (cstk)
+        if (pp->cstk)
             ctx = get_ctx(name, FALSE);
         if (!ctx)
             return FALSE;       /* got to return _something_ */
         m = ctx->localmac;
     }
     else
-        m = smacros[hash(name)];
+        m = *table_bucket(&pp->smacros, h);
 
     while (m)
     {
-        if (!mstrcmp(m->name, name, m->casesense && nocase) &&
+        if (m->hashval == h &&
+                !mstrcmp(m->name, name, m->casesense && nocase) &&
                 (nparam <= 0 || m->nparam == 0 || nparam == m->nparam) && (highest_level < 0 || m->level > highest_level))
         {
             highest_level = m->level;
@@ -2096,7 +2360,7 @@ if_condition(Token * tline, int i)
         case PP_IFNCTX:
         case PP_ELIFNCTX:
             j = FALSE;          /* have we matched yet? */
-            while (cstk && tline)
+            while (pp->cstk && tline)
             {
                 skip_white_(tline);
                 if (!tline || tline->type != TOK_ID)
@@ -2107,13 +2371,13 @@ if_condition(Token * tline, int i)
                     free_tlist(origline);
                     return -1;
                 }
-                if (!nasm_stricmp(tline->text, cstk->name))
+                if (!nasm_stricmp(tline->text, pp->cstk->name))
                     j = TRUE;
                 tline = tline->next;
             }
             if (i == PP_IFNCTX || i == PP_ELIFNCTX)
                 j = !j;
-            if(curly_opened == 0)
+            if(pp->curly_opened == 0)
                 free_tlist(origline);
             return j;
 
@@ -2133,7 +2397,7 @@ if_condition(Token * tline, int i)
                     error(ERR_NONFATAL,
                           "`%s' expects macro identifiers",
                           directives[i]);
-                    if(curly_opened == 0)
+                    if(pp->curly_opened == 0)
                         free_tlist(origline);
                     return -1;
                 }
@@ -2143,7 +2407,7 @@ if_condition(Token * tline, int i)
             }
             if (i == PP_IFNDEF || i == PP_ELIFNDEF)
                 j = !j;
-            if(curly_opened == 0)
+            if(pp->curly_opened == 0)
                 free_tlist(origline);
             return j;
 
@@ -2165,7 +2429,7 @@ if_condition(Token * tline, int i)
                 error(ERR_NONFATAL,
                         "`%s' expects two comma-separated arguments",
                         directives[i]);
-                if(curly_opened == 0)
+                if(pp->curly_opened == 0)
                     free_tlist(tline);
                 return -1;
             }
@@ -2179,7 +2443,7 @@ if_condition(Token * tline, int i)
                 {
                     error(ERR_NONFATAL, "`%s': more than one comma on line",
                             directives[i]);
-                    if(curly_opened == 0)
+                    if(pp->curly_opened == 0)
                         free_tlist(tline);
                     return -1;
                 }
@@ -2218,7 +2482,7 @@ if_condition(Token * tline, int i)
             if (i == PP_IFNIDN || i == PP_ELIFNIDN ||
                     i == PP_IFNIDNI || i == PP_ELIFNIDNI)
                 j = !j;
-            if(curly_opened == 0)
+            if(pp->curly_opened == 0)
                 free_tlist(tline);
             return j;
 
@@ -2295,10 +2559,12 @@ if_condition(Token * tline, int i)
                 tline = tline->next;
                 searching.plus = TRUE;
             }
-            mmac = mmacros[hash(searching.name)];
+            searching.hashval = hash(searching.name);
+            mmac = *table_bucket(&pp->mmacros, searching.hashval);
             while (mmac)
             {
-                if (!strcmp(mmac->name, searching.name) &&
+                if (mmac->hashval == searching.hashval &&
+                        !strcmp(mmac->name, searching.name) &&
                         (mmac->nparam_min <= searching.nparam_max
                                 || searching.plus)
                         && (searching.nparam_min <= mmac->nparam_max
@@ -2310,7 +2576,7 @@ if_condition(Token * tline, int i)
                 mmac = mmac->next;
             }
             nasm_free(searching.name);
-            if(curly_opened == 0)
+            if(pp->curly_opened == 0)
                 free_tlist(origline);
             if (i == PP_IFNMACRO || i == PP_ELIFNMACRO)
                 found = !found;
@@ -2361,7 +2627,7 @@ if_condition(Token * tline, int i)
                     i == PP_IFNNUM || i == PP_ELIFNNUM ||
                     i == PP_IFNSTR || i == PP_ELIFNSTR)
                 j = !j;
-			if(curly_opened == 0)
+			if(pp->curly_opened == 0)
 				free_tlist(tline);
             return j;
 
@@ -2371,20 +2637,20 @@ if_condition(Token * tline, int i)
             t = tline = expand_smacro(tline);
             tptr = &t;
             tokval.t_type = TOKEN_INVALID;
-            evalresult = evaluate(ppscan, tptr, &tokval, pass | CRITICAL,
+            evalresult = pp->evaluate(ppscan, tptr, &tokval, pp->pass | CRITICAL,
                                   error, evaluate_curly_brackets);
 	    /*
 	     * Do not free if this function is invoked when processing
 	     * a {%pp_id} structure, which is part of %if*** line
 	     */
-            if(curly_opened == 0)
+            if(pp->curly_opened == 0)
                 free_tlist(tline);
             if (!evalresult)
                 return -1;
             if (tokval.t_type)
                 error(ERR_WARNING,
                         "trailing garbage after expression ignored");
-            evalresult->Simplify(yasm_preproc->getDiagnostics());
+            evalresult->Simplify(pp->yasm_preproc->getDiagnostics());
             if (!evalresult->isIntNum())
             {
                 error(ERR_NONFATAL,
@@ -2474,7 +2740,7 @@ do_directive(Token * tline)
     Context *ctx;
     Cond *cond;
     SMacro *smac, **smhead;
-    MMacro *mmac;
+    MMacro *mmac, **mmhead;
     Token *t, *tt, *param_start, *macro_start, *last, **tptr, *origline;
     Line *l;
     struct tokenval tokval;
@@ -2496,8 +2762,8 @@ do_directive(Token * tline)
      * we should ignore all directives except for condition
      * directives.
      */
-    if (((istk->conds && !emitting(istk->conds->state)) ||
-         (istk->mstk && !istk->mstk->in_progress)) &&
+    if (((pp->istk->conds && !emitting(pp->istk->conds->state)) ||
+         (pp->istk->mstk && !pp->istk->mstk->in_progress)) &&
         !is_condition(i))
     {
         return NO_DIRECTIVE_FOUND;
@@ -2510,30 +2776,30 @@ do_directive(Token * tline)
      * %rep block) %endrep. If we're in a %rep block, another %rep
      * causes an error, so should be let through.
      */
-    if (defining && i != PP_MACRO && i != PP_IMACRO &&
+    if (pp->defining && i != PP_MACRO && i != PP_IMACRO &&
             i != PP_ENDMACRO && i != PP_ENDM &&
-            (defining->name || (i != PP_ENDREP && i != PP_REP)))
+            (pp->defining->name || (i != PP_ENDREP && i != PP_REP)))
     {
         return NO_DIRECTIVE_FOUND;
     }
 
-    if (defining) {
+    if (pp->defining) {
         if (i == PP_MACRO || i == PP_IMACRO) {
-            nested_mac_count++;
+            pp->nested_mac_count++;
             return NO_DIRECTIVE_FOUND;
-        } else if (nested_mac_count > 0) {
+        } else if (pp->nested_mac_count > 0) {
             if (i == PP_ENDMACRO) {
-                nested_mac_count--;
+                pp->nested_mac_count--;
                 return NO_DIRECTIVE_FOUND;
             }
         }
-        if (!defining->name) {
+        if (!pp->defining->name) {
             if (i == PP_REP) {
-                nested_rep_count++;
+                pp->nested_rep_count++;
                 return NO_DIRECTIVE_FOUND;
-            } else if (nested_rep_count > 0) {
+            } else if (pp->nested_rep_count > 0) {
                 if (i == PP_ENDREP) {
-                    nested_rep_count--;
+                    pp->nested_rep_count--;
                     return NO_DIRECTIVE_FOUND;
                 }
             }
@@ -2569,30 +2835,30 @@ do_directive(Token * tline)
             if (nasm_stricmp(tline->text, "flat") == 0)
             {
                 /* All subsequent ARG directives are for a 32-bit stack */
-                StackSize = 4;
-                StackPointer = "ebp";
-                ArgOffset = 8;
-                LocalOffset = 4;
+                pp->StackSize = 4;
+                pp->StackPointer = "ebp";
+                pp->ArgOffset = 8;
+                pp->LocalOffset = 4;
             }
             else if (nasm_stricmp(tline->text, "large") == 0)
             {
                 /* All subsequent ARG directives are for a 16-bit stack,
                  * far function call.
                  */
-                StackSize = 2;
-                StackPointer = "bp";
-                ArgOffset = 4;
-                LocalOffset = 2;
+                pp->StackSize = 2;
+                pp->StackPointer = "bp";
+                pp->ArgOffset = 4;
+                pp->LocalOffset = 2;
             }
             else if (nasm_stricmp(tline->text, "small") == 0)
             {
                 /* All subsequent ARG directives are for a 16-bit stack,
                    * far function call. We don't support near functions.
                  */
-                StackSize = 2;
-                StackPointer = "bp";
-                ArgOffset = 6;
-                LocalOffset = 2;
+                pp->StackSize = 2;
+                pp->StackPointer = "bp";
+                pp->ArgOffset = 6;
+                pp->LocalOffset = 2;
             }
             else
             {
@@ -2609,11 +2875,11 @@ do_directive(Token * tline)
              *
              *      ARG arg1:WORD, arg2:DWORD, arg4:QWORD
              */
-            offset = ArgOffset;
+            offset = pp->ArgOffset;
             do
             {
                 char *arg, directive[256];
-                int size = StackSize;
+                int size = pp->StackSize;
 
                 /* Find the argument name */
                 tline = tline->next;
@@ -2651,23 +2917,23 @@ do_directive(Token * tline)
                 tt = expand_smacro(tt);
                 if (nasm_stricmp(tt->text, "byte") == 0)
                 {
-                    size = MAX(StackSize, 1);
+                    size = MAX(pp->StackSize, 1);
                 }
                 else if (nasm_stricmp(tt->text, "word") == 0)
                 {
-                    size = MAX(StackSize, 2);
+                    size = MAX(pp->StackSize, 2);
                 }
                 else if (nasm_stricmp(tt->text, "dword") == 0)
                 {
-                    size = MAX(StackSize, 4);
+                    size = MAX(pp->StackSize, 4);
                 }
                 else if (nasm_stricmp(tt->text, "qword") == 0)
                 {
-                    size = MAX(StackSize, 8);
+                    size = MAX(pp->StackSize, 8);
                 }
                 else if (nasm_stricmp(tt->text, "tword") == 0)
                 {
-                    size = MAX(StackSize, 10);
+                    size = MAX(pp->StackSize, 10);
                 }
                 else
                 {
@@ -2680,7 +2946,7 @@ do_directive(Token * tline)
                 free_tlist(tt);
 
                 /* Now define the macro for the argument */
-                sprintf(directive, "%%define %s (%s+%d)", arg, StackPointer,
+                sprintf(directive, "%%define %s (%s+%d)", arg, pp->StackPointer,
                         offset);
                 do_directive(tokenise(directive));
                 offset += size;
@@ -2705,11 +2971,11 @@ do_directive(Token * tline)
              * required by TASM to define the local parameter size (and used
              * by the TASM macro package).
              */
-            offset = LocalOffset;
+            offset = pp->LocalOffset;
             do
             {
                 char *local, directive[256];
-                int size = StackSize;
+                int size = pp->StackSize;
 
                 /* Find the argument name */
                 tline = tline->next;
@@ -2748,23 +3014,23 @@ do_directive(Token * tline)
                 tt = expand_smacro(tt);
                 if (nasm_stricmp(tt->text, "byte") == 0)
                 {
-                    size = MAX(StackSize, 1);
+                    size = MAX(pp->StackSize, 1);
                 }
                 else if (nasm_stricmp(tt->text, "word") == 0)
                 {
-                    size = MAX(StackSize, 2);
+                    size = MAX(pp->StackSize, 2);
                 }
                 else if (nasm_stricmp(tt->text, "dword") == 0)
                 {
-                    size = MAX(StackSize, 4);
+                    size = MAX(pp->StackSize, 4);
                 }
                 else if (nasm_stricmp(tt->text, "qword") == 0)
                 {
-                    size = MAX(StackSize, 8);
+                    size = MAX(pp->StackSize, 8);
                 }
                 else if (nasm_stricmp(tt->text, "tword") == 0)
                 {
-                    size = MAX(StackSize, 10);
+                    size = MAX(pp->StackSize, 10);
                 }
                 else
                 {
@@ -2777,7 +3043,7 @@ do_directive(Token * tline)
                 free_tlist(tt);
 
                 /* Now define the macro for the argument */
-                sprintf(directive, "%%define %s (%s-%d)", local, StackPointer,
+                sprintf(directive, "%%define %s (%s-%d)", local, pp->StackPointer,
                         offset);
                 do_directive(tokenise(directive));
                 offset += size;
@@ -2801,23 +3067,7 @@ do_directive(Token * tline)
             if (tline->next)
                 error(ERR_WARNING,
                         "trailing garbage after `%%clear' ignored");
-            for (j = 0; j < NHASH; j++)
-            {
-                while (mmacros[j])
-                {
-                    MMacro *m2 = mmacros[j];
-                    mmacros[j] = m2->next;
-                    free_mmacro(m2);
-                }
-                while (smacros[j])
-                {
-                    SMacro *s = smacros[j];
-                    smacros[j] = smacros[j]->next;
-                    nasm_free(s->name);
-                    free_tlist(s->expansion);
-                    nasm_free(s);
-                }
-            }
+            free_macros();
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
@@ -2844,11 +3094,11 @@ do_directive(Token * tline)
                 p = tline->text;        /* internal_string is easier */
             expand_macros_in_string(&p);
             inc = (Include*)nasm_malloc(sizeof(Include));
-            inc->next = istk;
+            inc->next = pp->istk;
             inc->conds = NULL;
-            const DirectoryLookup* to_dir;
+            const DirectoryLookup* to_dir = 0;
             FileID to_file;
-            inc->in = inc_fopen(p, istk->cur_dir, to_dir, istk->fid, to_file);
+            inc->in = inc_fopen(p, pp->istk->cur_dir, to_dir, pp->istk->fid, to_file);
             inc->fid = to_file;
             inc->cur_dir = to_dir;
             inc->pos = 0;
@@ -2857,7 +3107,7 @@ do_directive(Token * tline)
             inc->lineinc = 1;
             inc->expansion = NULL;
             inc->mstk = NULL;
-            istk = inc;
+            pp->istk = inc;
             //list->uplevel(LIST_INCLUDE);
             free_tlist(origline);
             return DIRECTIVE_FOUND;
@@ -2876,11 +3126,11 @@ do_directive(Token * tline)
             if (tline->next)
                 error(ERR_WARNING, "trailing garbage after `%%push' ignored");
             ctx = (Context*)nasm_malloc(sizeof(Context));
-            ctx->next = cstk;
+            ctx->next = pp->cstk;
             ctx->localmac = NULL;
             ctx->name = nasm_strdup(tline->text);
-            ctx->number = unique++;
-            cstk = ctx;
+            ctx->number = pp->unique++;
+            pp->cstk = ctx;
             free_tlist(origline);
             break;
 
@@ -2896,12 +3146,12 @@ do_directive(Token * tline)
             }
             if (tline->next)
                 error(ERR_WARNING, "trailing garbage after `%%repl' ignored");
-            if (!cstk)
+            if (!pp->cstk)
                 error(ERR_NONFATAL, "`%%repl': context stack is empty");
             else
             {
-                nasm_free(cstk->name);
-                cstk->name = nasm_strdup(tline->text);
+                nasm_free(pp->cstk->name);
+                pp->cstk->name = nasm_strdup(tline->text);
             }
             free_tlist(origline);
             break;
@@ -2909,7 +3159,7 @@ do_directive(Token * tline)
         case PP_POP:
             if (tline->next)
                 error(ERR_WARNING, "trailing garbage after `%%pop' ignored");
-            if (!cstk)
+            if (!pp->cstk)
                 error(ERR_NONFATAL,
                         "`%%pop': context stack is already empty");
             else
@@ -2920,25 +3170,25 @@ do_directive(Token * tline)
         case PP_SCOPE:
             if (tline->next)
                 error(ERR_WARNING, "trailing garbage after `%%scope' ignored");
-            Level++;
+            pp->Level++;
             free_tlist(origline);
             break;
 
         case PP_ENDSCOPE:
             if (tline->next)
                 error(ERR_WARNING, "trailing garbage after `%%endscope' ignored");
-            if (!Level)
+            if (!pp->Level)
                 error(ERR_NONFATAL,
                         "`%%endscope': already popped all levels");
             else
             {
-                for (k = 0; k < NHASH; k++)
+                for (k = 0; k < (int)pp->smacros.nbuckets; k++)
                 {
-                    SMacro **smlast = &smacros[k];
-                    smac = smacros[k];
+                    SMacro **smlast = &pp->smacros.buckets[k];
+                    smac = pp->smacros.buckets[k];
                     while (smac)
                     {
-                        if (smac->level < Level)
+                        if (smac->level < pp->Level)
                         {
                             smlast = &smac->next;
                             smac = smac->next;
@@ -2949,17 +3199,18 @@ do_directive(Token * tline)
                             nasm_free(smac->name);
                             free_tlist(smac->expansion);
                             nasm_free(smac);
+                            pp->smacros.count--;
                             smac = *smlast;
                         }
                     }
                 }
-                for (ctx = cstk; ctx; ctx = ctx->next)
+                for (ctx = pp->cstk; ctx; ctx = ctx->next)
                 {
                     SMacro **smlast = &ctx->localmac;
                     smac = ctx->localmac;
                     while (smac)
                     {
-                        if (smac->level < Level)
+                        if (smac->level < pp->Level)
                         {
                             smlast = &smac->next;
                             smac = smac->next;
@@ -2974,7 +3225,7 @@ do_directive(Token * tline)
                         }
                     }
                 }
-                Level--;
+                pp->Level--;
             }
             free_tlist(origline);
             break;
@@ -3017,7 +3268,7 @@ do_directive(Token * tline)
         case PP_IFNSTR:
         case PP_IFNUM:
         case PP_IFSTR:
-            if (istk->conds && !emitting(istk->conds->state))
+            if (pp->istk->conds && !emitting(pp->istk->conds->state))
                 j = COND_NEVER;
             else
             {
@@ -3027,9 +3278,9 @@ do_directive(Token * tline)
             }
             free_tlist(origline);
             cond = (Cond*)nasm_malloc(sizeof(Cond));
-            cond->next = istk->conds;
+            cond->next = pp->istk->conds;
             cond->state = j;
-            istk->conds = cond;
+            pp->istk->conds = cond;
             return DIRECTIVE_FOUND;
 
         case PP_ELIF:
@@ -3049,11 +3300,11 @@ do_directive(Token * tline)
         case PP_ELIFNSTR:
         case PP_ELIFNUM:
         case PP_ELIFSTR:
-            if (!istk->conds)
+            if (!pp->istk->conds)
                 error(ERR_FATAL, "`%s': no matching `%%if'", directives[i]);
-            if (emitting(istk->conds->state)
-                    || istk->conds->state == COND_NEVER)
-                istk->conds->state = COND_NEVER;
+            if (emitting(pp->istk->conds->state)
+                    || pp->istk->conds->state == COND_NEVER)
+                pp->istk->conds->state = COND_NEVER;
             else
             {
                 /*
@@ -3066,7 +3317,7 @@ do_directive(Token * tline)
                  */
                 j = if_condition(expand_mmac_params(tline->next), i);
                 tline->next = NULL; /* it got freed */
-                istk->conds->state =
+                pp->istk->conds->state =
                         j < 0 ? COND_NEVER : j ? COND_IF_TRUE : COND_IF_FALSE;
             }
             free_tlist(origline);
@@ -3075,13 +3326,13 @@ do_directive(Token * tline)
         case PP_ELSE:
             if (tline->next)
                 error(ERR_WARNING, "trailing garbage after `%%else' ignored");
-            if (!istk->conds)
+            if (!pp->istk->conds)
                 error(ERR_FATAL, "`%%else': no matching `%%if'");
-            if (emitting(istk->conds->state)
-                    || istk->conds->state == COND_NEVER)
-                istk->conds->state = COND_ELSE_FALSE;
+            if (emitting(pp->istk->conds->state)
+                    || pp->istk->conds->state == COND_NEVER)
+                pp->istk->conds->state = COND_ELSE_FALSE;
             else
-                istk->conds->state = COND_ELSE_TRUE;
+                pp->istk->conds->state = COND_ELSE_TRUE;
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
@@ -3089,17 +3340,17 @@ do_directive(Token * tline)
             if (tline->next)
                 error(ERR_WARNING,
                         "trailing garbage after `%%endif' ignored");
-            if (!istk->conds)
+            if (!pp->istk->conds)
                 error(ERR_FATAL, "`%%endif': no matching `%%if'");
-            cond = istk->conds;
-            istk->conds = cond->next;
+            cond = pp->istk->conds;
+            pp->istk->conds = cond->next;
             nasm_free(cond);
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
         case PP_MACRO:
         case PP_IMACRO:
-            if (defining)
+            if (pp->defining)
                 error(ERR_FATAL,
                         "`%%%smacro': already defining a macro",
                         (i == PP_IMACRO ? "i" : ""));
@@ -3113,13 +3364,14 @@ do_directive(Token * tline)
                         (i == PP_IMACRO ? "i" : ""));
                 return DIRECTIVE_FOUND;
             }
-            defining = (MMacro*)nasm_malloc(sizeof(MMacro));
-            defining->name = nasm_strdup(tline->text);
-            defining->casesense = (i == PP_MACRO);
-            defining->plus = FALSE;
-            defining->nolist = FALSE;
-            defining->in_progress = FALSE;
-            defining->rep_nest = NULL;
+            pp->defining = (MMacro*)nasm_malloc(sizeof(MMacro));
+            pp->defining->name = nasm_strdup(tline->text);
+            pp->defining->hashval = hash(pp->defining->name);
+            pp->defining->casesense = (i == PP_MACRO);
+            pp->defining->plus = FALSE;
+            pp->defining->nolist = FALSE;
+            pp->defining->in_progress = FALSE;
+            pp->defining->rep_nest = NULL;
             tline = expand_smacro(tline->next);
             skip_white_(tline);
             if (!tok_type_(tline, TOK_NUMBER))
@@ -3127,12 +3379,12 @@ do_directive(Token * tline)
                 error(ERR_NONFATAL,
                         "`%%%smacro' expects a parameter count",
                         (i == PP_IMACRO ? "i" : ""));
-                defining->nparam_min = defining->nparam_max = 0;
+                pp->defining->nparam_min = pp->defining->nparam_max = 0;
             }
             else
             {
                 IntNum intn = nasm_readnum(tline->text, &j);
-                defining->nparam_min = defining->nparam_max = intn.getInt();
+                pp->defining->nparam_min = pp->defining->nparam_max = intn.getInt();
                 if (j)
                     error(ERR_NONFATAL,
                             "unable to parse parameter count `%s'",
@@ -3142,7 +3394,7 @@ do_directive(Token * tline)
             {
                 tline = tline->next->next;
                 if (tok_is_(tline, "*"))
-                    defining->nparam_max = INT_MAX;
+                    pp->defining->nparam_max = INT_MAX;
                 else if (!tok_type_(tline, TOK_NUMBER))
                     error(ERR_NONFATAL,
                             "`%%%smacro' expects a parameter count after `-'",
@@ -3150,12 +3402,12 @@ do_directive(Token * tline)
                 else
                 {
                     IntNum intn = nasm_readnum(tline->text, &j);
-                    defining->nparam_max = intn.getInt();
+                    pp->defining->nparam_max = intn.getInt();
                     if (j)
                         error(ERR_NONFATAL,
                                 "unable to parse parameter count `%s'",
                                 tline->text);
-                    if (defining->nparam_min > defining->nparam_max)
+                    if (pp->defining->nparam_min > pp->defining->nparam_max)
                         error(ERR_NONFATAL,
                                 "minimum parameter count exceeds maximum");
                 }
@@ -3163,26 +3415,27 @@ do_directive(Token * tline)
             if (tline && tok_is_(tline->next, "+"))
             {
                 tline = tline->next;
-                defining->plus = TRUE;
+                pp->defining->plus = TRUE;
             }
             if (tline && tok_type_(tline->next, TOK_ID) &&
                     !nasm_stricmp(tline->next->text, ".nolist"))
             {
                 tline = tline->next;
-                defining->nolist = TRUE;
+                pp->defining->nolist = TRUE;
             }
-            mmac = mmacros[hash(defining->name)];
+            mmac = *table_bucket(&pp->mmacros, pp->defining->hashval);
             while (mmac)
             {
-                if (!strcmp(mmac->name, defining->name) &&
-                        (mmac->nparam_min <= defining->nparam_max
-                                || defining->plus)
-                        && (defining->nparam_min <= mmac->nparam_max
+                if (mmac->hashval == pp->defining->hashval &&
+                        !strcmp(mmac->name, pp->defining->name) &&
+                        (mmac->nparam_min <= pp->defining->nparam_max
+                                || pp->defining->plus)
+                        && (pp->defining->nparam_min <= mmac->nparam_max
                                 || mmac->plus))
                 {
                     error(ERR_WARNING,
                             "redefining multi-line macro `%s'",
-                            defining->name);
+                            pp->defining->name);
                     break;
                 }
                 mmac = mmac->next;
@@ -3192,32 +3445,33 @@ do_directive(Token * tline)
              */
             if (tline && tline->next)
             {
-                defining->dlist = tline->next;
+                pp->defining->dlist = tline->next;
                 tline->next = NULL;
-                count_mmac_params(defining->dlist, &defining->ndefs,
-                        &defining->defaults);
+                count_mmac_params(pp->defining->dlist, &pp->defining->ndefs,
+                        &pp->defining->defaults);
             }
             else
             {
-                defining->dlist = NULL;
-                defining->defaults = NULL;
+                pp->defining->dlist = NULL;
+                pp->defining->defaults = NULL;
             }
-            defining->expansion = NULL;
+            pp->defining->expansion = NULL;
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
         case PP_ENDM:
         case PP_ENDMACRO:
-            if (!defining)
+            if (!pp->defining)
             {
                 error(ERR_NONFATAL, "`%s': not defining a macro",
                         tline->text);
                 return DIRECTIVE_FOUND;
             }
-            k = hash(defining->name);
-            defining->next = mmacros[k];
-            mmacros[k] = defining;
-            defining = NULL;
+            mmhead = table_bucket(&pp->mmacros, pp->defining->hashval);
+            pp->defining->next = *mmhead;
+            *mmhead = pp->defining;
+            table_added(&pp->mmacros);
+            pp->defining = NULL;
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
@@ -3236,23 +3490,23 @@ do_directive(Token * tline)
             tline = t;
             tptr = &t;
             tokval.t_type = TOKEN_INVALID;
-            evalresult = evaluate(ppscan, tptr, &tokval, pass, error,
+            evalresult = pp->evaluate(ppscan, tptr, &tokval, pp->pass, error,
                         evaluate_curly_brackets);
-	    if(curly_opened == 0)
+	    if(pp->curly_opened == 0)
 		    free_tlist(tline);
             if (!evalresult)
                 return DIRECTIVE_FOUND;
             if (tokval.t_type)
                 error(ERR_WARNING,
                         "trailing garbage after expression ignored");
-            evalresult->Simplify(yasm_preproc->getDiagnostics());
+            evalresult->Simplify(pp->yasm_preproc->getDiagnostics());
             if (!evalresult->isIntNum())
             {
                 error(ERR_NONFATAL, "non-constant value given to `%%rotate'");
                 delete evalresult;
                 return DIRECTIVE_FOUND;
             }
-            mmac = istk->mstk;
+            mmac = pp->istk->mstk;
             while (mmac && !mmac->name) /* avoid mistaking %reps for macros */
                 mmac = mmac->next_active;
             if (!mmac)
@@ -3297,18 +3551,18 @@ do_directive(Token * tline)
                 t = expand_smacro(tline);
                 tptr = &t;
                 tokval.t_type = TOKEN_INVALID;
-                evalresult = evaluate(ppscan, tptr, &tokval, pass, error,
+                evalresult = pp->evaluate(ppscan, tptr, &tokval, pp->pass, error,
                             evaluate_curly_brackets);
                 if (!evalresult)
                 {
-					if(curly_opened == 0)
+					if(pp->curly_opened == 0)
 					    free_tlist(origline);
                     return DIRECTIVE_FOUND;
                 }
                 if (tokval.t_type)
                     error(ERR_WARNING,
                           "trailing garbage after expression ignored");
-                evalresult->Simplify(yasm_preproc->getDiagnostics());
+                evalresult->Simplify(pp->yasm_preproc->getDiagnostics());
                 if (!evalresult->isIntNum())
                 {
                     error(ERR_NONFATAL, "non-constant value given to `%%rep'");
@@ -3325,23 +3579,23 @@ do_directive(Token * tline)
             }
             free_tlist(origline);
 
-            tmp_defining = defining;
-            defining = (MMacro*)nasm_malloc(sizeof(MMacro));
-            defining->name = NULL;      /* flags this macro as a %rep block */
-            defining->casesense = 0;
-            defining->plus = FALSE;
-            defining->nolist = nolist;
-            defining->in_progress = i;
-            defining->nparam_min = defining->nparam_max = 0;
-            defining->defaults = NULL;
-            defining->dlist = NULL;
-            defining->expansion = NULL;
-            defining->next_active = istk->mstk;
-            defining->rep_nest = tmp_defining;
+            tmp_defining = pp->defining;
+            pp->defining = (MMacro*)nasm_malloc(sizeof(MMacro));
+            pp->defining->name = NULL;      /* flags this macro as a %rep block */
+            pp->defining->casesense = 0;
+            pp->defining->plus = FALSE;
+            pp->defining->nolist = nolist;
+            pp->defining->in_progress = i;
+            pp->defining->nparam_min = pp->defining->nparam_max = 0;
+            pp->defining->defaults = NULL;
+            pp->defining->dlist = NULL;
+            pp->defining->expansion = NULL;
+            pp->defining->next_active = pp->istk->mstk;
+            pp->defining->rep_nest = tmp_defining;
             return DIRECTIVE_FOUND;
 
         case PP_ENDREP:
-            if (!defining || defining->name)
+            if (!pp->defining || pp->defining->name)
             {
                 error(ERR_NONFATAL, "`%%endrep': no matching `%%rep'");
                 return DIRECTIVE_FOUND;
@@ -3359,16 +3613,16 @@ do_directive(Token * tline)
              * from istk->expansion by a %exitrep.
              */
             l = (Line*)nasm_malloc(sizeof(Line));
-            l->next = istk->expansion;
-            l->finishes = defining;
+            l->next = pp->istk->expansion;
+            l->finishes = pp->defining;
             l->first = NULL;
-            istk->expansion = l;
+            pp->istk->expansion = l;
 
-            istk->mstk = defining;
+            pp->istk->mstk = pp->defining;
 
             //list->uplevel(defining->nolist ? LIST_MACRO_NOLIST : LIST_MACRO);
-            tmp_defining = defining;
-            defining = defining->rep_nest;
+            tmp_defining = pp->defining;
+            pp->defining = pp->defining->rep_nest;
             free_tlist(origline);
             return DIRECTIVE_FOUND;
 
@@ -3378,7 +3632,7 @@ do_directive(Token * tline)
              * macro-end marker for a macro with no name. Then we set
              * its `in_progress' flag to 0.
              */
-            for (l = istk->expansion; l; l = l->next)
+            for (l = pp->istk->expansion; l; l = l->next)
                 if (l->finishes && !l->finishes->name)
                     break;
 
@@ -3414,7 +3668,7 @@ do_directive(Token * tline)
 
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = table_bucket(&pp->smacros, hash(tline->text));
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3508,7 +3762,7 @@ do_directive(Token * tline)
                     free_tlist(macro_start);
                     return DIRECTIVE_FOUND;
                 }
-                else if (smac->level == Level)
+                else if (smac->level == pp->Level)
                 {
                     /*
                      * We're redefining in the same level, so we have to 
@@ -3520,21 +3774,17 @@ do_directive(Token * tline)
                 }
                 else
                 {
-                    smac = (SMacro*)nasm_malloc(sizeof(SMacro));
-                    smac->next = *smhead;
-                    *smhead = smac;
+                    smac = new_smacro(smhead, ctx, mname);
                 }
             }
             else
             {
-                smac = (SMacro*)nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(smhead, ctx, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = ((i == PP_DEFINE) || (i == PP_XDEFINE));
             smac->nparam = nparam;
-            smac->level = Level;
+            smac->level = pp->Level;
             smac->expansion = macro_start;
             smac->in_progress = FALSE;
             free_tlist(origline);
@@ -3561,7 +3811,7 @@ do_directive(Token * tline)
             /* Find the context that symbol belongs to */
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = table_bucket(&pp->smacros, hash(tline->text));
             else
                 smhead = &ctx->localmac;
 
@@ -3581,6 +3831,8 @@ do_directive(Token * tline)
                     nasm_free(smac->name);
                     free_tlist(smac->expansion);
                     nasm_free(smac);
+                    if (!ctx)
+                        pp->smacros.count--;
                 }
             }
             free_tlist(origline);
@@ -3601,7 +3853,7 @@ do_directive(Token * tline)
             }
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = table_bucket(&pp->smacros, hash(tline->text));
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3651,9 +3903,7 @@ do_directive(Token * tline)
             }
             else
             {
-                smac = (SMacro*)nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(smhead, ctx, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = (i == PP_STRLEN);
@@ -3681,7 +3931,7 @@ do_directive(Token * tline)
             }
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = table_bucket(&pp->smacros, hash(tline->text));
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3706,7 +3956,7 @@ do_directive(Token * tline)
             tt = t->next;
             tptr = &tt;
             tokval.t_type = TOKEN_INVALID;
-            evalresult = evaluate(ppscan, tptr, &tokval, pass, error,
+            evalresult = pp->evaluate(ppscan, tptr, &tokval, pp->pass, error,
                     evaluate_curly_brackets);
             if (!evalresult)
             {
@@ -3714,7 +3964,7 @@ do_directive(Token * tline)
                 free_tlist(origline);
                 return DIRECTIVE_FOUND;
             }
-            evalresult->Simplify(yasm_preproc->getDiagnostics());
+            evalresult->Simplify(pp->yasm_preproc->getDiagnostics());
             if (!evalresult->isIntNum())
             {
                 error(ERR_NONFATAL, "non-constant value given to `%%substr`");
@@ -3764,9 +4014,7 @@ do_directive(Token * tline)
             }
             else
             {
-                smac = (SMacro*)nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(smhead, ctx, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = (i == PP_SUBSTR);
@@ -3796,7 +4044,7 @@ do_directive(Token * tline)
             }
             ctx = get_ctx(tline->text, FALSE);
             if (!ctx)
-                smhead = &smacros[hash(tline->text)];
+                smhead = table_bucket(&pp->smacros, hash(tline->text));
             else
                 smhead = &ctx->localmac;
             mname = tline->text;
@@ -3807,9 +4055,9 @@ do_directive(Token * tline)
             t = tline;
             tptr = &t;
             tokval.t_type = TOKEN_INVALID;
-            evalresult = evaluate(ppscan, tptr, &tokval, pass, error, 
+            evalresult = pp->evaluate(ppscan, tptr, &tokval, pp->pass, error, 
                         evaluate_curly_brackets);
-            if(curly_opened == 0)
+            if(pp->curly_opened == 0)
                 free_tlist(tline);
             if (!evalresult)
             {
@@ -3821,7 +4069,7 @@ do_directive(Token * tline)
                 error(ERR_WARNING,
                         "trailing garbage after expression ignored");
 
-            evalresult->Simplify(yasm_preproc->getDiagnostics());
+            evalresult->Simplify(pp->yasm_preproc->getDiagnostics());
             if (!evalresult->isIntNum())
             {
                 error(ERR_NONFATAL,
@@ -3862,9 +4110,7 @@ do_directive(Token * tline)
             }
             else
             {
-                smac = (SMacro*)nasm_malloc(sizeof(SMacro));
-                smac->next = *smhead;
-                *smhead = smac;
+                smac = new_smacro(smhead, ctx, mname);
             }
             smac->name = nasm_strdup(mname);
             smac->casesense = (i == PP_ASSIGN);
@@ -3904,7 +4150,7 @@ do_directive(Token * tline)
             }
             skip_white_(tline);
             nasm_src_set_linnum(k);
-            istk->lineinc = m;
+            pp->istk->lineinc = m;
             if (tline)
             {
                 nasm_free(nasm_src_set_fname(detoken(tline, FALSE)));
@@ -3995,7 +4241,7 @@ expand_mmac_params(Token * tline)
 
             second_text = strchr(t->text, ':');
 
-            mac = istk->mstk;
+            mac = pp->istk->mstk;
             while (mac && !mac->name)   /* avoid mistaking %reps for macros */
                 mac = mac->next_active;
             if (!mac)
@@ -4220,6 +4466,7 @@ expand_smacro(Token * tline)
     Token *org_tline = tline;
     Context *ctx;
     char *mname;
+    unsigned int h;
 
     /*
      * Trick: we should avoid changing the start token pointer since it can
@@ -4314,8 +4561,9 @@ expand_smacro(Token * tline)
                 ctx = get_ctx(mname, TRUE);
             else
                 ctx = NULL;
+            h = hash(mname);
             if (!ctx)
-                head = smacros[hash(mname)];
+                head = *table_bucket(&pp->smacros, h);
             else
                 head = ctx->localmac;
             /*
@@ -4325,7 +4573,7 @@ expand_smacro(Token * tline)
              * necessary.
              */
             for (m = head; m; m = m->next)
-                if (!mstrcmp(m->name, mname, m->casesense))
+                if (m->hashval == h && !mstrcmp(m->name, mname, m->casesense))
                     break;
             if (m)
             {
@@ -4483,6 +4731,7 @@ expand_smacro(Token * tline)
                         }       /* parameter loop */
                         nparam++;
                         while (m && (m->nparam != nparam ||
+                                        m->hashval != h ||
                                         mstrcmp(m->name, mname,
                                                 m->casesense)))
                             m = m->next;
@@ -4724,8 +4973,10 @@ is_mmacro(Token * tline, Token *** params_array)
     MMacro *head, *m;
     Token **params;
     int nparam;
+    unsigned int h;
 
-    head = mmacros[hash(tline->text)];
+    h = hash(tline->text);
+    head = *table_bucket(&pp->mmacros, h);
 
     /*
      * Efficiency: first we see if any macro exists with the given
@@ -4734,7 +4985,7 @@ is_mmacro(Token * tline, Token *** params_array)
      * list if necessary to find the proper MMacro.
      */
     for (m = head; m; m = m->next)
-        if (!mstrcmp(m->name, tline->text, m->casesense))
+        if (m->hashval == h && !mstrcmp(m->name, tline->text, m->casesense))
             break;
     if (!m)
         return NULL;
@@ -4805,7 +5056,7 @@ is_mmacro(Token * tline, Token *** params_array)
          * same name.
          */
         for (m = m->next; m; m = m->next)
-            if (!mstrcmp(m->name, tline->text, m->casesense))
+            if (m->hashval == h && !mstrcmp(m->name, tline->text, m->casesense))
                 break;
     }
 
@@ -4916,10 +5167,10 @@ expand_mmacro(Token * tline)
      * variables.
      */
     ll = (Line*)nasm_malloc(sizeof(Line));
-    ll->next = istk->expansion;
+    ll->next = pp->istk->expansion;
     ll->finishes = m;
     ll->first = NULL;
-    istk->expansion = ll;
+    pp->istk->expansion = ll;
 
     m->in_progress = TRUE;
     m->params = params;
@@ -4927,11 +5178,11 @@ expand_mmacro(Token * tline)
     m->nparam = nparam;
     m->rotate = 0;
     m->paramlen = paramlen;
-    m->unique = unique++;
+    m->unique = pp->unique++;
     m->lineno = 0;
 
-    m->next_active = istk->mstk;
-    istk->mstk = m;
+    m->next_active = pp->istk->mstk;
+    pp->istk->mstk = m;
 
     for (l = m->expansion; l; l = l->next)
     {
@@ -4939,8 +5190,8 @@ expand_mmacro(Token * tline)
 
         ll = (Line*)nasm_malloc(sizeof(Line));
         ll->finishes = NULL;
-        ll->next = istk->expansion;
-        istk->expansion = ll;
+        ll->next = pp->istk->expansion;
+        pp->istk->expansion = ll;
         tail = &ll->first;
 
         for (t = l->first; t; t = t->next)
@@ -4972,8 +5223,8 @@ expand_mmacro(Token * tline)
         {
             ll = (Line*)nasm_malloc(sizeof(Line));
             ll->finishes = NULL;
-            ll->next = istk->expansion;
-            istk->expansion = ll;
+            ll->next = pp->istk->expansion;
+            pp->istk->expansion = ll;
             ll->first = startline;
             if (!dont_prepend)
             {
@@ -5002,7 +5253,7 @@ error(int severity, const char *fmt, ...)
     char buff[1024];
 
     /* If we're in a dead branch of IF or something like it, ignore the error */
-    if (istk && istk->conds && !emitting(istk->conds->state))
+    if (pp->istk && pp->istk->conds && !emitting(pp->istk->conds->state))
         return;
 
     va_start(arg, fmt);
@@ -5013,50 +5264,44 @@ error(int severity, const char *fmt, ...)
 #endif
     va_end(arg);
 
-    if (istk && istk->mstk && istk->mstk->name)
-        _error(severity | ERR_PASS1, "(%s:%d) %s", istk->mstk->name,
-                istk->mstk->lineno, buff);
+    if (pp->istk && pp->istk->mstk && pp->istk->mstk->name)
+        pp->_error(severity | ERR_PASS1, "(%s:%d) %s", pp->istk->mstk->name,
+                pp->istk->mstk->lineno, buff);
     else 
-        _error(severity | ERR_PASS1, "%s", buff);
+        pp->_error(severity | ERR_PASS1, "%s", buff);
 }
 
 static void
 pp_reset(FileID fid, int apass, efunc errfunc, evalfunc eval)
 {
-    int h;
-
-    _error = errfunc;
-    cstk = NULL;
-    istk = (Include*)nasm_malloc(sizeof(Include));
-    istk->next = NULL;
-    istk->conds = NULL;
-    istk->expansion = NULL;
-    istk->mstk = NULL;
-    istk->fid = fid;
+    pp->_error = errfunc;
+    pp->cstk = NULL;
+    pp->istk = (Include*)nasm_malloc(sizeof(Include));
+    pp->istk->next = NULL;
+    pp->istk->conds = NULL;
+    pp->istk->expansion = NULL;
+    pp->istk->mstk = NULL;
+    pp->istk->fid = fid;
     bool invalid = false;
-    istk->in = yasm_preproc->getSourceManager()
+    pp->istk->in = pp->yasm_preproc->getSourceManager()
         .getBuffer(fid, SourceLocation(), &invalid);
-    istk->cur_dir = NULL;
-    istk->pos = 0;
-    istk->fname = NULL;
-    nasm_free(nasm_src_set_fname(nasm_strdup(istk->in->getBufferIdentifier())));
+    pp->istk->cur_dir = NULL;
+    pp->istk->pos = 0;
+    pp->istk->fname = NULL;
+    nasm_free(nasm_src_set_fname(nasm_strdup(pp->istk->in->getBufferIdentifier())));
     nasm_src_set_linnum(0);
-    istk->lineinc = 1;
-    defining = NULL;
-    nested_mac_count = 0;
-    nested_rep_count = 0;
-    for (h = 0; h < NHASH; h++)
-    {
-        mmacros[h] = NULL;
-        smacros[h] = NULL;
-    }
-    unique = 0;
+    pp->istk->lineinc = 1;
+    pp->defining = NULL;
+    pp->nested_mac_count = 0;
+    pp->nested_rep_count = 0;
+    free_macros();
+    pp->unique = 0;
     if (tasm_compatible_mode) {
         pp_extra_stdmac(tasm_compat_macros);
     }
-    evaluate = eval;
-    pass = apass;
-    first_line = 1;
+    pp->evaluate = eval;
+    pp->pass = apass;
+    pp->first_line = 1;
 }
 
 /*
@@ -5081,10 +5326,10 @@ poke_predef(Line *predef_lines)
             tail = &(*tail)->next;
         }
         l = (Line*)nasm_malloc(sizeof(Line));
-        l->next = istk->expansion;
+        l->next = pp->istk->expansion;
         l->first = head;
         l->finishes = FALSE;
-        istk->expansion = l;
+        pp->istk->expansion = l;
     }
 }
 
@@ -5102,20 +5347,20 @@ pp_getline(void)
          */
         tline = NULL;
 
-        if (first_line)
+        if (pp->first_line)
         {
             /* Reverse order */
-            poke_predef(predef);
-            poke_predef(stddef);
-            poke_predef(builtindef);
-            first_line = 0;
+            poke_predef(pp->predef);
+            poke_predef(pp->stddef);
+            poke_predef(pp->builtindef);
+            pp->first_line = 0;
         }
 
-        if (!istk)
+        if (!pp->istk)
             return NULL;
-        while (istk->expansion && istk->expansion->finishes)
+        while (pp->istk->expansion && pp->istk->expansion->finishes)
         {
-            Line *l = istk->expansion;
+            Line *l = pp->istk->expansion;
             if (!l->finishes->name && l->finishes->in_progress > 1)
             {
                 Line *ll;
@@ -5139,7 +5384,7 @@ pp_getline(void)
                     Token *t, *tt, **tail;
 
                     ll = (Line*)nasm_malloc(sizeof(Line));
-                    ll->next = istk->expansion;
+                    ll->next = pp->istk->expansion;
                     ll->finishes = NULL;
                     ll->first = NULL;
                     tail = &ll->first;
@@ -5153,7 +5398,7 @@ pp_getline(void)
                         }
                     }
 
-                    istk->expansion = ll;
+                    pp->istk->expansion = ll;
                 }
             }
             else
@@ -5165,13 +5410,13 @@ pp_getline(void)
                  * I'm too confused to work out how to recover
                  * sensibly from it.
                  */
-                if (defining)
+                if (pp->defining)
                 {
-                    if (defining->name)
+                    if (pp->defining->name)
                         error(ERR_PANIC, "defining with name in expansion");
-                    else if (istk->mstk->name)
+                    else if (pp->istk->mstk->name)
                         error(ERR_FATAL, "`%%rep' without `%%endrep' within"
-                                " expansion of macro `%s'", istk->mstk->name);
+                                " expansion of macro `%s'", pp->istk->mstk->name);
                 }
 
                 /*
@@ -5179,8 +5424,8 @@ pp_getline(void)
                  * istk->mstk and l->finishes
                  */
                 {
-                    MMacro *m = istk->mstk;
-                    istk->mstk = m->next_active;
+                    MMacro *m = pp->istk->mstk;
+                    pp->istk->mstk = m->next_active;
                     if (m->name)
                     {
                         /*
@@ -5196,7 +5441,7 @@ pp_getline(void)
                     else
                         free_mmacro(m);
                 }
-                istk->expansion = l->next;
+                pp->istk->expansion = l->next;
                 nasm_free(l);
                 //list->downlevel(LIST_MACRO);
             }
@@ -5204,20 +5449,26 @@ pp_getline(void)
         while (1)
         {                       /* until we get a line we can use */
 
-            if (istk->expansion)
+            if (pp->istk->expansion)
             {                   /* from a macro expansion */
                 char *p;
-                Line *l = istk->expansion;
-                if (istk->mstk)
-                    istk->mstk->lineno++;
+                Line *l = pp->istk->expansion;
+                if (pp->istk->mstk)
+                    pp->istk->mstk->lineno++;
                 tline = l->first;
-                istk->expansion = l->next;
+                pp->istk->expansion = l->next;
                 nasm_free(l);
                 p = detoken(tline, FALSE);
                 //list->line(LIST_MACRO, p);
                 nasm_free(p);
                 break;
             }
+            if (pp->snapshot_func && !pp->istk->next)
+            {
+                void (*func)(void *) = pp->snapshot_func;
+                pp->snapshot_func = NULL;
+                func(pp->snapshot_data);
+            }
             line = read_line();
             if (line)
             {                   /* from the current input file */
@@ -5230,7 +5481,7 @@ pp_getline(void)
              * The current file has ended; work down the istk
              */
             {
-                Include *i = istk;
+                Include *i = pp->istk;
                 if (i->conds)
                     error(ERR_FATAL, "expected `%%endif' before end of file");
                 /* only set line and file name if there's a next node */
@@ -5239,12 +5490,12 @@ pp_getline(void)
                     nasm_src_set_linnum(i->lineno);
                     nasm_free(nasm_src_set_fname(nasm_strdup(i->fname)));
                 }
-                istk = i->next;
+                pp->istk = i->next;
                 //list->downlevel(LIST_INCLUDE);
                 nasm_free(i);
-                if (!istk)
+                if (!pp->istk)
                     return NULL;
-                if (istk->expansion && istk->expansion->finishes)
+                if (pp->istk->expansion && pp->istk->expansion->finishes)
                     break;
             }
         }
@@ -5259,7 +5510,7 @@ pp_getline(void)
          * condition, in which case we don't want to meddle with
          * anything.
          */
-        if (!defining && !(istk->conds && !emitting(istk->conds->state)))
+        if (!pp->defining && !(pp->istk->conds && !emitting(pp->istk->conds->state)))
             tline = expand_mmac_params(tline);
 
         /*
@@ -5269,7 +5520,7 @@ pp_getline(void)
         {
             continue;
         }
-        else if (defining)
+        else if (pp->defining)
         {
             /*
              * We're defining a multi-line macro. We emit nothing
@@ -5277,13 +5528,13 @@ pp_getline(void)
              * shove the tokenised line on to the macro definition.
              */
             Line *l = (Line*)nasm_malloc(sizeof(Line));
-            l->next = defining->expansion;
+            l->next = pp->defining->expansion;
             l->first = tline;
             l->finishes = FALSE;
-            defining->expansion = l;
+            pp->defining->expansion = l;
             continue;
         }
-        else if (istk->conds && !emitting(istk->conds->state))
+        else if (pp->istk->conds && !emitting(pp->istk->conds->state))
         {
             /*
              * We're in a non-emitting branch of a condition block.
@@ -5294,7 +5545,7 @@ pp_getline(void)
             free_tlist(tline);
             continue;
         }
-        else if (istk->mstk && !istk->mstk->in_progress)
+        else if (pp->istk->mstk && !pp->istk->mstk->in_progress)
         {
             /*
              * We're in a %rep block which has been terminated, so
@@ -5335,58 +5586,42 @@ pp_getline(void)
 static void
 pp_cleanup(int pass_)
 {
-    int h;
-
     if (pass_ == 1)
     {
-        if (defining)
+        if (pp->defining)
         {
             error(ERR_NONFATAL, "end of file while still defining macro `%s'",
-                    defining->name);
-            free_mmacro(defining);
+                    pp->defining->name);
+            free_mmacro(pp->defining);
         }
         return;
     }
-    while (cstk)
+    while (pp->cstk)
         ctx_pop();
-    for (h = 0; h < NHASH; h++)
-    {
-        while (mmacros[h])
-        {
-            MMacro *m = mmacros[h];
-            mmacros[h] = mmacros[h]->next;
-            free_mmacro(m);
-        }
-        while (smacros[h])
-        {
-            SMacro *s = smacros[h];
-            smacros[h] = smacros[h]->next;
-            nasm_free(s->name);
-            free_tlist(s->expansion);
-            nasm_free(s);
-        }
-    }
-    while (istk)
+    free_macros();
+    while (pp->istk)
     {
-        Include *i = istk;
-        istk = istk->next;
+        Include *i = pp->istk;
+        pp->istk = pp->istk->next;
         nasm_free(i->fname);
         nasm_free(i);
     }
-    while (cstk)
+    while (pp->cstk)
         ctx_pop();
     if (pass_ == 0)
         {
-                free_llist(builtindef);
-                free_llist(stddef);
-                free_llist(predef);
-                builtindef = NULL;
-                stddef = NULL;
-                predef = NULL;
-                freeTokens = NULL;
+                free_llist(pp->builtindef);
+                free_llist(pp->stddef);
+                free_llist(pp->predef);
+                table_free(&pp->mmacros);
+                table_free(&pp->smacros);
+                pp->builtindef = NULL;
+                pp->stddef = NULL;
+                pp->predef = NULL;
+                pp->freeTokens = NULL;
                 delete_Blocks();
-                blocks.next = NULL;
-                blocks.chunk = NULL;
+                pp->blocks.next = NULL;
+                pp->blocks.chunk = NULL;
         }
 }
 
@@ -5401,10 +5636,10 @@ pp_pre_include(const char *fname)
     inc = new_Token(space, TOK_PREPROC_ID, "%include", 0);
 
     l = (Line*)nasm_malloc(sizeof(Line));
-    l->next = predef;
+    l->next = pp->predef;
     l->first = inc;
     l->finishes = FALSE;
-    predef = l;
+    pp->predef = l;
 }
 
 void
@@ -5424,10 +5659,10 @@ pp_pre_define(char *definition)
         *equals = '=';
 
     l = (Line*)nasm_malloc(sizeof(Line));
-    l->next = predef;
+    l->next = pp->predef;
     l->first = def;
     l->finishes = FALSE;
-    predef = l;
+    pp->predef = l;
 }
 
 void
@@ -5441,10 +5676,10 @@ pp_pre_undefine(char *definition)
     space->next = tokenise(definition);
 
     l = (Line*)nasm_malloc(sizeof(Line));
-    l->next = predef;
+    l->next = pp->predef;
     l->first = def;
     l->finishes = FALSE;
-    predef = l;
+    pp->predef = l;
 }
 
 void
@@ -5464,10 +5699,10 @@ pp_builtin_define(char *definition)
         *equals = '=';
 
     l = (Line*)nasm_malloc(sizeof(Line));
-    l->next = builtindef;
+    l->next = pp->builtindef;
     l->first = def;
     l->finishes = FALSE;
-    builtindef = l;
+    pp->builtindef = l;
 }
 
 void
@@ -5486,13 +5721,304 @@ pp_extra_stdmac(const char **macros)
         nasm_free(macro);
 
         l = (Line*)nasm_malloc(sizeof(Line));
-        l->next = stddef;
+        l->next = pp->stddef;
         l->first = t;
         l->finishes = FALSE;
-        stddef = l;
+        pp->stddef = l;
     }
 }
 
+
+/*
+ * Macro snapshots.  Once the predefined lines (including any
+ * pre-included files) have been processed, the single-line and
+ * multi-line macros, the context stack and the unique label counter
+ * can be written out, so that a later run with the same predefined
+ * lines can load them instead of processing those lines again.
+ *
+ * Tokens are written as their type (one byte, or 255 and four bytes)
+ * and text; a list of tokens ends with a zero type.  Strings are
+ * written as their length and characters, with a length of 0xffffffff
+ * for NULL.
+ */
+#define SNAPSHOT_NULL_STR 0xffffffffUL
+
+static void
+snapshot_write_str(Bytes &bytes, const char *s)
+{
+    size_t len;
+
+    if (!s)
+    {
+        Write32(bytes, SNAPSHOT_NULL_STR);
+        return;
+    }
+    len = strlen(s);
+    Write32(bytes, len);
+    bytes.Write(llvm::makeArrayRef(reinterpret_cast<const unsigned char *>(s),
+                                   len));
+}
+
+static void
+snapshot_write_tlist(Bytes &bytes, const Token *t)
+{
+    for (; t; t = t->next)
+    {
+        if (t->type < 255)
+            Write8(bytes, t->type);
+        else
+        {
+            Write8(bytes, 255);
+            Write32(bytes, t->type);
+        }
+        snapshot_write_str(bytes, t->text);
+    }
+    Write8(bytes, 0);
+}
+
+static void
+snapshot_write_smacros(Bytes &bytes, const SMacro *m)
+{
+    for (; m; m = m->next)
+    {
+        Write8(bytes, 1);
+        snapshot_write_str(bytes, m->name);
+        Write32(bytes, m->level);
+        Write8(bytes, m->casesense);
+        Write32(bytes, m->nparam);
+        snapshot_write_tlist(bytes, m->expansion);
+    }
+}
+
+static char *
+snapshot_read_str(InputBuffer &input)
+{
+    unsigned long len = ReadU32(input);
+    StringRef s;
+    char *p;
+
+    if (len == SNAPSHOT_NULL_STR)
+        return NULL;
+    s = input.ReadString(len);
+    p = (char*)nasm_malloc(len + 1);
+    memcpy(p, s.data(), len);
+    p[len] = '\0';
+    return p;
+}
+
+/* Reading links each item in as soon as it is allocated, so that
+ * pp_cleanup() frees everything read if the input runs out. */
+static void
+snapshot_read_tlist(InputBuffer &input, Token **tail)
+{
+    for (;;)
+    {
+        int type = ReadU8(input);
+        if (type == 0)
+            break;
+        if (type == 255)
+            type = ReadU32(input);
+        *tail = new_Token(NULL, type, NULL, 0);
+        (*tail)->text = snapshot_read_str(input);
+        tail = &(*tail)->next;
+    }
+}
+
+static SMacro *
+snapshot_new_smacro(char *name, SMacro **tail)
+{
+    SMacro *m = (SMacro*)nasm_malloc(sizeof(SMacro));
+    m->next = NULL;
+    m->name = name;
+    m->hashval = hash(name);
+    m->level = 0;
+    m->casesense = TRUE;
+    m->nparam = 0;
+    m->in_progress = FALSE;
+    m->expansion = NULL;
+    *tail = m;
+    return m;
+}
+
+/* Loaded macros go at the ends of chains, keeping their saved order. */
+template <typename M>
+static M **
+snapshot_table_tail(MacroTable<M> *t, unsigned int h)
+{
+    M **tail = table_bucket(t, h);
+    while (*tail)
+        tail = &(*tail)->next;
+    return tail;
+}
+
+static void
+snapshot_read_smacro(InputBuffer &input, SMacro *m)
+{
+    m->level = ReadU32(input);
+    m->casesense = ReadU8(input);
+    m->nparam = ReadU32(input);
+    snapshot_read_tlist(input, &m->expansion);
+}
+
+void
+pp_set_snapshot_func(void (*func)(void *), void *data)
+{
+    pp->snapshot_func = func;
+    pp->snapshot_data = data;
+}
+
+static void
+snapshot_write_lines(Bytes &bytes, const Line *l)
+{
+    for (; l; l = l->next)
+    {
+        Write8(bytes, 1);
+        snapshot_write_tlist(bytes, l->first);
+    }
+    Write8(bytes, 0);
+}
+
+void
+pp_save_predefs(Bytes &bytes)
+{
+    snapshot_write_lines(bytes, pp->builtindef);
+    snapshot_write_lines(bytes, pp->stddef);
+    snapshot_write_lines(bytes, pp->predef);
+}
+
+int
+pp_save_state(Bytes &bytes)
+{
+    unsigned int h;
+    Context *c;
+    int ncontexts = 0;
+
+    /* half-defined macros, open conditionals and TASM state aren't saved */
+    if (pp->defining || pp->istk->conds || tasm_compatible_mode)
+        return FALSE;
+
+    Write32(bytes, pp->unique);
+
+    for (h = 0; h < pp->smacros.nbuckets; h++)
+        snapshot_write_smacros(bytes, pp->smacros.buckets[h]);
+    Write8(bytes, 0);
+
+    for (h = 0; h < pp->mmacros.nbuckets; h++)
+    {
+        MMacro *m;
+        for (m = pp->mmacros.buckets[h]; m; m = m->next)
+        {
+            Write8(bytes, 1);
+            snapshot_write_str(bytes, m->name);
+            Write8(bytes, m->casesense);
+            Write32(bytes, m->nparam_min);
+            Write32(bytes, m->nparam_max);
+            Write8(bytes, m->plus);
+            Write8(bytes, m->nolist);
+            snapshot_write_tlist(bytes, m->dlist);
+            /* lines are stored (and so written) last line first */
+            snapshot_write_lines(bytes, m->expansion);
+        }
+    }
+    Write8(bytes, 0);
+
+    /* contexts, innermost first */
+    for (c = pp->cstk; c; c = c->next)
+        ncontexts++;
+    Write32(bytes, ncontexts);
+    for (c = pp->cstk; c; c = c->next)
+    {
+        snapshot_write_str(bytes, c->name);
+        Write32(bytes, c->number);
+        snapshot_write_smacros(bytes, c->localmac);
+        Write8(bytes, 0);
+    }
+    return TRUE;
+}
+
+void
+pp_load_state(InputBuffer &input)
+{
+    Context **ctail = &pp->cstk;
+    unsigned long ncontexts;
+
+    while (*ctail)
+        ctail = &(*ctail)->next;
+
+    pp->unique = ReadU32(input);
+
+    while (ReadU8(input))
+    {
+        char *name = snapshot_read_str(input);
+        if (!name)
+            name = nasm_strdup("");
+        snapshot_read_smacro(input, snapshot_new_smacro(name,
+                snapshot_table_tail(&pp->smacros, hash(name))));
+        table_added(&pp->smacros);
+    }
+
+    while (ReadU8(input))
+    {
+        MMacro *m;
+        Line **ltail;
+        char *name = snapshot_read_str(input);
+        if (!name)
+            name = nasm_strdup("");
+        m = (MMacro*)nasm_malloc(sizeof(MMacro));
+        memset(m, 0, sizeof(MMacro));
+        m->name = name;
+        m->hashval = hash(name);
+        *snapshot_table_tail(&pp->mmacros, m->hashval) = m;
+        table_added(&pp->mmacros);
+        m->casesense = ReadU8(input);
+        m->nparam_min = ReadU32(input);
+        m->nparam_max = ReadU32(input);
+        m->plus = ReadU8(input);
+        m->nolist = ReadU8(input);
+        snapshot_read_tlist(input, &m->dlist);
+        ltail = &m->expansion;
+        while (ReadU8(input))
+        {
+            Line *l = (Line*)nasm_malloc(sizeof(Line));
+            l->next = NULL;
+            l->finishes = NULL;
+            l->first = NULL;
+            *ltail = l;
+            ltail = &l->next;
+            snapshot_read_tlist(input, &l->first);
+        }
+        if (m->dlist)
+            count_mmac_params(m->dlist, &m->ndefs, &m->defaults);
+    }
+
+    ncontexts = ReadU32(input);
+    while (ncontexts-- > 0)
+    {
+        Context *c = (Context*)nasm_malloc(sizeof(Context));
+        SMacro **tail = &c->localmac;
+        c->next = NULL;
+        c->localmac = NULL;
+        c->name = NULL;
+        *ctail = c;
+        ctail = &c->next;
+        c->name = snapshot_read_str(input);
+        c->number = ReadU32(input);
+        while (ReadU8(input))
+        {
+            char *name = snapshot_read_str(input);
+            SMacro *m;
+            if (!name)
+                name = nasm_strdup("");
+            m = snapshot_new_smacro(name, tail);
+            tail = &m->next;
+            snapshot_read_smacro(input, m);
+        }
+    }
+
+    /* The predefined lines are already accounted for. */
+    pp->first_line = 0;
+}
+
 static void
 make_tok_num(Token * tok, const IntNum& val)
 {
@@ -5508,6 +6034,25 @@ Preproc nasmpp = {
     pp_cleanup
 };
 
+PreprocState *
+pp_new_state(yasm::Preprocessor* preproc)
+{
+    return new PreprocState(preproc);
+}
+
+void
+pp_delete_state(PreprocState* state)
+{
+    if (!state)
+        return;
+    {
+        PreprocScope scope(state);
+        pp_cleanup(0);
+        nasm_free(pp->file_name);
+    }
+    delete state;
+}
+
 /*
  * This function processes the {%pp_dir} structure inside a
  * preprocessor expression. It is called by nasm-eval.cpp::expr6() 
@@ -5531,7 +6076,7 @@ static int evaluate_curly_brackets(void *private_data)
     int num_open=0, num_close = 0; //number of { and } encountered
     int i,j;
 
-    ++curly_opened; /* informs if_condition() we're processing a 
+    ++pp->curly_opened; /* informs if_condition() we're processing a 
     {%pp_dir} so that it will not free the line sent to it */
 
     while(t_end)
@@ -5586,7 +6131,7 @@ static int evaluate_curly_brackets(void *private_data)
     //point private data to the unprocessed token
     //(used in nasm-eval.cpp)
     *t1 = t_end->next;
-    --curly_opened;
+    --pp->curly_opened;
     return j;
 }
 /* Note: 
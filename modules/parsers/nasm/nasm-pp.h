@@ -9,18 +9,48 @@
 #ifndef YASM_NASM_PREPROC_H
 #define YASM_NASM_PREPROC_H
 
-namespace yasm { class Preprocessor; }
+namespace yasm {
+class Bytes;
+class InputBuffer;
+class Preprocessor;
+}
 
 namespace nasm {
 
+/*
+ * Preprocessor state.  All other functions in this header operate on the
+ * state made current for the calling thread by a PreprocScope.
+ */
+struct PreprocState;
+
+PreprocState *pp_new_state (yasm::Preprocessor *);
+void pp_delete_state (PreprocState *);
+
+class PreprocScope {
+public:
+    explicit PreprocScope (PreprocState *);
+    ~PreprocScope ();
+
+private:
+    PreprocScope (const PreprocScope &);                // not implemented
+    const PreprocScope &operator= (const PreprocScope &); // not implemented
+
+    PreprocState *m_prev;
+};
+
 void pp_pre_include (const char *);
 void pp_pre_define (char *);
 void pp_pre_undefine (char *);
 void pp_builtin_define (char *);
 void pp_extra_stdmac (const char **);
 
+/* Macro snapshots; see nasm-pp.cpp. */
+void pp_set_snapshot_func (void (*)(void *), void *);
+void pp_save_predefs (yasm::Bytes &);
+int pp_save_state (yasm::Bytes &);
+void pp_load_state (yasm::InputBuffer &);
+
 extern Preproc nasmpp;
-extern yasm::Preprocessor* yasm_preproc;
 
 void nasm_preproc_add_dep(char *);
 
@@ -39,6 +39,18 @@ namespace nasm {
 
 #define IDLEN_MAX 4096
 
+/*
+ * Storage class for per-thread state.  Without compiler support, the
+ * preprocessor may only be used by one thread at a time.
+ */
+#if defined(__GNUC__)
+# define NASM_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+# define NASM_THREAD_LOCAL __declspec(thread)
+#else
+# define NASM_THREAD_LOCAL
+#endif
+
 /*
  * -------------------------
  * Error reporting functions
@@ -289,8 +301,6 @@ enum {
 #define elements(x)     ( sizeof(x) / sizeof(*(x)) )
 
 extern int tasm_compatible_mode;
-extern int tasm_locals;
-extern const char *tasm_segment;
 const char *tasm_get_segment_register(const char *segment);
 
 } // namespace nasm
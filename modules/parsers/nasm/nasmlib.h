@@ -46,6 +46,10 @@ yasm::IntNum nasm_readnum(char *str, int *error);
  */
 yasm::IntNum nasm_readstrnum(char *str, size_t length, int *warn);
 
+/*
+ * Source position of the current preprocessor (see PreprocScope);
+ * implemented in nasm-pp.cpp.
+ */
 char *nasm_src_set_fname(char *newname);
 char *nasm_src_get_fname(void);
 long nasm_src_set_linnum(long newline);
@@ -0,0 +1,208 @@
+#! /usr/bin/env python
+# x86 instruction matching benchmark generator
+#
+#  Copyright (C) 2012  Peter Johnson
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+# Generates a large mix of x86 instructions in NASM or GAS syntax, for
+# benchmarking instruction matching.  Not run as part of the regression
+# tests.
+#
+# Usage: geninsnbench.py [options] [yasm]
+#
+# If a yasm executable is given, the generated source is assembled and the
+# time taken, instructions per second, and instruction forms scanned per
+# instruction (from -stats) are reported, along with the peak resident set
+# size and teardown time (the time from the object file being written to
+# the process exiting, which is dominated by freeing the object).
+# Otherwise the source is written to stdout.
+#
+import optparse
+import os
+import random
+import resource
+import subprocess
+import sys
+import tempfile
+import time
+
+def lprint(*args, **kwargs):
+    sep = kwargs.pop("sep", ' ')
+    end = kwargs.pop("end", '\n')
+    file = kwargs.pop("file", sys.stdout)
+    file.write(sep.join(args))
+    file.write(end)
+
+# Instruction templates, in NASM syntax with the destination first.
+# Operand placeholders: r8/r16/r32/r64 (general registers), x (XMM
+# register), y (YMM register), m (memory), i8/i32 (immediates).
+templates = [
+    "mov r32, r32", "mov r64, r64", "mov r32, i32", "mov r64, m",
+    "mov m, r64", "mov dword m, i32", "mov r8, r8", "mov r16, m",
+    "movzx r32, byte m", "movsx r64, word m", "movsxd r64, r32",
+    "lea r64, m", "add r32, r32", "add r64, i8", "add r64, i32",
+    "add m, r32", "sub r64, m", "sub r32, i8", "and r32, i32",
+    "or r64, r64", "xor r32, r32", "cmp r64, i8", "cmp r32, m",
+    "test r32, r32", "test r8, i8", "imul r64, r64", "imul r32, r32, i8",
+    "inc r32", "dec r64", "neg r64", "not r32", "shl r64, i8",
+    "shr r32, 1", "sar r64, cl", "push r64", "pop r64", "xchg r64, r64",
+    "cmovz r64, r64", "setnz r8", "bt r32, i8", "bswap r64", "cdq",
+    "cqo", "nop", "ret", "movd x, r32", "movq r64, x", "movdqa x, m",
+    "movdqu m, x", "movaps x, x", "addps x, x", "mulsd x, m",
+    "pxor x, x", "paddd x, m", "pshufd x, x, i8", "cvtsi2sd x, r64",
+    "vaddps y, y, y", "vmovdqu y, m", "vpxor x, x, x",
+    "vfmadd231ps y, y, m",
+]
+
+gpr = {
+    "r8": ["al", "bl", "cl", "dl", "sil", "dil", "r8b", "r11b"],
+    "r16": ["ax", "bx", "cx", "dx", "si", "di", "r9w", "r12w"],
+    "r32": ["eax", "ebx", "ecx", "edx", "esi", "edi", "r10d", "r13d"],
+    "r64": ["rax", "rbx", "rcx", "rdx", "rsi", "rdi", "r8", "r15"],
+}
+gas_suffix = {"r8": "b", "r16": "w", "r32": "l", "r64": "q"}
+bases = ["rax", "rbx", "rsp", "rbp", "r12", "r13"]
+
+def nasm_operand(rand, op):
+    words = op.split()
+    prefix = ""
+    if len(words) == 2:
+        prefix = words[0] + " "
+        op = words[1]
+    if op in gpr:
+        return prefix + rand.choice(gpr[op])
+    if op == "x":
+        return prefix + "xmm%d" % rand.randint(0, 15)
+    if op == "y":
+        return prefix + "ymm%d" % rand.randint(0, 15)
+    if op == "m":
+        return prefix + "[%s+%d]" % (rand.choice(bases),
+                                     rand.choice([0, 8, 64, 1024]))
+    if op == "i8":
+        return prefix + "%d" % rand.randint(2, 100)
+    if op == "i32":
+        return prefix + "%d" % rand.randint(1000, 1000000)
+    return prefix + op
+
+def gas_operand(nasm):
+    if nasm.startswith("["):
+        base, disp = nasm[1:-1].split("+")
+        return "%s(%%%s)" % (disp, base)
+    if nasm[0].isdigit():
+        return "$" + nasm
+    return "%" + nasm
+
+def generate(out, ninsns, syntax, seed):
+    """Generate source with ninsns instructions chosen at random from
+    the templates."""
+    rand = random.Random(seed)
+    if syntax == "gas":
+        lprint(".code64", file=out)
+    else:
+        lprint("bits 64", file=out)
+    for i in range(ninsns):
+        template = rand.choice(templates)
+        parts = template.split(None, 1)
+        mnemonic = parts[0]
+        ops = []
+        if len(parts) > 1:
+            ops = [x.strip() for x in parts[1].split(",")]
+        operands = [nasm_operand(rand, op) for op in ops]
+        if syntax != "gas":
+            lprint("%s %s" % (mnemonic, ", ".join(operands)), file=out)
+            continue
+        # Sized memory and immediate operands need a GAS suffix
+        for op in ops:
+            words = op.split()
+            if len(words) == 2:
+                mnemonic += {"byte": "b", "word": "w", "dword": "l"}[words[0]]
+        if mnemonic == "movsxd":
+            mnemonic = "movslq"
+        elif mnemonic.startswith("movzx") or mnemonic.startswith("movsx"):
+            mnemonic = ("movz" if mnemonic.startswith("movz") else "movs") \
+                + mnemonic[5:] + gas_suffix[ops[0]]
+        operands = [gas_operand(x.split()[-1]) for x in operands]
+        operands.reverse()
+        lprint("%s %s" % (mnemonic, ", ".join(operands)), file=out)
+
+def run(yasm, srcfn, syntax):
+    """Assemble srcfn.  Returns the elapsed time, teardown time, peak RSS
+    (in KB) and statistics."""
+    outfn = srcfn + ".o"
+    args = [yasm, "-f", "elf64", "-p", syntax, "-stats", "-o", outfn, srcfn]
+    start = time.time()
+    proc = subprocess.Popen(args, stderr=subprocess.PIPE)
+    stderrdata = proc.communicate()[1]
+    end = time.time()
+    elapsed = end - start
+    if proc.returncode != 0:
+        lprint(stderrdata.decode("ascii", "replace"), file=sys.stderr)
+        raise SystemExit("%s failed" % " ".join(args))
+    teardown = max(end - os.stat(outfn).st_mtime, 0.0)
+    maxrss = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss
+    os.remove(outfn)
+
+    stats = {}
+    for line in stderrdata.decode("ascii", "replace").splitlines():
+        parts = line.split(None, 2)
+        if len(parts) == 3 and parts[0].isdigit() and parts[1] == "x86":
+            stats[parts[2].lstrip("- ")] = int(parts[0])
+    return elapsed, teardown, maxrss, stats
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [options] [yasm]")
+    parser.add_option("-n", "--insns", type="int", default=500000,
+                      help="number of instructions (default %default)")
+    parser.add_option("-p", "--parser", default="nasm",
+                      choices=["nasm", "gas"],
+                      help="source syntax: nasm or gas (default %default)")
+    parser.add_option("-s", "--seed", type="int", default=1,
+                      help="random seed (default %default)")
+    (options, args) = parser.parse_args()
+
+    if not args:
+        generate(sys.stdout, options.insns, options.parser, options.seed)
+        return
+
+    fd, srcfn = tempfile.mkstemp(suffix=".asm")
+    out = os.fdopen(fd, "w")
+    try:
+        generate(out, options.insns, options.parser, options.seed)
+    finally:
+        out.close()
+
+    try:
+        elapsed, teardown, maxrss, stats = run(args[0], srcfn, options.parser)
+        scanned = stats.get("Total number of instruction groups scanned", 0)
+        hits = stats.get("Number of instruction match cache hits", 0)
+        lprint("%8.3f s  %10.0f insns/s  %5.2f forms scanned/insn  "
+               "%5.1f%% match cache hits" %
+               (elapsed, options.insns / max(elapsed, 1e-6),
+                float(scanned) / options.insns,
+                100.0 * hits / options.insns))
+        lprint("%8.0f KB peak RSS  %8.3f s teardown" % (maxrss, teardown))
+    finally:
+        os.remove(srcfn)
+
+if __name__ == "__main__":
+    main()
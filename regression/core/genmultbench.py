@@ -0,0 +1,130 @@
+#! /usr/bin/env python
+# TIMES output benchmark generator
+#
+#  Copyright (C) 2012  Peter Johnson
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+# Generates NASM source with large TIMES blocks, for benchmarking the
+# output of multiple bytecodes.  Not run as part of the regression tests.
+#
+# Two sources are generated that differ only in the immediate operand of
+# the repeated instructions: a constant, which lets the contents be
+# rendered once and replicated, and a label, which forces the contents to
+# be output one iteration at a time.
+#
+# Usage: genmultbench.py [options] [yasm]
+#
+# If a yasm executable is given, both sources are assembled, the outputs
+# are checked to be the same size, and the time taken and output path
+# counts (from -stats) are reported.  Otherwise the replicated source is
+# written to stdout.
+#
+import optparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+def lprint(*args, **kwargs):
+    sep = kwargs.pop("sep", ' ')
+    end = kwargs.pop("end", '\n')
+    file = kwargs.pop("file", sys.stdout)
+    file.write(sep.join(args))
+    file.write(end)
+
+def generate(out, nblocks, count, operand):
+    """Generate source with nblocks TIMES blocks of count repetitions,
+    each of a few instructions and data using operand."""
+    lprint("bits 32", file=out)
+    lprint("target:", file=out)
+    for i in range(nblocks):
+        lprint("times %d mov eax, %s" % (count, operand), file=out)
+        lprint("times %d dd %s, 0" % (count, operand), file=out)
+        lprint("times %d nop" % count, file=out)
+
+def run(yasm, srcfn):
+    """Assemble srcfn.  Returns the elapsed time, output, and statistics."""
+    outfn = srcfn + ".bin"
+    args = [yasm, "-f", "bin", "-stats", "-o", outfn, srcfn]
+    start = time.time()
+    proc = subprocess.Popen(args, stderr=subprocess.PIPE)
+    stderrdata = proc.communicate()[1]
+    elapsed = time.time() - start
+    if proc.returncode != 0:
+        lprint(stderrdata.decode("ascii", "replace"), file=sys.stderr)
+        raise SystemExit("%s failed" % " ".join(args))
+
+    stats = {}
+    for line in stderrdata.decode("ascii", "replace").splitlines():
+        parts = line.split(None, 2)
+        if len(parts) == 3 and parts[0].isdigit() and \
+                parts[1] == "MultipleBytecode":
+            stats[parts[2].lstrip("- ")] = int(parts[0])
+
+    f = open(outfn, "rb")
+    try:
+        output = f.read()
+    finally:
+        f.close()
+    os.remove(outfn)
+    return elapsed, output, stats
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [options] [yasm]")
+    parser.add_option("-b", "--blocks", type="int", default=10,
+                      help="number of TIMES blocks (default %default)")
+    parser.add_option("-c", "--count", type="int", default=100000,
+                      help="repetitions per block (default %default)")
+    (options, args) = parser.parse_args()
+
+    if not args:
+        generate(sys.stdout, options.blocks, options.count, "0x12345678")
+        return
+
+    sizes = []
+    for name, operand in [("replicated", "0x12345678"),
+                          ("iterated", "target")]:
+        fd, srcfn = tempfile.mkstemp(suffix=".asm")
+        out = os.fdopen(fd, "w")
+        try:
+            generate(out, options.blocks, options.count, operand)
+        finally:
+            out.close()
+        try:
+            elapsed, output, stats = run(args[0], srcfn)
+        finally:
+            os.remove(srcfn)
+        sizes.append(len(output))
+        lprint("%-10s %8.3f s  %12.0f bytes/s  %4d replicated  "
+               "%4d iterated" %
+               (name, elapsed, len(output) / max(elapsed, 1e-6),
+                stats.get("Number of multiple bytecodes output by "
+                          "replication", 0),
+                stats.get("Number of multiple bytecodes output per "
+                          "iteration", 0)))
+    if sizes[0] != sizes[1]:
+        raise SystemExit("output sizes differ")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,174 @@
+#! /usr/bin/env python
+# Optimizer benchmark generator
+#
+#  Copyright (C) 2012  Peter Johnson
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+# Generates NASM source with large numbers of short jumps whose sizes
+# depend on each other, for benchmarking the optimizer.  Not run as part
+# of the regression tests.
+#
+# With --cascade, the jumps instead form a chain in which each jump only
+# becomes long after the one following it does, so the expansions happen
+# one at a time from the end of the chain back to its start.
+#
+# Usage: genbench.py [options] [yasm]
+#
+# If a yasm executable is given, the generated source is assembled with
+# each optimizer (-O and -Orelax), the outputs are checked to be identical,
+# and the time taken, spans per second, and span recalculation counts (from
+# -stats) are reported.  With --align, -Orelax falls back to the interval
+# tree.  Otherwise the source is written to stdout.
+#
+import optparse
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+def lprint(*args, **kwargs):
+    sep = kwargs.pop("sep", ' ')
+    end = kwargs.pop("end", '\n')
+    file = kwargs.pop("file", sys.stdout)
+    file.write(sep.join(args))
+    file.write(end)
+
+def generate(out, njumps, reach, fill, align, seed):
+    """Generate source with njumps jumps to random labels at most reach
+    labels away.  Each label is followed by up to fill bytes of padding,
+    chosen so that many jumps are close to the short jump limit.  If
+    align is nonzero, every align'th label is preceded by an align."""
+    rand = random.Random(seed)
+    lprint("bits 64", file=out)
+    for i in range(njumps):
+        if align and i % align == 0:
+            lprint("align 16", file=out)
+        lprint("L%d:" % i, file=out)
+        target = i + rand.randint(-reach, reach)
+        target = max(0, min(njumps-1, target))
+        if rand.random() < 0.7:
+            lprint("jmp L%d" % target, file=out)
+        else:
+            lprint("jnz L%d" % target, file=out)
+        if fill:
+            lprint("times %d nop" % rand.randint(0, fill), file=out)
+
+def generate_cascade(out, njumps):
+    """Generate a chain of njumps jumps, each jumping just past the next
+    one, which is 127 bytes (the short jump limit) while the next jump is
+    short.  The last jump is long, so every jump ends up long."""
+    lprint("bits 64", file=out)
+    for i in range(njumps):
+        lprint("J%d: jmp T%d" % (i, i), file=out)
+        if i > 0:
+            lprint("T%d:" % (i-1), file=out)
+        lprint("times 125 nop", file=out)
+    lprint("times 200 nop", file=out)
+    lprint("T%d:" % (njumps-1), file=out)
+
+def run(yasm, srcfn, opt):
+    """Assemble srcfn with the given optimizer option.  Returns the
+    elapsed time, output, and statistics."""
+    outfn = srcfn + opt + ".o"
+    args = [yasm, "-f", "elf64", "-stats", "-o", outfn, srcfn]
+    if opt:
+        args.insert(1, opt)
+    start = time.time()
+    proc = subprocess.Popen(args, stderr=subprocess.PIPE)
+    stderrdata = proc.communicate()[1]
+    elapsed = time.time() - start
+    if proc.returncode != 0:
+        lprint(stderrdata.decode("ascii", "replace"), file=sys.stderr)
+        raise SystemExit("%s failed" % " ".join(args))
+
+    stats = {}
+    for line in stderrdata.decode("ascii", "replace").splitlines():
+        parts = line.split(None, 2)
+        if len(parts) == 3 and parts[0].isdigit() and parts[1] == "Optimize":
+            stats[parts[2].lstrip("- ")] = int(parts[0])
+
+    f = open(outfn, "rb")
+    try:
+        output = f.read()
+    finally:
+        f.close()
+    os.remove(outfn)
+    return elapsed, output, stats
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [options] [yasm]")
+    parser.add_option("-n", "--jumps", type="int", default=100000,
+                      help="number of jumps (default %default)")
+    parser.add_option("-r", "--reach", type="int", default=40,
+                      help="maximum jump distance in labels (default "
+                           "%default)")
+    parser.add_option("-f", "--fill", type="int", default=6,
+                      help="maximum padding bytes per label (default "
+                           "%default)")
+    parser.add_option("-a", "--align", type="int", default=0,
+                      help="align every N labels (default none)")
+    parser.add_option("-s", "--seed", type="int", default=1,
+                      help="random seed (default %default)")
+    parser.add_option("-c", "--cascade", action="store_true",
+                      help="generate a chain of dependent jumps instead")
+    (options, args) = parser.parse_args()
+
+    def gen(out):
+        if options.cascade:
+            generate_cascade(out, options.jumps)
+        else:
+            generate(out, options.jumps, options.reach, options.fill,
+                     options.align, options.seed)
+
+    if not args:
+        gen(sys.stdout)
+        return
+
+    fd, srcfn = tempfile.mkstemp(suffix=".asm")
+    out = os.fdopen(fd, "w")
+    try:
+        gen(out)
+    finally:
+        out.close()
+
+    try:
+        results = []
+        for opt in ["", "-Orelax"]:
+            elapsed, output, stats = run(args[0], srcfn, opt)
+            results.append(output)
+            spans = stats.get("Number of spans created", 0)
+            lprint("%-8s %8.3f s  %10.0f spans/s  %8d recalcs  "
+                   "%6d expansions  %8d rechecks" %
+                   (opt or "default", elapsed, spans / max(elapsed, 1e-6),
+                    stats.get("Number of span recalculations performed", 0),
+                    stats.get("Number of expansions performed", 0),
+                    stats.get("Number of spans rechecked by relaxation", 0)))
+        if results[0] != results[1]:
+            raise SystemExit("outputs differ")
+    finally:
+        os.remove(srcfn)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,20 @@
+# [yasm -f elf32 -p gas -Orelax]
+.L6431:
+	.fill 420,1,0x90
+.L6541:
+	.fill 30,1,0x90
+	jmp	.L6431
+	.fill 9,1,0x90
+	je	.L6431
+	.fill 16,1,0x90
+	jmp	.L6431
+	.fill 65,1,0x90
+	jmp	.L6541
+	.fill 39,1,0x90
+.LEHB394:
+	call	X
+	.p2align 4,,3
+	.fill 122,1,0x90
+.LEHE394:
+	.uleb128 .LEHE394-.LEHB394
+
@@ -0,0 +1,27 @@
+; [yasm -f bin -Orelax]
+; Aligns inside jump spans absorb or pass on expansions; a chain of jumps
+; only becomes long one jump at a time.
+bits 32
+j0:	jmp	t0
+	times 60 nop
+	align 16
+j1:	jmp	t1
+t0:
+	times 63 nop
+	align 8
+	times 57 nop
+j2:	jmp	t2
+t1:
+	times 100 nop
+	align 32
+j3:	jz	t3
+t2:
+	times 125 nop
+j4:	jmp	t4
+t3:
+	times 90 nop
+	align 16
+	times 40 nop
+t4:
+	ret
+j5:	jmp	j0
@@ -0,0 +1,61 @@
+; [yasm -f bin -Orelax]
+; Aligns inside jump spans make the result depend on the order in which
+; expansions are propagated; -Orelax must still match the default optimizer.
+bits 64
+L0:
+L11:
+jmp L17
+align 16
+L12:
+L14:
+L17:
+times 6 nop
+align 16
+jnz L21
+times 3 nop
+jmp L33
+times 2 nop
+jmp L39
+times 6 nop
+L21:
+jnz L39
+times 6 nop
+jmp L39
+times 2 nop
+jnz L39
+align 16
+jmp L0
+times 3 nop
+jmp L14
+times 1 nop
+L26:
+jmp L39
+times 4 nop
+jmp L26
+times 6 nop
+jnz L0
+times 4 nop
+L29:
+jmp L29
+times 3 nop
+align 16
+jmp L39
+times 2 nop
+L31:
+jmp L31
+times 6 nop
+jnz L39
+L33:
+jmp L39
+times 3 nop
+L34:
+jmp L26
+times 5 nop
+jmp L11
+times 2 nop
+align 16
+jnz L12
+times 4 nop
+jmp L34
+jnz L39
+L39:
@@ -0,0 +1,23 @@
+; [yasm -f bin -Orelax]
+; Each jump only becomes near after the following one expands.
+bits 32
+j1:	jmp	t1
+	times 60 nop
+j2:	jmp	t2
+	times 65 nop
+t1:
+	times 30 nop
+j3:	jmp	t3
+	times 30 nop
+t2:
+	times 47 nop
+j4:	jmp	t4
+	times 48 nop
+t3:
+	times 38 nop
+j5:	jmp	t5
+	times 39 nop
+t4:
+	times 200 nop
+t5:
+	ret
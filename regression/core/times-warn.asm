@@ -0,0 +1,8 @@
+; [yasm -f bin]
+; Numeric warnings in replicated TIMES contents are reported once, not
+; once per copy.
+	times 200 db X
+	times 150 db 1, X
+	times 120 dw Y
+X equ 300
+Y equ 0x12345
@@ -0,0 +1,20 @@
+; [yasm -f elf32]
+; TIMES contents are rendered once and replicated unless a value needs a
+; relocation for each copy.
+extern ext
+section .text
+start:
+	times 3 dd ext, 0		; relocated: one reloc per copy
+	times 2 dd start+4, 1		; relocated within the section
+	times 3 db 1, 2			; replicated
+mid:
+	times 2 dw after-start, 3	; difference within the section
+	times (mid-start)/4 db 0x90, 0x91	; count known only after layout
+	times 120 dd ext		; fill with a relocated value
+after:
+section .bss
+	times 5 resb 3			; gap
+	times 2 resd 1
+section .data
+	times 4 resb 2			; gap in a section with bits
+	db 0xff
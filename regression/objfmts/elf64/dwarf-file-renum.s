@@ -0,0 +1,27 @@
+# [yasm -p gas -f elf64 -g dwarf2pass]
+# .file directives that repeat a number, reissue a number with another
+# directory, assign numbers out of order, and share directories between files.
+	.file 1 "a/x.c"
+	.file 2 "b/y.c"
+	.file 1 "a/x.c"
+	.file 3 "a/z.c"
+	.file 2 "c/y.c"
+	.file 5 "b/w.c"
+	.file 4 "top.c"
+	.text
+f:
+	.loc 1 10
+	nop
+	.loc 2 20
+	nop
+	.loc 3 30
+	nop
+	.loc 5 50
+	nop
+	.loc 4 40
+	nop
+	.loc 1 11
+	ret
+# A .debug_info of our own keeps the working directory out of the output.
+	.section .debug_info,"",@progbits
+	.long 0
@@ -0,0 +1,28 @@
+# [oformat elf64]
+# f1 and f2 have CIE instructions with equal hashes (31*16+32 == 31*17+1)
+# but must get CIEs of their own; f3 and f4 must reuse those of f1 and f2.
+	.text
+f1:
+	.cfi_startproc
+	.cfi_def_cfa_offset 16
+	.cfi_def_cfa_offset 32
+	nop
+	.cfi_endproc
+f2:
+	.cfi_startproc
+	.cfi_def_cfa_offset 17
+	.cfi_def_cfa_offset 1
+	nop
+	.cfi_endproc
+f3:
+	.cfi_startproc
+	.cfi_def_cfa_offset 16
+	.cfi_def_cfa_offset 32
+	nop
+	.cfi_endproc
+f4:
+	.cfi_startproc
+	.cfi_def_cfa_offset 17
+	.cfi_def_cfa_offset 1
+	nop
+	.cfi_endproc
@@ -0,0 +1,17 @@
+.rept 3
+    nop
+.rept 2
+    ret
+.rept 0
+    hlt
+.endr
+.endr
+    int3
+.endr
+.rept 0
+.endr
+.rept 4
+.endr
+.rept 2
+    .byte 1, 2
+.endr
@@ -0,0 +1,4 @@
+; [yasm -f bin -I. -MD]
+; Dependencies written alongside the object file.
+%include "deps.inc"
+incbin "deps.bin", 1
@@ -0,0 +1,12 @@
+; [yasm -f bin -I. -M -MF deps.d]
+; Incbin names that need preprocessing.
+%define FILE "deps.bin"
+%include "deps.inc"
+incbin FILE
+%if 0
+incbin "missing.bin"
+%endif
+%macro inc 1
+incbin %1
+%endmacro
+inc "depsnest.inc"
@@ -0,0 +1,5 @@
+; [yasm -f bin -I. -M]
+; Includes and incbins found without preprocessing.
+%include "deps.inc"
+incbin "deps.bin"
+lbl: INCBIN 'deps.bin', 1
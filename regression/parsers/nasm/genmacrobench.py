@@ -0,0 +1,117 @@
+#! /usr/bin/env python
+# NASM preprocessor macro expansion benchmark generator
+#
+#  Copyright (C) 2012  Peter Johnson
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+# 1. Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+# 2. Redistributions in binary form must reproduce the above copyright
+#    notice, this list of conditions and the following disclaimer in the
+#    documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+#
+# Generates NASM source that defines many single-line and multi-line
+# macros and then invokes them, for benchmarking macro lookup and
+# expansion in the NASM preprocessor.  Not run as part of the regression
+# tests.
+#
+# Each invocation line calls one multi-line macro, whose body uses three
+# single-line macros (one case-insensitive, one with parameters), so each
+# line makes four macro expansions.
+#
+# Usage: genmacrobench.py [options] [yasm]
+#
+# If a yasm executable is given, the generated source is preprocessed
+# (with -e) and the time taken and macro expansions per second are
+# reported.  Otherwise the source is written to stdout.
+#
+import optparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+EXPANSIONS_PER_LINE = 4
+
+def lprint(*args, **kwargs):
+    sep = kwargs.pop("sep", ' ')
+    end = kwargs.pop("end", '\n')
+    file = kwargs.pop("file", sys.stdout)
+    file.write(sep.join(args))
+    file.write(end)
+
+def generate(out, nmacros, nlines):
+    """Generate source defining nmacros of each kind, followed by nlines
+    macro invocations spread over all of them."""
+    for i in range(nmacros):
+        lprint("%%define val%d %d" % (i, i), file=out)
+        lprint("%%idefine Scale%d 4" % i, file=out)
+        lprint("%%define addr%d(b,x) [b+x*scale%d+val%d]" % (i, i, i),
+               file=out)
+        lprint("%%macro load%d 1-2 eax" % i, file=out)
+        lprint("    mov %%2, addr%d(%%1, ecx)" % i, file=out)
+        lprint("%endmacro", file=out)
+    lprint("bits 32", file=out)
+    for i in range(nlines):
+        # Step through the macros with a stride coprime to their number
+        # so successive lines use unrelated names.
+        m = (i * 7919) % nmacros
+        lprint("load%d ebx" % m, file=out)
+
+def run(yasm, srcfn):
+    """Preprocess srcfn.  Returns the elapsed time."""
+    outfn = srcfn + ".i"
+    args = [yasm, "-e", "-o", outfn, srcfn]
+    start = time.time()
+    proc = subprocess.Popen(args, stderr=subprocess.PIPE)
+    stderrdata = proc.communicate()[1]
+    elapsed = time.time() - start
+    if proc.returncode != 0:
+        lprint(stderrdata.decode("ascii", "replace"), file=sys.stderr)
+        raise SystemExit("%s failed" % " ".join(args))
+    os.remove(outfn)
+    return elapsed
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [options] [yasm]")
+    parser.add_option("-m", "--macros", type="int", default=5000,
+                      help="number of macros of each kind (default %default)")
+    parser.add_option("-l", "--lines", type="int", default=200000,
+                      help="number of invocation lines (default %default)")
+    (options, args) = parser.parse_args()
+
+    if not args:
+        generate(sys.stdout, options.macros, options.lines)
+        return
+
+    fd, srcfn = tempfile.mkstemp(suffix=".asm")
+    out = os.fdopen(fd, "w")
+    try:
+        generate(out, options.macros, options.lines)
+    finally:
+        out.close()
+    try:
+        elapsed = run(args[0], srcfn)
+    finally:
+        os.remove(srcfn)
+    expansions = options.lines * EXPANSIONS_PER_LINE
+    lprint("%d macros  %8.3f s  %12.0f expansions/s" %
+           (options.macros * 3, elapsed, expansions / max(elapsed, 1e-6)))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,9 @@
+; [fail]
+; Preprocessor errors in a later piece of the preprocessor output
+; are reported after parser diagnostics from earlier pieces.
+mov eax,
+%rep 20000
+nop
+%endrep
+%assign x (1
+nop
@@ -0,0 +1,12 @@
+; [yasm -f bin -e]
+%define VAL 3
+%macro twice 1
+db %1
+db %1
+%endmacro
+%rep 2
+twice VAL
+%endrep
+%ifdef NOT_DEFINED
+db 9
+%endif
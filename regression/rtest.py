@@ -64,6 +64,7 @@ class Test(object):
         self.basefn = os.path.splitext("_".join(path_splitall(self.name)))[0]
         self.outfn = self.basefn + ".out"
         self.ewfn = self.basefn + ".ew"
+        self.depfn = self.basefn + ".d"
 
         # Read the input file in its entirety.  We use this for various things.
         f = open(self.fullpath)
@@ -183,6 +184,36 @@ class Test(object):
 
         return match
 
+    def compare_deps(self, stdoutdata):
+        """Check Makefile dependencies output."""
+        f = open(os.path.splitext(self.fullpath)[0] + ".d")
+        try:
+            golden = f.read()
+        finally:
+            f.close()
+
+        # Written to stdout unless to a file (by -MF or -MD).
+        try:
+            f = open(os.path.join(outdir, self.depfn))
+            try:
+                result = f.read()
+            finally:
+                f.close()
+        except IOError:
+            result = stdoutdata
+        # The object file is in the output directory, so the line breaks
+        # depend on where that is; compare ignoring them.
+        result = result.replace(os.path.join(outdir, ""), "")
+        golden = golden.replace("\\\n", "").split()
+        result = result.replace("\\\n", "").split()
+
+        if result == golden:
+            return True
+        lprint("%s: dependencies mismatch" % self.depfn)
+        lprint(" Expected: %s" % " ".join(golden))
+        lprint(" Actual: %s" % " ".join(result))
+        return False
+
     def get_option(self, option, default=None):
         """Get test-specific option from the first line of the input file.
         Returns None if option not present, otherwise option string."""
@@ -233,6 +264,19 @@ class Test(object):
         # Specify the output filename as we pipe the input.
         yasmargs.extend(["-o", os.path.join(outdir, self.outfn)])
 
+        # Makefile dependencies: "[yasm -M ...]" with a .d file.  Run in the
+        # test's directory so the files it reads are found, but write any
+        # -MF file to the output directory.
+        deps = os.path.exists(os.path.splitext(self.fullpath)[0] + ".d")
+        cwd = None
+        if deps:
+            cwd = os.path.dirname(self.fullpath)
+            if "-MF" in yasmargs:
+                i = yasmargs.index("-MF") + 1
+                yasmargs[i] = os.path.join(outdir, self.depfn)
+            if os.path.exists(os.path.join(outdir, self.depfn)):
+                os.remove(os.path.join(outdir, self.depfn))
+
         # We pipe the input, so append "-" to the command line for stdin input.
         yasmargs.append("-")
 
@@ -243,7 +287,7 @@ class Test(object):
         proc = subprocess.Popen(yasmargs, bufsize=4096,
                                 executable=(ygasoverride and ygasexe or yasmexe),
                                 stdin=subprocess.PIPE, stdout=subprocess.PIPE,
-                                stderr=subprocess.PIPE, env=env)
+                                stderr=subprocess.PIPE, env=env, cwd=cwd)
         (stdoutdata, stderrdata) = proc.communicate(self.inputfile)
         end = time.time()
 
@@ -268,7 +312,13 @@ class Test(object):
             if not match:
                 ok = False
 
-            if not expectfail:
+            if deps:
+                match = self.compare_deps(stdoutdata)
+                if not match:
+                    ok = False
+
+            # -M generates dependencies instead of assembling.
+            if not expectfail and "-M" not in yasmargs:
                 match = self.compare_out()
                 if not match:
                     ok = False
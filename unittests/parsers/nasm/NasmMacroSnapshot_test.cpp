@@ -0,0 +1,257 @@
+//
+// NASM macro snapshot tests
+//
+//  Copyright (C) 2012  Peter Johnson
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/Basic/FileManager.h"
+#include "yasmx/Basic/SourceManager.h"
+#include "yasmx/Parse/HeaderSearch.h"
+#include "yasmx/Parse/Parser.h"
+#include "yasmx/Parse/Preprocessor.h"
+#include "yasmx/System/plugin.h"
+#include "yasmx/Assembler.h"
+
+#include "unittests/diag_mock.h"
+
+
+using namespace yasm;
+using namespace yasmunit;
+
+// Each test preprocesses a main file with a pre-include (which includes
+// a nested file) and a pre-define, saving a macro snapshot on the first
+// run.  To tell whether a later run loaded the snapshot or rebuilt it,
+// Tamper() changes the macro body recorded in the snapshot file.
+class NasmMacroSnapshotTest : public ::testing::Test
+{
+protected:
+    static void SetUpTestCase()
+    {
+        ASSERT_TRUE(LoadStandardPlugins());
+    }
+
+    virtual void SetUp()
+    {
+        m_dir = llvm::sys::Path::GetTemporaryDirectory();
+        m_snapshot = getPath("macros.snap");
+        m_main = getPath("main.asm");
+        m_pre = getPath("pre.inc");
+        m_nested = getPath("nested.inc");
+        WriteFile(m_main, "m\ndb NESTED, FOO\n");
+        WriteFile(m_pre, "%include \"nested.inc\"\n"
+                         "%macro m 0\ndb \"AAAA\"\n%endmacro\n");
+        WriteFile(m_nested, "%define NESTED 1\n");
+    }
+
+    virtual void TearDown()
+    {
+        m_dir.eraseFromDisk(true);
+    }
+
+    std::string getPath(const char* name)
+    {
+        llvm::sys::Path path(m_dir);
+        path.appendComponent(name);
+        return path.str();
+    }
+
+    static void WriteFile(const std::string& path, llvm::StringRef contents)
+    {
+        std::string err;
+        llvm::raw_fd_ostream os(path.c_str(), err,
+                                llvm::raw_fd_ostream::F_Binary);
+        os << contents;
+    }
+
+    static std::string ReadFile(const std::string& path)
+    {
+        llvm::OwningPtr<llvm::MemoryBuffer> buf;
+        if (llvm::MemoryBuffer::getFile(path, buf))
+            return "";
+        return buf->getBuffer();
+    }
+
+    // Preprocess a main file with the snapshot.
+    std::string Preprocess(const std::string& main,
+                           const std::string& pre,
+                           const char* define = "FOO=5")
+    {
+        ::testing::StrictMock<MockDiagnosticString> mock_consumer;
+        llvm::IntrusiveRefCntPtr<DiagnosticIDs> diagids(new DiagnosticIDs);
+        DiagnosticsEngine diags(diagids, &mock_consumer, false);
+        FileSystemOptions opts;
+        FileManager fmgr(opts);
+        SourceManager smgr(diags, fmgr);
+        diags.setSourceManager(&smgr);
+        HeaderSearch headers(fmgr);
+
+        Assembler assembler("x86", "bin", diags);
+        assembler.setParser("nasm", diags);
+        const FileEntry* in = fmgr.getFile(main);
+        if (!in)
+            return "";
+        smgr.createMainFileID(in);
+        if (!assembler.InitObject(smgr, diags))
+            return "";
+
+        Preprocessor& pp =
+            assembler.InitParser(smgr, diags, headers).getPreprocessor();
+        pp.PreInclude(pre);
+        pp.PredefineMacro(define);
+        pp.setMacroSnapshot(m_snapshot);
+
+        std::string out;
+        llvm::raw_string_ostream os(out);
+        if (!assembler.Preprocess(os, diags))
+            return "";
+        return os.str();
+    }
+
+    std::string Preprocess(const char* define = "FOO=5")
+    {
+        return Preprocess(m_main, m_pre, define);
+    }
+
+    // Change the macro body recorded in the snapshot from AAAA to BBBB.
+    void Tamper()
+    {
+        std::string snapshot = ReadFile(m_snapshot);
+        ASSERT_NE(std::string::npos, snapshot.find("AAAA"));
+        std::string::size_type pos;
+        while ((pos = snapshot.find("AAAA")) != std::string::npos)
+            snapshot.replace(pos, 4, "BBBB");
+        WriteFile(m_snapshot, snapshot);
+    }
+
+    static bool Contains(const std::string& str, const char* sub)
+    {
+        return str.find(sub) != std::string::npos;
+    }
+
+    llvm::sys::Path m_dir;
+    std::string m_snapshot;
+    std::string m_main;
+    std::string m_pre;
+    std::string m_nested;
+};
+
+TEST_F(NasmMacroSnapshotTest, SaveAndLoad)
+{
+    std::string saved = Preprocess();
+    EXPECT_TRUE(Contains(saved, "db \"AAAA\""));
+    EXPECT_TRUE(Contains(saved, "db 1, 5"));
+    ASSERT_FALSE(ReadFile(m_snapshot).empty());
+
+    // Loading gives the same output as building.
+    EXPECT_EQ(saved, Preprocess());
+
+    // ...and really is loaded.
+    Tamper();
+    EXPECT_TRUE(Contains(Preprocess(), "db \"BBBB\""));
+}
+
+TEST_F(NasmMacroSnapshotTest, PreIncludeChanged)
+{
+    Preprocess();
+    Tamper();
+    WriteFile(m_pre, "%include \"nested.inc\"\n"
+                     "%macro m 0\ndb \"CCCCC\"\n%endmacro\n");
+    std::string out = Preprocess();
+    EXPECT_TRUE(Contains(out, "db \"CCCCC\""));
+    EXPECT_FALSE(Contains(out, "BBBB"));
+}
+
+TEST_F(NasmMacroSnapshotTest, NestedIncludeChanged)
+{
+    Preprocess();
+    Tamper();
+    WriteFile(m_nested, "%define NESTED 22\n");
+    std::string out = Preprocess();
+    EXPECT_TRUE(Contains(out, "db \"AAAA\""));
+    EXPECT_TRUE(Contains(out, "db 22, 5"));
+}
+
+TEST_F(NasmMacroSnapshotTest, DefineChanged)
+{
+    Preprocess("FOO=5");
+    Tamper();
+    std::string out = Preprocess("FOO=6");
+    EXPECT_TRUE(Contains(out, "db \"AAAA\""));
+    EXPECT_TRUE(Contains(out, "db 1, 6"));
+}
+
+TEST_F(NasmMacroSnapshotTest, SharedAcrossDirectories)
+{
+    // Main files in other directories pre-including the same file (by
+    // absolute path) share the snapshot.
+    llvm::sys::Path sub(m_dir);
+    sub.appendComponent("sub");
+    ASSERT_FALSE(sub.createDirectoryOnDisk());
+    sub.appendComponent("other.asm");
+    WriteFile(sub.str(), "m\n");
+
+    Preprocess();
+    Tamper();
+    EXPECT_TRUE(Contains(Preprocess(sub.str(), m_pre), "db \"BBBB\""));
+}
+
+TEST_F(NasmMacroSnapshotTest, RelativePreIncludeResolvesPerDirectory)
+{
+    // A relative pre-include is found next to each main file, so the
+    // snapshot isn't used for a main file where it names another file.
+    llvm::sys::Path sub(m_dir);
+    sub.appendComponent("sub");
+    ASSERT_FALSE(sub.createDirectoryOnDisk());
+    llvm::sys::Path sub_pre(sub), sub_main(sub);
+    sub_pre.appendComponent("pre.inc");
+    sub_main.appendComponent("main.asm");
+    WriteFile(sub_pre.str(), "%macro m 0\ndb \"DDDD\"\n%endmacro\n"
+                             "%define NESTED 3\n");
+    WriteFile(sub_main.str(), "m\ndb NESTED, FOO\n");
+
+    Preprocess(m_main, "pre.inc");
+    Tamper();
+    std::string out = Preprocess(sub_main.str(), "pre.inc");
+    EXPECT_TRUE(Contains(out, "db \"DDDD\""));
+    EXPECT_TRUE(Contains(out, "db 3, 5"));
+}
+
+TEST_F(NasmMacroSnapshotTest, NotSavedWithWarnings)
+{
+    // A warning from the pre-include would be lost by runs loading the
+    // snapshot.
+    WriteFile(m_nested, "%define NESTED 1\n%define NESTED(x) 2\n");
+    EXPECT_TRUE(Contains(Preprocess(), "db \"AAAA\""));
+    EXPECT_TRUE(ReadFile(m_snapshot).empty());
+}
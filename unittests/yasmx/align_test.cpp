@@ -29,6 +29,7 @@
 #include "yasmx/Bytecode.h"
 #include "yasmx/Expr.h"
 #include "yasmx/IntNum.h"
+#include "yasmx/Section.h"
 
 TEST(AlignTest, Append)
 {
@@ -48,3 +49,38 @@ TEST(AlignTest, Append)
     EXPECT_EQ(5U, align.getSource().getRawEncoding());
     EXPECT_TRUE(align.getFixed().empty());
 }
+
+TEST(AlignTest, AlreadyAligned)
+{
+    yasm::Section sect("test", false, false, yasm::SourceLocation());
+
+    // start of section is always aligned
+    yasm::AppendAlign(sect, yasm::Expr(16), yasm::Expr(), yasm::Expr(), 0,
+                      yasm::SourceLocation());
+    EXPECT_EQ(1U, sect.size());
+    EXPECT_FALSE(sect.bytecodes_back().hasContents());
+
+    // unknown after unaligned fixed data
+    yasm::AppendByte(sect, 1);
+    yasm::AppendAlign(sect, yasm::Expr(16), yasm::Expr(), yasm::Expr(), 0,
+                      yasm::SourceLocation());
+    EXPECT_EQ(1U, sect.size());
+    EXPECT_TRUE(sect.bytecodes_back().hasContents());
+
+    // a weaker alignment following a stronger one
+    yasm::AppendAlign(sect, yasm::Expr(8), yasm::Expr(), yasm::Expr(), 0,
+                      yasm::SourceLocation());
+    EXPECT_EQ(1U, sect.size());
+
+    // fixed data that is a multiple of the boundary
+    yasm::AppendData(sect, "abcdefgh", false);
+    yasm::AppendAlign(sect, yasm::Expr(8), yasm::Expr(), yasm::Expr(), 0,
+                      yasm::SourceLocation());
+    EXPECT_EQ(2U, sect.size());
+    EXPECT_FALSE(sect.bytecodes_back().hasContents());
+
+    // but not a stronger alignment
+    yasm::AppendAlign(sect, yasm::Expr(32), yasm::Expr(), yasm::Expr(), 0,
+                      yasm::SourceLocation());
+    EXPECT_TRUE(sect.bytecodes_back().hasContents());
+}
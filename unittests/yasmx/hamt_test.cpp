@@ -24,12 +24,17 @@
 //
 #include <gtest/gtest.h>
 
+#include <cstdlib>
 #include <string>
+#include <vector>
 
 #include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/TimeValue.h"
 #include "yasmx/Support/ptr_vector.h"
 #include "hamt.h"
+#include "ohash.h"
 
 class HamtTest : public ::testing::Test
 {
@@ -58,12 +63,13 @@ protected:
     };
 
     typedef yasm::hamt<std::string, Symbol, SymGetName> myhamt;
+    typedef yasm::ohash<std::string, Symbol, SymGetName> myohash;
 
     class GenSym
     {
     public:
         GenSym(int nsym);
-        void InsertCheckNew(myhamt& h);
+        template <typename Table> void InsertCheckNew(Table& h);
 
         typedef stdx::ptr_vector<Symbol> Symbols;
         Symbols syms;
@@ -71,6 +77,11 @@ protected:
     private:
         stdx::ptr_vector_owner<Symbol> m_syms_owner;
     };
+
+    template <typename Table>
+    static void BenchTable(const char* name,
+                           const std::vector<Symbol>& syms,
+                           int nsym);
 };
 
 TEST_F(HamtTest, Basic)
@@ -149,6 +160,157 @@ TEST_F(HamtTest, DupReplace)
     }
 }
 
+TEST_F(HamtTest, OhashFind)
+{
+    GenSym g(NUM_SYMS);
+    myohash h(false);
+
+    g.InsertCheckNew(h);
+    EXPECT_EQ(static_cast<std::size_t>(NUM_SYMS), h.size());
+
+    for (GenSym::Symbols::iterator i=g.syms.begin(), end=g.syms.end();
+         i != end; ++i)
+    {
+        Symbol* sym = h.Find(i->getName());
+        EXPECT_EQ(sym, &(*i));
+    }
+    EXPECT_TRUE(h.Find("SYM1") == 0);
+    EXPECT_TRUE(h.Find("nosuchsym") == 0);
+}
+
+TEST_F(HamtTest, OhashDupInsertReplace)
+{
+    GenSym g1(NUM_SYMS);
+    GenSym g2(NUM_SYMS);
+    myohash h(false);
+
+    g1.InsertCheckNew(h);
+
+    // duplicate insertion (without replacement) leaves the table unchanged
+    for (GenSym::Symbols::iterator i=g1.syms.begin(), end=g1.syms.end(),
+         i2=g2.syms.begin(), i2end=g2.syms.end();
+         i != end && i2 != i2end; ++i, ++i2)
+    {
+        Symbol* old = h.Insert(&(*i2));
+        EXPECT_EQ(old, &(*i));
+        EXPECT_EQ(h.Find(i->getName()), &(*i));
+    }
+
+    // duplicate insertion (with replacement)
+    for (GenSym::Symbols::iterator i=g1.syms.begin(), end=g1.syms.end(),
+         i2=g2.syms.begin(), i2end=g2.syms.end();
+         i != end && i2 != i2end; ++i, ++i2)
+    {
+        Symbol* old = h.Replace(&(*i2));
+        EXPECT_EQ(old, &(*i));
+        EXPECT_EQ(h.Find(i->getName()), &(*i2));
+    }
+    EXPECT_EQ(static_cast<std::size_t>(NUM_SYMS), h.size());
+}
+
+TEST_F(HamtTest, OhashRemove)
+{
+    GenSym g(NUM_SYMS);
+    myohash h(false);
+
+    g.InsertCheckNew(h);
+
+    // remove every other symbol
+    int n = 0;
+    for (GenSym::Symbols::iterator i=g.syms.begin(), end=g.syms.end();
+         i != end; ++i, ++n)
+    {
+        if (n % 2 == 0)
+        {
+            EXPECT_EQ(h.Remove(i->getName()), &(*i));
+        }
+    }
+    EXPECT_EQ(static_cast<std::size_t>(NUM_SYMS/2), h.size());
+
+    // the rest must still be found
+    n = 0;
+    for (GenSym::Symbols::iterator i=g.syms.begin(), end=g.syms.end();
+         i != end; ++i, ++n)
+    {
+        Symbol* sym = h.Find(i->getName());
+        if (n % 2 == 0)
+            EXPECT_TRUE(sym == 0);
+        else
+            EXPECT_EQ(sym, &(*i));
+    }
+    EXPECT_TRUE(h.Remove("sym0") == 0);
+}
+
+TEST_F(HamtTest, OhashNocase)
+{
+    Symbol lower("foo"), upper("FOO");
+    myohash h(true);
+
+    EXPECT_TRUE(h.Insert(&lower) == 0);
+    EXPECT_EQ(h.Find("Foo"), &lower);
+    EXPECT_EQ(h.Insert(&upper), &lower);
+    EXPECT_EQ(h.Remove("fOO"), &lower);
+    EXPECT_TRUE(h.Find("foo") == 0);
+}
+
+// Insert and find throughput of the symbol table implementations, from
+// 10^4 up to HAMT_BENCH_MAX (default 10^7) symbols.  Disabled by default;
+// run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*.
+template <typename Table>
+void
+HamtTest::BenchTable(const char* name,
+                     const std::vector<Symbol>& syms,
+                     int nsym)
+{
+    Table h(false);
+
+    llvm::sys::TimeValue start = llvm::sys::TimeValue::now();
+    for (int i=0; i<nsym; ++i)
+        h.Insert(const_cast<Symbol*>(&syms[i]));
+    llvm::sys::TimeValue inserted = llvm::sys::TimeValue::now();
+    int found = 0;
+    for (int i=0; i<nsym; ++i)
+    {
+        if (h.Find(syms[i].getName()))
+            ++found;
+    }
+    llvm::sys::TimeValue end = llvm::sys::TimeValue::now();
+    EXPECT_EQ(nsym, found);
+
+    double ins = (inserted - start).seconds() +
+        (inserted - start).nanoseconds() / 1e9;
+    double find = (end - inserted).seconds() +
+        (end - inserted).nanoseconds() / 1e9;
+    llvm::outs() << llvm::format("%-6s %9d symbols: insert %7.1f ns, "
+                                 "find %7.1f ns\n",
+                                 name, nsym, ins * 1e9 / nsym,
+                                 find * 1e9 / nsym);
+}
+
+TEST_F(HamtTest, DISABLED_Benchmark)
+{
+    int max = 10000000;
+    if (const char* env = std::getenv("HAMT_BENCH_MAX"))
+        max = std::atoi(env);
+
+    std::vector<Symbol> syms;
+    syms.reserve(max);
+    for (int i=0; i<max; i++)
+    {
+        // Names like those of macro-generated local labels.
+        llvm::SmallString<128> ss;
+        llvm::raw_svector_ostream os(ss);
+        os << "..@" << i << ".loop";
+        syms.push_back(Symbol(os.str()));
+    }
+
+    for (int nsym=10000; nsym<=max; nsym*=10)
+    {
+        BenchTable<myhamt>("hamt", syms, nsym);
+        BenchTable<myohash>("ohash", syms, nsym);
+    }
+}
+
 HamtTest::GenSym::GenSym(int nsym)
     : m_syms_owner(syms)
 {
@@ -161,8 +323,9 @@ HamtTest::GenSym::GenSym(int nsym)
     }
 }
 
+template <typename Table>
 void
-HamtTest::GenSym::InsertCheckNew(myhamt& h)
+HamtTest::GenSym::InsertCheckNew(Table& h)
 {
     for (GenSym::Symbols::iterator i=syms.begin(), end=syms.end();
          i != end; ++i)
@@ -0,0 +1,353 @@
+//
+// Incbin bytecode and file range output unit test
+//
+//  Copyright (C) 2012  Peter Johnson
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Config/config.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include "yasmx/Basic/Diagnostic.h"
+#include "yasmx/Basic/FileManager.h"
+#include "yasmx/Basic/SourceManager.h"
+#include "yasmx/Bytecode.h"
+#include "yasmx/BytecodeContainer.h"
+#include "yasmx/BytecodeOutput.h"
+#include "yasmx/Expr.h"
+#include "yasmx/IntNum.h"
+#include "yasmx/OutputImage.h"
+
+#include "unittests/diag_mock.h"
+
+
+using namespace yasm;
+using namespace yasmunit;
+
+namespace {
+
+void
+AddSpanTest(Bytecode& bc,
+            int id,
+            const Value& value,
+            long neg_thres,
+            long pos_thres)
+{
+}
+
+// Outputs bytecodes with no values to a stream.
+class RawOutput : public BytecodeStreamOutput
+{
+public:
+    RawOutput(raw_ostream& os, DiagnosticsEngine& diags)
+        : BytecodeStreamOutput(os, diags)
+    {}
+    RawOutput(OutputImage& os, DiagnosticsEngine& diags)
+        : BytecodeStreamOutput(os, diags)
+    {}
+    RawOutput(raw_fd_ostream& os, DiagnosticsEngine& diags)
+        : BytecodeStreamOutput(os, diags)
+    {}
+
+    bool ConvertValueToBytes(Value& value,
+                             Location loc,
+                             NumericOutput& num_out)
+    {
+        return false;
+    }
+};
+
+} // anonymous namespace
+
+// File ranges of at least 64 KB are kept by reference in output images and
+// copied within the kernel to files; smaller ones are simply copied.  These
+// check each output path with both sizes, with incbin start and maxlen
+// selecting a range in the middle of the file.
+class IncbinTest : public ::testing::Test
+{
+protected:
+    IncbinTest()
+        : m_diags(llvm::IntrusiveRefCntPtr<DiagnosticIDs>(new DiagnosticIDs),
+                  &m_consumer, false)
+        , m_fmgr(m_opts)
+        , m_smgr(m_diags, m_fmgr)
+        , m_container(0)
+    {
+        m_diags.setSourceManager(&m_smgr);
+    }
+
+    virtual void SetUp()
+    {
+        m_dir = llvm::sys::Path::GetTemporaryDirectory();
+        m_in = getPath("in.bin");
+        m_out = getPath("out.bin");
+        for (int i=0; i<200*1024; ++i)
+            m_data.push_back(static_cast<char>((i*7) ^ (i>>8)));
+        std::string err;
+        llvm::raw_fd_ostream os(m_in.c_str(), err,
+                                llvm::raw_fd_ostream::F_Binary);
+        os << m_data;
+    }
+
+    virtual void TearDown()
+    {
+        m_dir.eraseFromDisk(true);
+    }
+
+    std::string getPath(const char* name)
+    {
+        llvm::sys::Path path(m_dir);
+        path.appendComponent(name);
+        return path.str();
+    }
+
+    std::string ReadFile(const std::string& path)
+    {
+        llvm::OwningPtr<llvm::MemoryBuffer> buf;
+        if (llvm::MemoryBuffer::getFile(path, buf))
+            return "";
+        return buf->getBuffer();
+    }
+
+    // Append an incbin of len bytes from start and lay it out.
+    void Incbin(unsigned long start, unsigned long len)
+    {
+        AppendIncbin(m_container, m_in,
+                     std::auto_ptr<Expr>(new Expr(IntNum(start))),
+                     std::auto_ptr<Expr>(new Expr(IntNum(len))),
+                     SourceLocation());
+        m_container.Finalize(m_diags);
+        m_container.bytecodes_front().CalcLen(AddSpanTest, m_diags);
+        ASSERT_EQ(len, m_container.bytecodes_front().getTotalLen());
+        m_container.UpdateOffsets(m_diags);
+        ASSERT_FALSE(m_diags.hasErrorOccurred());
+    }
+
+    std::string Expected(unsigned long start, unsigned long len)
+    {
+        return "head" + m_data.substr(start, len) + "tail";
+    }
+
+    // Output through an image, then write the image to a file.
+    void OutputViaImage(bool nested)
+    {
+        OutputImage image;
+        image << "HEAD";
+        RawOutput out(image, m_diags);
+        m_container.bytecodes_front().Output(out);
+        image << "tail";
+        // Data before a file range can still be overwritten.
+        image.seek(0);
+        image << "head";
+
+        std::string err;
+        llvm::raw_fd_ostream os(m_out.c_str(), err,
+                                llvm::raw_fd_ostream::F_Binary);
+        if (nested)
+        {
+            OutputImage outer;
+            image.WriteTo(outer);
+            outer.WriteTo(os);
+        }
+        else
+            image.WriteTo(os);
+    }
+
+    // Output directly to a file.
+    void OutputToFile()
+    {
+        std::string err;
+        llvm::raw_fd_ostream os(m_out.c_str(), err,
+                                llvm::raw_fd_ostream::F_Binary);
+        os << "head";
+        RawOutput out(os, m_diags);
+        m_container.bytecodes_front().Output(out);
+        os << "tail";
+        EXPECT_EQ(8 + m_container.bytecodes_front().getTotalLen(),
+                  os.tell());
+    }
+
+    // Output to a generic stream.
+    std::string OutputToString()
+    {
+        std::string str;
+        llvm::raw_string_ostream os(str);
+        os << "head";
+        RawOutput out(os, m_diags);
+        m_container.bytecodes_front().Output(out);
+        os << "tail";
+        return os.str();
+    }
+
+    ::testing::StrictMock<MockDiagnosticString> m_consumer;
+    DiagnosticsEngine m_diags;
+    FileSystemOptions m_opts;
+    FileManager m_fmgr;
+    SourceManager m_smgr;
+    BytecodeContainer m_container;
+    llvm::sys::Path m_dir;
+    std::string m_in;
+    std::string m_out;
+    std::string m_data;
+};
+
+TEST_F(IncbinTest, LargeToFile)
+{
+    Incbin(1000, 150000);
+    OutputToFile();
+    EXPECT_EQ(Expected(1000, 150000), ReadFile(m_out));
+}
+
+TEST_F(IncbinTest, LargeViaImage)
+{
+    Incbin(1000, 150000);
+    OutputViaImage(false);
+    EXPECT_EQ(Expected(1000, 150000), ReadFile(m_out));
+}
+
+TEST_F(IncbinTest, LargeViaNestedImage)
+{
+    Incbin(1000, 150000);
+    OutputViaImage(true);
+    EXPECT_EQ(Expected(1000, 150000), ReadFile(m_out));
+}
+
+TEST_F(IncbinTest, LargeToString)
+{
+    Incbin(1000, 150000);
+    EXPECT_EQ(Expected(1000, 150000), OutputToString());
+}
+
+TEST_F(IncbinTest, SmallToFile)
+{
+    Incbin(70000, 5000);
+    OutputToFile();
+    EXPECT_EQ(Expected(70000, 5000), ReadFile(m_out));
+}
+
+TEST_F(IncbinTest, SmallViaImage)
+{
+    Incbin(70000, 5000);
+    OutputViaImage(false);
+    EXPECT_EQ(Expected(70000, 5000), ReadFile(m_out));
+}
+
+TEST(WriteFileRangeTest, Position)
+{
+    llvm::sys::Path dir = llvm::sys::Path::GetTemporaryDirectory();
+    llvm::sys::Path in(dir), out(dir);
+    in.appendComponent("in.bin");
+    out.appendComponent("out.bin");
+
+    std::string data;
+    for (int i=0; i<100*1024; ++i)
+        data.push_back(static_cast<char>(i ^ (i>>8)));
+    std::string err;
+    {
+        llvm::raw_fd_ostream os(in.c_str(), err,
+                                llvm::raw_fd_ostream::F_Binary);
+        os << data;
+    }
+    {
+        // The copy must land after buffered output, and the stream
+        // position must account for it.
+        llvm::raw_fd_ostream os(out.c_str(), err,
+                                llvm::raw_fd_ostream::F_Binary);
+        os << "ab";
+        uint64_t copied = os.write_file_range(in.c_str(), 2000, 80000);
+#if defined(HAVE_COPY_FILE_RANGE) || \
+    (defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H))
+        EXPECT_EQ(80000U, copied);
+#endif
+        EXPECT_EQ(2 + copied, os.tell());
+        if (copied < 80000)
+            os << StringRef(data).substr(2000 + copied, 80000 - copied);
+        os << "c";
+
+        // Ranges past the end of the file are not copied.
+        EXPECT_EQ(0U, os.write_file_range(in.c_str(), 90000, 20000));
+    }
+
+    llvm::OwningPtr<llvm::MemoryBuffer> buf;
+    ASSERT_FALSE(llvm::MemoryBuffer::getFile(out.str(), buf));
+    EXPECT_EQ("ab" + data.substr(2000, 80000) + "c", buf->getBuffer().str());
+    dir.eraseFromDisk(true);
+}
+
+TEST(OutputImageTest, File)
+{
+    llvm::sys::Path dir = llvm::sys::Path::GetTemporaryDirectory();
+    llvm::sys::Path out(dir);
+    out.appendComponent("out.bin");
+
+    std::string big;
+    for (int i=0; i<100*1024; ++i)
+        big.push_back(static_cast<char>(i ^ (i>>8)));
+    std::string err;
+    {
+        // Built in the file (where it can be mapped), growing past the
+        // expected size, with a hole and a window.
+        llvm::raw_fd_ostream os(out.c_str(), err,
+                                llvm::raw_fd_ostream::F_Binary);
+        OutputImage image(os, out.str(), 8);
+        image << "abc";
+        image.seek(10);
+        image << "x";
+        {
+            OutputImage window(image, 20, 3);
+            window << "xyz";
+            EXPECT_EQ(3U, window.getSize());
+            window.WriteTo(image);
+        }
+        EXPECT_EQ(23U, image.tell());
+        image << big;
+        image.seek(0);
+        image << "A";
+        image.Finish();
+        EXPECT_EQ(23 + big.size(), os.tell());
+    }
+
+    llvm::OwningPtr<llvm::MemoryBuffer> buf;
+    ASSERT_FALSE(llvm::MemoryBuffer::getFile(out.str(), buf));
+    EXPECT_EQ(std::string("Abc\0\0\0\0\0\0\0x\0\0\0\0\0\0\0\0\0xyz", 23) + big,
+              buf->getBuffer().str());
+    dir.eraseFromDisk(true);
+}
+
+TEST(OutputImageTest, MemoryWindow)
+{
+    OutputImage image;
+    image << "ab";
+    image.reserve(10);
+    OutputImage window(image, 4, 4);
+    window << "wxyz";
+    window.WriteTo(image);
+    image << "c";
+    EXPECT_EQ(std::string("ab\0\0wxyzc", 9), image.getContents().str());
+}
@@ -25,8 +25,11 @@
 #include <gtest/gtest.h>
 
 #include <cstdio>
+#include <limits>
+#include <vector>
 
 #include "llvm/Support/raw_ostream.h"
+#include "yasmx/Support/ThreadPool.h"
 #include "yasmx/Bytes.h"
 #include "yasmx/IntNum.h"
 #include "yasmx/NumericOutput.h"
@@ -546,4 +549,132 @@ TEST_P(IntNumGetSizedTest, Overwrite)
 }
 
 INSTANTIATE_TEST_CASE_P(IntNumGetSizedTests, IntNumGetSizedTest,
-                        ::testing::ValuesIn(GetSizedLongTestValues));
\ No newline at end of file
+                        ::testing::ValuesIn(GetSizedLongTestValues));
+
+TEST(IntNumSmallValueTest, Overflow)
+{
+    // Results that don't fit in a small value must still be exact.
+    IntNum max(std::numeric_limits<long>::max());
+    IntNum min(std::numeric_limits<long>::min());
+    EXPECT_EQ("9223372036854775808", (max+1).getStr());
+    EXPECT_EQ("-9223372036854775809", (min-1).getStr());
+    EXPECT_EQ("18446744073709551614", (max*2).getStr());
+    EXPECT_EQ("9223372036854775808", (IntNum(1)<<63).getStr());
+    EXPECT_EQ("-9223372036854775808", (IntNum(-1)<<63).getStr());
+    EXPECT_EQ(0x4000000000000000L, (IntNum(1)<<62).getInt());
+    EXPECT_EQ(-1, (IntNum(-5)>>70).getInt());
+    EXPECT_EQ(0, (IntNum(5)>>70).getInt());
+}
+
+TEST(IntNumSmallValueTest, SignExtend)
+{
+    IntNum x(0xff);
+    x.SignExtend(8);
+    EXPECT_EQ(-1, x.getInt());
+
+    x = 0x7f;
+    x.SignExtend(8);
+    EXPECT_EQ(0x7f, x.getInt());
+
+    x = IntNum(1)<<62;
+    x.SignExtend(63);
+    EXPECT_EQ("-4611686018427387904", x.getStr());
+
+    x = (IntNum(1)<<64) - 1;
+    x.SignExtend(64);
+    EXPECT_EQ(-1, x.getInt());
+}
+
+TEST(IntNumSmallValueTest, MixedCompare)
+{
+    // Bitvectors can hold values that would also fit in a small value.
+    IntNum max(std::numeric_limits<long>::max());
+    IntNum bigmax = (IntNum(1)<<63) - 1;
+    EXPECT_TRUE(bigmax == max);
+    EXPECT_TRUE(max == bigmax);
+    EXPECT_FALSE(bigmax < max);
+    EXPECT_FALSE(max > bigmax);
+    EXPECT_EQ(0, Compare(max, bigmax));
+    EXPECT_TRUE(max < bigmax+1);
+    EXPECT_TRUE(bigmax-1 < max);
+
+    IntNum huge = IntNum(1)<<100;
+    EXPECT_TRUE(huge > max);
+    EXPECT_TRUE(max < huge);
+    EXPECT_TRUE(-huge < IntNum(std::numeric_limits<long>::min()));
+    EXPECT_EQ(1, Compare(IntNum(0), -huge));
+}
+
+TEST(IntNumSmallValueTest, InPlace)
+{
+    IntNum x = IntNum(1)<<100;
+    x += x;
+    EXPECT_EQ(IntNum(1)<<101, x);
+    x -= x;
+    EXPECT_EQ(0, x.getInt());
+
+    std::string s;
+    llvm::raw_string_ostream oss(s);
+    IntNum(std::numeric_limits<long>::min()).Print(oss, 16);
+    EXPECT_EQ("-0x8000000000000000", oss.str());
+}
+
+// Compute a mix of small and big value results and write them to bytes.
+static void
+CalcAndOutput(std::vector<unsigned char>* out)
+{
+    for (long v=-100; v<100; ++v)
+    {
+        IntNum x(v);
+        IntNum results[] =
+        {
+            x*7 + 3,
+            (x<<40) * 12345,
+            ((x<<100) + x) / 3,
+            (x<<80) % 1000003,
+            -(x<<70) ^ x,
+        };
+        for (unsigned int i=0; i<sizeof(results)/sizeof(results[0]); ++i)
+        {
+            Bytes bytes;
+            bytes.resize(16);
+            NumericOutput num_out(bytes);
+            num_out.setSize(128);
+            num_out.OutputInteger(results[i]);
+            out->insert(out->end(), bytes.begin(), bytes.end());
+        }
+        std::string s = ((x<<90) - 1).getStr();
+        out->insert(out->end(), s.begin(), s.end());
+    }
+}
+
+static void
+CalcAndCompare(const std::vector<unsigned char>* golden, bool* ok)
+{
+    for (int i=0; i<4 && *ok; ++i)
+    {
+        std::vector<unsigned char> out;
+        CalcAndOutput(&out);
+        *ok = (out == *golden);
+    }
+}
+
+TEST(IntNumConcurrencyTest, ParallelOutput)
+{
+    std::vector<unsigned char> golden;
+    CalcAndOutput(&golden);
+
+    enum { NUM_JOBS = 16 };
+    bool ok[NUM_JOBS];
+    {
+        ThreadPool pool(8);
+        for (int i=0; i<NUM_JOBS; ++i)
+        {
+            ok[i] = true;
+            pool.Async(TR1::bind(&CalcAndCompare, &golden, &ok[i]));
+        }
+        pool.Wait();
+    }
+    for (int i=0; i<NUM_JOBS; ++i)
+        EXPECT_TRUE(ok[i]) << "job " << i;
+}
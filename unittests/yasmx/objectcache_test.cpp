@@ -0,0 +1,163 @@
+//
+//  Copyright (C) 2012  Peter Johnson
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/system_error.h"
+#include "yasmx/Frontend/AssemblyCache.h"
+#include "yasmx/Support/ObjectCache.h"
+
+using yasm::AssemblyCache;
+using yasm::ObjectCache;
+
+class ObjectCacheTest : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        m_dir = llvm::sys::Path::GetTemporaryDirectory();
+        m_cache_dir = getPath("cache");
+        m_in = getPath("in.asm");
+        m_inc = getPath("in.inc");
+        m_obj = getPath("in.o");
+        WriteFile(m_in, "%include \"in.inc\"\n");
+        WriteFile(m_inc, "db 1\n");
+    }
+
+    virtual void TearDown()
+    {
+        m_dir.eraseFromDisk(true);
+    }
+
+    std::string getPath(const char* name)
+    {
+        llvm::sys::Path path(m_dir);
+        path.appendComponent(name);
+        return path.str();
+    }
+
+    static void WriteFile(const std::string& path, const char* contents)
+    {
+        std::string err;
+        llvm::raw_fd_ostream os(path.c_str(), err);
+        os << contents;
+    }
+
+    static std::string ReadFile(const std::string& path)
+    {
+        llvm::OwningPtr<llvm::MemoryBuffer> buf;
+        if (llvm::MemoryBuffer::getFile(path, buf))
+            return "";
+        return buf->getBuffer();
+    }
+
+    // Look up the input, and on a miss "assemble" it by writing obj.
+    bool Assemble(const char* obj)
+    {
+        ObjectCache cache(m_cache_dir, 0);
+        cache.AddOption("options");
+        if (cache.Lookup(m_in, m_obj))
+            return true;
+        WriteFile(m_obj, obj);
+        std::vector<std::string> inputs;
+        inputs.push_back(m_in);
+        inputs.push_back(m_inc);
+        cache.Store(m_obj, inputs);
+        return false;
+    }
+
+    llvm::sys::Path m_dir;
+    std::string m_cache_dir;
+    std::string m_in;
+    std::string m_inc;
+    std::string m_obj;
+};
+
+TEST_F(ObjectCacheTest, HitAndMiss)
+{
+    EXPECT_FALSE(Assemble("first"));
+    WriteFile(m_obj, "");
+    EXPECT_TRUE(Assemble("second"));
+    EXPECT_EQ("first", ReadFile(m_obj));
+
+    ObjectCache::Stats stats;
+    ObjectCache(m_cache_dir, 0).getStats(&stats);
+    EXPECT_EQ(1U, stats.hits);
+    EXPECT_EQ(1U, stats.misses);
+    EXPECT_EQ(1U, stats.num_objects);
+}
+
+TEST_F(ObjectCacheTest, IncludeChanged)
+{
+    EXPECT_FALSE(Assemble("first"));
+    WriteFile(m_inc, "db 2\n");
+    EXPECT_FALSE(Assemble("second"));
+    EXPECT_EQ("second", ReadFile(m_obj));
+    EXPECT_TRUE(Assemble("third"));
+    EXPECT_EQ("second", ReadFile(m_obj));
+}
+
+TEST_F(ObjectCacheTest, MainFileChanged)
+{
+    EXPECT_FALSE(Assemble("first"));
+    WriteFile(m_in, "%include \"in.inc\"\ndb 3\n");
+    EXPECT_FALSE(Assemble("second"));
+    EXPECT_EQ("second", ReadFile(m_obj));
+}
+
+static std::string
+RunSettings(const char* a1, const char* a2, const char* a3, const char* a4,
+            const char* obj_filename)
+{
+    char* argv[] = {
+        const_cast<char*>("yasm"), const_cast<char*>(a1),
+        const_cast<char*>(a2), const_cast<char*>(a3), const_cast<char*>(a4)
+    };
+    return AssemblyCache::getRunSettings("yasm 1.0", 5, argv, obj_filename,
+                                         0);
+}
+
+TEST(AssemblyCacheTest, RunSettings)
+{
+    std::string base = RunSettings("-f", "elf64", "--cache-dir", "c",
+                                   "a.o");
+
+    // The object filename and cache options don't change the object.
+    EXPECT_EQ(base, RunSettings("-f", "elf64", "-o", "a.o", "a.o"));
+    EXPECT_EQ(base, RunSettings("-f", "elf64", "-ob.o", "--cache-stats",
+                                "b.o"));
+    EXPECT_EQ(base, RunSettings("-f", "elf64", "--objfile=c.o",
+                                "--cache-size=10", "c.o"));
+
+    // Other options do.
+    EXPECT_NE(base, RunSettings("-f", "elf32", "-o", "a.o", "a.o"));
+    EXPECT_NE(base, RunSettings("-f", "elf64", "-oformat", "elf", ""));
+}
@@ -0,0 +1,86 @@
+//
+//  Copyright (C) 2012  Peter Johnson
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND OTHER CONTRIBUTORS ``AS IS''
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR OTHER CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+// POSSIBILITY OF SUCH DAMAGE.
+//
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "llvm/Support/raw_ostream.h"
+#include "yasmx/StringTable.h"
+
+using yasm::StringTable;
+
+static std::string
+Contents(const StringTable& strtab)
+{
+    std::string s;
+    llvm::raw_string_ostream os(s);
+    strtab.Write(os);
+    os.flush();
+    return s;
+}
+
+TEST(StringTableTest, Append)
+{
+    StringTable strtab;
+    EXPECT_EQ(1UL, strtab.getIndex("foo"));
+    EXPECT_EQ(5UL, strtab.getIndex("foo"));
+    EXPECT_EQ(9UL, strtab.getSize());
+}
+
+TEST(StringTableTest, Intern)
+{
+    StringTable strtab(4, true);
+    EXPECT_EQ(4UL, strtab.getIndex(""));
+    EXPECT_EQ(5UL, strtab.getIndex("foo"));
+    EXPECT_EQ(9UL, strtab.getIndex("bar"));
+    EXPECT_EQ(5UL, strtab.getIndex("foo"));
+    EXPECT_EQ(std::string("\0foo\0bar\0", 9), Contents(strtab));
+    EXPECT_EQ("bar", strtab.getString(9));
+}
+
+TEST(StringTableTest, TailMerge)
+{
+    StringTable strtab(0, true);
+    unsigned long text = strtab.getIndex(".text");
+    unsigned long reltext = strtab.getIndex(".rel.text");
+    unsigned long data = strtab.getIndex(".data");
+    unsigned long ext = strtab.getIndex("ext");
+    unsigned long reldata = strtab.getIndex(".rel.data");
+    strtab.Finalize();
+
+    EXPECT_EQ(std::string("\0.rel.text\0.rel.data\0", 21),
+              Contents(strtab));
+    EXPECT_EQ(1UL, strtab.getFinalIndex(reltext));
+    EXPECT_EQ(5UL, strtab.getFinalIndex(text));
+    EXPECT_EQ(7UL, strtab.getFinalIndex(ext));
+    EXPECT_EQ(11UL, strtab.getFinalIndex(reldata));
+    EXPECT_EQ(15UL, strtab.getFinalIndex(data));
+    EXPECT_EQ(0UL, strtab.getFinalIndex(0));
+
+    // Known strings keep their final index; new ones are appended.
+    EXPECT_EQ(5UL, strtab.getIndex(".text"));
+    EXPECT_EQ(21UL, strtab.getIndex(".bss"));
+    EXPECT_EQ(".bss", strtab.getString(21));
+}